@@ -16,6 +16,7 @@ static struct pt_buffer* pt_buffer_create(uint32_t length)
     
     buff->next = NULL;
     buff->length = 0;
+    buff->refs = 0;
     buff->max_length = ALIGN_SIZE(length, PAGESIZE);
     buff->buff = (unsigned char*)malloc(buff->max_length);
     
@@ -49,6 +50,7 @@ static struct pt_buffer *pt_buffer_alloc_by_allocator()
     
     buff->next = NULL;
     buff->length = 0;
+    buff->refs = 0;
     
     return buff;
 }
@@ -108,6 +110,10 @@ struct pt_buffer* pt_buffer_new(uint32_t length)
 
 void pt_buffer_free(struct pt_buffer *buff)
 {
+    if(buff->refs){
+        buff->refs--;
+        return;
+    }
     
     if(buffer_allocator.enable == false){
         pt_buffer_release(buff);
@@ -117,6 +123,12 @@ void pt_buffer_free(struct pt_buffer *buff)
     pt_buffer_free_by_allocator(buff);
 }
 
+struct pt_buffer *pt_buffer_ref(struct pt_buffer *buff)
+{
+    buff->refs++;
+    return buff;
+}
+
 void pt_buffer_reserve(struct pt_buffer *buff, uint32_t length)
 {
     uint32_t new_length = buff->length + length;
@@ -168,6 +180,72 @@ qboolean pt_buffer_read(struct pt_buffer *buff,unsigned char *data, uint32_t len
     return true;
 }
 
+void pt_buffer_skip(struct pt_buffer *buff, uint32_t length)
+{
+    if(length >= buff->length){
+        buff->length = 0;
+        return;
+    }
+    
+    memmove(buff->buff, &buff->buff[length], buff->length - length);
+    buff->length -= length;
+}
+
+void pt_buffer_write_u8(struct pt_buffer *buff, uint8_t v)
+{
+    pt_buffer_write(buff, &v, sizeof(v));
+}
+
+void pt_buffer_write_u16(struct pt_buffer *buff, uint16_t v)
+{
+    pt_buffer_write(buff, (unsigned char*)&v, sizeof(v));
+}
+
+void pt_buffer_write_u32(struct pt_buffer *buff, uint32_t v)
+{
+    pt_buffer_write(buff, (unsigned char*)&v, sizeof(v));
+}
+
+void pt_buffer_write_u64(struct pt_buffer *buff, uint64_t v)
+{
+    pt_buffer_write(buff, (unsigned char*)&v, sizeof(v));
+}
+
+void pt_buffer_write_varint(struct pt_buffer *buff, uint64_t v)
+{
+    unsigned char data[10];
+    uint32_t length = 0;
+    
+    while(v >= 0x80)
+    {
+        data[length++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    data[length++] = (unsigned char)v;
+    
+    pt_buffer_write(buff, data, length);
+}
+
+void pt_buffer_write_svarint(struct pt_buffer *buff, int64_t v)
+{
+    pt_buffer_write_varint(buff, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+void pt_buffer_write_bytes(struct pt_buffer *buff, const unsigned char *data, uint32_t length)
+{
+    pt_buffer_write_varint(buff, length);
+    pt_buffer_write(buff, data, length);
+}
+
+void pt_buffer_write_array(struct pt_buffer *buff, uint32_t count)
+{
+    pt_buffer_write_varint(buff, count);
+}
+
+void pt_buffer_write_optional(struct pt_buffer *buff, qboolean present)
+{
+    pt_buffer_write_u8(buff, present ? 1 : 0);
+}
 
 void DUMP(struct pt_buffer*buff)
 {
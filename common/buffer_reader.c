@@ -14,15 +14,34 @@ void buffer_reader_init(struct buffer_reader *reader, struct pt_buffer *buff)
 {
     reader->buff = buff;
     reader->pos = 0;
+    reader->error = false;
+}
+
+/*
+ 剩余的字节数，pos已经超过数据长度时返回0，不能直接相减
+ */
+static uint32_t buffer_reader_remain(struct buffer_reader *reader)
+{
+    if(reader->pos > reader->buff->length) return 0;
+    
+    return reader->buff->length - reader->pos;
 }
 
 void buffer_reader_ignore_bytes(struct buffer_reader *reader, uint32_t n)
 {
+    //数据包太短时停在末尾，之后的读取都失败
+    if(n > buffer_reader_remain(reader)){
+        reader->pos = reader->buff->length;
+        reader->error = true;
+        return;
+    }
+    
     reader->pos += n;
 }
 qboolean buffer_reader_read(struct buffer_reader *reader, unsigned char *data, uint32_t length)
 {
-    if(reader->pos + length > reader->buff->length){
+    if(length > buffer_reader_remain(reader)){
+        reader->error = true;
         return false;
     }
     
@@ -43,5 +62,141 @@ unsigned char *buffer_reader_cur_pos(struct buffer_reader *reader)
 }
 uint32_t buffer_reader_over_size(struct buffer_reader *reader)
 {
-    return reader->buff->length - reader->pos;
-}
\ No newline at end of file
+    return buffer_reader_remain(reader);
+}
+
+qboolean buffer_reader_ok(struct buffer_reader *reader)
+{
+    return reader->error == false;
+}
+
+/*
+ 检查剩余数据，不够时置为错误，之后的读取都失败
+ */
+static const unsigned char *buffer_reader_take(struct buffer_reader *reader, uint32_t length)
+{
+    const unsigned char *p;
+    
+    if(reader->error || length > buffer_reader_remain(reader)){
+        reader->error = true;
+        return NULL;
+    }
+    
+    p = &reader->buff->buff[reader->pos];
+    reader->pos += length;
+    
+    return p;
+}
+
+uint8_t buffer_reader_read_u8(struct buffer_reader *reader)
+{
+    const unsigned char *p = buffer_reader_take(reader, sizeof(uint8_t));
+    
+    return p ? *p : 0;
+}
+
+uint16_t buffer_reader_read_u16(struct buffer_reader *reader)
+{
+    const unsigned char *p = buffer_reader_take(reader, sizeof(uint16_t));
+    uint16_t v = 0;
+    
+    if(p) memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint32_t buffer_reader_read_u32(struct buffer_reader *reader)
+{
+    const unsigned char *p = buffer_reader_take(reader, sizeof(uint32_t));
+    uint32_t v = 0;
+    
+    if(p) memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint64_t buffer_reader_read_u64(struct buffer_reader *reader)
+{
+    const unsigned char *p = buffer_reader_take(reader, sizeof(uint64_t));
+    uint64_t v = 0;
+    
+    if(p) memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint64_t buffer_reader_read_varint(struct buffer_reader *reader)
+{
+    const unsigned char *p;
+    const unsigned char *end;
+    uint64_t v = 0;
+    int shift = 0;
+    
+    if(reader->error) return 0;
+    
+    p = &reader->buff->buff[reader->pos];
+    end = &reader->buff->buff[reader->buff->length];
+    
+    //最多10字节，第10字节只能使用最低1位
+    while(p < end && shift < 64)
+    {
+        v |= (uint64_t)(*p & 0x7F) << shift;
+        
+        if((*p++ & 0x80) == 0){
+            if(shift == 63 && p[-1] > 1) break;
+            reader->pos = (uint32_t)(p - reader->buff->buff);
+            return v;
+        }
+        
+        shift += 7;
+    }
+    
+    reader->error = true;
+    return 0;
+}
+
+int64_t buffer_reader_read_svarint(struct buffer_reader *reader)
+{
+    uint64_t v = buffer_reader_read_varint(reader);
+    
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+struct pt_bytes buffer_reader_read_bytes(struct buffer_reader *reader)
+{
+    struct pt_bytes bytes = {NULL, 0};
+    uint64_t length = buffer_reader_read_varint(reader);
+    
+    if(reader->error) return bytes;
+    
+    if(length > buffer_reader_remain(reader)){
+        reader->error = true;
+        return bytes;
+    }
+    
+    bytes.data = buffer_reader_take(reader, (uint32_t)length);
+    bytes.length = (uint32_t)length;
+    
+    return bytes;
+}
+
+uint32_t buffer_reader_read_array(struct buffer_reader *reader, uint32_t min_item_size)
+{
+    uint64_t count = buffer_reader_read_varint(reader);
+    
+    if(reader->error) return 0;
+    
+    if(min_item_size && count > buffer_reader_remain(reader) / min_item_size){
+        reader->error = true;
+        return 0;
+    }
+    
+    if(count > UINT32_MAX){
+        reader->error = true;
+        return 0;
+    }
+    
+    return (uint32_t)count;
+}
+
+qboolean buffer_reader_read_optional(struct buffer_reader *reader)
+{
+    return buffer_reader_read_u8(reader) != 0;
+}
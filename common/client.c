@@ -11,6 +11,20 @@
 #include "crc32.h"
 #include "error.h"
 #include "client.h"
+#include "uring.h"
+#include "shm.h"
+#include "rudp.h"
+#include "rpc.h"
+#include "spin.h"
+
+#ifdef PT_HAVE_URING
+#include <errno.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+static void pt_client_close(struct pt_client *client);
 
 static void pt_client_alloc_cb(uv_handle_t* handle,size_t suggested_size,uv_buf_t* buf) {
     uv_stream_t *sock = (uv_stream_t*)handle;
@@ -61,45 +75,287 @@ static void pt_client_close_cb(uv_handle_t* peer) {
     struct pt_client *client = sock->data;
     
     bzero(&client->conn, sizeof(client->conn));
+    client->closing = false;
     
     if(client->buf) {
         client->buf->length = 0;
     }
 }
 
-static void pt_client_read_cb(uv_stream_t* stream,
-                              ssize_t nread,
-                              const uv_buf_t* buf)
+/*
+ 重连后一次写入的outbox，释放整个链表
+ */
+static void pt_client_outbox_write_cb(uv_write_t* req, int status)
 {
-    uint32_t packet_err;
-    uv_stream_t *sock = (uv_stream_t*)stream;
-    struct pt_client *client = sock->data;
-    struct pt_buffer *async_buf = NULL;
+    struct pt_wreq *wr = (struct pt_wreq*)req;
+    struct pt_wreq *next;
     
-    //用户状态异常断开，执行disconnect
-    if(nread < 0)
+    while(wr){
+        next = wr->next;
+        pt_buffer_free(wr->buff);
+        free(wr);
+        wr = next;
+    }
+}
+
+static void pt_client_outbox_clear(struct pt_client *client)
+{
+    pt_client_outbox_write_cb((uv_write_t*)client->outbox_head, 0);
+    
+    client->outbox_head = NULL;
+    client->outbox_tail = NULL;
+    client->outbox_size = 0;
+}
+
+/*
+ 断开期间缓存数据包，超过outbox_max时丢弃
+ */
+static qboolean pt_client_outbox_push(struct pt_client *client, struct pt_buffer *buff)
+{
+    struct pt_wreq *wr;
+    
+    if(client->outbox_size + buff->length > client->outbox_max){
+        DBGPRINT("client outbox overflow");
+        pt_buffer_free(buff);
+        return false;
+    }
+    
+    wr = malloc(sizeof(struct pt_wreq));
+    if(wr == NULL){
+        FATAL("malloc pt_wreq failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+    
+    wr->buff = buff;
+    wr->data = client;
+    wr->next = NULL;
+    wr->buf = uv_buf_init((char*)buff->buff, buff->length);
+    
+    if(client->outbox_tail){
+        client->outbox_tail->next = wr;
+    } else {
+        client->outbox_head = wr;
+    }
+    client->outbox_tail = wr;
+    client->outbox_size += buff->length;
+    
+    return true;
+}
+
+/*
+ 连接成功后使用新的加密状态加密outbox中的数据包，libuv后端合并为一次uv_write
+ */
+static void pt_client_outbox_flush(struct pt_client *client)
+{
+    struct pt_wreq *head = client->outbox_head;
+    struct pt_wreq *wr;
+    struct pt_wreq *next;
+    uv_buf_t *bufs;
+    uint32_t count = 0;
+    int r;
+    
+    if(head == NULL) return;
+    
+    client->outbox_head = NULL;
+    client->outbox_tail = NULL;
+    client->outbox_size = 0;
+    
+    for(wr = head; wr; wr = wr->next){
+        if(client->enable_encrypt){
+            pt_encrypt_package(&client->encrypt_ctx, &client->serial, wr->buff);
+        }
+        count++;
+    }
+    
+#ifdef PT_HAVE_URING
+    if(client->uring == NULL)
+#endif
+    if(client->shm == NULL && client->rudp == NULL)
     {
-        pt_client_disconnect(client);
+        bufs = malloc(sizeof(uv_buf_t) * count);
+        if(bufs == NULL){
+            FATAL("malloc uv_buf_t failed", __FUNCTION__, __FILE__, __LINE__);
+            abort();
+        }
+        
+        count = 0;
+        for(wr = head; wr; wr = wr->next){
+            bufs[count++] = wr->buf;
+        }
+        
+        //uv_write会复制bufs数组
+        r = uv_write(&head->req, (uv_stream_t*)&client->conn, bufs, count, pt_client_outbox_write_cb);
+        free(bufs);
+        
+        if(r != 0){
+            ERROR("uv_write outbox failed", __FUNCTION__, __FILE__, __LINE__);
+            pt_client_outbox_write_cb(&head->req, r);
+        }
         return;
     }
     
-    //用户发送了EOF包，执行断开
-    if(nread == 0){
-        pt_client_disconnect(client);
+    //其他后端自己合并写入
+    for(wr = head; wr; wr = next){
+        next = wr->next;
+        pt_client_send(client, wr->buff);
+        free(wr);
+    }
+}
+
+static void pt_client_reconnect_cb(uv_timer_t* handle);
+
+static void pt_client_reconnect_close_cb(uv_handle_t* handle)
+{
+    struct pt_client *client = handle->data;
+    
+    client->reconnect_timer_state = PT_CLIENT_TIMER_NONE;
+}
+
+/*
+ 按指数退避加随机抖动设置下一次重连
+ */
+static void pt_client_schedule_reconnect(struct pt_client *client)
+{
+    uint64_t delay;
+    uint32_t shift;
+    
+    if(client->auto_reconnect == false) return;
+    if(client->reconnect_timer_state == PT_CLIENT_TIMER_CLOSING) return;
+    
+    shift = client->reconnect_attempts < 16 ? client->reconnect_attempts : 16;
+    delay = (uint64_t)client->reconnect_min_delay << shift;
+    if(delay > client->reconnect_max_delay){
+        delay = client->reconnect_max_delay;
+    }
+    
+    //在[delay/2, delay]之间随机，避免大量客户端同时重连
+    client->reconnect_seed ^= client->reconnect_seed << 13;
+    client->reconnect_seed ^= client->reconnect_seed >> 17;
+    client->reconnect_seed ^= client->reconnect_seed << 5;
+    delay = delay / 2 + (uint64_t)client->reconnect_seed % (delay / 2 + 1);
+    
+    client->reconnect_attempts++;
+    
+    if(client->reconnect_timer_state == PT_CLIENT_TIMER_NONE){
+        uv_timer_init(client->loop, &client->reconnect_timer);
+        client->reconnect_timer.data = client;
+        client->reconnect_timer_state = PT_CLIENT_TIMER_READY;
+    }
+    
+    uv_timer_start(&client->reconnect_timer, pt_client_reconnect_cb, delay, 0);
+}
+
+/*
+ 连接成功的公共处理，重置加密状态并发送断开期间缓存的数据
+ */
+static void pt_client_on_established(struct pt_client *client)
+{
+    client->connecting = false;
+    client->connected = true;
+    client->reconnect_attempts = 0;
+    
+    if(client->enable_encrypt) {
+        RC4_set_key(&client->encrypt_ctx, sizeof(client->encrypt_key), (const unsigned char*)&client->encrypt_key);
+        client->serial = 0;
+        client->unrel_serial = 0;
+    }
+    
+    pt_client_outbox_flush(client);
+    
+    if(client->on_connected){
+        client->on_connected(client);
+    }
+}
+
+//连接失败的公共处理
+static void pt_client_on_connect_failed(struct pt_client *client)
+{
+    client->connecting = false;
+    client->connected = false;
+    
+    if(client->on_connected){
+        client->on_connected(client);
+    }
+    
+    pt_client_schedule_reconnect(client);
+}
+
+static void pt_client_dispatch(struct pt_client *client, struct pt_buffer *buff);
+
+/*
+ 拆开批量包，每个子消息组成一个普通的数据包分发
+ */
+static void pt_client_unpack_batch(struct pt_client *client, struct pt_buffer *buff)
+{
+    const unsigned char *pos = pt_get_packet_buffer(buff);
+    uint32_t remain = pt_get_packet_size(buff);
+    const unsigned char *data;
+    uint32_t length;
+    uint16_t id;
+    struct pt_buffer *msg;
+    
+    while(pt_batch_next(&pos, &remain, &id, &data, &length))
+    {
+        msg = pt_create_package(pt_create_nethdr(id), (unsigned char*)data, length);
+        pt_client_dispatch(client, msg);
+        pt_buffer_free(msg);
+    }
+    
+    if(remain != 0){
+        ERROR("batch packet invalid", __FUNCTION__, __FILE__, __LINE__);
+    }
+}
+
+/*
+ RPC回复交给pt_rpc，其他数据包通知用户
+ */
+static void pt_client_dispatch(struct pt_client *client, struct pt_buffer *buff)
+{
+    struct net_header *hdr = (struct net_header*)buff->buff;
+    
+    if(client->rpc && hdr->id == ID_RESERVE_RPC_RESPONSE){
+        pt_rpc_on_response(client->rpc, buff);
         return;
     }
     
+    if(hdr->id == ID_TRANSMIT_BATCH){
+        pt_client_unpack_batch(client, buff);
+        return;
+    }
+    
+    //服务器的心跳包，回复一个空的心跳包
+    if(hdr->id == ID_TRANSMIT_KEEPALIVE && pt_get_packet_size(buff) == 0){
+        pt_client_send_data(client, ID_TRANSMIT_KEEPALIVE, NULL, 0);
+        return;
+    }
+    
+    if(client->on_receive) client->on_receive(client, buff);
+}
+
+/*
+ 将收到的数据追加到缓冲区，拆包并通知用户
+ */
+static void pt_client_on_data(struct pt_client *client, const unsigned char *data, uint32_t length)
+{
+    uint32_t packet_err;
+    struct pt_buffer *async_buf = NULL;
+    
     //写数据到缓冲区
-    pt_buffer_write(client->buf, (unsigned char*)buf->base, (uint32_t)nread);
+    pt_buffer_write(client->buf, data, length);
     
     //循环读取缓冲区数据，如果数据错误则返回false且不再执行本while
     while(pt_get_packet_status(client->buf, &packet_err)){
         async_buf = pt_split_packet(client->buf);
         if(async_buf != NULL)
         {
-            if(client->on_receive) client->on_receive(client, async_buf);
-            pt_buffer_free(async_buf);
+            client->receiving = async_buf;
+            pt_client_dispatch(client, async_buf);
             
+            //on_receive中取走的数据包由用户释放
+            if(client->receiving){
+                pt_buffer_free(client->receiving);
+                client->receiving = NULL;
+            }
         }
         else{
             ERROR("pt_split_packet == NULL wtf?", __FUNCTION__, __FILE__, __LINE__);
@@ -112,34 +368,130 @@ static void pt_client_read_cb(uv_stream_t* stream,
         const char *msg = packet_err == PACKET_INFO_FAKE ? "PACKET_INFO_FAKE" : "PACKET_INFO_OVERFLOW";
         sprintf(error, "pt_get_packet_status error:%s",msg);
         ERROR(error, __FUNCTION__, __FILE__, __LINE__);
-        pt_client_disconnect(client);
+        pt_client_close(client);
+    }
+}
+
+static void pt_client_read_cb(uv_stream_t* stream,
+                              ssize_t nread,
+                              const uv_buf_t* buf)
+{
+    uv_stream_t *sock = (uv_stream_t*)stream;
+    struct pt_client *client = sock->data;
+    
+    //用户状态异常断开，执行disconnect
+    if(nread < 0)
+    {
+        pt_client_close(client);
+        return;
+    }
+    
+    //用户发送了EOF包，执行断开
+    if(nread == 0){
+        pt_client_close(client);
+        return;
+    }
+    
+    pt_client_on_data(client, (unsigned char*)buf->base, (uint32_t)nread);
+}
+
+#ifdef __linux__
+static void pt_client_shm_on_data(struct pt_shm *shm, const unsigned char *data, uint32_t length)
+{
+    struct pt_client *client = shm->data;
+    
+    if(length == 0){
+        pt_client_close(client);
+        return;
+    }
+    
+    pt_client_on_data(client, data, length);
+}
+
+static void pt_client_shm_on_close(struct pt_shm *shm)
+{
+    struct pt_client *client = shm->data;
+    
+    pt_shm_free(shm);
+    client->shm = NULL;
+    client->closing = false;
+    
+    if(client->buf) {
+        client->buf->length = 0;
+    }
+}
+
+//握手使用的unix socket已经dup到pt_shm中，创建pt_shm失败时连接到此关闭完成
+static void pt_client_shm_sock_close_cb(uv_handle_t* peer)
+{
+    struct pt_client *client = peer->data;
+    
+    if(client->shm == NULL){
+        client->closing = false;
+    }
+}
+
+/*
+ 连接成功后把unix socket交给pt_shm，创建共享内存并发送给服务器
+ */
+static qboolean pt_client_shm_start(struct pt_client *client)
+{
+    int fd = -1;
+    
+    uv_fileno((uv_handle_t*)&client->conn, &fd);
+    fd = dup(fd);
+    
+    if(fd >= 0){
+        client->shm = pt_shm_connect(client->loop, fd, client, pt_client_shm_on_data, pt_client_shm_on_close);
+    } else {
+        ERROR("dup shm socket failed", __FUNCTION__, __FILE__, __LINE__);
     }
     
+    client->closing = client->shm == NULL;
+    uv_close((uv_handle_t*)&client->conn, pt_client_shm_sock_close_cb);
+    
+    return client->shm != NULL;
 }
+#endif
 
 static void pt_client_connect_cb(uv_connect_t* req, int status)
 {
     int r;
     struct pt_client *client = req->data;
-    client->connecting = false;
+    
     if(status != 0){
-        client->connected = false;
         free(req);
-        if(client->on_connected){
-            client->on_connected(client);
-        }
+        
+        //连接失败的句柄也需要关闭，之后才能重新连接
+        client->closing = true;
+        uv_close((uv_handle_t*)&client->conn, pt_client_close_cb);
+        
+        pt_client_on_connect_failed(client);
         return;
     }
     
-    client->connected = true;
+#ifdef __linux__
+    if(client->is_shm && pt_client_shm_start(client) == false){
+        free(req);
+        pt_client_on_connect_failed(client);
+        return;
+    }
+#endif
     
-    if(client->enable_encrypt) {
-        RC4_set_key(&client->encrypt_ctx, sizeof(client->encrypt_key), (const unsigned char*)&client->encrypt_key);
-        client->serial = 0;
+    pt_client_on_established(client);
+    
+    //共享内存模式不从socket读取数据
+    if(client->shm || client->connected == false){
+        free(req);
+        return;
     }
     
-    if(client->on_connected){
-        client->on_connected(client);
+    if(client->busy_poll && client->conn.stream.type == UV_TCP){
+        int fd;
+        
+        if(uv_fileno((uv_handle_t*)&client->conn, &fd) == 0){
+            pt_spin_busy_poll(fd, client->busy_poll);
+        }
     }
     
     r = uv_read_start((uv_stream_t*)&client->conn, pt_client_alloc_cb, pt_client_read_cb);
@@ -152,6 +504,189 @@ static void pt_client_connect_cb(uv_connect_t* req, int status)
     free(req);
 }
 
+#ifdef PT_HAVE_URING
+static void pt_client_uring_on_data(struct pt_uring_conn *conn, const unsigned char *data, int length)
+{
+    struct pt_client *client = conn->data;
+    
+    if(length <= 0){
+        pt_client_close(client);
+        return;
+    }
+    
+    pt_client_on_data(client, data, (uint32_t)length);
+}
+
+/*
+ io_uring后端连接的所有请求都已完成，释放连接资源
+ */
+static void pt_client_uring_on_close(struct pt_uring_conn *conn)
+{
+    struct pt_client *client = conn->data;
+    struct pt_uring *ring = conn->ring;
+    
+    pt_uring_conn_free(conn);
+    pt_uring_release(ring);
+    client->uring = NULL;
+    client->closing = false;
+    
+    if(client->buf) {
+        client->buf->length = 0;
+    }
+}
+
+static void pt_client_uring_connect_cb(struct pt_uring_req *req, int res, uint32_t flags)
+{
+    struct pt_uring_conn *conn = req->data;
+    struct pt_client *client = conn->data;
+    
+    if(res < 0){
+        //连接没有其他请求，直接关闭
+        client->closing = true;
+        pt_uring_conn_close(conn);
+        
+        pt_client_on_connect_failed(client);
+        return;
+    }
+    
+    pt_client_on_established(client);
+    
+    if(client->connected && client->busy_poll){
+        pt_spin_busy_poll(conn->fd, client->busy_poll);
+    }
+    
+    if(client->connected && pt_uring_conn_start(conn, pt_client_uring_on_data, pt_client_uring_on_close) == false){
+        FATAL("pt_uring_conn_start failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+}
+
+static void pt_client_uring_connect(struct pt_client *client, int domain, const struct sockaddr *addr, socklen_t length)
+{
+    int fd;
+    struct pt_uring *ring;
+    
+    ring = pt_uring_get(client->loop);
+    if(ring == NULL){
+        FATAL("pt_uring_get failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+    
+    fd = socket(domain, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0){
+        FATAL("socket failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+    
+    client->uring = pt_uring_conn_new(ring, fd, client);
+    client->uring->on_close = pt_client_uring_on_close;
+    client->connecting = true;
+    
+    if(pt_uring_conn_connect(client->uring, addr, length, pt_client_uring_connect_cb) == false){
+        client->connecting = false;
+        FATAL("pt_uring_conn_connect failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+}
+#endif
+
+static void pt_client_udp_output(struct pt_rudp *rudp, const unsigned char *data, uint32_t length)
+{
+    struct pt_client *client = rudp->data;
+    uv_buf_t buf = uv_buf_init((char*)data, length);
+    
+    uv_udp_try_send(&client->conn.udp, &buf, 1, (const struct sockaddr*)&client->udp_addr);
+}
+
+static void pt_client_udp_on_message(struct pt_rudp *rudp, int channel, const unsigned char *data, uint32_t length)
+{
+    struct pt_client *client = rudp->data;
+    const struct net_header *header = (const struct net_header*)data;
+    struct pt_buffer *buff;
+    
+    if(client->connected == false) return;
+    
+    if(channel == PT_RUDP_CHANNEL_RELIABLE){
+        pt_client_on_data(client, data, length);
+        return;
+    }
+    
+    //不可靠通道的每个消息都是一个完整的数据包
+    if(length < sizeof(struct net_header) || header->magic != PACKET_MAGIC || header->length != length){
+        return;
+    }
+    
+    buff = pt_buffer_new(length);
+    pt_buffer_write(buff, data, length);
+    pt_client_dispatch(client, buff);
+    pt_buffer_free(buff);
+}
+
+/*
+ 所有句柄关闭后释放pt_rudp，关闭可能发生在pt_rudp_input的回调中
+ */
+static void pt_client_udp_close_cb(uv_handle_t* handle)
+{
+    struct pt_client *client = handle->data;
+    
+    pt_rudp_free(client->rudp);
+    client->rudp = NULL;
+    client->closing = false;
+    
+    if(client->buf) {
+        client->buf->length = 0;
+    }
+}
+
+static void pt_client_udp_shutdown(struct pt_client *client)
+{
+    pt_rudp_close(client->rudp);
+    client->closing = true;
+    uv_close((uv_handle_t*)&client->udp_timer, NULL);
+    uv_close((uv_handle_t*)&client->conn.udp, pt_client_udp_close_cb);
+}
+
+static void pt_client_udp_on_event(struct pt_rudp *rudp, int event)
+{
+    struct pt_client *client = rudp->data;
+    
+    if(event == PT_RUDP_EVENT_CONNECTED)
+    {
+        pt_client_on_established(client);
+        return;
+    }
+    
+    //连接超时
+    if(client->connecting){
+        pt_client_udp_shutdown(client);
+        pt_client_on_connect_failed(client);
+        return;
+    }
+    
+    pt_client_close(client);
+}
+
+static void pt_client_udp_alloc_cb(uv_handle_t* handle,size_t suggested_size,uv_buf_t* buf)
+{
+    pt_client_alloc_cb(handle, PT_RUDP_MTU, buf);
+}
+
+static void pt_client_udp_recv_cb(uv_udp_t* handle, ssize_t nread, const uv_buf_t* buf, const struct sockaddr* addr, unsigned flags)
+{
+    struct pt_client *client = handle->data;
+    
+    if(nread <= 0 || addr == NULL || client->rudp == NULL) return;
+    
+    pt_rudp_input(client->rudp, (unsigned char*)buf->base, (uint32_t)nread, (uint32_t)uv_now(client->loop));
+}
+
+static void pt_client_udp_timer_cb(uv_timer_t* handle)
+{
+    struct pt_client *client = handle->data;
+    
+    pt_rudp_update(client->rudp, (uint32_t)uv_now(client->loop));
+}
+
 struct pt_client *pt_client_new()
 {
     struct pt_client *client;
@@ -177,6 +712,29 @@ void pt_client_set_encrypt(struct pt_client *client, const uint32_t encrypt_key[
     client->encrypt_key[3] = encrypt_key[3];
 }
 
+qboolean pt_client_set_backend(struct pt_client *client, int backend)
+{
+    if(client->connecting || client->connected){
+        LOG("client already connected",__FUNCTION__,__FILE__,__LINE__);
+        return false;
+    }
+    
+#ifndef PT_HAVE_URING
+    if(backend == PT_BACKEND_URING){
+        LOG("io_uring backend not compiled, define PT_HAVE_URING",__FUNCTION__,__FILE__,__LINE__);
+        return false;
+    }
+#endif
+    
+    client->backend = backend;
+    return true;
+}
+
+void pt_client_set_busy_poll(struct pt_client *client, uint32_t usec)
+{
+    client->busy_poll = usec;
+}
+
 void pt_client_init(uv_loop_t *loop, struct pt_client *client, pt_cli_on_connected on_connected, pt_cli_on_receive on_receive, pt_cli_on_disconnected on_disconnected)
 {
     client->loop = loop;
@@ -188,6 +746,8 @@ void pt_client_init(uv_loop_t *loop, struct pt_client *client, pt_cli_on_connect
 
 void pt_client_free(struct pt_client *client)
 {
+    pt_client_outbox_clear(client);
+    
     if(client->buf){
         pt_buffer_free(client->buf);
         client->buf = NULL;
@@ -205,13 +765,43 @@ void pt_client_free(struct pt_client *client)
 void pt_client_send(struct pt_client *client, struct pt_buffer *buff)
 {
     int r;
-    if(!client->connected) return;
+    
+    if(!client->connected){
+        //未加密的数据包可以在重连后发送，加密的数据包依赖断开前的加密状态只能丢弃
+        if(client->auto_reconnect && client->enable_encrypt == false){
+            pt_client_outbox_push(client, buff);
+            return;
+        }
+        
+        pt_buffer_free(buff);
+        return;
+    }
+    
+    if(client->rudp){
+        pt_rudp_send(client->rudp, PT_RUDP_CHANNEL_RELIABLE, buff->buff, buff->length);
+        pt_buffer_free(buff);
+        return;
+    }
     
     struct pt_wreq *req = malloc(sizeof(struct pt_wreq));
     req->buff = buff;
     req->data = client;
     req->buf = uv_buf_init((char*)buff->buff, buff->length);
     
+#ifdef PT_HAVE_URING
+    if(client->uring){
+        pt_uring_conn_write(client->uring, req);
+        return;
+    }
+#endif
+    
+#ifdef __linux__
+    if(client->shm){
+        pt_shm_write(client->shm, req);
+        return;
+    }
+#endif
+    
     r = uv_write(&req->req, (uv_stream_t*)&client->conn, &req->buf, 1, pt_client_write_cb);
     
     if(r != 0){
@@ -221,19 +811,268 @@ void pt_client_send(struct pt_client *client, struct pt_buffer *buff)
     }
 }
 
+qboolean pt_client_send_prepared(struct pt_client *client, struct pt_buffer *buff)
+{
+    if(client->connected == false){
+        if(client->auto_reconnect == false){
+            pt_buffer_free(buff);
+            return false;
+        }
+        return pt_client_outbox_push(client, buff);
+    }
+    
+    if(client->enable_encrypt){
+        pt_encrypt_package(&client->encrypt_ctx, &client->serial, buff);
+    }
+    
+    pt_client_send(client, buff);
+    return true;
+}
+
+qboolean pt_client_send_data(struct pt_client *client, uint16_t id, const unsigned char *data, uint32_t length)
+{
+    struct pt_buffer *buff;
+    struct net_header hdr = pt_create_nethdr(id);
+    uint32_t serial = 0;
+    
+    if(client->connected == false && client->auto_reconnect == false){
+        return false;
+    }
+    
+    //加密时预留包序列的位置，发送时才加密
+    buff = pt_buffer_new(sizeof(hdr) + sizeof(serial) + length);
+    pt_buffer_write(buff, (unsigned char*)&hdr, sizeof(hdr));
+    if(client->enable_encrypt){
+        pt_buffer_write(buff, (unsigned char*)&serial, sizeof(serial));
+    }
+    pt_buffer_write(buff, data, length);
+    ((struct net_header*)buff->buff)->length = buff->length;
+    
+    return pt_client_send_prepared(client, buff);
+}
+
+qboolean pt_client_send_batch(struct pt_client *client, struct pt_buffer *batch)
+{
+    return pt_client_send_prepared(client, batch);
+}
+
+/*
+ 连接使用libuv的stream写入
+ */
+static qboolean pt_client_is_stream(struct pt_client *client)
+{
+#ifdef PT_HAVE_URING
+    if(client->uring) return false;
+#endif
+    return client->shm == NULL && client->rudp == NULL;
+}
+
+qboolean pt_client_send_wrapped(struct pt_client *client, uint16_t id, const void *head, uint32_t head_len,
+                                struct pt_buffer *owner, uint32_t offset, uint32_t length)
+{
+    struct net_header hdr = pt_create_nethdr(id);
+    struct pt_wreq_iov *wr;
+    struct pt_buffer *buff;
+    uint32_t serial = 0;
+    int r;
+    
+    //头部和数据分两段写入，owner在写入完成后由pt_client_write_cb释放
+    if(client->connected && client->enable_encrypt == false && pt_client_is_stream(client) &&
+       head_len <= PT_WREQ_HEAD_MAX - sizeof(hdr))
+    {
+        wr = malloc(sizeof(struct pt_wreq_iov));
+        if(wr == NULL){
+            FATAL("malloc pt_wreq_iov failed", __FUNCTION__, __FILE__, __LINE__);
+            abort();
+        }
+    
+        hdr.length = sizeof(hdr) + head_len + length;
+        memcpy(wr->head, &hdr, sizeof(hdr));
+        if(head_len){
+            memcpy(wr->head + sizeof(hdr), head, head_len);
+        }
+    
+        wr->base.buff = owner;
+        wr->base.data = client;
+        wr->base.next = NULL;
+        wr->bufs[0] = uv_buf_init((char*)wr->head, sizeof(hdr) + head_len);
+        wr->bufs[1] = uv_buf_init((char*)owner->buff + offset, length);
+    
+        r = uv_write(&wr->base.req, (uv_stream_t*)&client->conn, wr->bufs, 2, pt_client_write_cb);
+        if(r != 0){
+            FATAL("uv_write failed", __FUNCTION__, __FILE__,__LINE__);
+            pt_buffer_free(owner);
+            free(wr);
+            return false;
+        }
+        return true;
+    }
+    
+    //加密或者其他后端需要完整的数据包
+    buff = pt_buffer_new(sizeof(hdr) + sizeof(serial) + head_len + length);
+    pt_buffer_write(buff, (unsigned char*)&hdr, sizeof(hdr));
+    if(client->enable_encrypt){
+        pt_buffer_write(buff, (unsigned char*)&serial, sizeof(serial));
+    }
+    if(head_len){
+        pt_buffer_write(buff, (unsigned char*)head, head_len);
+    }
+    pt_buffer_write(buff, owner->buff + offset, length);
+    ((struct net_header*)buff->buff)->length = buff->length;
+    
+    pt_buffer_free(owner);
+    
+    return pt_client_send_prepared(client, buff);
+}
+
+struct pt_buffer *pt_client_detach_packet(struct pt_client *client, struct pt_buffer *buff)
+{
+    if(buff == NULL || client->receiving != buff) return NULL;
+    
+    client->receiving = NULL;
+    return buff;
+}
+
+void pt_client_set_reconnect(struct pt_client *client, uint32_t min_delay, uint32_t max_delay, uint32_t outbox_max)
+{
+    client->auto_reconnect = true;
+    client->reconnect_min_delay = min_delay ? min_delay : 1;
+    client->reconnect_max_delay = max_delay > client->reconnect_min_delay ? max_delay : client->reconnect_min_delay;
+    client->outbox_max = outbox_max;
+    
+    //同一台机器上同时启动的客户端也使用不同的序列，xorshift的状态不能为0
+    client->reconnect_seed = (uint32_t)uv_hrtime() ^ (uint32_t)getpid() ^ (uint32_t)(uintptr_t)client;
+    if(client->reconnect_seed == 0) client->reconnect_seed = 1;
+}
+
+size_t pt_client_send_queue_size(struct pt_client *client)
+{
+#ifdef PT_HAVE_URING
+    if(client->uring){
+        return client->uring->queue_size;
+    }
+#endif
+#ifdef __linux__
+    if(client->shm){
+        return client->shm->pending_size;
+    }
+#endif
+    if(client->rudp){
+        return pt_rudp_queue_size(client->rudp);
+    }
+    if(client->connected == false){
+        return 0;
+    }
+    return client->conn.stream.write_queue_size;
+}
+
+qboolean pt_client_send_unreliable(struct pt_client *client, struct pt_buffer *buff)
+{
+    if(client->rudp == NULL){
+        return pt_client_send_prepared(client, buff);
+    }
+    
+    if(client->connected == false){
+        pt_buffer_free(buff);
+        return false;
+    }
+    
+    //不可靠通道不分片，不能改用可靠通道发送，否则和可靠通道的加密状态不一致
+    if(buff->length > PT_RUDP_MSS){
+        LOG("unreliable packet > PT_RUDP_MSS",__FUNCTION__,__FILE__,__LINE__);
+        pt_buffer_free(buff);
+        return false;
+    }
+    
+    if(client->enable_encrypt){
+        pt_encrypt_datagram(client->encrypt_key, client->unrel_serial++, buff);
+    }
+    
+    pt_rudp_send(client->rudp, PT_RUDP_CHANNEL_UNRELIABLE, buff->buff, buff->length);
+    pt_buffer_free(buff);
+    return true;
+}
+
+qboolean pt_client_send_unreliable_data(struct pt_client *client, uint16_t id, const unsigned char *data, uint32_t length)
+{
+    struct pt_buffer *buff;
+    struct net_header hdr = pt_create_nethdr(id);
+    uint32_t serial = 0;
+    
+    buff = pt_buffer_new(sizeof(hdr) + sizeof(serial) + length);
+    pt_buffer_write(buff, (unsigned char*)&hdr, sizeof(hdr));
+    if(client->enable_encrypt){
+        pt_buffer_write(buff, (unsigned char*)&serial, sizeof(serial));
+    }
+    pt_buffer_write(buff, data, length);
+    ((struct net_header*)buff->buff)->length = buff->length;
+    
+    return pt_client_send_unreliable(client, buff);
+}
+
+//记录连接地址，自动重连时使用
+static void pt_client_set_target(struct pt_client *client, int type, const char *host, uint16_t port)
+{
+    client->connect_type = type;
+    client->connect_port = port;
+    
+    if(client->connect_host != host){
+        strncpy(client->connect_host, host, sizeof(client->connect_host) - 1);
+        client->connect_host[sizeof(client->connect_host) - 1] = 0;
+    }
+}
+
+static void pt_client_reconnect_cb(uv_timer_t* handle)
+{
+    struct pt_client *client = handle->data;
+    
+    if(client->auto_reconnect == false || client->connected || client->connecting) return;
+    
+    //上一个连接的句柄还没有关闭完成
+    if(client->closing){
+        uv_timer_start(&client->reconnect_timer, pt_client_reconnect_cb, PT_CLIENT_CLOSE_WAIT, 0);
+        return;
+    }
+    
+    switch(client->connect_type)
+    {
+        case PT_CLIENT_CONNECT_TCP:
+            pt_client_connect(client, client->connect_host, client->connect_port);
+            break;
+        case PT_CLIENT_CONNECT_PIPE:
+            pt_client_connect_pipe(client, client->connect_host);
+            break;
+        case PT_CLIENT_CONNECT_UDP:
+            pt_client_connect_udp(client, client->connect_host, client->connect_port);
+            break;
+    }
+}
+
 void pt_client_connect(struct pt_client *client, const char *host, uint16_t port)
 {
     int r;
     struct sockaddr_in adr;
     
-    if(client->connecting || client->connected) return;
+    if(client->connecting || client->connected || client->closing) return;
+    
+    pt_client_set_target(client, PT_CLIENT_CONNECT_TCP, host, port);
     
+#ifdef PT_HAVE_URING
+    if(client->backend == PT_BACKEND_URING){
+        uv_ip4_addr(host, port, &adr);
+        pt_client_uring_connect(client, AF_INET, (const struct sockaddr*)&adr, sizeof(adr));
+        return;
+    }
+#endif
     
     if(uv_tcp_init(client->loop,&client->conn.tcp) != 0){
         FATAL("uv_tcp_init failed", __FUNCTION__, __FILE__, __LINE__);
         abort();
     }
     
+    //关闭回调会清空conn，每次连接都需要重新设置
+    client->conn.stream.data = client;
+    
     uv_connect_t *conn = malloc(sizeof(uv_connect_t));
     conn->data = client;
     
@@ -243,24 +1082,43 @@ void pt_client_connect(struct pt_client *client, const char *host, uint16_t port
     
     r = uv_tcp_connect(conn, &client->conn.tcp, (const struct sockaddr*)&adr, pt_client_connect_cb);
     if(r != 0){
-        //printf("%s\n",uv_strerror(r));
-        client->connecting = false;
-        FATAL("uv_tcp_connect failed", __FUNCTION__, __FILE__, __LINE__);
-        abort();
+        char error[256];
+        sprintf(error, "uv_tcp_connect failed:%s", uv_strerror(r));
+        ERROR(error, __FUNCTION__, __FILE__, __LINE__);
+        
+        free(conn);
+        client->closing = true;
+        uv_close((uv_handle_t*)&client->conn, pt_client_close_cb);
+        pt_client_on_connect_failed(client);
     }
 }
 
 
 void pt_client_connect_pipe(struct pt_client *client, const char *path)
 {
-    if(client->connecting || client->connected) return;
+    if(client->connecting || client->connected || client->closing) return;
     
+    pt_client_set_target(client, PT_CLIENT_CONNECT_PIPE, path, 0);
+    
+#ifdef PT_HAVE_URING
+    if(client->backend == PT_BACKEND_URING){
+        struct sockaddr_un un;
+        
+        bzero(&un, sizeof(un));
+        un.sun_family = AF_UNIX;
+        strncpy(un.sun_path, path, sizeof(un.sun_path) - 1);
+        pt_client_uring_connect(client, AF_UNIX, (const struct sockaddr*)&un, sizeof(un));
+        return;
+    }
+#endif
     
     if(uv_pipe_init(client->loop,&client->conn.pipe, true) != 0){
         FATAL("uv_pipe_init failed", __FUNCTION__, __FILE__, __LINE__);
         abort();
     }
     
+    client->conn.stream.data = client;
+    
     uv_connect_t *conn = malloc(sizeof(uv_connect_t));
     conn->data = client;
     
@@ -269,15 +1127,111 @@ void pt_client_connect_pipe(struct pt_client *client, const char *path)
     uv_pipe_connect(conn, &client->conn.pipe, path, pt_client_connect_cb);
 }
 
+void pt_client_connect_shm(struct pt_client *client, const char *path)
+{
+#ifdef __linux__
+    if(client->connecting || client->connected) return;
+    
+    client->is_shm = true;
+    pt_client_connect_pipe(client, path);
+#else
+    FATAL("shm transport not supported", __FUNCTION__, __FILE__, __LINE__);
+    abort();
+#endif
+}
+
+void pt_client_connect_udp(struct pt_client *client, const char *host, uint16_t port)
+{
+    struct sockaddr_in adr;
+    uint32_t conv;
+    
+    if(client->connecting || client->connected || client->closing || client->rudp) return;
+    
+    pt_client_set_target(client, PT_CLIENT_CONNECT_UDP, host, port);
+    
+    if(client->backend != PT_BACKEND_LIBUV){
+        FATAL("udp transport requires libuv backend", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+    
+    if(uv_udp_init(client->loop, &client->conn.udp) != 0){
+        FATAL("uv_udp_init failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+    client->conn.udp.data = client;
+    
+    uv_ip4_addr("0.0.0.0", 0, &adr);
+    if(uv_udp_bind(&client->conn.udp, (const struct sockaddr*)&adr, 0) != 0){
+        FATAL("uv_udp_bind failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+    
+    uv_ip4_addr(host, port, &client->udp_addr);
+    
+    uv_udp_recv_start(&client->conn.udp, pt_client_udp_alloc_cb, pt_client_udp_recv_cb);
+    
+    uv_timer_init(client->loop, &client->udp_timer);
+    client->udp_timer.data = client;
+    uv_timer_start(&client->udp_timer, pt_client_udp_timer_cb, PT_RUDP_INTERVAL, PT_RUDP_INTERVAL);
+    
+    //连接ID由服务器区分不同的连接，随机生成
+    conv = (uint32_t)uv_hrtime() ^ (uint32_t)getpid() ^ (uint32_t)(uintptr_t)client;
+    conv = conv * 2654435761U;
+    
+    client->connecting = true;
+    client->rudp = pt_rudp_new(conv, client, pt_client_udp_output, pt_client_udp_on_message, pt_client_udp_on_event);
+    client->rudp->stream = true;
+    pt_rudp_connect(client->rudp, (uint32_t)uv_now(client->loop));
+}
+
 void pt_client_disconnect(struct pt_client *client)
+{
+    //主动断开，不再自动重连
+    client->auto_reconnect = false;
+    
+    if(client->reconnect_timer_state == PT_CLIENT_TIMER_READY){
+        client->reconnect_timer_state = PT_CLIENT_TIMER_CLOSING;
+        uv_close((uv_handle_t*)&client->reconnect_timer, pt_client_reconnect_close_cb);
+    }
+    
+    pt_client_outbox_clear(client);
+    pt_client_close(client);
+}
+
+/*
+ 关闭连接，自动重连模式下之后会重新连接
+ */
+static void pt_client_close(struct pt_client *client)
 {
     if(client->connected == false) return;
     
     client->connected = false;
+    client->closing = true;
+    
+    //未完成的请求不会再收到回复
+    if(client->rpc){
+        pt_rpc_on_disconnect(client->rpc);
+    }
     
     if(client->on_disconnected){
         client->on_disconnected(client);
     }
     
-    uv_close((uv_handle_t*)&client->conn.stream, pt_client_close_cb);
+#ifdef PT_HAVE_URING
+    if(client->uring){
+        pt_uring_conn_close(client->uring);
+    } else
+#endif
+#ifdef __linux__
+    if(client->shm){
+        pt_shm_close(client->shm);
+    } else
+#endif
+    if(client->rudp){
+        pt_client_udp_shutdown(client);
+    } else {
+        uv_close((uv_handle_t*)&client->conn.stream, pt_client_close_cb);
+    }
+    
+    pt_client_schedule_reconnect(client);
 }
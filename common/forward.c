@@ -0,0 +1,205 @@
+//
+//  forward.c
+//  xcode
+//
+//  网关转发
+//
+
+#include "common.h"
+#include "error.h"
+#include "table.h"
+#include "forward.h"
+
+struct pt_forward *pt_forward_new(struct pt_server *server)
+{
+    struct pt_forward *forward = malloc(sizeof(struct pt_forward));
+
+    if(forward == NULL){
+        FATAL("malloc pt_forward failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+
+    bzero(forward, sizeof(struct pt_forward));
+
+    forward->server = server;
+
+    return forward;
+}
+
+void pt_forward_free(struct pt_forward *forward)
+{
+    if(forward->routes){
+        free(forward->routes);
+    }
+
+    free(forward);
+}
+
+qboolean pt_forward_add_route(struct pt_forward *forward, uint16_t id_min, uint16_t id_max, struct pt_pool *pool)
+{
+    struct pt_forward_route *route;
+    uint32_t i;
+
+    if(id_min > id_max || pool == NULL){
+        LOG("invalid forward route",__FUNCTION__,__FILE__,__LINE__);
+        return false;
+    }
+
+    for(i = 0; i < forward->number_of_routes; i++)
+    {
+        route = &forward->routes[i];
+
+        if(id_min <= route->id_max && route->id_min <= id_max){
+            LOG("forward route overlapped",__FUNCTION__,__FILE__,__LINE__);
+            return false;
+        }
+    }
+
+    forward->routes = realloc(forward->routes, sizeof(struct pt_forward_route) * (forward->number_of_routes + 1));
+    if(forward->routes == NULL){
+        FATAL("realloc forward->routes failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+
+    route = &forward->routes[forward->number_of_routes++];
+    route->id_min = id_min;
+    route->id_max = id_max;
+    route->pool = pool;
+
+    return true;
+}
+
+static struct pt_forward_route *pt_forward_find_route(struct pt_forward *forward, uint16_t id)
+{
+    struct pt_forward_route *route;
+    uint32_t i;
+
+    for(i = 0; i < forward->number_of_routes; i++)
+    {
+        route = &forward->routes[i];
+
+        if(id >= route->id_min && id <= route->id_max){
+            return route;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ 取走收到的数据包，不能取走时(例如批量包拆开的子消息)复制一份
+ */
+static struct pt_buffer *pt_forward_own(struct pt_buffer *detached, struct pt_buffer *buff)
+{
+    struct pt_buffer *owner;
+
+    if(detached) return detached;
+
+    owner = pt_buffer_new(buff->length);
+    pt_buffer_write(owner, buff->buff, buff->length);
+
+    return owner;
+}
+
+qboolean pt_forward_client_receive(struct pt_forward *forward, struct pt_sclient *user, struct pt_buffer *buff)
+{
+    struct net_header *hdr = (struct net_header*)buff->buff;
+    struct pt_forward_route *route;
+    struct forward_header fh;
+    struct pt_client *client;
+    struct pt_buffer *owner;
+    //加密时解密后的数据以包序列开头，不转发
+    uint32_t offset = sizeof(struct net_header) + (forward->server->enable_encrypt ? sizeof(uint32_t) : 0);
+    uint32_t length;
+
+    route = pt_forward_find_route(forward, hdr->id);
+    if(route == NULL) return false;
+
+    client = pt_pool_pick_hash(route->pool, user->id);
+    if(client == NULL || buff->length < offset){
+        forward->number_of_dropped++;
+        return true;
+    }
+
+    fh.session = user->id;
+    fh.id = hdr->id;
+    length = buff->length - offset;
+
+    owner = pt_forward_own(pt_server_detach_packet(user, buff), buff);
+
+    if(pt_client_send_wrapped(client, ID_RESERVE_TRANSMIT_ENUM, &fh, sizeof(fh), owner, offset, length)){
+        forward->number_of_forwarded++;
+    } else {
+        forward->number_of_dropped++;
+    }
+
+    return true;
+}
+
+qboolean pt_forward_backend_receive(struct pt_forward *forward, struct pt_client *client, struct pt_buffer *buff)
+{
+    struct net_header *hdr = (struct net_header*)buff->buff;
+    struct forward_header fh;
+    struct pt_sclient *user;
+    struct pt_buffer *owner;
+    uint32_t offset = sizeof(struct net_header) + sizeof(struct forward_header);
+    uint32_t length;
+
+    if(hdr->id != ID_RESERVE_TRANSMIT_ENUM) return false;
+
+    if(buff->length < offset){
+        ERROR("forward packet invalid", __FUNCTION__, __FILE__, __LINE__);
+        return true;
+    }
+
+    memcpy(&fh, buff->buff + sizeof(struct net_header), sizeof(fh));
+
+    user = pt_table_find(forward->server->clients, fh.session);
+    if(user == NULL || user->connected == false){
+        forward->number_of_dropped++;
+        return true;
+    }
+
+    //后端要求断开这个客户端
+    if(fh.id == ID_RESERVE_TRANSMIT_ENUM){
+        pt_server_disconnect_conn(user);
+        return true;
+    }
+
+    length = buff->length - offset;
+    owner = pt_forward_own(pt_client_detach_packet(client, buff), buff);
+
+    //net_header重新生成，forward_header不发送给客户端
+    if(pt_server_send_wrapped(user, fh.id, NULL, 0, owner, offset, length)){
+        forward->number_of_replied++;
+    } else {
+        forward->number_of_dropped++;
+    }
+
+    return true;
+}
+
+void pt_forward_client_disconnect(struct pt_forward *forward, struct pt_sclient *user)
+{
+    struct forward_header fh;
+    struct pt_client *client;
+    uint32_t i, j;
+
+    fh.session = user->id;
+    fh.id = ID_RESERVE_TRANSMIT_ENUM;
+
+    for(i = 0; i < forward->number_of_routes; i++)
+    {
+        //多个规则使用同一个连接池时只通知一次
+        for(j = 0; j < i; j++)
+        {
+            if(forward->routes[j].pool == forward->routes[i].pool) break;
+        }
+        if(j < i) continue;
+
+        client = pt_pool_pick_hash(forward->routes[i].pool, user->id);
+        if(client == NULL) continue;
+
+        pt_client_send_data(client, ID_RESERVE_TRANSMIT_ENUM, (const unsigned char*)&fh, sizeof(fh));
+    }
+}
@@ -0,0 +1,202 @@
+//
+//  hashring.c
+//  xcode
+//
+//  一致性哈希环
+//
+
+#include "common.h"
+#include "error.h"
+#include "hashring.h"
+
+uint64_t pt_hashring_mix(uint64_t x)
+{
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+uint64_t pt_hashring_hash(const void *data, uint32_t length)
+{
+    const unsigned char *p = data;
+    uint64_t h = 0xCBF29CE484222325ULL;
+    uint32_t i;
+
+    for(i = 0; i < length; i++)
+    {
+        h = (h ^ p[i]) * 0x100000001B3ULL;
+    }
+
+    return pt_hashring_mix(h);
+}
+
+struct pt_hashring *pt_hashring_new(uint32_t vnodes)
+{
+    struct pt_hashring *ring = malloc(sizeof(struct pt_hashring));
+
+    if(ring == NULL){
+        FATAL("malloc pt_hashring failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+
+    bzero(ring, sizeof(struct pt_hashring));
+
+    ring->vnodes = vnodes ? vnodes : PT_HASHRING_VNODES;
+
+    return ring;
+}
+
+void pt_hashring_free(struct pt_hashring *ring)
+{
+    if(ring->nodes){
+        free(ring->nodes);
+    }
+    if(ring->points){
+        free(ring->points);
+    }
+
+    free(ring);
+}
+
+/*
+ 排序时point->node指向ring->nodes中的节点，哈希值相同时按节点的key决定顺序，保证和添加顺序无关
+ */
+static int pt_hashring_compare(const void *a, const void *b)
+{
+    const struct pt_hashring_point *x = a;
+    const struct pt_hashring_point *y = b;
+    const struct pt_hashring_node *nx = x->node;
+    const struct pt_hashring_node *ny = y->node;
+
+    if(x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+    if(nx->key != ny->key) return nx->key < ny->key ? -1 : 1;
+    return 0;
+}
+
+static int pt_hashring_find_node(struct pt_hashring *ring, void *node)
+{
+    uint32_t i;
+
+    for(i = 0; i < ring->number_of_nodes; i++)
+    {
+        if(ring->nodes[i].node == node) return (int)i;
+    }
+
+    return -1;
+}
+
+/*
+ 按所有节点重新生成虚拟节点
+ */
+static void pt_hashring_rebuild(struct pt_hashring *ring)
+{
+    struct pt_hashring_node *n;
+    struct pt_hashring_point *point;
+    uint32_t count = 0;
+    uint32_t i, j;
+
+    for(i = 0; i < ring->number_of_nodes; i++)
+    {
+        count += ring->nodes[i].weight * ring->vnodes;
+    }
+
+    ring->points = realloc(ring->points, sizeof(struct pt_hashring_point) * (count ? count : 1));
+    if(ring->points == NULL){
+        FATAL("realloc ring->points failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+
+    point = ring->points;
+    for(i = 0; i < ring->number_of_nodes; i++)
+    {
+        n = &ring->nodes[i];
+
+        for(j = 0; j < n->weight * ring->vnodes; j++)
+        {
+            //节点的key先单独混合，key本身是pt_hashring_mix的结果时key ^ mix(j)对节点和序号对称，不同节点的虚拟节点会重合
+            point->hash = pt_hashring_mix(pt_hashring_mix(n->key) ^ j);
+            point->node = n;
+            point++;
+        }
+    }
+
+    ring->number_of_points = count;
+    qsort(ring->points, count, sizeof(struct pt_hashring_point), pt_hashring_compare);
+
+    //排序完成后换成用户的节点
+    for(i = 0; i < count; i++)
+    {
+        ring->points[i].node = ((struct pt_hashring_node*)ring->points[i].node)->node;
+    }
+}
+
+qboolean pt_hashring_add(struct pt_hashring *ring, uint64_t key, void *node, uint32_t weight)
+{
+    struct pt_hashring_node *n;
+
+    if(pt_hashring_find_node(ring, node) >= 0) return false;
+
+    ring->nodes = realloc(ring->nodes, sizeof(struct pt_hashring_node) * (ring->number_of_nodes + 1));
+    if(ring->nodes == NULL){
+        FATAL("realloc ring->nodes failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+
+    n = &ring->nodes[ring->number_of_nodes++];
+    n->key = key;
+    n->node = node;
+    n->weight = weight ? weight : 1;
+
+    pt_hashring_rebuild(ring);
+
+    return true;
+}
+
+qboolean pt_hashring_remove(struct pt_hashring *ring, void *node)
+{
+    int index = pt_hashring_find_node(ring, node);
+
+    if(index < 0) return false;
+
+    ring->number_of_nodes--;
+    memmove(&ring->nodes[index], &ring->nodes[index + 1], sizeof(struct pt_hashring_node) * (ring->number_of_nodes - index));
+
+    pt_hashring_rebuild(ring);
+
+    return true;
+}
+
+qboolean pt_hashring_contains(struct pt_hashring *ring, void *node)
+{
+    return pt_hashring_find_node(ring, node) >= 0;
+}
+
+void *pt_hashring_lookup(struct pt_hashring *ring, uint64_t key)
+{
+    uint64_t hash = pt_hashring_mix(key);
+    uint32_t low = 0;
+    uint32_t high = ring->number_of_points;
+    uint32_t mid;
+
+    if(ring->number_of_points == 0) return NULL;
+
+    //第一个hash >= key的虚拟节点
+    while(low < high)
+    {
+        mid = low + (high - low) / 2;
+
+        if(ring->points[mid].hash < hash){
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    //超过最后一个时回到环的起点
+    if(low == ring->number_of_points){
+        low = 0;
+    }
+
+    return ring->points[low].node;
+}
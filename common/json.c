@@ -0,0 +1,892 @@
+//
+//  json.c
+//  xcode
+//
+//  ID_TRANSMIT_JSON使用的JSON解析，路由和输出
+//
+
+#include <math.h>
+
+#include "common.h"
+#include "error.h"
+#include "json.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define PT_JSON_SSE2 1
+#endif
+
+static const char *pt_json_skip_ws(const char *p, const char *end)
+{
+    while(p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+    {
+        p++;
+    }
+
+    return p;
+}
+
+/*
+ p指向开头引号之后，返回结尾引号之后的位置，没有结尾返回NULL
+ */
+static const char *pt_json_skip_string(const char *p, const char *end)
+{
+#ifdef PT_JSON_SSE2
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i slash = _mm_set1_epi8('\\');
+    __m128i chunk;
+    int mask, i;
+
+    while(end - p >= 16)
+    {
+        chunk = _mm_loadu_si128((const __m128i*)p);
+        mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, slash)));
+
+        if(mask == 0){
+            p += 16;
+            continue;
+        }
+
+        i = __builtin_ctz(mask);
+        if(p[i] == '"') return p + i + 1;
+
+        //跳过转义的字符
+        p += i + 2;
+    }
+#endif
+
+    while(p < end)
+    {
+        if(*p == '"') return p + 1;
+        p += *p == '\\' ? 2 : 1;
+    }
+
+    return NULL;
+}
+
+/*
+ p指向'{'或者'['，返回对应的结尾之后的位置
+ 只检查括号的数量，不检查是否匹配
+ */
+static const char *pt_json_skip_container(const char *p, const char *end)
+{
+    int depth = 0;
+    char c;
+
+#ifdef PT_JSON_SSE2
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i lbrace = _mm_set1_epi8('{');
+    const __m128i rbrace = _mm_set1_epi8('}');
+    const __m128i lbracket = _mm_set1_epi8('[');
+    const __m128i rbracket = _mm_set1_epi8(']');
+    __m128i chunk;
+    int mask, i;
+
+    while(end - p >= 16)
+    {
+        chunk = _mm_loadu_si128((const __m128i*)p);
+        mask = _mm_movemask_epi8(_mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, lbrace)),
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, rbrace), _mm_cmpeq_epi8(chunk, lbracket)),
+                         _mm_cmpeq_epi8(chunk, rbracket))));
+
+        while(mask)
+        {
+            i = __builtin_ctz(mask);
+            c = p[i];
+
+            //字符串中的括号不计算，跳过字符串后重新扫描
+            if(c == '"'){
+                p = pt_json_skip_string(p + i + 1, end);
+                if(p == NULL) return NULL;
+                goto next;
+            }
+
+            if(c == '{' || c == '['){
+                depth++;
+            } else if(--depth == 0){
+                return p + i + 1;
+            }
+
+            mask &= mask - 1;
+        }
+
+        p += 16;
+    next:
+        ;
+    }
+#endif
+
+    while(p < end)
+    {
+        c = *p++;
+
+        if(c == '"'){
+            p = pt_json_skip_string(p, end);
+            if(p == NULL) return NULL;
+        } else if(c == '{' || c == '['){
+            depth++;
+        } else if(c == '}' || c == ']'){
+            if(--depth == 0) return p;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ 返回值结尾之后的位置，格式错误返回NULL
+ */
+static const char *pt_json_skip_value(const char *p, const char *end)
+{
+    if(p >= end) return NULL;
+
+    switch(*p)
+    {
+        case '"':
+            return pt_json_skip_string(p + 1, end);
+        case '{':
+        case '[':
+            return pt_json_skip_container(p, end);
+        case ',':
+        case ':':
+        case '}':
+        case ']':
+            return NULL;
+    }
+
+    //数字，true，false，null
+    while(p < end && *p != ',' && *p != '}' && *p != ']' && *p != ':' &&
+          *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+    {
+        p++;
+    }
+
+    return p;
+}
+
+qboolean pt_json_parse(struct pt_json *value, const char *data, uint32_t length)
+{
+    const char *p = pt_json_skip_ws(data, data + length);
+    const char *end = data + length;
+
+    while(end > p && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r' || end[-1] == '\n'))
+    {
+        end--;
+    }
+
+    value->data = p;
+    value->length = (uint32_t)(end - p);
+
+    return pt_json_type(value) != PT_JSON_INVALID;
+}
+
+int pt_json_type(const struct pt_json *value)
+{
+    if(value->length == 0) return PT_JSON_INVALID;
+
+    switch(value->data[0])
+    {
+        case '{': return PT_JSON_OBJECT;
+        case '[': return PT_JSON_ARRAY;
+        case '"': return PT_JSON_STRING;
+        case 't': return PT_JSON_TRUE;
+        case 'f': return PT_JSON_FALSE;
+        case 'n': return PT_JSON_NULL;
+        case '-':
+        case '0': case '1': case '2': case '3': case '4':
+        case '5': case '6': case '7': case '8': case '9':
+            return PT_JSON_NUMBER;
+    }
+
+    return PT_JSON_INVALID;
+}
+
+qboolean pt_json_iter_init(struct pt_json_iter *iter, const struct pt_json *value)
+{
+    int type = pt_json_type(value);
+
+    if(type != PT_JSON_OBJECT && type != PT_JSON_ARRAY) return false;
+
+    iter->pos = value->data + 1;
+    iter->end = value->data + value->length;
+    iter->object = type == PT_JSON_OBJECT;
+    iter->first = true;
+
+    return true;
+}
+
+qboolean pt_json_iter_next(struct pt_json_iter *iter, struct pt_json *key, struct pt_json *value)
+{
+    const char *p = pt_json_skip_ws(iter->pos, iter->end);
+    const char *end = iter->end;
+    const char *next;
+
+    if(p >= end) return false;
+
+    if(*p == (iter->object ? '}' : ']')){
+        iter->pos = end;
+        return false;
+    }
+
+    if(iter->first == false){
+        if(*p != ',') return false;
+        p = pt_json_skip_ws(p + 1, end);
+    }
+    iter->first = false;
+
+    if(iter->object){
+        if(p >= end || *p != '"') return false;
+
+        next = pt_json_skip_string(p + 1, end);
+        if(next == NULL) return false;
+
+        if(key){
+            key->data = p;
+            key->length = (uint32_t)(next - p);
+        }
+
+        p = pt_json_skip_ws(next, end);
+        if(p >= end || *p != ':') return false;
+        p = pt_json_skip_ws(p + 1, end);
+    } else if(key){
+        key->data = NULL;
+        key->length = 0;
+    }
+
+    next = pt_json_skip_value(p, end);
+    if(next == NULL || next == p) return false;
+
+    value->data = p;
+    value->length = (uint32_t)(next - p);
+
+    iter->pos = next;
+
+    return true;
+}
+
+/*
+ 带引号的原始字符串是否等于长度为length的str
+ */
+static qboolean pt_json_raw_equals(const struct pt_json *value, const char *str, size_t length)
+{
+    return value->length == length + 2 && memcmp(value->data + 1, str, length) == 0;
+}
+
+qboolean pt_json_get(const struct pt_json *object, const char *key, struct pt_json *out)
+{
+    struct pt_json_iter iter;
+    struct pt_json k;
+    size_t length = strlen(key);
+
+    if(pt_json_type(object) != PT_JSON_OBJECT) return false;
+
+    pt_json_iter_init(&iter, object);
+
+    while(pt_json_iter_next(&iter, &k, out))
+    {
+        if(pt_json_raw_equals(&k, key, length)) return true;
+    }
+
+    return false;
+}
+
+qboolean pt_json_index(const struct pt_json *array, uint32_t index, struct pt_json *out)
+{
+    struct pt_json_iter iter;
+    uint32_t i = 0;
+
+    if(pt_json_type(array) != PT_JSON_ARRAY) return false;
+
+    pt_json_iter_init(&iter, array);
+
+    while(pt_json_iter_next(&iter, NULL, out))
+    {
+        if(i++ == index) return true;
+    }
+
+    return false;
+}
+
+qboolean pt_json_string_view(const struct pt_json *value, struct pt_bytes *out)
+{
+    if(pt_json_type(value) != PT_JSON_STRING || value->length < 2) return false;
+
+    out->data = (const unsigned char*)value->data + 1;
+    out->length = value->length - 2;
+
+    return true;
+}
+
+qboolean pt_json_string_equals(const struct pt_json *value, const char *str)
+{
+    return pt_json_type(value) == PT_JSON_STRING && pt_json_raw_equals(value, str, strlen(str));
+}
+
+static int pt_json_hex(const char *p)
+{
+    int v = 0;
+    int i;
+
+    for(i = 0; i < 4; i++)
+    {
+        v <<= 4;
+
+        if(p[i] >= '0' && p[i] <= '9') v |= p[i] - '0';
+        else if(p[i] >= 'a' && p[i] <= 'f') v |= p[i] - 'a' + 10;
+        else if(p[i] >= 'A' && p[i] <= 'F') v |= p[i] - 'A' + 10;
+        else return -1;
+    }
+
+    return v;
+}
+
+qboolean pt_json_string_copy(const struct pt_json *value, char *buf, uint32_t size, uint32_t *length)
+{
+    struct pt_bytes raw;
+    const char *p;
+    const char *end;
+    uint32_t n = 0;
+    uint32_t cp;
+    int lo;
+    char c;
+
+    if(size == 0 || pt_json_string_view(value, &raw) == false) return false;
+
+    p = (const char*)raw.data;
+    end = p + raw.length;
+
+    while(p < end)
+    {
+        c = *p++;
+
+        if(c != '\\'){
+            if(n + 1 >= size) return false;
+            buf[n++] = c;
+            continue;
+        }
+
+        if(p >= end) return false;
+
+        switch(c = *p++)
+        {
+            case 'b': c = '\b'; break;
+            case 'f': c = '\f'; break;
+            case 'n': c = '\n'; break;
+            case 'r': c = '\r'; break;
+            case 't': c = '\t'; break;
+            case '"':
+            case '\\':
+            case '/':
+                break;
+            case 'u':
+                if(end - p < 4 || (lo = pt_json_hex(p)) < 0) return false;
+                cp = (uint32_t)lo;
+                p += 4;
+
+                //代理对
+                if(cp >= 0xD800 && cp < 0xDC00){
+                    if(end - p < 6 || p[0] != '\\' || p[1] != 'u') return false;
+                    lo = pt_json_hex(p + 2);
+                    if(lo < 0xDC00 || lo >= 0xE000) return false;
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + ((uint32_t)lo - 0xDC00);
+                    p += 6;
+                }
+
+                if(cp < 0x80){
+                    if(n + 1 >= size) return false;
+                    buf[n++] = (char)cp;
+                } else if(cp < 0x800){
+                    if(n + 2 >= size) return false;
+                    buf[n++] = (char)(0xC0 | (cp >> 6));
+                    buf[n++] = (char)(0x80 | (cp & 0x3F));
+                } else if(cp < 0x10000){
+                    if(n + 3 >= size) return false;
+                    buf[n++] = (char)(0xE0 | (cp >> 12));
+                    buf[n++] = (char)(0x80 | ((cp >> 6) & 0x3F));
+                    buf[n++] = (char)(0x80 | (cp & 0x3F));
+                } else {
+                    if(n + 4 >= size) return false;
+                    buf[n++] = (char)(0xF0 | (cp >> 18));
+                    buf[n++] = (char)(0x80 | ((cp >> 12) & 0x3F));
+                    buf[n++] = (char)(0x80 | ((cp >> 6) & 0x3F));
+                    buf[n++] = (char)(0x80 | (cp & 0x3F));
+                }
+                continue;
+            default:
+                return false;
+        }
+
+        if(n + 1 >= size) return false;
+        buf[n++] = c;
+    }
+
+    buf[n] = 0;
+    if(length) *length = n;
+
+    return true;
+}
+
+qboolean pt_json_get_int(const struct pt_json *value, int64_t *out)
+{
+    const char *p = value->data;
+    const char *end = value->data + value->length;
+    qboolean negative = false;
+    uint64_t v = 0;
+    uint64_t limit;
+    int digit;
+
+    if(pt_json_type(value) != PT_JSON_NUMBER) return false;
+
+    if(*p == '-'){
+        negative = true;
+        p++;
+    }
+
+    if(p >= end) return false;
+
+    limit = negative ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX;
+
+    while(p < end)
+    {
+        if(*p < '0' || *p > '9') return false;
+
+        digit = *p++ - '0';
+        if(v > (limit - digit) / 10) return false;
+        v = v * 10 + digit;
+    }
+
+    *out = negative ? (int64_t)(0 - v) : (int64_t)v;
+
+    return true;
+}
+
+qboolean pt_json_get_double(const struct pt_json *value, double *out)
+{
+    char tmp[64];
+    char *end;
+
+    //数据不以0结尾，复制后再使用strtod
+    if(pt_json_type(value) != PT_JSON_NUMBER || value->length >= sizeof(tmp)) return false;
+
+    memcpy(tmp, value->data, value->length);
+    tmp[value->length] = 0;
+
+    *out = strtod(tmp, &end);
+
+    return end == tmp + value->length;
+}
+
+qboolean pt_json_get_bool(const struct pt_json *value, qboolean *out)
+{
+    if(value->length == 4 && memcmp(value->data, "true", 4) == 0){
+        *out = true;
+        return true;
+    }
+
+    if(value->length == 5 && memcmp(value->data, "false", 5) == 0){
+        *out = false;
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ 路由表的key，type和action之间用0分隔
+ */
+static uint64_t pt_json_route_hash(const char *type, uint32_t type_length, const char *action, uint32_t action_length)
+{
+    uint64_t h = 0xCBF29CE484222325ULL;
+    uint32_t i;
+
+    for(i = 0; i < type_length; i++)
+    {
+        h = (h ^ (unsigned char)type[i]) * 0x100000001B3ULL;
+    }
+
+    h = h * 0x100000001B3ULL;
+
+    for(i = 0; i < action_length; i++)
+    {
+        h = (h ^ (unsigned char)action[i]) * 0x100000001B3ULL;
+    }
+
+    return h;
+}
+
+struct pt_json_router *pt_json_router_new()
+{
+    struct pt_json_router *router = malloc(sizeof(struct pt_json_router));
+
+    if(router == NULL){
+        FATAL("malloc pt_json_router failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+
+    bzero(router, sizeof(struct pt_json_router));
+
+    router->routes = pt_table_new();
+
+    return router;
+}
+
+static void pt_json_route_free(struct pt_json_route *route)
+{
+    free(route->type);
+    free(route->action);
+    free(route);
+}
+
+void pt_json_router_free(struct pt_json_router *router)
+{
+    struct pt_table_node *node;
+    struct pt_json_route *route;
+    struct pt_json_route *next;
+    uint32_t i;
+
+    for(i = 0; i < router->routes->granularity; i++)
+    {
+        for(node = router->routes->head[i]; node; node = node->next)
+        {
+            for(route = node->ptr; route; route = next)
+            {
+                next = route->next;
+                pt_json_route_free(route);
+            }
+        }
+    }
+
+    pt_table_free(router->routes);
+    free(router);
+}
+
+void pt_json_router_add(struct pt_json_router *router, const char *type, const char *action,
+                        pt_json_handler handler, void *udata)
+{
+    uint64_t hash = pt_json_route_hash(type, (uint32_t)strlen(type), action, (uint32_t)strlen(action));
+    struct pt_json_route *head = pt_table_find(router->routes, hash);
+    struct pt_json_route *route;
+
+    for(route = head; route; route = route->next)
+    {
+        if(strcmp(route->type, type) == 0 && strcmp(route->action, action) == 0){
+            route->handler = handler;
+            route->udata = udata;
+            return;
+        }
+    }
+
+    route = malloc(sizeof(struct pt_json_route));
+    if(route == NULL){
+        FATAL("malloc pt_json_route failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+
+    route->type = strdup(type);
+    route->action = strdup(action);
+    route->handler = handler;
+    route->udata = udata;
+    route->next = head;
+
+    if(head){
+        pt_table_erase(router->routes, hash);
+    }
+    pt_table_insert(router->routes, hash, route);
+
+    router->count++;
+}
+
+int pt_json_router_dispatch(struct pt_json_router *router, const char *data, uint32_t length, void *ctx)
+{
+    struct pt_json doc;
+    struct pt_json_iter iter;
+    struct pt_json key;
+    struct pt_json value;
+    struct pt_json type = {NULL, 0};
+    struct pt_json action = {NULL, 0};
+    struct pt_json params = {NULL, 0};
+    struct pt_json_route *route;
+    uint32_t type_length, action_length;
+    int found = 0;
+
+    if(pt_json_parse(&doc, data, length) == false || pt_json_iter_init(&iter, &doc) == false){
+        return PT_JSON_ROUTE_INVALID;
+    }
+
+    //只扫描顶层的成员，params的内容只跳过不解析
+    while(found != 7 && pt_json_iter_next(&iter, &key, &value))
+    {
+        if(pt_json_raw_equals(&key, "type", 4)){
+            type = value;
+            found |= 1;
+        } else if(pt_json_raw_equals(&key, "action", 6)){
+            action = value;
+            found |= 2;
+        } else if(pt_json_raw_equals(&key, "params", 6)){
+            params = value;
+            found |= 4;
+        }
+    }
+
+    if(pt_json_type(&type) != PT_JSON_STRING || pt_json_type(&action) != PT_JSON_STRING){
+        return PT_JSON_ROUTE_INVALID;
+    }
+
+    type_length = type.length - 2;
+    action_length = action.length - 2;
+
+    route = pt_table_find(router->routes, pt_json_route_hash(type.data + 1, type_length, action.data + 1, action_length));
+
+    for(; route; route = route->next)
+    {
+        if(strlen(route->type) == type_length && memcmp(route->type, type.data + 1, type_length) == 0 &&
+           strlen(route->action) == action_length && memcmp(route->action, action.data + 1, action_length) == 0){
+            route->handler(ctx, &params, route->udata);
+            return PT_JSON_ROUTE_OK;
+        }
+    }
+
+    return PT_JSON_ROUTE_UNKNOWN;
+}
+
+void pt_json_writer_init(struct pt_json_writer *writer, struct pt_buffer *buff)
+{
+    bzero(writer, sizeof(struct pt_json_writer));
+
+    writer->buff = buff;
+}
+
+qboolean pt_json_writer_ok(struct pt_json_writer *writer)
+{
+    return writer->error == false && writer->depth == 0;
+}
+
+static void pt_json_put(struct pt_json_writer *writer, const char *data, uint32_t length)
+{
+    pt_buffer_write(writer->buff, (const unsigned char*)data, length);
+}
+
+static void pt_json_putc(struct pt_json_writer *writer, char c)
+{
+    pt_buffer_write(writer->buff, (const unsigned char*)&c, 1);
+}
+
+/*
+ 写入值之前，同一层的第二个成员开始需要逗号
+ */
+static void pt_json_prefix(struct pt_json_writer *writer)
+{
+    uint64_t bit;
+
+    if(writer->after_key){
+        writer->after_key = false;
+        return;
+    }
+
+    if(writer->depth == 0) return;
+
+    bit = 1ULL << (writer->depth - 1);
+
+    if(writer->has_item & bit){
+        pt_json_putc(writer, ',');
+    }
+
+    writer->has_item |= bit;
+}
+
+static void pt_json_begin(struct pt_json_writer *writer, char c)
+{
+    pt_json_prefix(writer);
+
+    if(writer->depth >= PT_JSON_MAX_DEPTH){
+        writer->error = true;
+        return;
+    }
+
+    pt_json_putc(writer, c);
+
+    writer->depth++;
+    writer->has_item &= ~(1ULL << (writer->depth - 1));
+}
+
+static void pt_json_end(struct pt_json_writer *writer, char c)
+{
+    if(writer->depth == 0 || writer->after_key){
+        writer->error = true;
+        return;
+    }
+
+    writer->depth--;
+
+    pt_json_putc(writer, c);
+}
+
+void pt_json_write_object_begin(struct pt_json_writer *writer)
+{
+    pt_json_begin(writer, '{');
+}
+
+void pt_json_write_object_end(struct pt_json_writer *writer)
+{
+    pt_json_end(writer, '}');
+}
+
+void pt_json_write_array_begin(struct pt_json_writer *writer)
+{
+    pt_json_begin(writer, '[');
+}
+
+void pt_json_write_array_end(struct pt_json_writer *writer)
+{
+    pt_json_end(writer, ']');
+}
+
+/*
+ 输出带引号的字符串，需要转义的字符之间的部分整段复制
+ */
+static void pt_json_put_string(struct pt_json_writer *writer, const char *str, uint32_t length)
+{
+    static const char hex[] = "0123456789abcdef";
+    const char *p = str;
+    const char *end = str + length;
+    const char *run = str;
+    char esc[6];
+    unsigned char c;
+
+    //大部分字符串不需要转义，预留一次空间
+    pt_buffer_reserve(writer->buff, length + 2);
+
+    pt_json_putc(writer, '"');
+
+    while(p < end)
+    {
+#ifdef PT_JSON_SSE2
+        if(end - p >= 16){
+            const __m128i chunk = _mm_loadu_si128((const __m128i*)p);
+            const __m128i ctrl = _mm_cmpeq_epi8(_mm_max_epu8(chunk, _mm_set1_epi8(0x1F)), _mm_set1_epi8(0x1F));
+            int mask = _mm_movemask_epi8(_mm_or_si128(ctrl,
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('"')), _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\\')))));
+
+            if(mask == 0){
+                p += 16;
+                continue;
+            }
+
+            p += __builtin_ctz(mask);
+        }
+#endif
+
+        c = (unsigned char)*p;
+
+        if(c >= 0x20 && c != '"' && c != '\\'){
+            p++;
+            continue;
+        }
+
+        pt_json_put(writer, run, (uint32_t)(p - run));
+
+        esc[0] = '\\';
+        switch(c)
+        {
+            case '"': esc[1] = '"'; break;
+            case '\\': esc[1] = '\\'; break;
+            case '\b': esc[1] = 'b'; break;
+            case '\f': esc[1] = 'f'; break;
+            case '\n': esc[1] = 'n'; break;
+            case '\r': esc[1] = 'r'; break;
+            case '\t': esc[1] = 't'; break;
+            default:
+                esc[1] = 'u';
+                esc[2] = '0';
+                esc[3] = '0';
+                esc[4] = hex[c >> 4];
+                esc[5] = hex[c & 0xF];
+                pt_json_put(writer, esc, 6);
+                run = ++p;
+                continue;
+        }
+
+        pt_json_put(writer, esc, 2);
+        run = ++p;
+    }
+
+    pt_json_put(writer, run, (uint32_t)(end - run));
+    pt_json_putc(writer, '"');
+}
+
+void pt_json_write_key(struct pt_json_writer *writer, const char *key)
+{
+    if(writer->after_key){
+        writer->error = true;
+        return;
+    }
+
+    pt_json_prefix(writer);
+    pt_json_put_string(writer, key, (uint32_t)strlen(key));
+    pt_json_putc(writer, ':');
+
+    writer->after_key = true;
+}
+
+void pt_json_write_string(struct pt_json_writer *writer, const char *str, uint32_t length)
+{
+    pt_json_prefix(writer);
+    pt_json_put_string(writer, str, length);
+}
+
+void pt_json_write_int(struct pt_json_writer *writer, int64_t v)
+{
+    char tmp[24];
+    char *p = tmp + sizeof(tmp);
+    uint64_t u = v < 0 ? 0 - (uint64_t)v : (uint64_t)v;
+
+    do {
+        *--p = (char)('0' + u % 10);
+        u /= 10;
+    } while(u);
+
+    if(v < 0) *--p = '-';
+
+    pt_json_prefix(writer);
+    pt_json_put(writer, p, (uint32_t)(tmp + sizeof(tmp) - p));
+}
+
+void pt_json_write_double(struct pt_json_writer *writer, double v)
+{
+    char tmp[32];
+    int length;
+
+    if(isfinite(v) == 0){
+        pt_json_write_null(writer);
+        return;
+    }
+
+    length = snprintf(tmp, sizeof(tmp), "%.17g", v);
+
+    pt_json_prefix(writer);
+    pt_json_put(writer, tmp, (uint32_t)length);
+}
+
+void pt_json_write_bool(struct pt_json_writer *writer, qboolean v)
+{
+    pt_json_prefix(writer);
+
+    if(v){
+        pt_json_put(writer, "true", 4);
+    } else {
+        pt_json_put(writer, "false", 5);
+    }
+}
+
+void pt_json_write_null(struct pt_json_writer *writer)
+{
+    pt_json_prefix(writer);
+    pt_json_put(writer, "null", 4);
+}
+
+void pt_json_write_raw(struct pt_json_writer *writer, const char *json, uint32_t length)
+{
+    pt_json_prefix(writer);
+    pt_json_put(writer, json, length);
+}
@@ -0,0 +1,467 @@
+//
+//  mux.c
+//  xcode
+//
+//  在一个内网连接上复用多个会话
+//
+
+#include "common.h"
+#include "error.h"
+#include "packet.h"
+#include "mux.h"
+
+static void pt_mux_flush_cb(uv_idle_t *handle)
+{
+    pt_mux_flush(handle->data);
+}
+
+static struct pt_mux *pt_mux_new(uv_loop_t *loop, pt_mux_on_open on_open, pt_mux_on_data on_data, pt_mux_on_close on_close)
+{
+    struct pt_mux *mux = malloc(sizeof(struct pt_mux));
+
+    if(mux == NULL){
+        FATAL("malloc pt_mux failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+
+    bzero(mux, sizeof(struct pt_mux));
+
+    mux->loop = loop;
+    mux->sessions = pt_table_new();
+    mux->auto_credit = true;
+    mux->on_open = on_open;
+    mux->on_data = on_data;
+    mux->on_close = on_close;
+
+    uv_idle_init(loop, &mux->flush_idle);
+    mux->flush_idle.data = mux;
+
+    return mux;
+}
+
+struct pt_mux *pt_mux_new_client(struct pt_client *client, pt_mux_on_open on_open, pt_mux_on_data on_data, pt_mux_on_close on_close)
+{
+    struct pt_mux *mux = pt_mux_new(client->loop, on_open, on_data, on_close);
+
+    mux->client = client;
+    mux->next_id = 1;
+
+    return mux;
+}
+
+struct pt_mux *pt_mux_new_server(struct pt_sclient *user, pt_mux_on_open on_open, pt_mux_on_data on_data, pt_mux_on_close on_close)
+{
+    struct pt_mux *mux = pt_mux_new(user->server->loop, on_open, on_data, on_close);
+
+    mux->user = user;
+    mux->next_id = 2;
+
+    return mux;
+}
+
+static struct pt_mux_session *pt_mux_session_new(struct pt_mux *mux, uint32_t id, void *data)
+{
+    struct pt_mux_session *session = malloc(sizeof(struct pt_mux_session));
+
+    if(session == NULL){
+        FATAL("malloc pt_mux_session failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+
+    bzero(session, sizeof(struct pt_mux_session));
+
+    session->mux = mux;
+    session->id = id;
+    session->send_window = PT_MUX_WINDOW;
+    session->recv_window = PT_MUX_WINDOW;
+    session->data = data;
+
+    session->next = mux->head;
+    if(mux->head){
+        mux->head->prev = session;
+    }
+    mux->head = session;
+    mux->number_of_sessions++;
+
+    pt_table_insert(mux->sessions, id, session);
+
+    return session;
+}
+
+/*
+ 从mux中移除，之后收到的帧不再属于这个会话
+ */
+static void pt_mux_session_unlink(struct pt_mux_session *session)
+{
+    struct pt_mux *mux = session->mux;
+
+    pt_table_erase(mux->sessions, session->id);
+
+    if(session->prev){
+        session->prev->next = session->next;
+    } else {
+        mux->head = session->next;
+    }
+    if(session->next){
+        session->next->prev = session->prev;
+    }
+    mux->number_of_sessions--;
+}
+
+static void pt_mux_session_free(struct pt_mux_session *session)
+{
+    struct pt_buffer *buff;
+
+    while(session->pending_head)
+    {
+        buff = session->pending_head;
+        session->pending_head = buff->next;
+        pt_buffer_free(buff);
+    }
+
+    free(session);
+}
+
+/*
+ 对方关闭或者mux释放，先移除再通知，on_close中释放mux也不会再次通知这个会话
+ */
+static void pt_mux_session_closed(struct pt_mux_session *session)
+{
+    struct pt_mux *mux = session->mux;
+
+    pt_mux_session_unlink(session);
+
+    if(mux->on_close){
+        mux->on_close(session);
+    }
+
+    pt_mux_session_free(session);
+}
+
+static void pt_mux_close_cb(uv_handle_t *handle)
+{
+    struct pt_mux *mux = handle->data;
+
+    pt_table_free(mux->sessions);
+    free(mux);
+}
+
+void pt_mux_free(struct pt_mux *mux)
+{
+    if(mux->closed) return;
+
+    mux->closed = true;
+
+    while(mux->head)
+    {
+        pt_mux_session_closed(mux->head);
+    }
+
+    if(mux->out){
+        pt_buffer_free(mux->out);
+        mux->out = NULL;
+    }
+
+    //pt_mux_receive的循环中调用时，mux在本次回调返回后才释放
+    uv_close((uv_handle_t*)&mux->flush_idle, pt_mux_close_cb);
+}
+
+/*
+ net_header之后的数据，客户端一侧加密时预留包序列
+ */
+static uint32_t pt_mux_head_size(struct pt_mux *mux)
+{
+    if(mux->client && mux->client->enable_encrypt){
+        return sizeof(struct net_header) + sizeof(uint32_t);
+    }
+    return sizeof(struct net_header);
+}
+
+void pt_mux_flush(struct pt_mux *mux)
+{
+    struct pt_buffer *buff = mux->out;
+
+    uv_idle_stop(&mux->flush_idle);
+
+    if(buff == NULL) return;
+
+    mux->out = NULL;
+    ((struct net_header*)buff->buff)->length = buff->length;
+    mux->number_of_writes++;
+
+    if(mux->client){
+        pt_client_send_prepared(mux->client, buff);
+    } else {
+        pt_server_send(mux->user, buff);
+    }
+}
+
+/*
+ 追加一个子帧，超过一个数据包时先写入之前的子帧
+ */
+static void pt_mux_append(struct pt_mux *mux, uint32_t session, uint8_t type, const unsigned char *data, uint32_t length)
+{
+    struct net_header hdr = pt_create_nethdr(ID_RESERVE_MUX);
+    struct mux_header mhdr;
+    uint32_t serial = 0;
+
+    if(mux->closed) return;
+
+    if(mux->out && mux->out->length + sizeof(mhdr) + length > pt_max_pack_size){
+        pt_mux_flush(mux);
+    }
+
+    if(mux->out == NULL){
+        mux->out = pt_buffer_new(PAGESIZE);
+        pt_buffer_write(mux->out, (unsigned char*)&hdr, sizeof(hdr));
+        if(pt_mux_head_size(mux) != sizeof(hdr)){
+            pt_buffer_write(mux->out, (unsigned char*)&serial, sizeof(serial));
+        }
+
+        //同一次事件循环中的子帧合并写入
+        uv_idle_start(&mux->flush_idle, pt_mux_flush_cb);
+    }
+
+    mhdr.session = session;
+    mhdr.type = type;
+    mhdr.length = length;
+
+    pt_buffer_write(mux->out, (unsigned char*)&mhdr, sizeof(mhdr));
+    if(length){
+        pt_buffer_write(mux->out, data, length);
+    }
+
+    mux->number_of_frames++;
+}
+
+struct pt_mux_session *pt_mux_open(struct pt_mux *mux, void *data)
+{
+    uint32_t id;
+
+    if(mux->closed) return NULL;
+
+    //跳过还在使用的id，回绕时跳过0
+    do {
+        id = mux->next_id;
+        mux->next_id += 2;
+        if(mux->next_id < 2){
+            mux->next_id = mux->client ? 1 : 2;
+        }
+    } while(pt_table_find(mux->sessions, id));
+
+    pt_mux_append(mux, id, PT_MUX_OPEN, NULL, 0);
+
+    return pt_mux_session_new(mux, id, data);
+}
+
+qboolean pt_mux_send(struct pt_mux_session *session, const unsigned char *data, uint32_t length)
+{
+    struct pt_mux *mux = session->mux;
+    struct pt_buffer *buff;
+
+    if(mux->closed) return false;
+
+    if(pt_mux_head_size(mux) + sizeof(struct mux_header) + length > pt_max_pack_size){
+        LOG("mux data too large", __FUNCTION__, __FILE__, __LINE__);
+        return false;
+    }
+
+    //有排队的数据时也需要排队，保持顺序
+    if(session->pending_head || session->send_window < length)
+    {
+        if(session->pending_size + length > PT_MUX_MAX_PENDING){
+            DBGPRINT("mux session pending overflow");
+            return false;
+        }
+
+        //开始排队时通知对方，对方处理的数据不足半个窗口时也会归还，否则两端互相等待
+        if(session->pending_head == NULL){
+            pt_mux_append(mux, session->id, PT_MUX_BLOCKED, NULL, 0);
+        }
+
+        buff = pt_buffer_new(length);
+        pt_buffer_write(buff, data, length);
+        buff->next = NULL;
+
+        if(session->pending_tail){
+            session->pending_tail->next = buff;
+        } else {
+            session->pending_head = buff;
+        }
+        session->pending_tail = buff;
+        session->pending_size += length;
+
+        return true;
+    }
+
+    session->send_window -= length;
+    pt_mux_append(mux, session->id, PT_MUX_DATA, data, length);
+
+    return true;
+}
+
+/*
+ 收到CREDIT后发送排队的数据
+ */
+static void pt_mux_send_pending(struct pt_mux_session *session)
+{
+    struct pt_buffer *buff;
+
+    while(session->pending_head && session->send_window >= session->pending_head->length)
+    {
+        buff = session->pending_head;
+        session->pending_head = buff->next;
+        if(session->pending_head == NULL){
+            session->pending_tail = NULL;
+        }
+        session->pending_size -= buff->length;
+        session->send_window -= buff->length;
+
+        pt_mux_append(session->mux, session->id, PT_MUX_DATA, buff->buff, buff->length);
+        pt_buffer_free(buff);
+    }
+
+    //归还的窗口还不够，继续等待
+    if(session->pending_head){
+        pt_mux_append(session->mux, session->id, PT_MUX_BLOCKED, NULL, 0);
+    }
+}
+
+void pt_mux_close(struct pt_mux_session *session)
+{
+    pt_mux_append(session->mux, session->id, PT_MUX_CLOSE, NULL, 0);
+    pt_mux_session_unlink(session);
+    pt_mux_session_free(session);
+}
+
+static void pt_mux_credit(struct pt_mux_session *session)
+{
+    uint32_t credit = session->recv_consumed;
+
+    session->recv_consumed = 0;
+    session->recv_window += credit;
+    session->peer_blocked = false;
+
+    pt_mux_append(session->mux, session->id, PT_MUX_CREDIT, (unsigned char*)&credit, sizeof(credit));
+}
+
+void pt_mux_consume(struct pt_mux_session *session, uint32_t length)
+{
+    session->recv_consumed += length;
+
+    if(session->recv_consumed == 0) return;
+    if(session->recv_consumed < PT_MUX_WINDOW / 2 && session->peer_blocked == false) return;
+
+    pt_mux_credit(session);
+}
+
+/*
+ 处理一个子帧，对方违反协议时返回false
+ */
+static qboolean pt_mux_on_frame(struct pt_mux *mux, const struct mux_header *mhdr, const unsigned char *data)
+{
+    struct pt_mux_session *session = pt_table_find(mux->sessions, mhdr->session);
+    uint32_t credit;
+
+    switch(mhdr->type)
+    {
+        case PT_MUX_OPEN:
+            //对方只能使用和本端不同奇偶的id
+            if(session || mhdr->session == 0 || (mhdr->session & 1) == (mux->next_id & 1)) return false;
+
+            session = pt_mux_session_new(mux, mhdr->session, NULL);
+
+            if(mux->on_open){
+                mux->on_open(session);
+            } else {
+                pt_mux_close(session);
+            }
+            return true;
+
+        case PT_MUX_DATA:
+            //本端已经关闭的会话，丢弃关闭之前发出的数据
+            if(session == NULL) return true;
+
+            if(mhdr->length > session->recv_window) return false;
+            session->recv_window -= mhdr->length;
+
+            if(mux->on_data){
+                mux->on_data(session, data, mhdr->length);
+            }
+
+            //on_data中可能关闭了会话或者整个mux
+            if(mux->auto_credit && mux->closed == false && pt_table_find(mux->sessions, mhdr->session) == session){
+                pt_mux_consume(session, mhdr->length);
+            }
+            return true;
+
+        case PT_MUX_CLOSE:
+            if(session == NULL) return true;
+
+            pt_mux_session_closed(session);
+            return true;
+
+        case PT_MUX_CREDIT:
+            if(mhdr->length != sizeof(credit)) return false;
+            if(session == NULL) return true;
+
+            memcpy(&credit, data, sizeof(credit));
+
+            if(session->send_window + credit < session->send_window) return false;
+            session->send_window += credit;
+
+            pt_mux_send_pending(session);
+            return true;
+
+        case PT_MUX_BLOCKED:
+            if(mhdr->length != 0) return false;
+            if(session == NULL) return true;
+
+            //已经处理的数据立即归还，还没有处理的在pt_mux_consume中归还
+            session->peer_blocked = true;
+            if(session->recv_consumed){
+                pt_mux_credit(session);
+            }
+            return true;
+    }
+
+    return false;
+}
+
+int pt_mux_receive(struct pt_mux *mux, struct pt_buffer *buff)
+{
+    struct net_header *hdr = (struct net_header*)buff->buff;
+    const unsigned char *pos = pt_get_packet_buffer(buff);
+    uint32_t remain = pt_get_packet_size(buff);
+    struct mux_header mhdr;
+
+    if(hdr->id != ID_RESERVE_MUX) return PT_MUX_RECV_UNKNOWN;
+
+    //服务器一侧解密后的数据以包序列开头
+    if(mux->user && mux->user->server->enable_encrypt){
+        if(remain < sizeof(uint32_t)) return PT_MUX_RECV_INVALID;
+        pos += sizeof(uint32_t);
+        remain -= sizeof(uint32_t);
+    }
+
+    while(remain && mux->closed == false)
+    {
+        if(remain < sizeof(mhdr)) return PT_MUX_RECV_INVALID;
+
+        memcpy(&mhdr, pos, sizeof(mhdr));
+        pos += sizeof(mhdr);
+        remain -= sizeof(mhdr);
+
+        if(mhdr.length > remain) return PT_MUX_RECV_INVALID;
+
+        if(pt_mux_on_frame(mux, &mhdr, pos) == false){
+            ERROR("mux frame invalid", __FUNCTION__, __FILE__, __LINE__);
+            return PT_MUX_RECV_INVALID;
+        }
+
+        pos += mhdr.length;
+        remain -= mhdr.length;
+    }
+
+    return PT_MUX_RECV_OK;
+}
@@ -18,7 +18,8 @@ qboolean pt_get_packet_status(struct pt_buffer *buf, uint32_t *err)
     
     hdr = (struct net_header*)buf->buff;
     
-    if(hdr->magic != PACKET_MAGIC){
+    //长度小于包头时无法拆包，丢弃也不会前进，和错误的magic一样断开
+    if(hdr->magic != PACKET_MAGIC || hdr->length < sizeof(struct net_header)){
         *err = PACKET_INFO_FAKE;
         return false;
     }
@@ -41,20 +42,23 @@ struct pt_buffer* pt_split_packet(struct pt_buffer *netbuf)
 {
     struct pt_buffer *buf;
     struct net_header *hdr;
+    uint32_t length;
     
     hdr = (struct net_header*)netbuf->buff;
-    buf = pt_buffer_new(hdr->length);
+    //pt_buffer_read会移动netbuf的数据，之后hdr指向的是下一个包
+    length = hdr->length;
+    buf = pt_buffer_new(length);
     
     if(buf == NULL){
         FATAL("pt_buffer_new == NULL", __FUNCTION__, __FILE__, __LINE__);
         abort();
     }
-    if(pt_buffer_read(netbuf, buf->buff, hdr->length, true) == false){
+    if(pt_buffer_read(netbuf, buf->buff, length, true) == false){
         pt_buffer_free(buf);
         return NULL;
     }
     
-    buf->length = hdr->length;
+    buf->length = length;
     return buf;
 }
 
@@ -106,11 +110,82 @@ qboolean pt_decrypt_package(uint32_t serial,RC4_KEY *ctx, struct pt_buffer *buff
     return true;
 }
 
+void pt_encrypt_package(RC4_KEY *ctx, uint32_t *serial, struct pt_buffer *buff)
+{
+    struct net_header *hdr = (struct net_header *)buff->buff;
+    unsigned char *encrypt_beg = pt_get_packet_buffer(buff);
+    uint32_t encrypt_size = pt_get_packet_size(buff);
+    
+    *(uint32_t*)encrypt_beg = *serial;
+    
+    hdr->length = buff->length;
+    hdr->crc = crc32(0, encrypt_beg, encrypt_size);
+    
+    RC4(ctx,encrypt_size,encrypt_beg,encrypt_beg);
+    
+    *serial = *serial + 1;
+}
+
+static void pt_datagram_key(RC4_KEY *ctx, const uint32_t key[4], uint32_t serial)
+{
+    unsigned char material[sizeof(uint32_t) * 5];
+    unsigned char discard[256];
+    
+    memcpy(material, key, sizeof(uint32_t) * 4);
+    memcpy(material + sizeof(uint32_t) * 4, &serial, sizeof(serial));
+    
+    RC4_set_key(ctx, sizeof(material), material);
+    
+    //相近的密钥生成的密钥流开头有关联，丢弃前256字节
+    bzero(discard, sizeof(discard));
+    RC4(ctx, sizeof(discard), discard, discard);
+}
+
+void pt_encrypt_datagram(const uint32_t key[4], uint32_t serial, struct pt_buffer *buff)
+{
+    struct net_header *hdr = (struct net_header *)buff->buff;
+    unsigned char *encrypt_beg = pt_get_packet_buffer(buff);
+    uint32_t encrypt_size = pt_get_packet_size(buff);
+    RC4_KEY ctx;
+    
+    *(uint32_t*)encrypt_beg = serial;
+    
+    hdr->length = buff->length;
+    hdr->crc = crc32(0, encrypt_beg, encrypt_size);
+    
+    pt_datagram_key(&ctx, key, serial);
+    RC4(&ctx, encrypt_size - sizeof(uint32_t), encrypt_beg + sizeof(uint32_t), encrypt_beg + sizeof(uint32_t));
+}
+
+qboolean pt_decrypt_datagram(const uint32_t key[4], struct pt_buffer *buff, uint32_t *serial)
+{
+    struct net_header *hdr = (struct net_header*)buff->buff;
+    unsigned char *data = pt_get_packet_buffer(buff);
+    uint32_t length = pt_get_packet_size(buff);
+    RC4_KEY ctx;
+    
+    if(length < sizeof(uint32_t)){
+        TRACE("length < sizeof(uint32_t)", __FUNCTION__, __FILE__, __LINE__);
+        return false;
+    }
+    
+    *serial = *(uint32_t*)data;
+    
+    pt_datagram_key(&ctx, key, *serial);
+    RC4(&ctx, length - sizeof(uint32_t), data + sizeof(uint32_t), data + sizeof(uint32_t));
+    
+    if(crc32(0, data, length) != hdr->crc){
+        TRACE("crc32(0, data, length) != hdr->crc", __FUNCTION__, __FILE__, __LINE__);
+        return false;
+    }
+    
+    return true;
+}
+
 struct pt_buffer * pt_create_encrypt_package(RC4_KEY *ctx, uint32_t *serial,
                                struct net_header hdr,unsigned char* data, uint32_t length)
 {
     struct pt_buffer *buff;
-    struct net_header *new_hdr;
     
     
     buff = pt_buffer_new(256);
@@ -118,16 +193,7 @@ struct pt_buffer * pt_create_encrypt_package(RC4_KEY *ctx, uint32_t *serial,
     pt_buffer_write(buff, (unsigned char*)serial, sizeof(uint32_t));
     pt_buffer_write(buff, data, length);
     
-    new_hdr = (struct net_header *)buff->buff;
-    unsigned char *encrypt_beg = pt_get_packet_buffer(buff);
-    uint32_t encrypt_size = pt_get_packet_size(buff);
-    
-    new_hdr->crc = crc32(0, encrypt_beg, encrypt_size);
-    
-    RC4(ctx,encrypt_size,encrypt_beg,encrypt_beg);
-    
-    new_hdr->length = buff->length;
-    *serial = *serial + 1;
+    pt_encrypt_package(ctx, serial, buff);
     
     return buff;
 }
@@ -144,4 +210,62 @@ struct pt_buffer *pt_create_package(struct net_header hdr,unsigned char* data, u
     new_hdr->length = buff->length;
     
     return buff;
-}
\ No newline at end of file
+}
+
+struct pt_buffer *pt_batch_new(qboolean encrypt)
+{
+    struct net_header hdr = pt_create_nethdr(ID_TRANSMIT_BATCH);
+    struct pt_buffer *buff = pt_buffer_new(256);
+    uint32_t serial = 0;
+    
+    pt_buffer_write(buff, (unsigned char*)&hdr, sizeof(struct net_header));
+    if(encrypt){
+        pt_buffer_write(buff, (unsigned char*)&serial, sizeof(serial));
+    }
+    
+    ((struct net_header *)buff->buff)->length = buff->length;
+    
+    return buff;
+}
+
+qboolean pt_batch_append(struct pt_buffer *batch, uint16_t id, const unsigned char *data, uint32_t length)
+{
+    struct batch_header bhdr;
+    
+    if(batch->length + sizeof(bhdr) + length > pt_max_pack_size){
+        return false;
+    }
+    
+    bhdr.id = id;
+    bhdr.length = length;
+    
+    pt_buffer_write(batch, (unsigned char*)&bhdr, sizeof(bhdr));
+    pt_buffer_write(batch, data, length);
+    
+    ((struct net_header *)batch->buff)->length = batch->length;
+    
+    return true;
+}
+
+qboolean pt_batch_next(const unsigned char **pos, uint32_t *remain, uint16_t *id,
+                       const unsigned char **data, uint32_t *length)
+{
+    struct batch_header bhdr;
+    
+    if(*remain < sizeof(bhdr)) return false;
+    
+    memcpy(&bhdr, *pos, sizeof(bhdr));
+    
+    if(bhdr.length > *remain - sizeof(bhdr) || bhdr.id == ID_TRANSMIT_BATCH){
+        return false;
+    }
+    
+    *id = bhdr.id;
+    *data = *pos + sizeof(bhdr);
+    *length = bhdr.length;
+    
+    *pos += sizeof(bhdr) + bhdr.length;
+    *remain -= sizeof(bhdr) + bhdr.length;
+    
+    return true;
+}
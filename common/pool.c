@@ -0,0 +1,370 @@
+//
+//  pool.c
+//  xcode
+//
+//  客户端连接池
+//
+
+#include "common.h"
+#include "error.h"
+#include "pool.h"
+
+static uint64_t pt_pool_hash_endpoint(const char *host, uint16_t port)
+{
+    return pt_hashring_mix(pt_hashring_hash(host, (uint32_t)strlen(host)) ^ port);
+}
+
+static void pt_pool_set_healthy(struct pt_pool_endpoint *ep, qboolean healthy)
+{
+    if(ep->healthy == healthy) return;
+
+    ep->healthy = healthy;
+
+    if(healthy){
+        pt_hashring_add(ep->pool->ring, ep->hash, ep, 1);
+    } else {
+        pt_hashring_remove(ep->pool->ring, ep);
+    }
+
+    if(ep->pool->on_state){
+        ep->pool->on_state(ep->pool, ep);
+    }
+}
+
+static void pt_pool_on_connected(struct pt_client *client)
+{
+    struct pt_pool_endpoint *ep = client->data;
+    uint64_t now = uv_now(ep->pool->loop);
+    int shift;
+
+    if(client->connected == false){
+        //连接失败，延迟重连，同一轮重连的多个连接只计算一次
+        if(now >= ep->next_retry){
+            ep->failures++;
+            shift = ep->failures - 1 < PT_POOL_RECONNECT_MAX_SHIFT ? ep->failures - 1 : PT_POOL_RECONNECT_MAX_SHIFT;
+            ep->next_retry = now + ((uint64_t)PT_POOL_RECONNECT_INTERVAL << shift);
+        }
+        return;
+    }
+
+    ep->failures = 0;
+    ep->number_of_connected++;
+    pt_pool_set_healthy(ep, true);
+}
+
+static void pt_pool_on_client_receive(struct pt_client *client, struct pt_buffer *buff)
+{
+    struct pt_pool_endpoint *ep = client->data;
+
+    if(ep->pool->on_receive){
+        ep->pool->on_receive(ep->pool, client, buff);
+    }
+}
+
+static void pt_pool_on_disconnected(struct pt_client *client)
+{
+    struct pt_pool_endpoint *ep = client->data;
+
+    ep->number_of_connected--;
+
+    if(ep->number_of_connected == 0){
+        pt_pool_set_healthy(ep, false);
+    }
+}
+
+static void pt_pool_connect(struct pt_pool_endpoint *ep, struct pt_client *client)
+{
+    if(ep->port == 0){
+        pt_client_connect_pipe(client, ep->host);
+    } else {
+        pt_client_connect(client, ep->host, ep->port);
+    }
+}
+
+/*
+ 重新连接已经断开的连接
+ */
+static void pt_pool_timer_cb(uv_timer_t* handle)
+{
+    struct pt_pool *pool = handle->data;
+    struct pt_pool_endpoint *ep;
+    struct pt_client *client;
+    uint64_t now = uv_now(pool->loop);
+    int i, j;
+
+    for(i = 0; i < pool->number_of_endpoints; i++)
+    {
+        ep = pool->endpoints[i];
+
+        if(now < ep->next_retry) continue;
+
+        for(j = 0; j < pool->conns_per_endpoint; j++)
+        {
+            client = ep->conns[j];
+
+            if(client->connected || client->connecting || client->closing) continue;
+
+            pt_pool_connect(ep, client);
+        }
+    }
+}
+
+struct pt_pool *pt_pool_new(uv_loop_t *loop, int conns_per_endpoint, pt_pool_on_receive on_receive, pt_pool_on_state on_state)
+{
+    struct pt_pool *pool = malloc(sizeof(struct pt_pool));
+
+    if(pool == NULL){
+        FATAL("malloc pt_pool failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+
+    bzero(pool, sizeof(struct pt_pool));
+
+    pool->loop = loop;
+    pool->conns_per_endpoint = conns_per_endpoint > 0 ? conns_per_endpoint : 1;
+    pool->on_receive = on_receive;
+    pool->on_state = on_state;
+    pool->ring = pt_hashring_new(0);
+
+    return pool;
+}
+
+void pt_pool_free(struct pt_pool *pool)
+{
+    struct pt_pool_endpoint *ep;
+    int i, j;
+
+    if(pool->is_startup){
+        FATAL("pool not closed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+
+    for(i = 0; i < pool->number_of_endpoints; i++)
+    {
+        ep = pool->endpoints[i];
+
+        for(j = 0; j < pool->conns_per_endpoint; j++)
+        {
+            pt_client_free(ep->conns[j]);
+        }
+
+        free(ep->conns);
+        free(ep);
+    }
+
+    pt_hashring_free(pool->ring);
+    free(pool->endpoints);
+    free(pool);
+}
+
+void pt_pool_set_encrypt(struct pt_pool *pool, const uint32_t encrypt_key[4])
+{
+    pool->enable_encrypt = true;
+
+    for(int i = 0; i < 4; i++)
+    {
+        pool->encrypt_key[i] = encrypt_key[i];
+    }
+}
+
+struct pt_pool_endpoint *pt_pool_add_endpoint(struct pt_pool *pool, const char *host, uint16_t port)
+{
+    struct pt_pool_endpoint *ep;
+    struct pt_client *client;
+    int i;
+
+    if(strlen(host) >= sizeof(ep->host)){
+        LOG("endpoint host too long", __FUNCTION__, __FILE__, __LINE__);
+        return NULL;
+    }
+
+    ep = malloc(sizeof(struct pt_pool_endpoint));
+    pool->endpoints = realloc(pool->endpoints, sizeof(struct pt_pool_endpoint*) * (pool->number_of_endpoints + 1));
+
+    if(ep == NULL || pool->endpoints == NULL){
+        FATAL("malloc pt_pool_endpoint failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+
+    bzero(ep, sizeof(struct pt_pool_endpoint));
+
+    ep->pool = pool;
+    strcpy(ep->host, host);
+    ep->port = port;
+    ep->hash = pt_pool_hash_endpoint(host, port);
+    ep->conns = malloc(sizeof(struct pt_client*) * pool->conns_per_endpoint);
+
+    for(i = 0; i < pool->conns_per_endpoint; i++)
+    {
+        client = pt_client_new();
+        pt_client_init(pool->loop, client, pt_pool_on_connected, pt_pool_on_client_receive, pt_pool_on_disconnected);
+
+        if(pool->enable_encrypt){
+            pt_client_set_encrypt(client, pool->encrypt_key);
+        }
+
+        client->data = ep;
+        ep->conns[i] = client;
+    }
+
+    pool->endpoints[pool->number_of_endpoints++] = ep;
+
+    if(pool->is_startup){
+        for(i = 0; i < pool->conns_per_endpoint; i++)
+        {
+            pt_pool_connect(ep, ep->conns[i]);
+        }
+    }
+
+    return ep;
+}
+
+void pt_pool_start(struct pt_pool *pool)
+{
+    int i, j;
+
+    if(pool->is_startup) return;
+
+    pool->is_startup = true;
+
+    uv_timer_init(pool->loop, &pool->timer);
+    pool->timer.data = pool;
+    uv_timer_start(&pool->timer, pt_pool_timer_cb, PT_POOL_TIMER_INTERVAL, PT_POOL_TIMER_INTERVAL);
+
+    for(i = 0; i < pool->number_of_endpoints; i++)
+    {
+        for(j = 0; j < pool->conns_per_endpoint; j++)
+        {
+            pt_pool_connect(pool->endpoints[i], pool->endpoints[i]->conns[j]);
+        }
+    }
+}
+
+void pt_pool_close(struct pt_pool *pool)
+{
+    int i, j;
+
+    if(pool->is_startup == false) return;
+
+    pool->is_startup = false;
+
+    uv_close((uv_handle_t*)&pool->timer, NULL);
+
+    for(i = 0; i < pool->number_of_endpoints; i++)
+    {
+        for(j = 0; j < pool->conns_per_endpoint; j++)
+        {
+            pt_client_disconnect(pool->endpoints[i]->conns[j]);
+        }
+    }
+}
+
+/*
+ 在一个后端中选择未发送字节数最少的连接
+ */
+static struct pt_client *pt_pool_pick_endpoint(struct pt_pool *pool, struct pt_pool_endpoint *ep,
+                                               uint32_t start, size_t *queue_size)
+{
+    struct pt_client *best = NULL;
+    struct pt_client *client;
+    size_t size;
+    int i;
+
+    for(i = 0; i < pool->conns_per_endpoint; i++)
+    {
+        client = ep->conns[(start + i) % pool->conns_per_endpoint];
+
+        if(client->connected == false) continue;
+
+        size = pt_client_send_queue_size(client);
+
+        if(best == NULL || size < *queue_size){
+            best = client;
+            *queue_size = size;
+            if(size == 0) break;
+        }
+    }
+
+    return best;
+}
+
+struct pt_client *pt_pool_pick(struct pt_pool *pool)
+{
+    struct pt_client *best = NULL;
+    struct pt_client *client;
+    struct pt_pool_endpoint *ep;
+    size_t best_size = 0;
+    size_t size = 0;
+    uint32_t start = pool->cursor++;
+    int i;
+
+    for(i = 0; i < pool->number_of_endpoints; i++)
+    {
+        ep = pool->endpoints[(start + i) % pool->number_of_endpoints];
+
+        if(ep->healthy == false) continue;
+
+        client = pt_pool_pick_endpoint(pool, ep, start, &size);
+
+        if(client && (best == NULL || size < best_size)){
+            best = client;
+            best_size = size;
+            if(size == 0) break;
+        }
+    }
+
+    return best;
+}
+
+/*
+ 一致性哈希，环上只有可用的后端
+ */
+struct pt_client *pt_pool_pick_hash(struct pt_pool *pool, uint64_t key)
+{
+    struct pt_pool_endpoint *ep = pt_hashring_lookup(pool->ring, key);
+    struct pt_client *client;
+    uint32_t start;
+    int i;
+
+    if(ep == NULL) return NULL;
+
+    //同一个key在后端内固定使用一个连接，保证顺序
+    //这个连接断开时按固定的顺序使用下一个已连接的，不按队列长度选择，否则同一个key的数据会分散到不同的连接
+    start = (uint32_t)(key % pool->conns_per_endpoint);
+
+    for(i = 0; i < pool->conns_per_endpoint; i++)
+    {
+        client = ep->conns[(start + i) % pool->conns_per_endpoint];
+
+        if(client->connected) return client;
+    }
+
+    return NULL;
+}
+
+static qboolean pt_pool_send_to(struct pt_client *client, uint16_t id, const unsigned char *data, uint32_t length)
+{
+    struct pt_buffer *buff;
+    struct net_header hdr = pt_create_nethdr(id);
+
+    if(client == NULL) return false;
+
+    if(client->enable_encrypt){
+        buff = pt_create_encrypt_package(&client->encrypt_ctx, &client->serial, hdr, (unsigned char*)data, length);
+    } else {
+        buff = pt_create_package(hdr, (unsigned char*)data, length);
+    }
+
+    pt_client_send(client, buff);
+    return true;
+}
+
+qboolean pt_pool_send(struct pt_pool *pool, uint16_t id, const unsigned char *data, uint32_t length)
+{
+    return pt_pool_send_to(pt_pool_pick(pool), id, data, length);
+}
+
+qboolean pt_pool_send_hash(struct pt_pool *pool, uint64_t key, uint16_t id, const unsigned char *data, uint32_t length)
+{
+    return pt_pool_send_to(pt_pool_pick_hash(pool, key), id, data, length);
+}
@@ -0,0 +1,495 @@
+//
+//  pubsub.c
+//  xcode
+//
+//  服务器内的发布/订阅
+//
+
+#include "common.h"
+#include "error.h"
+#include "packet.h"
+#include "hashring.h"
+#include "pubsub.h"
+
+static void pt_pubsub_on_disconnect(struct pt_sclient *user, void *udata)
+{
+    pt_pubsub_unsubscribe_all(udata, user);
+}
+
+struct pt_pubsub *pt_pubsub_new(struct pt_server *server)
+{
+    struct pt_pubsub *pubsub = malloc(sizeof(struct pt_pubsub));
+
+    if(pubsub == NULL){
+        FATAL("malloc pt_pubsub failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+
+    bzero(pubsub, sizeof(struct pt_pubsub));
+
+    pubsub->server = server;
+    pubsub->topics = pt_table_new();
+    pubsub->members = pt_table_new();
+
+    pt_server_add_disconnect_hook(server, pt_pubsub_on_disconnect, pubsub);
+
+    return pubsub;
+}
+
+/*
+ 检查主题格式，'*'和'#'必须是完整的一段，'#'只能是最后一段
+ */
+static qboolean pt_pubsub_check_topic(const char *topic, uint32_t length, qboolean *wildcard)
+{
+    const char *p = topic;
+    const char *end = topic + length;
+    const char *seg;
+
+    *wildcard = false;
+
+    if(length == 0 || length > PT_PUBSUB_MAX_TOPIC) return false;
+
+    while(p <= end)
+    {
+        seg = memchr(p, '.', end - p);
+        if(seg == NULL) seg = end;
+
+        if(seg - p == 1 && (*p == '*' || *p == '#')){
+            if(*p == '#' && seg != end) return false;
+            *wildcard = true;
+        } else if(memchr(p, '*', seg - p) || memchr(p, '#', seg - p)){
+            return false;
+        }
+
+        p = seg + 1;
+    }
+
+    return true;
+}
+
+/*
+ pattern按'.'分段匹配topic
+ */
+static qboolean pt_pubsub_match(const char *pattern, uint32_t plen, const char *topic, uint32_t tlen)
+{
+    const char *p = pattern;
+    const char *pend = pattern + plen;
+    const char *t = topic;
+    const char *tend = topic + tlen;
+    const char *pseg;
+    const char *tseg;
+    qboolean topic_done = false;
+
+    for(;;)
+    {
+        pseg = memchr(p, '.', pend - p);
+        if(pseg == NULL) pseg = pend;
+
+        //剩余的任意段
+        if(pseg - p == 1 && *p == '#') return true;
+
+        if(topic_done) return false;
+
+        tseg = memchr(t, '.', tend - t);
+        if(tseg == NULL) tseg = tend;
+
+        if((pseg - p != 1 || *p != '*') && (pseg - p != tseg - t || memcmp(p, t, pseg - p) != 0)){
+            return false;
+        }
+
+        if(pseg == pend) return tseg == tend;
+
+        topic_done = tseg == tend;
+        p = pseg + 1;
+        t = tseg + 1;
+    }
+}
+
+static struct pt_pubsub_topic *pt_pubsub_find_topic(struct pt_pubsub *pubsub, const char *name, uint32_t length,
+                                                    uint64_t hash, qboolean wildcard)
+{
+    struct pt_pubsub_topic *topic;
+
+    topic = wildcard ? pubsub->wildcards : pt_table_find(pubsub->topics, hash);
+
+    for(; topic; topic = topic->next)
+    {
+        if(topic->length == length && memcmp(topic->name, name, length) == 0){
+            return topic;
+        }
+    }
+
+    return NULL;
+}
+
+static struct pt_pubsub_topic *pt_pubsub_topic_new(struct pt_pubsub *pubsub, const char *name, uint32_t length,
+                                                   uint64_t hash, qboolean wildcard)
+{
+    struct pt_pubsub_topic *topic = malloc(sizeof(struct pt_pubsub_topic));
+
+    if(topic == NULL){
+        FATAL("malloc pt_pubsub_topic failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+
+    bzero(topic, sizeof(struct pt_pubsub_topic));
+
+    topic->name = malloc(length + 1);
+    if(topic->name == NULL){
+        FATAL("malloc topic->name failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+    memcpy(topic->name, name, length);
+    topic->name[length] = 0;
+    topic->length = length;
+    topic->hash = hash;
+    topic->wildcard = wildcard;
+
+    if(wildcard){
+        topic->next = pubsub->wildcards;
+        pubsub->wildcards = topic;
+    } else {
+        //插入到冲突链表的头部
+        topic->next = pt_table_find(pubsub->topics, hash);
+        if(topic->next){
+            pt_table_erase(pubsub->topics, hash);
+        }
+        pt_table_insert(pubsub->topics, hash, topic);
+    }
+
+    pubsub->number_of_topics++;
+
+    return topic;
+}
+
+static void pt_pubsub_topic_free(struct pt_pubsub *pubsub, struct pt_pubsub_topic *topic)
+{
+    struct pt_pubsub_topic **curr;
+    struct pt_pubsub_topic *head = NULL;
+
+    if(topic->wildcard){
+        curr = &pubsub->wildcards;
+    } else {
+        head = pt_table_find(pubsub->topics, topic->hash);
+        curr = &head;
+    }
+
+    while(*curr && *curr != topic){
+        curr = &(*curr)->next;
+    }
+    if(*curr){
+        *curr = topic->next;
+    }
+
+    //冲突链表的头部改变
+    if(topic->wildcard == false){
+        pt_table_erase(pubsub->topics, topic->hash);
+        if(head){
+            pt_table_insert(pubsub->topics, topic->hash, head);
+        }
+    }
+
+    pubsub->number_of_topics--;
+
+    free(topic->subs);
+    free(topic->name);
+    free(topic);
+}
+
+static struct pt_pubsub_member *pt_pubsub_member_get(struct pt_pubsub *pubsub, struct pt_sclient *user)
+{
+    struct pt_pubsub_member *member = pt_table_find(pubsub->members, user->id);
+
+    if(member) return member;
+
+    member = malloc(sizeof(struct pt_pubsub_member));
+    if(member == NULL){
+        FATAL("malloc pt_pubsub_member failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+
+    bzero(member, sizeof(struct pt_pubsub_member));
+
+    member->user = user;
+    member->next = pubsub->member_head;
+    if(pubsub->member_head){
+        pubsub->member_head->prev = member;
+    }
+    pubsub->member_head = member;
+
+    pt_table_insert(pubsub->members, user->id, member);
+
+    return member;
+}
+
+static void pt_pubsub_member_free(struct pt_pubsub *pubsub, struct pt_pubsub_member *member)
+{
+    pt_table_erase(pubsub->members, member->user->id);
+
+    if(member->prev){
+        member->prev->next = member->next;
+    } else {
+        pubsub->member_head = member->next;
+    }
+    if(member->next){
+        member->next->prev = member->prev;
+    }
+
+    free(member->links);
+    free(member);
+}
+
+/*
+ 删除连接的第index个订阅，两边的数组都用最后一个元素填补空位
+ 主题没有订阅者或者连接没有订阅时释放
+ */
+static void pt_pubsub_remove_link(struct pt_pubsub *pubsub, struct pt_pubsub_member *member, uint32_t index)
+{
+    struct pt_pubsub_topic *topic = member->links[index].topic;
+    uint32_t slot = member->links[index].slot;
+    struct pt_pubsub_sub *last_sub;
+    struct pt_pubsub_link *last_link;
+
+    topic->number_of_subs--;
+    if(slot != topic->number_of_subs){
+        last_sub = &topic->subs[topic->number_of_subs];
+        topic->subs[slot] = *last_sub;
+        last_sub->member->links[last_sub->slot].slot = slot;
+    }
+
+    member->number_of_links--;
+    if(index != member->number_of_links){
+        last_link = &member->links[member->number_of_links];
+        member->links[index] = *last_link;
+        last_link->topic->subs[last_link->slot].slot = index;
+    }
+
+    if(topic->number_of_subs == 0){
+        pt_pubsub_topic_free(pubsub, topic);
+    }
+
+    if(member->number_of_links == 0){
+        pt_pubsub_member_free(pubsub, member);
+    }
+}
+
+qboolean pt_pubsub_subscribe(struct pt_pubsub *pubsub, struct pt_sclient *user, const char *name)
+{
+    uint32_t length = (uint32_t)strlen(name);
+    struct pt_pubsub_member *member;
+    struct pt_pubsub_topic *topic;
+    struct pt_pubsub_sub *sub;
+    struct pt_pubsub_link *link;
+    qboolean wildcard;
+    uint64_t hash;
+    uint32_t i;
+
+    if(user->connected == false || pt_pubsub_check_topic(name, length, &wildcard) == false) return false;
+
+    hash = pt_hashring_hash(name, length);
+    topic = pt_pubsub_find_topic(pubsub, name, length, hash, wildcard);
+    member = pt_pubsub_member_get(pubsub, user);
+
+    if(topic){
+        for(i = 0; i < member->number_of_links; i++)
+        {
+            if(member->links[i].topic == topic) return false;
+        }
+    } else {
+        topic = pt_pubsub_topic_new(pubsub, name, length, hash, wildcard);
+    }
+
+    if(topic->number_of_subs == topic->max_subs){
+        topic->max_subs = topic->max_subs ? topic->max_subs * 2 : 4;
+        topic->subs = realloc(topic->subs, sizeof(struct pt_pubsub_sub) * topic->max_subs);
+        if(topic->subs == NULL){
+            FATAL("realloc topic->subs failed", __FUNCTION__, __FILE__, __LINE__);
+            abort();
+        }
+    }
+
+    if(member->number_of_links == member->max_links){
+        member->max_links = member->max_links ? member->max_links * 2 : 4;
+        member->links = realloc(member->links, sizeof(struct pt_pubsub_link) * member->max_links);
+        if(member->links == NULL){
+            FATAL("realloc member->links failed", __FUNCTION__, __FILE__, __LINE__);
+            abort();
+        }
+    }
+
+    sub = &topic->subs[topic->number_of_subs];
+    sub->user = user;
+    sub->member = member;
+    sub->slot = member->number_of_links;
+
+    link = &member->links[member->number_of_links];
+    link->topic = topic;
+    link->slot = topic->number_of_subs;
+
+    topic->number_of_subs++;
+    member->number_of_links++;
+
+    return true;
+}
+
+qboolean pt_pubsub_unsubscribe(struct pt_pubsub *pubsub, struct pt_sclient *user, const char *name)
+{
+    uint32_t length = (uint32_t)strlen(name);
+    struct pt_pubsub_member *member = pt_table_find(pubsub->members, user->id);
+    struct pt_pubsub_topic *topic;
+    qboolean wildcard;
+    uint32_t i;
+
+    if(member == NULL || pt_pubsub_check_topic(name, length, &wildcard) == false) return false;
+
+    topic = pt_pubsub_find_topic(pubsub, name, length, pt_hashring_hash(name, length), wildcard);
+    if(topic == NULL) return false;
+
+    for(i = 0; i < member->number_of_links; i++)
+    {
+        if(member->links[i].topic == topic){
+            pt_pubsub_remove_link(pubsub, member, i);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ 从最后一个开始删除，不需要移动其他订阅，最后一个删除后member被释放
+ */
+static void pt_pubsub_member_clear(struct pt_pubsub *pubsub, struct pt_pubsub_member *member)
+{
+    uint32_t i;
+
+    for(i = member->number_of_links; i > 0; i--)
+    {
+        pt_pubsub_remove_link(pubsub, member, i - 1);
+    }
+}
+
+void pt_pubsub_unsubscribe_all(struct pt_pubsub *pubsub, struct pt_sclient *user)
+{
+    struct pt_pubsub_member *member = pt_table_find(pubsub->members, user->id);
+
+    if(member == NULL) return;
+
+    //发布中发送失败导致的断开，发布完成后再删除，避免修改正在遍历的数组
+    if(pubsub->publishing){
+        if(pubsub->number_of_deferred == pubsub->max_deferred){
+            pubsub->max_deferred = pubsub->max_deferred ? pubsub->max_deferred * 2 : 16;
+            pubsub->deferred = realloc(pubsub->deferred, sizeof(struct pt_sclient*) * pubsub->max_deferred);
+            if(pubsub->deferred == NULL){
+                FATAL("realloc pubsub->deferred failed", __FUNCTION__, __FILE__, __LINE__);
+                abort();
+            }
+        }
+        pubsub->deferred[pubsub->number_of_deferred++] = user;
+        return;
+    }
+
+    pt_pubsub_member_clear(pubsub, member);
+}
+
+/*
+ 发送给一个主题的所有订阅者，本次发布已经投递过的连接跳过
+ */
+static uint32_t pt_pubsub_deliver(struct pt_pubsub *pubsub, struct pt_pubsub_topic *topic, struct pt_buffer *packet,
+                                  uint16_t id, uint32_t length)
+{
+    struct pt_pubsub_sub *sub;
+    uint32_t count = 0;
+    uint32_t i;
+
+    for(i = 0; i < topic->number_of_subs; i++)
+    {
+        sub = &topic->subs[i];
+
+        if(sub->member->generation == pubsub->generation) continue;
+        sub->member->generation = pubsub->generation;
+
+        if(sub->user->connected == false) continue;
+
+        //net_header之后的数据直接引用共享的数据包
+        if(pt_server_send_wrapped(sub->user, id, NULL, 0, pt_buffer_ref(packet), sizeof(struct net_header), length)){
+            count++;
+        }
+    }
+
+    return count;
+}
+
+uint32_t pt_pubsub_publish_packet(struct pt_pubsub *pubsub, const char *name, struct pt_buffer *packet)
+{
+    uint32_t length = (uint32_t)strlen(name);
+    struct pt_pubsub_topic *topic;
+    qboolean wildcard;
+    uint16_t id = ((struct net_header*)packet->buff)->id;
+    uint32_t count = 0;
+    uint32_t i;
+
+    if(pt_pubsub_check_topic(name, length, &wildcard) == false || wildcard){
+        LOG("invalid publish topic", __FUNCTION__, __FILE__, __LINE__);
+        pt_buffer_free(packet);
+        return 0;
+    }
+
+    pubsub->generation++;
+    pubsub->publishing++;
+
+    topic = pt_pubsub_find_topic(pubsub, name, length, pt_hashring_hash(name, length), false);
+    if(topic){
+        count += pt_pubsub_deliver(pubsub, topic, packet, id, packet->length - sizeof(struct net_header));
+    }
+
+    for(topic = pubsub->wildcards; topic; topic = topic->next)
+    {
+        if(pt_pubsub_match(topic->name, topic->length, name, length)){
+            count += pt_pubsub_deliver(pubsub, topic, packet, id, packet->length - sizeof(struct net_header));
+        }
+    }
+
+    pubsub->publishing--;
+    pubsub->number_of_deliveries += count;
+
+    //释放自己的引用，发送队列中的引用在写入完成后释放
+    pt_buffer_free(packet);
+
+    if(pubsub->publishing == 0 && pubsub->number_of_deferred){
+        for(i = 0; i < pubsub->number_of_deferred; i++)
+        {
+            pt_pubsub_unsubscribe_all(pubsub, pubsub->deferred[i]);
+        }
+        pubsub->number_of_deferred = 0;
+    }
+
+    return count;
+}
+
+uint32_t pt_pubsub_publish(struct pt_pubsub *pubsub, const char *topic, uint16_t id, const unsigned char *data, uint32_t length)
+{
+    struct net_header hdr = pt_create_nethdr(id);
+    struct pt_buffer *packet = pt_buffer_new(sizeof(hdr) + length);
+
+    pt_buffer_write(packet, (unsigned char*)&hdr, sizeof(hdr));
+    pt_buffer_write(packet, data, length);
+    ((struct net_header*)packet->buff)->length = packet->length;
+
+    return pt_pubsub_publish_packet(pubsub, topic, packet);
+}
+
+void pt_pubsub_free(struct pt_pubsub *pubsub)
+{
+    pt_server_remove_disconnect_hook(pubsub->server, pt_pubsub_on_disconnect, pubsub);
+
+    while(pubsub->member_head)
+    {
+        pt_pubsub_member_clear(pubsub, pubsub->member_head);
+    }
+
+    pt_table_free(pubsub->topics);
+    pt_table_free(pubsub->members);
+    free(pubsub->deferred);
+    free(pubsub);
+}
@@ -0,0 +1,98 @@
+//
+//  ratelimit.c
+//  xcode
+//
+//  令牌桶限速
+//
+
+#include "common.h"
+#include "error.h"
+#include "packet.h"
+#include "ratelimit.h"
+
+void pt_token_bucket_init(struct pt_token_bucket *bucket, uint32_t rate, uint32_t burst, uint64_t now)
+{
+    bucket->rate = rate;
+    bucket->burst = (uint64_t)burst * PT_TOKEN_SCALE;
+    bucket->tokens = bucket->burst;
+    bucket->last = now;
+}
+
+qboolean pt_token_bucket_check(struct pt_token_bucket *bucket, uint32_t count, uint64_t now)
+{
+    if(bucket->rate == 0) return true;
+    
+    //每毫秒补充rate / 1000个令牌，按千分之一保存正好是rate
+    if(now > bucket->last){
+        bucket->tokens += (now - bucket->last) * bucket->rate;
+        if(bucket->tokens > bucket->burst){
+            bucket->tokens = bucket->burst;
+        }
+        bucket->last = now;
+    }
+    
+    return bucket->tokens >= (uint64_t)count * PT_TOKEN_SCALE;
+}
+
+void pt_token_bucket_take(struct pt_token_bucket *bucket, uint32_t count)
+{
+    if(bucket->rate == 0) return;
+    
+    bucket->tokens -= (uint64_t)count * PT_TOKEN_SCALE;
+}
+
+uint64_t pt_token_bucket_wait(struct pt_token_bucket *bucket, uint32_t count)
+{
+    uint64_t need = (uint64_t)count * PT_TOKEN_SCALE;
+    
+    if(bucket->rate == 0 || bucket->tokens >= need) return 0;
+    
+    return (need - bucket->tokens + bucket->rate - 1) / bucket->rate;
+}
+
+void pt_rate_limit_init(struct pt_rate_limit *limit, const struct pt_rate_rule *rule, uint64_t now)
+{
+    uint32_t burst = rule->bps > pt_max_pack_size ? rule->bps : pt_max_pack_size;
+    
+    pt_token_bucket_init(&limit->packets, rule->pps, rule->pps, now);
+    pt_token_bucket_init(&limit->bytes, rule->bps, burst, now);
+}
+
+int pt_rate_limit_check(const struct pt_rate_rule *rules, struct pt_rate_limit *limits, uint32_t count,
+                        uint16_t id, uint32_t length, uint64_t now, uint64_t *wait)
+{
+    int policy = PT_RATE_PASS;
+    uint64_t t;
+    uint32_t i;
+    
+    *wait = 0;
+    
+    for(i = 0; i < count; i++)
+    {
+        if(id < rules[i].id_min || id > rules[i].id_max) continue;
+        
+        if(pt_token_bucket_check(&limits[i].packets, 1, now) == false){
+            t = pt_token_bucket_wait(&limits[i].packets, 1);
+            if(t > *wait) *wait = t;
+            if(rules[i].policy > policy) policy = rules[i].policy;
+        }
+        
+        if(pt_token_bucket_check(&limits[i].bytes, length, now) == false){
+            t = pt_token_bucket_wait(&limits[i].bytes, length);
+            if(t > *wait) *wait = t;
+            if(rules[i].policy > policy) policy = rules[i].policy;
+        }
+    }
+    
+    if(policy != PT_RATE_PASS) return policy;
+    
+    for(i = 0; i < count; i++)
+    {
+        if(id < rules[i].id_min || id > rules[i].id_max) continue;
+        
+        pt_token_bucket_take(&limits[i].packets, 1);
+        pt_token_bucket_take(&limits[i].bytes, length);
+    }
+    
+    return PT_RATE_PASS;
+}
@@ -0,0 +1,278 @@
+//
+//  respcache.c
+//  xcode
+//
+//  幂等请求的响应缓存
+//
+
+#include "common.h"
+#include "error.h"
+#include "packet.h"
+#include "hashring.h"
+#include "respcache.h"
+
+struct pt_respcache *pt_respcache_new(uv_loop_t *loop, uint32_t ttl, uint64_t max_size)
+{
+    struct pt_respcache *cache = malloc(sizeof(struct pt_respcache));
+
+    if(cache == NULL){
+        FATAL("malloc pt_respcache failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+
+    bzero(cache, sizeof(struct pt_respcache));
+
+    cache->loop = loop;
+    cache->entries = pt_table_new();
+    cache->ttl = ttl ? ttl : PT_RESPCACHE_TTL;
+    cache->max_size = max_size ? max_size : PT_RESPCACHE_MAX_SIZE;
+
+    return cache;
+}
+
+void pt_respcache_free(struct pt_respcache *cache)
+{
+    pt_respcache_clear(cache);
+
+    pt_table_free(cache->entries);
+    free(cache);
+}
+
+/*
+ 请求的数据，服务器解密后的数据以包序列开头，每个包都不同，不能作为key
+ */
+static void pt_respcache_payload(struct pt_sclient *user, struct pt_buffer *request, const unsigned char **data, uint32_t *length)
+{
+    *data = pt_get_packet_buffer(request);
+    *length = pt_get_packet_size(request);
+
+    if(user->server->enable_encrypt && *length >= sizeof(uint32_t)){
+        *data += sizeof(uint32_t);
+        *length -= sizeof(uint32_t);
+    }
+}
+
+static uint64_t pt_respcache_hash(uint16_t id, const unsigned char *data, uint32_t length)
+{
+    return pt_hashring_mix(pt_hashring_hash(data, length) ^ id);
+}
+
+static struct pt_respcache_entry *pt_respcache_find(struct pt_respcache *cache, uint64_t hash, uint16_t id,
+                                                    const unsigned char *data, uint32_t length)
+{
+    struct pt_respcache_entry *entry;
+
+    for(entry = pt_table_find(cache->entries, hash); entry; entry = entry->next)
+    {
+        if(entry->id == id && entry->request_length == length && memcmp(entry->request, data, length) == 0){
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+static void pt_respcache_lru_unlink(struct pt_respcache *cache, struct pt_respcache_entry *entry)
+{
+    if(entry->lru_prev){
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        cache->lru_head = entry->lru_next;
+    }
+    if(entry->lru_next){
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        cache->lru_tail = entry->lru_prev;
+    }
+}
+
+static void pt_respcache_lru_push(struct pt_respcache *cache, struct pt_respcache_entry *entry)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = cache->lru_head;
+    if(cache->lru_head){
+        cache->lru_head->lru_prev = entry;
+    } else {
+        cache->lru_tail = entry;
+    }
+    cache->lru_head = entry;
+}
+
+static void pt_respcache_remove(struct pt_respcache *cache, struct pt_respcache_entry *entry)
+{
+    struct pt_respcache_entry *head = pt_table_find(cache->entries, entry->hash);
+    struct pt_respcache_entry **curr = &head;
+
+    while(*curr && *curr != entry){
+        curr = &(*curr)->next;
+    }
+    if(*curr){
+        *curr = entry->next;
+    }
+
+    //冲突链表的头部改变
+    pt_table_erase(cache->entries, entry->hash);
+    if(head){
+        pt_table_insert(cache->entries, entry->hash, head);
+    }
+
+    pt_respcache_lru_unlink(cache, entry);
+
+    cache->size -= entry->size;
+    cache->number_of_entries--;
+
+    pt_buffer_free(entry->response);
+    free(entry->request);
+    free(entry);
+}
+
+/*
+ 缓存的响应加入发送队列，net_header之后的数据直接引用共享的数据包
+ */
+static qboolean pt_respcache_queue(struct pt_sclient *user, struct pt_buffer *response)
+{
+    uint16_t id = ((struct net_header*)response->buff)->id;
+
+    return pt_server_send_wrapped(user, id, NULL, 0, pt_buffer_ref(response),
+                                  sizeof(struct net_header), response->length - sizeof(struct net_header));
+}
+
+qboolean pt_respcache_reply(struct pt_respcache *cache, struct pt_sclient *user, struct pt_buffer *request)
+{
+    uint16_t id = ((struct net_header*)request->buff)->id;
+    struct pt_respcache_entry *entry;
+    const unsigned char *data;
+    uint32_t length;
+    uint64_t hash;
+
+    if((cache->ids[id >> 3] & (1 << (id & 7))) == 0) return false;
+
+    pt_respcache_payload(user, request, &data, &length);
+    hash = pt_respcache_hash(id, data, length);
+
+    entry = pt_respcache_find(cache, hash, id, data, length);
+    if(entry == NULL){
+        cache->number_of_misses++;
+        return false;
+    }
+
+    if(entry->expire <= uv_now(cache->loop)){
+        pt_respcache_remove(cache, entry);
+        cache->number_of_misses++;
+        return false;
+    }
+
+    pt_respcache_lru_unlink(cache, entry);
+    pt_respcache_lru_push(cache, entry);
+
+    cache->number_of_hits++;
+
+    //发送失败时连接已经断开，请求同样不需要处理
+    pt_respcache_queue(user, entry->response);
+
+    return true;
+}
+
+qboolean pt_respcache_send_packet(struct pt_respcache *cache, struct pt_sclient *user, struct pt_buffer *request,
+                                  struct pt_buffer *packet)
+{
+    uint16_t id = ((struct net_header*)request->buff)->id;
+    struct pt_respcache_entry *entry;
+    const unsigned char *data;
+    uint32_t length;
+    uint64_t hash;
+    uint32_t size;
+
+    pt_respcache_payload(user, request, &data, &length);
+    hash = pt_respcache_hash(id, data, length);
+
+    //相同的请求替换之前的响应
+    entry = pt_respcache_find(cache, hash, id, data, length);
+    if(entry){
+        pt_respcache_remove(cache, entry);
+    }
+
+    size = sizeof(struct pt_respcache_entry) + length + packet->length;
+
+    //超过上限的响应只发送不缓存
+    if(size > cache->max_size){
+        return pt_server_send(user, packet);
+    }
+
+    entry = malloc(sizeof(struct pt_respcache_entry));
+    if(entry == NULL){
+        FATAL("malloc pt_respcache_entry failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+
+    bzero(entry, sizeof(struct pt_respcache_entry));
+
+    entry->request = malloc(length ? length : 1);
+    if(entry->request == NULL){
+        FATAL("malloc entry->request failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+    memcpy(entry->request, data, length);
+    entry->request_length = length;
+    entry->hash = hash;
+    entry->id = id;
+    entry->response = packet;
+    entry->expire = uv_now(cache->loop) + cache->ttl;
+    entry->size = size;
+
+    //插入到冲突链表的头部
+    entry->next = pt_table_find(cache->entries, hash);
+    if(entry->next){
+        pt_table_erase(cache->entries, hash);
+    }
+    pt_table_insert(cache->entries, hash, entry);
+
+    pt_respcache_lru_push(cache, entry);
+    cache->size += size;
+    cache->number_of_entries++;
+    cache->ids[id >> 3] |= 1 << (id & 7);
+
+    while(cache->size > cache->max_size && cache->lru_tail != entry)
+    {
+        pt_respcache_remove(cache, cache->lru_tail);
+        cache->number_of_evictions++;
+    }
+
+    return pt_respcache_queue(user, packet);
+}
+
+qboolean pt_respcache_send(struct pt_respcache *cache, struct pt_sclient *user, struct pt_buffer *request,
+                           uint16_t id, const unsigned char *data, uint32_t length)
+{
+    struct net_header hdr = pt_create_nethdr(id);
+    struct pt_buffer *packet = pt_buffer_new(sizeof(hdr) + length);
+
+    pt_buffer_write(packet, (unsigned char*)&hdr, sizeof(hdr));
+    pt_buffer_write(packet, data, length);
+    ((struct net_header*)packet->buff)->length = packet->length;
+
+    return pt_respcache_send_packet(cache, user, request, packet);
+}
+
+void pt_respcache_invalidate(struct pt_respcache *cache, uint16_t id)
+{
+    struct pt_respcache_entry *entry = cache->lru_head;
+    struct pt_respcache_entry *next;
+
+    while(entry)
+    {
+        next = entry->lru_next;
+        if(entry->id == id){
+            pt_respcache_remove(cache, entry);
+        }
+        entry = next;
+    }
+}
+
+void pt_respcache_clear(struct pt_respcache *cache)
+{
+    while(cache->lru_head)
+    {
+        pt_respcache_remove(cache, cache->lru_head);
+    }
+}
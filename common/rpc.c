@@ -0,0 +1,329 @@
+//
+//  rpc.c
+//  xcode
+//
+//  基于pt_client的请求/回复
+//
+
+#include "common.h"
+#include "error.h"
+#include "rpc.h"
+
+#define PT_RPC_HEAP_PARENT(i) (((i) - 1) / 2)
+
+static void pt_rpc_heap_swap(struct pt_rpc *rpc, uint32_t a, uint32_t b)
+{
+    struct pt_rpc_request *t = rpc->heap[a];
+
+    rpc->heap[a] = rpc->heap[b];
+    rpc->heap[b] = t;
+
+    rpc->heap[a]->heap_index = a;
+    rpc->heap[b]->heap_index = b;
+}
+
+static void pt_rpc_heap_up(struct pt_rpc *rpc, uint32_t i)
+{
+    while(i > 0 && rpc->heap[i]->deadline < rpc->heap[PT_RPC_HEAP_PARENT(i)]->deadline)
+    {
+        pt_rpc_heap_swap(rpc, i, PT_RPC_HEAP_PARENT(i));
+        i = PT_RPC_HEAP_PARENT(i);
+    }
+}
+
+static void pt_rpc_heap_down(struct pt_rpc *rpc, uint32_t i)
+{
+    uint32_t l, r, min;
+
+    for(;;)
+    {
+        l = i * 2 + 1;
+        r = l + 1;
+        min = i;
+
+        if(l < rpc->heap_size && rpc->heap[l]->deadline < rpc->heap[min]->deadline) min = l;
+        if(r < rpc->heap_size && rpc->heap[r]->deadline < rpc->heap[min]->deadline) min = r;
+        if(min == i) return;
+
+        pt_rpc_heap_swap(rpc, i, min);
+        i = min;
+    }
+}
+
+static void pt_rpc_heap_push(struct pt_rpc *rpc, struct pt_rpc_request *req)
+{
+    if(rpc->heap_size == rpc->heap_max){
+        rpc->heap_max = rpc->heap_max ? rpc->heap_max * 2 : 64;
+        rpc->heap = realloc(rpc->heap, sizeof(struct pt_rpc_request*) * rpc->heap_max);
+        if(rpc->heap == NULL){
+            FATAL("realloc rpc->heap failed", __FUNCTION__, __FILE__, __LINE__);
+            abort();
+        }
+    }
+
+    req->heap_index = rpc->heap_size;
+    rpc->heap[rpc->heap_size++] = req;
+    pt_rpc_heap_up(rpc, req->heap_index);
+}
+
+static void pt_rpc_heap_remove(struct pt_rpc *rpc, struct pt_rpc_request *req)
+{
+    uint32_t i = req->heap_index;
+
+    rpc->heap_size--;
+    if(i == rpc->heap_size) return;
+
+    rpc->heap[i] = rpc->heap[rpc->heap_size];
+    rpc->heap[i]->heap_index = i;
+
+    pt_rpc_heap_down(rpc, i);
+    pt_rpc_heap_up(rpc, i);
+}
+
+static void pt_rpc_timer_cb(uv_timer_t* handle);
+
+/*
+ 堆顶改变后重新设置定时器
+ */
+static void pt_rpc_update_timer(struct pt_rpc *rpc)
+{
+    uint64_t now, due;
+
+    if(rpc->heap_size == 0){
+        if(rpc->timer_due){
+            uv_timer_stop(&rpc->timer);
+            rpc->timer_due = 0;
+        }
+        return;
+    }
+
+    due = rpc->heap[0]->deadline;
+    if(due == rpc->timer_due) return;
+
+    now = uv_now(rpc->client->loop);
+    rpc->timer_due = due;
+    uv_timer_start(&rpc->timer, pt_rpc_timer_cb, due > now ? due - now : 0, 0);
+}
+
+/*
+ 从等待表和堆中删除请求，执行回调并释放
+ */
+static void pt_rpc_complete(struct pt_rpc *rpc, struct pt_rpc_request *req, int status,
+                            const unsigned char *data, uint32_t length)
+{
+    pt_table_erase(rpc->pending, req->id);
+    pt_rpc_heap_remove(rpc, req);
+
+    if(req->cb){
+        req->cb(req, status, data, length);
+    }
+
+    free(req);
+}
+
+static void pt_rpc_timer_cb(uv_timer_t* handle)
+{
+    struct pt_rpc *rpc = handle->data;
+    uint64_t now = uv_now(rpc->client->loop);
+
+    rpc->timer_due = 0;
+
+    while(rpc->heap_size > 0 && rpc->heap[0]->deadline <= now)
+    {
+        pt_rpc_complete(rpc, rpc->heap[0], PT_RPC_TIMEOUT, NULL, 0);
+    }
+
+    pt_rpc_update_timer(rpc);
+}
+
+static void pt_rpc_close_cb(uv_handle_t* handle)
+{
+    struct pt_rpc *rpc = handle->data;
+
+    pt_table_free(rpc->pending);
+    free(rpc->heap);
+    free(rpc);
+}
+
+struct pt_rpc *pt_rpc_new(struct pt_client *client)
+{
+    struct pt_rpc *rpc = malloc(sizeof(struct pt_rpc));
+
+    if(rpc == NULL){
+        FATAL("malloc pt_rpc failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+
+    bzero(rpc, sizeof(struct pt_rpc));
+
+    rpc->client = client;
+    rpc->next_id = 1;
+    rpc->pending = pt_table_new();
+    rpc->default_timeout = PT_RPC_DEFAULT_TIMEOUT;
+
+    uv_timer_init(client->loop, &rpc->timer);
+    rpc->timer.data = rpc;
+
+    client->rpc = rpc;
+
+    return rpc;
+}
+
+void pt_rpc_free(struct pt_rpc *rpc)
+{
+    pt_rpc_on_disconnect(rpc);
+
+    if(rpc->client->rpc == rpc){
+        rpc->client->rpc = NULL;
+    }
+
+    uv_close((uv_handle_t*)&rpc->timer, pt_rpc_close_cb);
+}
+
+uint32_t pt_rpc_call(struct pt_rpc *rpc, uint16_t method, const unsigned char *data, uint32_t length,
+                     uint32_t timeout, pt_rpc_callback cb, void *udata)
+{
+    struct pt_client *client = rpc->client;
+    struct pt_rpc_request *req;
+    struct pt_buffer *buff;
+    struct net_header hdr = pt_create_nethdr(ID_RESERVE_RPC_REQUEST);
+    struct rpc_header rhdr;
+    uint32_t serial = 0;
+
+    if(client->connected == false) return 0;
+
+    req = malloc(sizeof(struct pt_rpc_request));
+    if(req == NULL){
+        FATAL("malloc pt_rpc_request failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+
+    //跳过0和仍在等待中的ID
+    do {
+        req->id = rpc->next_id++;
+    } while(req->id == 0 || pt_table_find(rpc->pending, req->id));
+
+    req->rpc = rpc;
+    req->method = method;
+    req->deadline = uv_now(client->loop) + (timeout ? timeout : rpc->default_timeout);
+    req->cb = cb;
+    req->data = udata;
+
+    rhdr.request_id = req->id;
+    rhdr.method = method;
+    rhdr.status = 0;
+
+    //直接组包，避免参数再复制一次
+    buff = pt_buffer_new(sizeof(hdr) + sizeof(serial) + sizeof(rhdr) + length);
+    pt_buffer_write(buff, (unsigned char*)&hdr, sizeof(hdr));
+    if(client->enable_encrypt){
+        pt_buffer_write(buff, (unsigned char*)&serial, sizeof(serial));
+    }
+    pt_buffer_write(buff, (unsigned char*)&rhdr, sizeof(rhdr));
+    pt_buffer_write(buff, data, length);
+
+    if(client->enable_encrypt){
+        pt_encrypt_package(&client->encrypt_ctx, &client->serial, buff);
+    } else {
+        ((struct net_header*)buff->buff)->length = buff->length;
+    }
+
+    pt_table_insert(rpc->pending, req->id, req);
+    pt_rpc_heap_push(rpc, req);
+    pt_rpc_update_timer(rpc);
+
+    pt_client_send(client, buff);
+
+    return rhdr.request_id;
+}
+
+qboolean pt_rpc_cancel(struct pt_rpc *rpc, uint32_t request_id)
+{
+    struct pt_rpc_request *req = pt_table_find(rpc->pending, request_id);
+
+    if(req == NULL) return false;
+
+    pt_rpc_complete(rpc, req, PT_RPC_DISCONNECTED, NULL, 0);
+    pt_rpc_update_timer(rpc);
+    return true;
+}
+
+uint32_t pt_rpc_pending_count(struct pt_rpc *rpc)
+{
+    return rpc->heap_size;
+}
+
+void pt_rpc_on_response(struct pt_rpc *rpc, struct pt_buffer *buff)
+{
+    struct rpc_header rhdr;
+    struct pt_rpc_request *req;
+    uint32_t length = pt_get_packet_size(buff);
+
+    if(length < sizeof(rhdr)){
+        DBGPRINT("rpc response too small");
+        return;
+    }
+
+    memcpy(&rhdr, pt_get_packet_buffer(buff), sizeof(rhdr));
+
+    //已经超时或者取消的请求
+    req = pt_table_find(rpc->pending, rhdr.request_id);
+    if(req == NULL) return;
+
+    pt_rpc_complete(rpc, req, rhdr.status, pt_get_packet_buffer(buff) + sizeof(rhdr), length - sizeof(rhdr));
+    pt_rpc_update_timer(rpc);
+}
+
+void pt_rpc_on_disconnect(struct pt_rpc *rpc)
+{
+    while(rpc->heap_size > 0)
+    {
+        pt_rpc_complete(rpc, rpc->heap[0], PT_RPC_DISCONNECTED, NULL, 0);
+    }
+
+    pt_rpc_update_timer(rpc);
+}
+
+qboolean pt_rpc_read_request(struct pt_sclient *user, struct pt_buffer *buff, struct rpc_header *hdr,
+                             const unsigned char **data, uint32_t *length)
+{
+    const unsigned char *p = pt_get_packet_buffer(buff);
+    uint32_t size = pt_get_packet_size(buff);
+
+    //解密后的数据以包序列开头
+    if(user->server->enable_encrypt){
+        if(size < sizeof(uint32_t)) return false;
+        p += sizeof(uint32_t);
+        size -= sizeof(uint32_t);
+    }
+
+    if(size < sizeof(struct rpc_header)) return false;
+
+    memcpy(hdr, p, sizeof(struct rpc_header));
+
+    *data = p + sizeof(struct rpc_header);
+    *length = size - sizeof(struct rpc_header);
+
+    return true;
+}
+
+qboolean pt_rpc_reply(struct pt_sclient *user, const struct rpc_header *request, uint16_t status,
+                      const unsigned char *data, uint32_t length)
+{
+    struct pt_buffer *buff;
+    struct net_header hdr = pt_create_nethdr(ID_RESERVE_RPC_RESPONSE);
+    struct rpc_header rhdr;
+
+    rhdr.request_id = request->request_id;
+    rhdr.method = request->method;
+    rhdr.status = status;
+
+    buff = pt_buffer_new(sizeof(hdr) + sizeof(rhdr) + length);
+    pt_buffer_write(buff, (unsigned char*)&hdr, sizeof(hdr));
+    pt_buffer_write(buff, (unsigned char*)&rhdr, sizeof(rhdr));
+    pt_buffer_write(buff, data, length);
+
+    ((struct net_header*)buff->buff)->length = buff->length;
+
+    return pt_server_send(user, buff);
+}
@@ -0,0 +1,808 @@
+//
+//  rudp.c
+//  xcode
+//
+//  基于UDP的可靠传输
+//
+//  可靠通道：消息按MSS分片，每个分片一个序列号
+//           字节流模式不保留消息边界，窗口满时新数据合并到等待发送的数据段中
+//           接收端每次回复累计确认(una)和后面32个包的选择确认(sack)
+//           发送端收到更新的确认PT_RUDP_FASTACK次后快速重传，否则按rto超时重传
+//           拥塞窗口：慢启动，拥塞避免线性增长，快速重传减半，超时降为1
+//  不可靠通道：不分片不重传，接收端只接受比上一个更新的序列
+//
+
+#include "common.h"
+#include "error.h"
+#include "buffer.h"
+#include "rudp.h"
+
+#define PT_RUDP_SEQ_DIFF(a, b) ((int32_t)((a) - (b)))
+
+static struct pt_rudp_seg *pt_rudp_seg_new(uint32_t length)
+{
+    struct pt_rudp_seg *seg = malloc(sizeof(struct pt_rudp_seg) + length);
+
+    if(seg == NULL){
+        FATAL("malloc pt_rudp_seg failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+
+    bzero(seg, sizeof(struct pt_rudp_seg));
+    seg->len = length;
+
+    return seg;
+}
+
+/*
+ 改变链表中数据段的大小，返回新的地址
+ */
+static struct pt_rudp_seg *pt_rudp_seg_resize(struct pt_rudp_list *list, struct pt_rudp_seg *seg, uint32_t length)
+{
+    seg = realloc(seg, sizeof(struct pt_rudp_seg) + length);
+
+    if(seg == NULL){
+        FATAL("realloc pt_rudp_seg failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+
+    if(seg->prev){
+        seg->prev->next = seg;
+    } else {
+        list->head = seg;
+    }
+
+    if(seg->next){
+        seg->next->prev = seg;
+    } else {
+        list->tail = seg;
+    }
+
+    return seg;
+}
+
+static void pt_rudp_list_push(struct pt_rudp_list *list, struct pt_rudp_seg *seg)
+{
+    seg->next = NULL;
+    seg->prev = list->tail;
+
+    if(list->tail){
+        list->tail->next = seg;
+    } else {
+        list->head = seg;
+    }
+
+    list->tail = seg;
+    list->count++;
+}
+
+static void pt_rudp_list_insert_after(struct pt_rudp_list *list, struct pt_rudp_seg *pos, struct pt_rudp_seg *seg)
+{
+    if(pos == NULL){
+        seg->prev = NULL;
+        seg->next = list->head;
+        if(list->head) list->head->prev = seg;
+        list->head = seg;
+        if(list->tail == NULL) list->tail = seg;
+    } else {
+        seg->prev = pos;
+        seg->next = pos->next;
+        if(pos->next) pos->next->prev = seg;
+        pos->next = seg;
+        if(list->tail == pos) list->tail = seg;
+    }
+
+    list->count++;
+}
+
+static void pt_rudp_list_remove(struct pt_rudp_list *list, struct pt_rudp_seg *seg)
+{
+    if(seg->prev){
+        seg->prev->next = seg->next;
+    } else {
+        list->head = seg->next;
+    }
+
+    if(seg->next){
+        seg->next->prev = seg->prev;
+    } else {
+        list->tail = seg->prev;
+    }
+
+    seg->next = seg->prev = NULL;
+    list->count--;
+}
+
+static void pt_rudp_list_clear(struct pt_rudp_list *list)
+{
+    struct pt_rudp_seg *seg;
+
+    while(list->head)
+    {
+        seg = list->head;
+        list->head = seg->next;
+        free(seg);
+    }
+
+    list->tail = NULL;
+    list->count = 0;
+}
+
+struct pt_rudp *pt_rudp_new(uint32_t conv, void *data, pt_rudp_output_cb output,
+                            pt_rudp_message_cb on_message, pt_rudp_event_cb on_event)
+{
+    struct pt_rudp *rudp = malloc(sizeof(struct pt_rudp));
+
+    if(rudp == NULL){
+        FATAL("malloc pt_rudp failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+
+    bzero(rudp, sizeof(struct pt_rudp));
+
+    rudp->conv = conv;
+    rudp->data = data;
+    rudp->output = output;
+    rudp->on_message = on_message;
+    rudp->on_event = on_event;
+
+    rudp->rmt_wnd = PT_RUDP_WND_SIZE;
+    rudp->rto = PT_RUDP_RTO_DEFAULT;
+    rudp->cwnd = 4;
+    rudp->ssthresh = PT_RUDP_WND_SIZE / 2;
+
+    rudp->out = malloc(PT_RUDP_MTU);
+    rudp->msg_max = PT_RUDP_MSS * 4;
+    rudp->msg = malloc(rudp->msg_max);
+
+    if(rudp->out == NULL || rudp->msg == NULL){
+        FATAL("malloc pt_rudp buffer failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+
+    return rudp;
+}
+
+void pt_rudp_free(struct pt_rudp *rudp)
+{
+    pt_rudp_list_clear(&rudp->snd_queue);
+    pt_rudp_list_clear(&rudp->snd_buf);
+    pt_rudp_list_clear(&rudp->rcv_buf);
+    pt_rudp_list_clear(&rudp->rcv_queue);
+
+    free(rudp->out);
+    free(rudp->msg);
+    free(rudp);
+}
+
+static void pt_rudp_output_flush(struct pt_rudp *rudp)
+{
+    if(rudp->out_length == 0) return;
+
+    rudp->output(rudp, rudp->out, rudp->out_length);
+    rudp->out_length = 0;
+    rudp->last_send = rudp->current;
+}
+
+/*
+ 计算本端的累计确认和选择确认
+ */
+static void pt_rudp_fill_ack(struct pt_rudp *rudp, struct pt_rudp_header *hdr)
+{
+    struct pt_rudp_seg *seg;
+    int32_t diff;
+    uint32_t wnd;
+
+    hdr->una = rudp->rcv_nxt;
+    hdr->sack = 0;
+
+    for(seg = rudp->rcv_buf.head; seg; seg = seg->next)
+    {
+        diff = PT_RUDP_SEQ_DIFF(seg->sn, rudp->rcv_nxt + 1);
+        if(diff < 0) continue;
+        if(diff >= 32) break;
+        hdr->sack |= 1U << diff;
+    }
+
+    wnd = rudp->rcv_queue.count + rudp->rcv_buf.count;
+    hdr->wnd = wnd < PT_RUDP_WND_SIZE ? (uint16_t)(PT_RUDP_WND_SIZE - wnd) : 0;
+}
+
+/*
+ 将一个数据段追加到输出缓冲区，超过MTU时先发送之前的数据
+ */
+static void pt_rudp_output_seg(struct pt_rudp *rudp, uint8_t cmd, uint8_t channel, uint32_t sn, uint16_t frg,
+                               uint32_t ts, const unsigned char *data, uint16_t length)
+{
+    struct pt_rudp_header hdr;
+
+    if(rudp->out_length + sizeof(hdr) + length > PT_RUDP_MTU){
+        pt_rudp_output_flush(rudp);
+    }
+
+    hdr.conv = rudp->conv;
+    hdr.cmd = cmd;
+    hdr.channel = channel;
+    hdr.frg = frg;
+    hdr.sn = sn;
+    hdr.ts = ts;
+    hdr.len = length;
+    pt_rudp_fill_ack(rudp, &hdr);
+
+    memcpy(rudp->out + rudp->out_length, &hdr, sizeof(hdr));
+    rudp->out_length += sizeof(hdr);
+
+    if(length){
+        memcpy(rudp->out + rudp->out_length, data, length);
+        rudp->out_length += length;
+    }
+
+    //每个数据段都带有确认信息
+    rudp->ack_pending = false;
+}
+
+static void pt_rudp_update_rtt(struct pt_rudp *rudp, int32_t rtt)
+{
+    int32_t delta;
+    int32_t rto;
+
+    if(rtt < 0) return;
+
+    if(rudp->srtt == 0){
+        rudp->srtt = rtt;
+        rudp->rttvar = rtt / 2;
+    } else {
+        delta = rtt - rudp->srtt;
+        if(delta < 0) delta = -delta;
+        rudp->rttvar = (3 * rudp->rttvar + delta) / 4;
+        rudp->srtt = (7 * rudp->srtt + rtt) / 8;
+        if(rudp->srtt < 1) rudp->srtt = 1;
+    }
+
+    rto = rudp->srtt + 4 * rudp->rttvar;
+    if(rto < PT_RUDP_RTO_MIN) rto = PT_RUDP_RTO_MIN;
+    if(rto > PT_RUDP_RTO_MAX) rto = PT_RUDP_RTO_MAX;
+    rudp->rto = (uint32_t)rto;
+}
+
+/*
+ 处理对方的确认信息，删除已经确认的包，统计快速重传计数，用只发送过一次的包估算rtt
+ */
+static void pt_rudp_process_ack(struct pt_rudp *rudp, const struct pt_rudp_header *hdr)
+{
+    struct pt_rudp_seg *seg;
+    struct pt_rudp_seg *next;
+    uint32_t maxack = hdr->una;
+    uint32_t acked = 0;
+    int32_t rtt = -1;
+    int32_t diff;
+    int i;
+
+    for(i = 31; i >= 0; i--)
+    {
+        if(hdr->sack & (1U << i)){
+            maxack = hdr->una + 1 + i;
+            break;
+        }
+    }
+
+    for(seg = rudp->snd_buf.head; seg; seg = next)
+    {
+        next = seg->next;
+
+        diff = PT_RUDP_SEQ_DIFF(seg->sn, hdr->una);
+        if(diff < 0 || (diff >= 1 && diff <= 32 && (hdr->sack & (1U << (diff - 1))))){
+            //Karn算法，重传过的包不知道确认的是哪一次发送，不用来估算rtt
+            if(seg->xmit == 1) rtt = PT_RUDP_SEQ_DIFF(rudp->current, seg->ts);
+            pt_rudp_list_remove(&rudp->snd_buf, seg);
+            free(seg);
+            acked++;
+            continue;
+        }
+
+        //有更新的包被确认，这个包可能已经丢失
+        if(PT_RUDP_SEQ_DIFF(seg->sn, maxack) < 0){
+            seg->fastack++;
+        }
+    }
+
+    rudp->snd_una = rudp->snd_buf.head ? rudp->snd_buf.head->sn : rudp->snd_nxt;
+    rudp->rmt_wnd = hdr->wnd;
+
+    //使用最后一个确认的包，它发送得最晚，受对方延迟确认的影响最小
+    if(rtt >= 0) pt_rudp_update_rtt(rudp, rtt);
+
+    //拥塞窗口增长
+    while(acked-- > 0)
+    {
+        if(rudp->cwnd < rudp->ssthresh){
+            rudp->cwnd++;
+        } else if(++rudp->cwnd_incr >= rudp->cwnd){
+            rudp->cwnd_incr = 0;
+            rudp->cwnd++;
+        }
+        if(rudp->cwnd > PT_RUDP_WND_SIZE) rudp->cwnd = PT_RUDP_WND_SIZE;
+    }
+}
+
+/*
+ 将接收缓冲区中连续的包移到接收队列，并重组完整的消息
+ */
+static void pt_rudp_deliver(struct pt_rudp *rudp)
+{
+    struct pt_rudp_seg *seg;
+    struct pt_rudp_seg *end;
+    uint32_t length;
+    uint32_t count;
+
+    while(rudp->rcv_buf.head && rudp->rcv_buf.head->sn == rudp->rcv_nxt)
+    {
+        seg = rudp->rcv_buf.head;
+        pt_rudp_list_remove(&rudp->rcv_buf, seg);
+        pt_rudp_list_push(&rudp->rcv_queue, seg);
+        rudp->rcv_nxt++;
+    }
+
+    for(;;)
+    {
+        if(rudp->recv_paused) return;
+
+        //找到消息的最后一个分片
+        length = 0;
+        count = 0;
+        for(end = rudp->rcv_queue.head; end; end = end->next)
+        {
+            length += end->len;
+            count++;
+            if(end->frg == 0) break;
+        }
+
+        if(end == NULL) return;
+
+        if(length > rudp->msg_max){
+            rudp->msg_max = ALIGN_SIZE(length, PAGESIZE);
+            rudp->msg = realloc(rudp->msg, rudp->msg_max);
+            if(rudp->msg == NULL){
+                FATAL("realloc pt_rudp msg failed", __FUNCTION__, __FILE__, __LINE__);
+                abort();
+            }
+        }
+
+        length = 0;
+        while(count-- > 0)
+        {
+            seg = rudp->rcv_queue.head;
+            memcpy(rudp->msg + length, seg->data, seg->len);
+            length += seg->len;
+            pt_rudp_list_remove(&rudp->rcv_queue, seg);
+            free(seg);
+        }
+
+        rudp->on_message(rudp, PT_RUDP_CHANNEL_RELIABLE, rudp->msg, length);
+
+        if(rudp->state != PT_RUDP_STATE_ESTABLISHED) return;
+    }
+}
+
+static void pt_rudp_recv_push(struct pt_rudp *rudp, const struct pt_rudp_header *hdr, const unsigned char *data)
+{
+    struct pt_rudp_seg *seg;
+    struct pt_rudp_seg *pos;
+    int32_t diff = PT_RUDP_SEQ_DIFF(hdr->sn, rudp->rcv_nxt);
+
+    rudp->ack_pending = true;
+    rudp->ack_ts = hdr->ts;
+
+    //重复的包或者超出接收窗口，暂停交付时rcv_queue占用的部分也计算在内
+    if(diff < 0 || (uint32_t)diff + rudp->rcv_queue.count >= PT_RUDP_WND_SIZE) return;
+
+    //按序列插入，重复的包直接丢弃
+    for(pos = rudp->rcv_buf.tail; pos; pos = pos->prev)
+    {
+        if(pos->sn == hdr->sn) return;
+        if(PT_RUDP_SEQ_DIFF(pos->sn, hdr->sn) < 0) break;
+    }
+
+    seg = pt_rudp_seg_new(hdr->len);
+    seg->sn = hdr->sn;
+    seg->frg = hdr->frg;
+    memcpy(seg->data, data, hdr->len);
+
+    pt_rudp_list_insert_after(&rudp->rcv_buf, pos, seg);
+
+    pt_rudp_deliver(rudp);
+}
+
+static void pt_rudp_recv_unreliable(struct pt_rudp *rudp, const struct pt_rudp_header *hdr, const unsigned char *data)
+{
+    //只接受比上一个更新的包
+    if(rudp->unrel_received && PT_RUDP_SEQ_DIFF(hdr->sn, rudp->unrel_rcv_last) <= 0) return;
+
+    rudp->unrel_received = true;
+    rudp->unrel_rcv_last = hdr->sn;
+
+    rudp->on_message(rudp, PT_RUDP_CHANNEL_UNRELIABLE, data, hdr->len);
+}
+
+static void pt_rudp_set_state(struct pt_rudp *rudp, int state)
+{
+    int event;
+
+    if(rudp->state == state) return;
+
+    rudp->state = state;
+
+    if(state == PT_RUDP_STATE_ESTABLISHED){
+        event = PT_RUDP_EVENT_CONNECTED;
+    } else if(state == PT_RUDP_STATE_CLOSED){
+        event = PT_RUDP_EVENT_CLOSED;
+    } else {
+        return;
+    }
+
+    if(rudp->on_event) rudp->on_event(rudp, event);
+}
+
+/*
+ 发送数据：新数据按拥塞窗口发送，超时和快速重传
+ */
+static void pt_rudp_flush(struct pt_rudp *rudp)
+{
+    struct pt_rudp_seg *seg;
+    uint32_t current = rudp->current;
+    uint32_t wnd;
+    uint32_t inflight;
+    qboolean lost = false;
+    qboolean fast = false;
+
+    if(rudp->state != PT_RUDP_STATE_ESTABLISHED) return;
+
+    wnd = rudp->cwnd < rudp->rmt_wnd ? rudp->cwnd : rudp->rmt_wnd;
+    if(wnd == 0) wnd = 1;
+    if(wnd > PT_RUDP_WND_SIZE) wnd = PT_RUDP_WND_SIZE;
+
+    //把新的数据移到发送缓冲区
+    while(rudp->snd_queue.head && rudp->snd_buf.count < wnd)
+    {
+        seg = rudp->snd_queue.head;
+        pt_rudp_list_remove(&rudp->snd_queue, seg);
+        rudp->snd_queue_size -= seg->len;
+
+        seg->sn = rudp->snd_nxt++;
+        seg->xmit = 0;
+        seg->rto = rudp->rto;
+        pt_rudp_list_push(&rudp->snd_buf, seg);
+    }
+
+    inflight = rudp->snd_buf.count;
+
+    for(seg = rudp->snd_buf.head; seg; seg = seg->next)
+    {
+        qboolean send = false;
+
+        if(seg->xmit == 0){
+            send = true;
+            seg->rto = rudp->rto;
+        } else if(PT_RUDP_SEQ_DIFF(current, seg->resendts) >= 0){
+            //超时重传，rto指数退避
+            send = true;
+            lost = true;
+            seg->rto += seg->rto / 2;
+            if(seg->rto > PT_RUDP_RTO_MAX) seg->rto = PT_RUDP_RTO_MAX;
+        } else if(seg->fastack >= PT_RUDP_FASTACK){
+            send = true;
+            fast = true;
+            seg->fastack = 0;
+        }
+
+        if(send == false) continue;
+
+        seg->xmit++;
+        seg->ts = current;
+        seg->resendts = current + seg->rto;
+
+        if(seg->xmit >= PT_RUDP_DEAD_LINK){
+            LOG("rudp dead link", __FUNCTION__, __FILE__, __LINE__);
+            pt_rudp_output_flush(rudp);
+            pt_rudp_set_state(rudp, PT_RUDP_STATE_CLOSED);
+            return;
+        }
+
+        pt_rudp_output_seg(rudp, PT_RUDP_CMD_PUSH, PT_RUDP_CHANNEL_RELIABLE, seg->sn, seg->frg,
+                           seg->ts, seg->data, seg->len);
+    }
+
+    //只剩确认需要发送
+    if(rudp->ack_pending){
+        pt_rudp_output_seg(rudp, PT_RUDP_CMD_ACK, PT_RUDP_CHANNEL_RELIABLE, 0, 0, rudp->ack_ts, NULL, 0);
+    }
+
+    pt_rudp_output_flush(rudp);
+
+    //拥塞控制
+    if(fast){
+        rudp->ssthresh = inflight / 2 > 2 ? inflight / 2 : 2;
+        rudp->cwnd = rudp->ssthresh + PT_RUDP_FASTACK;
+        rudp->cwnd_incr = 0;
+    }
+    if(lost){
+        rudp->ssthresh = inflight / 2 > 2 ? inflight / 2 : 2;
+        rudp->cwnd = 1;
+        rudp->cwnd_incr = 0;
+    }
+}
+
+void pt_rudp_connect(struct pt_rudp *rudp, uint32_t current)
+{
+    rudp->current = current;
+    rudp->connect_start = current;
+    rudp->last_recv = current;
+    rudp->syn_ts = current;
+    rudp->state = PT_RUDP_STATE_SYN_SENT;
+
+    pt_rudp_output_seg(rudp, PT_RUDP_CMD_SYN, 0, 0, 0, current, NULL, 0);
+    pt_rudp_output_flush(rudp);
+}
+
+void pt_rudp_accept(struct pt_rudp *rudp, uint32_t current)
+{
+    rudp->current = current;
+    rudp->last_recv = current;
+    rudp->state = PT_RUDP_STATE_ESTABLISHED;
+}
+
+void pt_rudp_close(struct pt_rudp *rudp)
+{
+    if(rudp->state == PT_RUDP_STATE_CLOSED) return;
+
+    pt_rudp_output_seg(rudp, PT_RUDP_CMD_FIN, 0, 0, 0, rudp->current, NULL, 0);
+    pt_rudp_output_flush(rudp);
+
+    //主动关闭不通知事件
+    rudp->state = PT_RUDP_STATE_CLOSED;
+}
+
+void pt_rudp_send(struct pt_rudp *rudp, int channel, const unsigned char *data, uint32_t length)
+{
+    struct pt_rudp_seg *seg;
+    uint32_t count;
+    uint32_t size;
+    uint32_t i;
+
+    if(rudp->state == PT_RUDP_STATE_CLOSED) return;
+
+    if(channel == PT_RUDP_CHANNEL_UNRELIABLE)
+    {
+        //不可靠通道不分片，超过MSS的消息直接丢弃
+        if(length > PT_RUDP_MSS){
+            DBGPRINT("unreliable message > PT_RUDP_MSS");
+            return;
+        }
+        if(rudp->state != PT_RUDP_STATE_ESTABLISHED) return;
+
+        pt_rudp_output_seg(rudp, PT_RUDP_CMD_PUSH, PT_RUDP_CHANNEL_UNRELIABLE, rudp->unrel_snd_nxt++, 0,
+                           rudp->current, data, (uint16_t)length);
+        pt_rudp_output_flush(rudp);
+        return;
+    }
+
+    //字节流模式先把数据追加到还没有发送的最后一个数据段，窗口满时小消息不会各占一个数据段
+    seg = rudp->snd_queue.tail;
+    if(rudp->stream && seg && seg->len < PT_RUDP_MSS && length > 0)
+    {
+        size = PT_RUDP_MSS - seg->len;
+        if(size > length) size = length;
+
+        seg = pt_rudp_seg_resize(&rudp->snd_queue, seg, seg->len + size);
+        memcpy(seg->data + seg->len, data, size);
+        seg->len += size;
+        rudp->snd_queue_size += size;
+
+        data += size;
+        length -= size;
+
+        if(length == 0){
+            pt_rudp_flush(rudp);
+            if(rudp->inputting == false){
+                pt_rudp_output_flush(rudp);
+            }
+            return;
+        }
+    }
+
+    count = length == 0 ? 1 : (length + PT_RUDP_MSS - 1) / PT_RUDP_MSS;
+
+    for(i = 0; i < count; i++)
+    {
+        size = length > PT_RUDP_MSS ? PT_RUDP_MSS : length;
+
+        seg = pt_rudp_seg_new(size);
+        memcpy(seg->data, data, size);
+        //字节流不需要重组消息，每个数据段单独交付
+        seg->frg = rudp->stream ? 0 : (uint16_t)(count - i - 1);
+
+        pt_rudp_list_push(&rudp->snd_queue, seg);
+        rudp->snd_queue_size += size;
+
+        data += size;
+        length -= size;
+    }
+
+    pt_rudp_flush(rudp);
+
+    //在pt_rudp_input的回调中发送时，等处理完所有数据段后一起发送
+    if(rudp->inputting == false){
+        pt_rudp_output_flush(rudp);
+    }
+}
+
+qboolean pt_rudp_peek(const unsigned char *data, uint32_t length, uint32_t *conv, uint8_t *cmd)
+{
+    const struct pt_rudp_header *hdr = (const struct pt_rudp_header*)data;
+
+    if(length < sizeof(struct pt_rudp_header)) return false;
+
+    *conv = hdr->conv;
+    *cmd = hdr->cmd;
+
+    return true;
+}
+
+void pt_rudp_input(struct pt_rudp *rudp, const unsigned char *data, uint32_t length, uint32_t current)
+{
+    struct pt_rudp_header hdr;
+    qboolean acked = false;
+
+    rudp->current = current;
+    rudp->inputting = true;
+
+    while(length >= sizeof(hdr) && rudp->state != PT_RUDP_STATE_CLOSED)
+    {
+        memcpy(&hdr, data, sizeof(hdr));
+        data += sizeof(hdr);
+        length -= sizeof(hdr);
+
+        if(hdr.conv != rudp->conv || hdr.len > length) break;
+
+        rudp->last_recv = current;
+
+        switch(hdr.cmd)
+        {
+            case PT_RUDP_CMD_SYN:
+                //重复的SYN说明SYNACK丢失
+                if(rudp->state == PT_RUDP_STATE_ESTABLISHED){
+                    pt_rudp_output_seg(rudp, PT_RUDP_CMD_SYNACK, 0, 0, 0, hdr.ts, NULL, 0);
+                }
+                break;
+
+            case PT_RUDP_CMD_SYNACK:
+                if(rudp->state == PT_RUDP_STATE_SYN_SENT){
+                    pt_rudp_update_rtt(rudp, PT_RUDP_SEQ_DIFF(current, hdr.ts));
+                    pt_rudp_set_state(rudp, PT_RUDP_STATE_ESTABLISHED);
+                }
+                break;
+
+            case PT_RUDP_CMD_FIN:
+                rudp->inputting = false;
+                pt_rudp_set_state(rudp, PT_RUDP_STATE_CLOSED);
+                return;
+
+            case PT_RUDP_CMD_ACK:
+                if(rudp->state == PT_RUDP_STATE_ESTABLISHED){
+                    pt_rudp_process_ack(rudp, &hdr);
+                    acked = true;
+                }
+                break;
+
+            case PT_RUDP_CMD_PUSH:
+                if(rudp->state != PT_RUDP_STATE_ESTABLISHED) break;
+
+                //数据段也带有对方的确认信息
+                pt_rudp_process_ack(rudp, &hdr);
+                acked = true;
+
+                if(hdr.channel == PT_RUDP_CHANNEL_UNRELIABLE){
+                    pt_rudp_recv_unreliable(rudp, &hdr, data);
+                } else {
+                    pt_rudp_recv_push(rudp, &hdr, data);
+                }
+                break;
+
+            case PT_RUDP_CMD_PING:
+                //对端恢复接收后用PING通知新的接收窗口
+                if(rudp->state == PT_RUDP_STATE_ESTABLISHED){
+                    rudp->rmt_wnd = hdr.wnd;
+                }
+                rudp->ack_pending = true;
+                rudp->ack_ts = hdr.ts;
+                break;
+
+            default:
+                length = 0;
+                continue;
+        }
+
+        data += hdr.len;
+        length -= hdr.len;
+    }
+
+    //确认后窗口可能打开，立即发送等待中的数据和ACK
+    if(rudp->state == PT_RUDP_STATE_ESTABLISHED && (acked || rudp->ack_pending)){
+        pt_rudp_flush(rudp);
+    }
+
+    rudp->inputting = false;
+    pt_rudp_output_flush(rudp);
+}
+
+void pt_rudp_update(struct pt_rudp *rudp, uint32_t current)
+{
+    rudp->current = current;
+
+    if(rudp->state == PT_RUDP_STATE_CLOSED) return;
+
+    if(rudp->state == PT_RUDP_STATE_SYN_SENT)
+    {
+        if(PT_RUDP_SEQ_DIFF(current, rudp->connect_start) >= PT_RUDP_CONNECT_TIMEOUT){
+            pt_rudp_set_state(rudp, PT_RUDP_STATE_CLOSED);
+            return;
+        }
+
+        if(PT_RUDP_SEQ_DIFF(current, rudp->syn_ts) >= PT_RUDP_SYN_INTERVAL){
+            rudp->syn_ts = current;
+            pt_rudp_output_seg(rudp, PT_RUDP_CMD_SYN, 0, 0, 0, current, NULL, 0);
+            pt_rudp_output_flush(rudp);
+        }
+        return;
+    }
+
+    if(PT_RUDP_SEQ_DIFF(current, rudp->last_recv) >= PT_RUDP_IDLE_TIMEOUT){
+        LOG("rudp idle timeout", __FUNCTION__, __FILE__, __LINE__);
+        pt_rudp_set_state(rudp, PT_RUDP_STATE_CLOSED);
+        return;
+    }
+
+    if(PT_RUDP_SEQ_DIFF(current, rudp->last_send) >= PT_RUDP_PING_INTERVAL){
+        pt_rudp_output_seg(rudp, PT_RUDP_CMD_PING, 0, 0, 0, current, NULL, 0);
+    }
+
+    pt_rudp_flush(rudp);
+    pt_rudp_output_flush(rudp);
+}
+
+void pt_rudp_read_stop(struct pt_rudp *rudp)
+{
+    rudp->recv_paused = true;
+}
+
+void pt_rudp_read_start(struct pt_rudp *rudp)
+{
+    if(rudp->recv_paused == false) return;
+
+    rudp->recv_paused = false;
+
+    if(rudp->state != PT_RUDP_STATE_ESTABLISHED) return;
+
+    pt_rudp_deliver(rudp);
+
+    //接收窗口变大，用PING通知对端，对端收到后回复ACK
+    if(rudp->state == PT_RUDP_STATE_ESTABLISHED){
+        pt_rudp_output_seg(rudp, PT_RUDP_CMD_PING, 0, 0, 0, rudp->current, NULL, 0);
+        if(rudp->inputting == false){
+            pt_rudp_output_flush(rudp);
+        }
+    }
+}
+
+uint32_t pt_rudp_queue_size(struct pt_rudp *rudp)
+{
+    struct pt_rudp_seg *seg;
+    uint32_t size = rudp->snd_queue_size;
+
+    for(seg = rudp->snd_buf.head; seg; seg = seg->next)
+    {
+        size += seg->len;
+    }
+
+    return size;
+}
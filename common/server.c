@@ -10,6 +10,22 @@
 #include "error.h"
 #include "crc32.h"
 #include "server.h"
+#include "uring.h"
+#include "shm.h"
+#include "rudp.h"
+#include "respcache.h"
+#include "spin.h"
+
+#include <errno.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+#ifdef PT_HAVE_URING
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#endif
 
 static void pt_server_log(const char *fmt, int error, const char *func, const char *file, int line)
 {
@@ -56,15 +72,58 @@ static struct pt_sclient* pt_sclient_new(struct pt_server *server)
     
     user->buf = pt_buffer_new(USER_DEFAULT_BUFF_SIZE);
     user->id = ++server->serial;
+    user->send_high_watermark = server->send_high_watermark;
+    user->send_low_watermark = server->send_low_watermark;
     
     return user;
 }
 
 static void pt_sclient_free(struct pt_sclient* user)
 {
+    struct pt_buffer *buff;
+    int i;
+    
     pt_buffer_free(user->buf);
     user->buf = NULL;
     
+    if(user->batch){
+        pt_buffer_free(user->batch);
+        user->batch = NULL;
+    }
+    
+    //释放还在优先级队列中的数据
+    for(i = 0; i < PT_PRIORITY_LEVELS; i++)
+    {
+        while(user->prio_head[i]){
+            buff = user->prio_head[i];
+            user->prio_head[i] = buff->next;
+            buff->next = NULL;
+            pt_buffer_free(buff);
+        }
+    }
+    
+    free(user->rate_limits);
+    user->rate_limits = NULL;
+    
+#ifdef PT_HAVE_URING
+    if(user->uring){
+        pt_uring_conn_free(user->uring);
+        user->uring = NULL;
+    }
+#endif
+    
+#ifdef __linux__
+    if(user->shm){
+        pt_shm_free(user->shm);
+        user->shm = NULL;
+    }
+#endif
+    
+    if(user->rudp){
+        pt_rudp_free(user->rudp);
+        user->rudp = NULL;
+    }
+    
     if(user->async_buf){
         free(user->async_buf->base);
         free(user->async_buf);
@@ -73,6 +132,8 @@ static void pt_sclient_free(struct pt_sclient* user)
     free(user);
 }
 
+static void pt_server_check_drain(struct pt_sclient *user);
+
 /*
  当写入操作完成或失败会执行本函数
  释放pt_buffer和write_request数据
@@ -80,9 +141,12 @@ static void pt_sclient_free(struct pt_sclient* user)
 static void pt_server_write_cb(uv_write_t* req, int status)
 {
     struct pt_wreq *wr = (struct pt_wreq*)req;
+    struct pt_sclient *user = wr->data;
     
     pt_buffer_free(wr->buff);
     free(wr);
+    
+    pt_server_check_drain(user);
 }
 
 /*
@@ -95,10 +159,111 @@ static void pt_server_on_close_conn(uv_handle_t* peer) {
 }
 
 
+/*
+ 关闭UDP连接，发送FIN并从连接表中删除
+ 可能在pt_rudp_input的回调中执行，pt_rudp需要在下一次定时器中释放
+ */
+static void pt_server_udp_close(struct pt_sclient *user)
+{
+    struct pt_server *server = user->server;
+    
+    pt_rudp_close(user->rudp);
+    pt_table_erase(server->udp_sessions, user->rudp->conv);
+    
+    if(user->udp_prev){
+        user->udp_prev->udp_next = user->udp_next;
+    } else {
+        server->udp_active = user->udp_next;
+    }
+    if(user->udp_next){
+        user->udp_next->udp_prev = user->udp_prev;
+    }
+    
+    user->udp_prev = NULL;
+    user->udp_next = server->udp_closed;
+    server->udp_closed = user;
+}
+
+/*
+ 从等待处理缓冲区数据的链表中删除
+ */
+static void pt_server_ready_remove(struct pt_sclient *user)
+{
+    struct pt_server *server = user->server;
+    
+    if(user->in_ready == false) return;
+    
+    if(user->ready_prev){
+        user->ready_prev->ready_next = user->ready_next;
+    } else {
+        server->ready_head = user->ready_next;
+    }
+    if(user->ready_next){
+        user->ready_next->ready_prev = user->ready_prev;
+    } else {
+        server->ready_tail = user->ready_prev;
+    }
+    
+    user->ready_prev = NULL;
+    user->ready_next = NULL;
+    user->in_ready = false;
+    server->ready_count--;
+}
+
+/*
+ 从自动暂停读取的链表中删除
+ */
+static void pt_server_throttle_remove(struct pt_sclient *user)
+{
+    struct pt_server *server = user->server;
+    
+    if(user->read_throttled == false) return;
+    
+    if(user->throttle_prev){
+        user->throttle_prev->throttle_next = user->throttle_next;
+    } else {
+        server->throttled = user->throttle_next;
+    }
+    if(user->throttle_next){
+        user->throttle_next->throttle_prev = user->throttle_prev;
+    }
+    
+    user->throttle_prev = NULL;
+    user->throttle_next = NULL;
+    user->read_throttled = false;
+}
+
+/*
+ 从限速暂停读取的链表中删除
+ */
+static void pt_server_rate_remove(struct pt_sclient *user)
+{
+    struct pt_server *server = user->server;
+    
+    if(user->read_limited == false) return;
+    
+    if(user->rate_prev){
+        user->rate_prev->rate_next = user->rate_next;
+    } else {
+        server->rate_delayed = user->rate_next;
+    }
+    if(user->rate_next){
+        user->rate_next->rate_prev = user->rate_prev;
+    }
+    
+    user->rate_prev = NULL;
+    user->rate_next = NULL;
+    user->read_limited = false;
+}
+
+static void pt_server_release_budget(struct pt_server *server);
+
 //关闭一个客户端的连接
 static void pt_server_close_conn(struct pt_sclient *user, qboolean remove)
 {
     struct pt_server *server = user->server;
+    struct pt_server_hook *hook;
+    struct pt_server_hook *next;
     
     //检查用户是否已被关闭
     if(user->connected  == false)
@@ -108,11 +273,29 @@ static void pt_server_close_conn(struct pt_sclient *user, qboolean remove)
     
     user->connected = false;
     
+    //未完成的工作不再计算在预算内
+    pt_server_ready_remove(user);
+    pt_server_throttle_remove(user);
+    pt_server_rate_remove(user);
+    if(server->wheel){
+        pt_timewheel_remove(server->wheel, &user->read_timer);
+        pt_timewheel_remove(server->wheel, &user->write_timer);
+    }
+    server->pending_work -= user->pending_work;
+    user->pending_work = 0;
+    pt_server_release_budget(server);
+    
     if(remove)
     {
         //通知用户函数，用户断开
         if(server->on_disconnect) server->on_disconnect(user);
         
+        //通知组件，执行中可以移除自己
+        for(hook = server->disconnect_hooks; hook; hook = next){
+            next = hook->next;
+            hook->hook(user, hook->udata);
+        }
+        
         //从用户ID表中删除
         pt_table_erase(server->clients, user->id);
         
@@ -120,6 +303,28 @@ static void pt_server_close_conn(struct pt_sclient *user, qboolean remove)
         server->number_of_connected--;
     }
     
+#ifdef PT_HAVE_URING
+    if(user->uring){
+        pt_uring_conn_close(user->uring);
+        return;
+    }
+#endif
+    
+#ifdef __linux__
+    if(user->shm){
+        pt_shm_close(user->shm);
+        return;
+    }
+#endif
+    
+    if(user->rudp){
+        pt_server_udp_close(user);
+        return;
+    }
+    
+    //socket正在发送给新进程，发送完成后再关闭
+    if(user->handing_off) return;
+    
     uv_close((uv_handle_t*)&user->sock.stream, pt_server_on_close_conn);
 }
 
@@ -128,47 +333,288 @@ static void pt_server_close_conn(struct pt_sclient *user, qboolean remove)
 static void pt_server_on_close_listener(uv_handle_t *handle)
 {
     struct pt_server *server = handle->data;
+    struct pt_sclient *user;
+    
+    //释放所有已经关闭的UDP连接
+    while(server->udp_closed){
+        user = server->udp_closed;
+        server->udp_closed = user->udp_next;
+        pt_sclient_free(user);
+    }
+    
+    if(server->pipe_path){
+        unlink(server->pipe_path);
+        free(server->pipe_path);
+        server->pipe_path = NULL;
+    }
+    
     server->is_startup = false;
 }
 
 /*
- libuv的数据包收到函数
- 
- 当用户收到数据或连接断开时，会调用本函数
- 本函数会处理用户断开
- 数据到达
+ 拆分缓冲区中的数据包并通知用户
  对数据安全进行检查等
  */
-static void pt_server_read_cb(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf)
+static void pt_server_ready_push(struct pt_sclient *user);
+static void pt_server_update_read(struct pt_sclient *user);
+
+/*
+ 没有数据的ID_TRANSMIT_KEEPALIVE，加密时只有包序列
+ */
+static qboolean pt_server_is_heartbeat(struct pt_sclient *user, struct pt_buffer *buff)
 {
-    uint32_t packet_err = PACKET_INFO_OK;   //默认是没有任何错误的
-    struct pt_sclient *user = stream->data;
-    struct pt_buffer *userbuf = NULL;
+    struct net_header *hdr = (struct net_header*)buff->buff;
     
-    //用户状态异常断开，执行disconnect
-    if(nread < 0)
+    return hdr->id == ID_TRANSMIT_KEEPALIVE &&
+        pt_get_packet_size(buff) == (user->server->enable_encrypt ? sizeof(uint32_t) : 0);
+}
+
+/*
+ 批量包的一个子消息组成一个普通的数据包通知用户
+ 加密时子消息也以批量包的包序列开头，和普通数据包的格式一致，serial为NULL时没有包序列
+ */
+static void pt_server_batch_receive(struct pt_sclient *user, const unsigned char *serial, uint16_t id,
+                                    const unsigned char *data, uint32_t length)
+{
+    struct net_header hdr = pt_create_nethdr(id);
+    struct pt_buffer *msg;
+    
+    if(user->server->on_receive == NULL) return;
+    
+    msg = pt_buffer_new(sizeof(hdr) + sizeof(uint32_t) + length);
+    pt_buffer_write(msg, (unsigned char*)&hdr, sizeof(hdr));
+    if(serial){
+        pt_buffer_write(msg, serial, sizeof(uint32_t));
+    }
+    pt_buffer_write(msg, data, length);
+    ((struct net_header*)msg->buff)->length = msg->length;
+    
+    user->server->on_receive(user, msg);
+    
+    pt_buffer_free(msg);
+}
+
+//应用层暂停，预算暂停或者限速，批量包中剩余的子消息不再处理
+//已经解密的批量包不能交给新进程，热重启发送连接期间仍然处理完
+#define PT_SERVER_BATCH_HELD(user) ((user)->read_paused || (user)->read_throttled || (user)->read_limited)
+
+//应用层暂停，预算暂停或者限速，缓冲区中的数据包不再处理
+//热重启发送连接期间不再处理数据，缓冲区中的数据交给新进程
+#define PT_SERVER_READ_HELD(user) (PT_SERVER_BATCH_HELD(user) || \
+                                   (user)->server->handoff_state == PT_SERVER_HANDOFF_SENDING)
+
+static void pt_server_rate_cb(uv_timer_t *handle)
+{
+    struct pt_server *server = handle->data;
+    struct pt_sclient *user;
+    struct pt_sclient *next;
+    uint64_t now = uv_now(server->loop);
+    
+    for(user = server->rate_delayed; user; user = next)
     {
-        DBGPRINT("nread < 0");
-        pt_server_close_conn(user, true);
-        return;
+        next = user->rate_next;
+        
+        if(now < user->rate_resume) continue;
+        
+        pt_server_rate_remove(user);
+        pt_server_update_read(user);
     }
     
-    //用户发送了EOF包，执行断开
-    if(nread == 0){
-        DBGPRINT("nread == 0");
-        pt_server_close_conn(user, true);
-        return;
+    if(server->rate_delayed == NULL){
+        uv_timer_stop(&server->rate_timer);
     }
+}
+
+/*
+ 超过限速，暂停读取wait毫秒
+ */
+static void pt_server_rate_delay(struct pt_sclient *user, uint64_t wait)
+{
+    struct pt_server *server = user->server;
     
-    //将数据追加到缓冲区
-    pt_buffer_write(user->buf, (unsigned char*)buf->base, (uint32_t)nread);
+    user->rate_resume = uv_now(server->loop) + (wait ? wait : 1);
+    
+    if(user->read_limited) return;
+    
+    user->read_limited = true;
+    user->rate_prev = NULL;
+    user->rate_next = server->rate_delayed;
+    if(server->rate_delayed){
+        server->rate_delayed->rate_prev = user;
+    }
+    server->rate_delayed = user;
+    
+    if(server->rate_timer_init == false){
+        uv_timer_init(server->loop, &server->rate_timer);
+        server->rate_timer.data = server;
+        server->rate_timer_init = true;
+    }
+    
+    if(uv_is_active((uv_handle_t*)&server->rate_timer) == false){
+        uv_timer_start(&server->rate_timer, pt_server_rate_cb, PT_SERVER_RATE_INTERVAL, PT_SERVER_RATE_INTERVAL);
+    }
+    
+    pt_server_update_read(user);
+}
+
+/*
+ 丢弃缓冲区头部的一个数据包
+ 加密时客户端的rc4状态和包序列已经前进，这里也需要解密一次保持同步，但不校验crc
+ */
+static void pt_server_drop_packet(struct pt_sclient *user)
+{
+    struct net_header *hdr = (struct net_header*)user->buf->buff;
+    uint32_t length = hdr->length;
+    
+    if(user->server->enable_encrypt && length > sizeof(struct net_header)){
+        RC4(&user->encrypt_ctx, length - sizeof(struct net_header),
+            pt_get_packet_buffer(user->buf), pt_get_packet_buffer(user->buf));
+        user->serial++;
+    }
+    
+    pt_buffer_skip(user->buf, length);
+}
+
+/*
+ 检查缓冲区头部的数据包是否超过限速，只读取net_header
+ */
+static int pt_server_check_rate(struct pt_sclient *user, uint64_t *wait)
+{
+    struct pt_server *server = user->server;
+    struct net_header *hdr = (struct net_header*)user->buf->buff;
+    
+    //批量包按每个子消息检查
+    if(user->rate_limits == NULL || hdr->id == ID_TRANSMIT_BATCH) return PT_RATE_PASS;
+    
+    return pt_rate_limit_check(server->rate_rules, user->rate_limits, server->number_of_rate_rules,
+                               hdr->id, hdr->length, uv_now(server->loop), wait);
+}
+
+//本次处理的数据包数量或者时间超过预算
+static qboolean pt_server_dispatch_expired(struct pt_server *server, uint32_t packets, uint64_t deadline)
+{
+    return (server->dispatch_packets && packets >= server->dispatch_packets) ||
+           (deadline && packets > 0 && uv_hrtime() >= deadline);
+}
+
+/*
+ 逐个通知user->batch中剩余的子消息，每个子消息和普通数据包一样检查限速，暂停和预算
+ 停止时剩余的子消息留在user->batch中，下次pt_server_dispatch时先处理
+ 处理完返回true，需要停止处理或者连接已经断开时返回false
+ */
+static qboolean pt_server_dispatch_batch(struct pt_sclient *user, uint32_t *packets, uint64_t deadline, qboolean *deferred)
+{
+    struct pt_server *server = user->server;
+    const unsigned char *serial = server->enable_encrypt ? pt_get_packet_buffer(user->batch) : NULL;
+    const unsigned char *pos;
+    const unsigned char *data;
+    uint32_t remain;
+    uint32_t length;
+    uint16_t id;
+    uint64_t wait;
+    
+    while(user->batch)
+    {
+        if(user->connected == false) return false;
+        
+        pos = user->batch->buff + user->batch_offset;
+        remain = user->batch->length - user->batch_offset;
+        
+        if(remain == 0){
+            pt_buffer_free(user->batch);
+            user->batch = NULL;
+            break;
+        }
+        
+        if(PT_SERVER_BATCH_HELD(user)) return false;
+        
+        if(pt_server_dispatch_expired(server, *packets, deadline)){
+            *deferred = true;
+            return false;
+        }
+        
+        if(pt_batch_next(&pos, &remain, &id, &data, &length) == false){
+            DBGPRINT("batch packet invalid");
+            pt_server_close_conn(user, true);
+            return false;
+        }
+        (*packets)++;
+        
+        if(user->rate_limits){
+            switch(pt_rate_limit_check(server->rate_rules, user->rate_limits, server->number_of_rate_rules,
+                                       id, length, uv_now(server->loop), &wait))
+            {
+                case PT_RATE_DROP:
+                    user->batch_offset = (uint32_t)(pos - user->batch->buff);
+                    continue;
+                case PT_RATE_DELAY:
+                    //这个子消息留到恢复后再处理
+                    pt_server_rate_delay(user, wait);
+                    return false;
+                case PT_RATE_DISCONNECT:
+                    LOG("rate limit exceeded", __FUNCTION__, __FILE__, __LINE__);
+                    pt_server_close_conn(user, true);
+                    return false;
+            }
+        }
+        
+        user->batch_offset = (uint32_t)(pos - user->batch->buff);
+        
+        pt_server_batch_receive(user, serial, id, data, length);
+    }
+    
+    return true;
+}
+
+static void pt_server_dispatch(struct pt_sclient *user)
+{
+    uint32_t packet_err = PACKET_INFO_OK;   //默认是没有任何错误的
+    struct pt_buffer *userbuf = NULL;
+    struct pt_server *server = user->server;
+    uint32_t packets = 0;
+    uint64_t deadline = server->dispatch_time ? uv_hrtime() + (uint64_t)server->dispatch_time * 1000 : 0;
+    uint64_t wait;
+    qboolean deferred = false;
+    qboolean stopped = false;
+    
+    user->dispatching = true;
+    
+    //先处理上次停止时剩余的批量包子消息
+    if(user->batch && pt_server_dispatch_batch(user, &packets, deadline, &deferred) == false){
+        stopped = true;
+    }
     
     //循环读取缓冲区数据，如果数据错误则返回false且不再执行本while
     //稳定性修复，当客户端断开的时候，不再处理接收的数据
     //等待系统的回收
     //在这里connected == false一般是由pt_server_send函数overflow导致的
-    while(user->connected && pt_get_packet_status(user->buf, &packet_err))
+    //on_receive中暂停读取时，剩余的数据包留在缓冲区中
+    while(stopped == false && user->connected && PT_SERVER_READ_HELD(user) == false &&
+          pt_get_packet_status(user->buf, &packet_err))
     {
+        //超过本次的预算，剩余的数据包排到其他连接后面
+        if(pt_server_dispatch_expired(server, packets, deadline)){
+            deferred = true;
+            break;
+        }
+        packets++;
+        
+        //在解密和回调之前检查限速
+        switch(pt_server_check_rate(user, &wait))
+        {
+            case PT_RATE_DROP:
+                pt_server_drop_packet(user);
+                continue;
+            case PT_RATE_DELAY:
+                pt_server_rate_delay(user, wait);
+                continue;
+            case PT_RATE_DISCONNECT:
+                LOG("rate limit exceeded", __FUNCTION__, __FILE__, __LINE__);
+                user->dispatching = false;
+                pt_server_close_conn(user, true);
+                return;
+        }
+        
         //拆分一个数据包
         userbuf = pt_split_packet(user->buf);
         if(userbuf != NULL)
@@ -181,6 +627,7 @@ static void pt_server_read_cb(uv_stream_t* stream, ssize_t nread, const uv_buf_t
                 {
                     //数据不正确，断开用户的连接，释放缓冲区
                     pt_buffer_free(userbuf);
+                    user->dispatching = false;
                     pt_server_close_conn(user, true);
                     return;
                 }
@@ -189,14 +636,39 @@ static void pt_server_read_cb(uv_stream_t* stream, ssize_t nread, const uv_buf_t
                 user->serial++;
             }
             
-            //回调用户函数，通知数据到达
-            if(user->server->on_receive)
+            //批量包拆开后逐个通知，每个子消息单独计入预算和限速
+            if(((struct net_header*)userbuf->buff)->id == ID_TRANSMIT_BATCH)
+            {
+                if(user->server->enable_encrypt && pt_get_packet_size(userbuf) < sizeof(uint32_t))
+                {
+                    DBGPRINT("batch packet invalid");
+                    pt_buffer_free(userbuf);
+                    user->dispatching = false;
+                    pt_server_close_conn(user, true);
+                    return;
+                }
+                
+                user->batch = userbuf;
+                user->batch_offset = sizeof(struct net_header) + (user->server->enable_encrypt ? sizeof(uint32_t) : 0);
+                userbuf = NULL;
+                
+                if(pt_server_dispatch_batch(user, &packets, deadline, &deferred) == false) break;
+            }
+            //空的心跳包只用于刷新空闲时间，不通知用户
+            //响应缓存命中时已经发送了缓存的响应，同样不通知用户
+            else if(pt_server_is_heartbeat(user, userbuf) == false && user->server->on_receive &&
+                    (server->respcache == NULL || pt_respcache_reply(server->respcache, user, userbuf) == false))
             {
+                user->receiving = userbuf;
                 user->server->on_receive(user, userbuf);
+                
+                //on_receive中取走的数据包由用户释放
+                userbuf = user->receiving;
+                user->receiving = NULL;
             }
             
             //释放拆分包后的数据
-            pt_buffer_free(userbuf);
+            if(userbuf) pt_buffer_free(userbuf);
         }
         else
         {
@@ -205,6 +677,26 @@ static void pt_server_read_cb(uv_stream_t* stream, ssize_t nread, const uv_buf_t
         }
     }
     
+    user->dispatching = false;
+    
+    if(user->connected == false) return;
+    
+    if(deferred){
+        pt_server_ready_push(user);
+        
+        //处理完之前不再读取新数据，防止缓冲区无限增长
+        if(user->read_deferred == false){
+            user->read_deferred = true;
+            pt_server_update_read(user);
+        }
+        return;
+    }
+    
+    if(user->read_deferred){
+        user->read_deferred = false;
+        pt_server_update_read(user);
+    }
+    
     //如果用户发的数据是致命错误，则干掉用户
     if(packet_err == PACKET_INFO_FAKE || packet_err == PACKET_INFO_OVERFLOW){
         char error[255];
@@ -216,52 +708,231 @@ static void pt_server_read_cb(uv_stream_t* stream, ssize_t nread, const uv_buf_t
 }
 
 /*
- libuv的connection通知
- 
- 处理新用户连接，最大用户数量，创建pt_sclient结构并添加到clients表中
- 执行用户自定义的通知信息
+ 将收到的数据追加到缓冲区，拆包并通知用户
+ 对数据安全进行检查等
  */
-static void pt_server_connection_cb(uv_stream_t* listener, int status)
+static void pt_server_on_data(struct pt_sclient *user, const unsigned char *data, uint32_t length)
 {
-    int r;
-    struct pt_server *server = listener->data;
-    struct pt_sclient *user = pt_sclient_new(server);
-    
-    user->server = server;
+    //将数据追加到缓冲区
+    pt_buffer_write(user->buf, data, length);
+    user->last_read = uv_now(user->server->loop);
     
-    if(server->is_pipe){
-        uv_pipe_init(listener->loop, &user->sock.pipe, true);
-    } else {
-        uv_tcp_init(listener->loop, &user->sock.tcp);
-    }
+    //暂停读取时底层可能还会交付已经收到的数据，只保存不处理
+    //已经在等待队列中的连接轮到时再处理，保持公平
+    if(user->dispatching || user->in_ready || PT_SERVER_READ_HELD(user)) return;
     
-    user->sock.stream.data = user;
+    pt_server_dispatch(user);
+}
+
+static void pt_server_ready_cb(uv_idle_t *handle)
+{
+    struct pt_server *server = handle->data;
+    struct pt_sclient *user;
     
-    r = uv_accept(listener, (uv_stream_t*)&user->sock);
+    //本轮只处理已经在链表中的连接，处理期间新加入的在下一轮处理
+    uint32_t count = server->ready_count;
     
-    //如果accept失败，写出错误日志，并关掉这个sock
-    if( r != 0 )
+    while(count-- > 0 && server->ready_head)
     {
-        char error[255];
-        sprintf(error, "uv_accept error:%s",uv_strerror(r));
-        ERROR(error, __FUNCTION__, __FILE__, __LINE__);
-        uv_close((uv_handle_t*)&user->sock, pt_server_on_close_conn);
-        return;
+        user = server->ready_head;
+        pt_server_ready_remove(user);
+        
+        pt_server_dispatch(user);
     }
     
-    //设置客户端连接已经成功
-    user->connected = true;
+    if(server->ready_head == NULL){
+        uv_idle_stop(&server->ready_idle);
+    }
+}
+
+/*
+ 把连接加入等待处理的队列尾部，在下一轮loop中处理
+ 恢复读取时也使用这个队列，避免在其他连接的回调中重入on_receive
+ */
+static void pt_server_ready_push(struct pt_sclient *user)
+{
+    struct pt_server *server = user->server;
+    
+    if(user->in_ready) return;
+    
+    if(server->ready_idle_init == false){
+        uv_idle_init(server->loop, &server->ready_idle);
+        server->ready_idle.data = server;
+        server->ready_idle_init = true;
+    }
+    
+    user->in_ready = true;
+    user->ready_next = NULL;
+    user->ready_prev = server->ready_tail;
+    if(server->ready_tail){
+        server->ready_tail->ready_next = user;
+    } else {
+        server->ready_head = user;
+    }
+    server->ready_tail = user;
+    server->ready_count++;
+    
+    uv_idle_start(&server->ready_idle, pt_server_ready_cb);
+}
+
+/*
+ libuv的数据包收到函数
+ 
+ 当用户收到数据或连接断开时，会调用本函数
+ 本函数会处理用户断开
+ */
+static void pt_server_read_cb(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf)
+{
+    struct pt_sclient *user = stream->data;
+    
+    //用户状态异常断开，执行disconnect
+    if(nread < 0)
+    {
+        DBGPRINT("nread < 0");
+        pt_server_close_conn(user, true);
+        return;
+    }
+    
+    //用户发送了EOF包，执行断开
+    if(nread == 0){
+        DBGPRINT("nread == 0");
+        pt_server_close_conn(user, true);
+        return;
+    }
+    
+    pt_server_on_data(user, (unsigned char*)buf->base, (uint32_t)nread);
+}
+
+/*
+ 发送一个空的心跳包
+ */
+static void pt_server_send_heartbeat(struct pt_sclient *user)
+{
+    struct net_header hdr = pt_create_nethdr(ID_TRANSMIT_KEEPALIVE);
+    
+    pt_server_send_priority(user, pt_create_package(hdr, NULL, 0), PT_PRIORITY_CONTROL);
+}
+
+/*
+ 读空闲的定时器，同时负责心跳
+ 到期时按最后收到数据的时间重新计算，收到数据时不需要修改时间轮
+ */
+static void pt_server_read_timer_cb(struct pt_timewheel_node *node)
+{
+    struct pt_sclient *user = node->data;
+    struct pt_server *server = user->server;
+    uint64_t now = uv_now(server->loop);
+    uint64_t next = UINT64_MAX;
+    uint64_t due;
+    
+    if(server->read_idle_timeout && now - user->last_read >= server->read_idle_timeout){
+        if(server->on_idle){
+            server->on_idle(user, PT_IDLE_READ);
+        } else {
+            DBGPRINT("read idle timeout");
+            pt_server_close_conn(user, true);
+        }
+        
+        if(user->connected == false) return;
+        
+        //on_idle没有断开连接，重新开始计时
+        user->last_read = now;
+    }
+    
+    //对端一段时间没有发送数据，发送心跳包，对端回复后刷新last_read
+    if(server->heartbeat_interval){
+        due = (user->last_read > user->last_ping ? user->last_read : user->last_ping) + server->heartbeat_interval;
+        
+        if(now >= due){
+            user->last_ping = now;
+            pt_server_send_heartbeat(user);
+            if(user->connected == false) return;
+            due = now + server->heartbeat_interval;
+        }
+        next = due - now;
+    }
+    
+    if(server->read_idle_timeout){
+        due = user->last_read + server->read_idle_timeout - now;
+        next = due < next ? due : next;
+    }
+    
+    pt_timewheel_add(server->wheel, node, next);
+}
+
+/*
+ 写空闲的定时器
+ */
+static void pt_server_write_timer_cb(struct pt_timewheel_node *node)
+{
+    struct pt_sclient *user = node->data;
+    struct pt_server *server = user->server;
+    uint64_t now = uv_now(server->loop);
+    
+    if(now - user->last_write >= server->write_idle_timeout){
+        if(server->on_idle){
+            server->on_idle(user, PT_IDLE_WRITE);
+        } else {
+            pt_server_send_heartbeat(user);
+        }
+        
+        if(user->connected == false) return;
+        
+        //回调中没有发送数据，也重新开始计时
+        if(now - user->last_write >= server->write_idle_timeout){
+            user->last_write = now;
+        }
+    }
+    
+    pt_timewheel_add(server->wheel, node, user->last_write + server->write_idle_timeout - now);
+}
+
+/*
+ 连接建立后开始空闲计时
+ */
+static void pt_server_idle_start(struct pt_sclient *user)
+{
+    struct pt_server *server = user->server;
+    uint64_t now = uv_now(server->loop);
+    
+    user->last_read = now;
+    user->last_write = now;
+    user->last_ping = now;
+    
+    if(server->wheel == NULL) return;
+    
+    pt_timewheel_node_init(&user->read_timer, pt_server_read_timer_cb, user);
+    pt_timewheel_node_init(&user->write_timer, pt_server_write_timer_cb, user);
+    
+    if(server->read_idle_timeout || server->heartbeat_interval){
+        pt_server_read_timer_cb(&user->read_timer);
+    }
+    if(server->write_idle_timeout){
+        pt_timewheel_add(server->wheel, &user->write_timer, server->write_idle_timeout);
+    }
+}
+
+/*
+ 新用户连接成功后的公共处理
+ 
+ 最大用户数量，执行用户自定义的通知信息，添加到clients表中
+ 返回false时用户已经被关闭
+ */
+static qboolean pt_server_accept_user(struct pt_server *server, struct pt_sclient *user)
+{
+    //设置客户端连接已经成功
+    user->connected = true;
     
     //限制当前服务器的最大连接数
     if(server->number_of_connected + 1 > server->number_of_max_connected){
         pt_server_close_conn(user, false);
-        return;
+        return false;
     }
     
     //进行数据过滤，如果用户Connect请求被on_connect干掉则直接断开用户
     if(server->on_connect && server->on_connect(user) == false){
         pt_server_close_conn(user, false);
-        return;
+        return false;
     }
     
     if(server->enable_encrypt){
@@ -269,8 +940,151 @@ static void pt_server_connection_cb(uv_stream_t* listener, int status)
         RC4_set_key(&user->encrypt_ctx, sizeof(server->encrypt_key), (const unsigned char*)&server->encrypt_key);
     }
     
+    if(server->number_of_rate_rules){
+        uint32_t i;
+        
+        user->rate_limits = malloc(sizeof(struct pt_rate_limit) * server->number_of_rate_rules);
+        if(user->rate_limits == NULL){
+            FATAL("malloc user->rate_limits failed", __FUNCTION__, __FILE__, __LINE__);
+            abort();
+        }
+        
+        for(i = 0; i < server->number_of_rate_rules; i++)
+        {
+            pt_rate_limit_init(&user->rate_limits[i], &server->rate_rules[i], uv_now(server->loop));
+        }
+    }
+    
     server->number_of_connected++;
     
+    //添加到搜索树内
+    pt_table_insert(server->clients, user->id, user);
+    
+    pt_server_idle_start(user);
+    
+    return true;
+}
+
+#ifdef __linux__
+/*
+ 共享内存连接收到数据，length == 0 表示对端断开
+ */
+static void pt_server_shm_on_data(struct pt_shm *shm, const unsigned char *data, uint32_t length)
+{
+    struct pt_sclient *user = shm->data;
+    
+    if(length == 0){
+        DBGPRINT("shm peer closed");
+        pt_server_close_conn(user, true);
+        return;
+    }
+    
+    pt_server_on_data(user, data, length);
+}
+
+static void pt_server_shm_on_sent(struct pt_shm *shm, uint32_t length)
+{
+    pt_server_check_drain(shm->data);
+}
+
+static void pt_server_shm_on_close(struct pt_shm *shm)
+{
+    pt_sclient_free(shm->data);
+}
+
+/*
+ 共享内存握手完成，之后和普通连接的处理相同
+ */
+static void pt_server_shm_on_ready(struct pt_shm *shm, int status)
+{
+    struct pt_sclient *user = shm->data;
+    
+    if(status != 0){
+        pt_shm_close(shm);
+        return;
+    }
+    
+    pt_server_accept_user(user->server, user);
+}
+
+//握手使用的unix socket已经dup到pt_shm中，这里不需要释放任何资源
+static void pt_server_on_close_shm_sock(uv_handle_t* peer)
+{
+}
+#endif
+
+static void pt_server_set_sock_busy_poll(struct pt_sclient *user)
+{
+    int fd;
+    
+    if(uv_fileno((uv_handle_t*)&user->sock, &fd) == 0){
+        pt_spin_busy_poll(fd, user->server->busy_poll);
+    }
+}
+
+/*
+ libuv的connection通知
+ 
+ 处理新用户连接，最大用户数量，创建pt_sclient结构并添加到clients表中
+ 执行用户自定义的通知信息
+ */
+static void pt_server_connection_cb(uv_stream_t* listener, int status)
+{
+    int r;
+    struct pt_server *server = listener->data;
+    struct pt_sclient *user = pt_sclient_new(server);
+    
+    user->server = server;
+    
+    if(server->is_pipe){
+        uv_pipe_init(listener->loop, &user->sock.pipe, true);
+    } else {
+        uv_tcp_init(listener->loop, &user->sock.tcp);
+    }
+    
+    user->sock.stream.data = user;
+    
+    r = uv_accept(listener, (uv_stream_t*)&user->sock);
+    
+    //如果accept失败，写出错误日志，并关掉这个sock
+    if( r != 0 )
+    {
+        char error[255];
+        sprintf(error, "uv_accept error:%s",uv_strerror(r));
+        ERROR(error, __FUNCTION__, __FILE__, __LINE__);
+        uv_close((uv_handle_t*)&user->sock, pt_server_on_close_conn);
+        return;
+    }
+    
+#ifdef __linux__
+    //共享内存模式，unix socket只用于握手和检测断开
+    if(server->is_shm){
+        int fd = -1;
+        
+        uv_fileno((uv_handle_t*)&user->sock, &fd);
+        fd = dup(fd);
+        
+        if(fd < 0){
+            ERROR("dup shm socket failed", __FUNCTION__, __FILE__, __LINE__);
+            uv_close((uv_handle_t*)&user->sock, pt_server_on_close_conn);
+            return;
+        }
+        
+        uv_close((uv_handle_t*)&user->sock, pt_server_on_close_shm_sock);
+        
+        user->shm = pt_shm_accept(server->loop, fd, user, pt_server_shm_on_ready,
+                                  pt_server_shm_on_data, pt_server_shm_on_close);
+        if(user->shm){
+            user->shm->on_sent = pt_server_shm_on_sent;
+        }
+        return;
+    }
+#endif
+    
+    if(pt_server_accept_user(server, user) == false){
+        return;
+    }
+    
     if(server->is_pipe == false){
         //设置用户30秒后做keepalive检查
         uv_tcp_keepalive(&user->sock.tcp, true, server->keep_alive_delay);
@@ -279,228 +1093,2194 @@ static void pt_server_connection_cb(uv_stream_t* listener, int status)
         if(server->no_delay){
             uv_tcp_nodelay(&user->sock.tcp, true);
         }
+        
+        if(server->busy_poll){
+            pt_server_set_sock_busy_poll(user);
+        }
+    }
+    
+    //开始读取网络数据
+    r = uv_read_start(&user->sock.stream, pt_server_alloc_buf, server->read_cb);
+    
+    if( r != 0 )
+    {
+        char error[255];
+        sprintf(error, "uv_read_start error:%s",uv_strerror(r));
+        ERROR(error, __FUNCTION__, __FILE__, __LINE__);
+        
+        //修复一个bug，之前直接使用uv_close，正确应该使用这个函数
+        pt_server_close_conn(user, true);
+        return;
+    }
+}
+
+#ifdef PT_HAVE_URING
+/*
+ io_uring后端收到数据或连接断开
+ */
+static void pt_server_uring_on_data(struct pt_uring_conn *conn, const unsigned char *data, int length)
+{
+    struct pt_sclient *user = conn->data;
+    
+    if(length <= 0){
+        DBGPRINT("uring recv <= 0");
+        pt_server_close_conn(user, true);
+        return;
+    }
+    
+    pt_server_on_data(user, data, (uint32_t)length);
+}
+
+static void pt_server_uring_on_sent(struct pt_uring_conn *conn, uint32_t length)
+{
+    pt_server_check_drain(conn->data);
+}
+
+/*
+ io_uring后端连接的所有请求都已完成，释放用户资源
+ */
+static void pt_server_uring_on_close(struct pt_uring_conn *conn)
+{
+    pt_sclient_free(conn->data);
+}
+
+static void pt_server_uring_sockopt(struct pt_server *server, int fd)
+{
+    int on = 1;
+    
+    if(server->is_pipe) return;
+    
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &server->keep_alive_delay, sizeof(server->keep_alive_delay));
+    
+    if(server->no_delay){
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    
+    if(server->busy_poll){
+        pt_spin_busy_poll(fd, server->busy_poll);
+    }
+}
+
+/*
+ multishot accept的完成通知，每个新连接产生一个cqe
+ */
+static void pt_server_uring_accept_cb(struct pt_uring_req *req, int res, uint32_t flags)
+{
+    struct pt_server *server = req->data;
+    struct pt_sclient *user;
+    
+    if(res >= 0)
+    {
+        //服务器正在关闭，不再接受新连接
+        if(server->is_closing){
+            close(res);
+        } else {
+            user = pt_sclient_new(server);
+            user->server = server;
+            user->uring = pt_uring_conn_new(server->uring, res, user);
+            user->uring->on_data = pt_server_uring_on_data;
+            user->uring->on_close = pt_server_uring_on_close;
+            user->uring->on_sent = pt_server_uring_on_sent;
+            
+            pt_server_uring_sockopt(server, res);
+            
+            if(pt_server_accept_user(server, user)){
+                pt_uring_conn_start(user->uring, pt_server_uring_on_data, pt_server_uring_on_close);
+            }
+        }
+    }
+    else if(res != -ECANCELED)
+    {
+        char error[255];
+        sprintf(error, "uring accept error:%s",strerror(-res));
+        ERROR(error, __FUNCTION__, __FILE__, __LINE__);
+    }
+    
+    if(flags & IORING_CQE_F_MORE) return;
+    
+    //multishot结束，服务器仍在运行则重新投递
+    if(server->is_closing == false){
+        pt_uring_accept(server->uring, server->accept_req, server->listen_fd);
+        return;
+    }
+    
+    close(server->listen_fd);
+    server->listen_fd = -1;
+    server->is_closing = false;
+    server->is_startup = false;
+    
+    pt_uring_release(server->uring);
+    server->uring = NULL;
+}
+
+static qboolean pt_server_uring_listen(struct pt_server *server, int domain, const struct sockaddr *addr, socklen_t length)
+{
+    int on = 1;
+    int fd;
+    
+    fd = socket(domain, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0){
+        pt_server_log("socket failed:%s", uv_translate_sys_error(errno), __FUNCTION__, __FILE__, __LINE__);
+        return false;
+    }
+    
+    if(domain != AF_UNIX){
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    }
+    
+    if(bind(fd, addr, length) != 0){
+        pt_server_log("bind failed:%s", uv_translate_sys_error(errno), __FUNCTION__, __FILE__, __LINE__);
+        close(fd);
+        return false;
+    }
+    
+    if(listen(fd, SOMAXCONN) != 0){
+        pt_server_log("listen failed:%s", uv_translate_sys_error(errno), __FUNCTION__, __FILE__, __LINE__);
+        close(fd);
+        return false;
+    }
+    
+    server->uring = pt_uring_get(server->loop);
+    if(server->uring == NULL){
+        close(fd);
+        return false;
+    }
+    
+    if(server->accept_req == NULL){
+        server->accept_req = malloc(sizeof(struct pt_uring_req));
+    }
+    server->accept_req->cb = pt_server_uring_accept_cb;
+    server->accept_req->data = server;
+    server->listen_fd = fd;
+    
+    if(pt_uring_accept(server->uring, server->accept_req, fd) == false){
+        pt_uring_release(server->uring);
+        server->uring = NULL;
+        close(fd);
+        return false;
+    }
+    
+    server->is_startup = true;
+    return true;
+}
+#endif
+
+/*
+ UDP连接需要发送一个数据包
+ */
+static void pt_server_udp_output(struct pt_rudp *rudp, const unsigned char *data, uint32_t length)
+{
+    struct pt_sclient *user = rudp->data;
+    uv_buf_t buf = uv_buf_init((char*)data, length);
+    
+    //UDP不保证送达，发送失败和丢包一样由重传处理
+    uv_udp_try_send(&user->server->listener.udp, &buf, 1, (const struct sockaddr*)&user->udp_addr);
+}
+
+/*
+ 不可靠通道的消息不能延迟，超过限速时丢弃，返回false
+ */
+static qboolean pt_server_udp_check_rate(struct pt_sclient *user, uint16_t id, uint32_t length)
+{
+    uint64_t wait;
+    int policy;
+    
+    if(user->rate_limits == NULL) return true;
+    
+    policy = pt_rate_limit_check(user->server->rate_rules, user->rate_limits, user->server->number_of_rate_rules,
+                                 id, length, uv_now(user->server->loop), &wait);
+    if(policy == PT_RATE_DISCONNECT){
+        LOG("rate limit exceeded", __FUNCTION__, __FILE__, __LINE__);
+        pt_server_close_conn(user, true);
+    }
+    
+    return policy == PT_RATE_PASS;
+}
+
+/*
+ 不可靠通道的每个消息都是一个完整的数据包，加密时每个数据包单独解密
+ 解密后和可靠通道的数据包格式相同，以包序列开头
+ 批量包的子消息逐个检查限速，暂停读取后剩余的子消息丢弃
+ */
+static void pt_server_udp_on_datagram(struct pt_sclient *user, const unsigned char *data, uint32_t length)
+{
+    const struct net_header *header = (const struct net_header*)data;
+    struct pt_server *server = user->server;
+    struct pt_buffer *buff;
+    const unsigned char *serial = NULL;
+    const unsigned char *pos;
+    const unsigned char *msg;
+    uint32_t remain;
+    uint32_t msg_length;
+    uint32_t sn;
+    uint16_t id;
+    
+    if(length < sizeof(struct net_header) || header->magic != PACKET_MAGIC || header->length != length){
+        DBGPRINT("udp datagram invalid");
+        return;
+    }
+    
+    buff = pt_buffer_new(length);
+    pt_buffer_write(buff, data, length);
+    
+    if(server->enable_encrypt){
+        //丢包和乱序不影响其他数据包，伪造和重放的数据包直接丢弃
+        if(pt_decrypt_datagram(server->encrypt_key, buff, &sn) == false ||
+           (user->unrel_received && (int32_t)(sn - user->unrel_serial) <= 0)){
+            DBGPRINT("udp datagram decrypt failed");
+            pt_buffer_free(buff);
+            return;
+        }
+        
+        user->unrel_received = true;
+        user->unrel_serial = sn;
+        serial = pt_get_packet_buffer(buff);
+    }
+    
+    user->last_read = uv_now(server->loop);
+    
+    if(header->id == ID_TRANSMIT_BATCH){
+        pos = pt_get_packet_buffer(buff) + (serial ? sizeof(uint32_t) : 0);
+        remain = pt_get_packet_size(buff) - (serial ? sizeof(uint32_t) : 0);
+        
+        while(user->connected && PT_SERVER_READ_HELD(user) == false &&
+              pt_batch_next(&pos, &remain, &id, &msg, &msg_length))
+        {
+            if(pt_server_udp_check_rate(user, id, msg_length)){
+                pt_server_batch_receive(user, serial, id, msg, msg_length);
+            }
+        }
+    } else if(pt_server_udp_check_rate(user, header->id, length) && server->on_receive){
+        server->on_receive(user, buff);
+    }
+    
+    pt_buffer_free(buff);
+}
+
+static void pt_server_udp_on_message(struct pt_rudp *rudp, int channel, const unsigned char *data, uint32_t length)
+{
+    struct pt_sclient *user = rudp->data;
+    
+    if(user->connected == false) return;
+    
+    if(channel == PT_RUDP_CHANNEL_RELIABLE){
+        pt_server_on_data(user, data, length);
+    } else if(PT_SERVER_READ_HELD(user) == false) {
+        //暂停读取时不可靠通道的消息直接丢弃
+        pt_server_udp_on_datagram(user, data, length);
+    }
+}
+
+static void pt_server_udp_on_event(struct pt_rudp *rudp, int event)
+{
+    if(event == PT_RUDP_EVENT_CLOSED){
+        DBGPRINT("udp connection closed");
+        pt_server_close_conn(rudp->data, true);
+    }
+}
+
+static void pt_server_udp_alloc_buf(uv_handle_t* handle,size_t suggested_size,uv_buf_t* buf)
+{
+    struct pt_server *server = handle->data;
+    
+    buf->base = server->udp_buf;
+    buf->len = PT_RUDP_MTU;
+}
+
+/*
+ 创建一个新的UDP连接，只有SYN可以创建连接
+ */
+static struct pt_sclient* pt_server_udp_accept(struct pt_server *server, uint32_t conv, const struct sockaddr *addr)
+{
+    struct pt_sclient *user = pt_sclient_new(server);
+    
+    user->server = server;
+    user->rudp = pt_rudp_new(conv, user, pt_server_udp_output, pt_server_udp_on_message, pt_server_udp_on_event);
+    user->rudp->stream = true;
+    memcpy(&user->udp_addr, addr, addr->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+    
+    user->udp_next = server->udp_active;
+    if(server->udp_active){
+        server->udp_active->udp_prev = user;
+    }
+    server->udp_active = user;
+    pt_table_insert(server->udp_sessions, conv, user);
+    
+    pt_rudp_accept(user->rudp, (uint32_t)uv_now(server->loop));
+    
+    if(pt_server_accept_user(server, user) == false){
+        return NULL;
+    }
+    
+    return user;
+}
+
+static void pt_server_udp_recv_cb(uv_udp_t* handle, ssize_t nread, const uv_buf_t* buf, const struct sockaddr* addr, unsigned flags)
+{
+    struct pt_server *server = handle->data;
+    struct pt_sclient *user;
+    uint32_t conv;
+    uint8_t cmd;
+    
+    if(nread <= 0 || addr == NULL) return;
+    
+    if(pt_rudp_peek((unsigned char*)buf->base, (uint32_t)nread, &conv, &cmd) == false) return;
+    
+    user = pt_table_find(server->udp_sessions, conv);
+    
+    if(user == NULL)
+    {
+        if(cmd != PT_RUDP_CMD_SYN) return;
+        
+        user = pt_server_udp_accept(server, conv, addr);
+        if(user == NULL) return;
+    }
+    else if(memcmp(&user->udp_addr, addr, addr->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in)) != 0)
+    {
+        //连接ID相同但地址不同，丢弃
+        return;
+    }
+    
+    pt_rudp_input(user->rudp, (unsigned char*)buf->base, (uint32_t)nread, (uint32_t)uv_now(server->loop));
+    
+    //收到确认后发送队列可能减少
+    pt_server_check_drain(user);
+}
+
+/*
+ 驱动所有UDP连接的重传，心跳和超时，并释放已经关闭的连接
+ */
+static void pt_server_udp_timer_cb(uv_timer_t* handle)
+{
+    struct pt_server *server = handle->data;
+    struct pt_sclient *user;
+    struct pt_sclient *next;
+    uint32_t current = (uint32_t)uv_now(server->loop);
+    
+    while(server->udp_closed){
+        user = server->udp_closed;
+        server->udp_closed = user->udp_next;
+        pt_sclient_free(user);
+    }
+    
+    for(user = server->udp_active; user; user = next){
+        next = user->udp_next;
+        pt_rudp_update(user->rudp, current);
+        pt_server_check_drain(user);
+    }
+}
+
+struct pt_server* pt_server_new()
+{
+    struct pt_server *server = (struct pt_server *)malloc(sizeof(struct pt_server));
+    
+    if(server == NULL){
+        FATAL("malloc pt_server failed",__FUNCTION__,__FILE__,__LINE__);
+        abort();
+    }
+    
+    bzero(server, sizeof(struct pt_server));
+    
+    server->clients = pt_table_new();
+    
+    //初始化libuv的回调函数
+    server->connection_cb = pt_server_connection_cb;
+    server->read_cb = pt_server_read_cb;
+    server->write_cb = pt_server_write_cb;
+    server->number_of_max_send_queue = PT_SERVER_MAX_SEND_QUEUE;
+    server->send_high_watermark = PT_SERVER_SEND_HIGH_WATERMARK;
+    server->send_low_watermark = PT_SERVER_SEND_LOW_WATERMARK;
+    server->dispatch_packets = PT_SERVER_DISPATCH_PACKETS;
+    server->dispatch_time = PT_SERVER_DISPATCH_TIME;
+    server->listen_fd = -1;
+    
+    return server;
+}
+
+
+
+void pt_server_free(struct pt_server *srv)
+{
+    if(srv->is_startup == true){
+        FATAL("server not shutdown", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+    pt_table_free(srv->clients);
+    
+    if(srv->accept_req){
+        free(srv->accept_req);
+    }
+    
+    if(srv->udp_sessions){
+        pt_table_free(srv->udp_sessions);
+    }
+    
+    while(srv->disconnect_hooks){
+        pt_server_remove_disconnect_hook(srv, srv->disconnect_hooks->hook, srv->disconnect_hooks->udata);
+    }
+    
+    if(srv->handoff_buf){
+        pt_buffer_free(srv->handoff_buf);
+    }
+    
+    free(srv->rate_rules);
+    free(srv->udp_buf);
+    free(srv->pipe_path);
+    free(srv);
+}
+
+void pt_server_add_disconnect_hook(struct pt_server *server, pt_server_disconnect_hook hook, void *udata)
+{
+    struct pt_server_hook *node = malloc(sizeof(struct pt_server_hook));
+    struct pt_server_hook **tail = &server->disconnect_hooks;
+    
+    if(node == NULL){
+        FATAL("malloc pt_server_hook failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+    
+    node->next = NULL;
+    node->hook = hook;
+    node->udata = udata;
+    
+    while(*tail){
+        tail = &(*tail)->next;
+    }
+    *tail = node;
+}
+
+void pt_server_remove_disconnect_hook(struct pt_server *server, pt_server_disconnect_hook hook, void *udata)
+{
+    struct pt_server_hook **curr = &server->disconnect_hooks;
+    struct pt_server_hook *node;
+    
+    while(*curr){
+        node = *curr;
+        if(node->hook == hook && node->udata == udata){
+            *curr = node->next;
+            free(node);
+            return;
+        }
+        curr = &node->next;
+    }
+}
+
+qboolean pt_server_set_backend(struct pt_server *server, int backend)
+{
+    if(server->is_startup){
+        LOG("server already startup",__FUNCTION__,__FILE__,__LINE__);
+        return false;
+    }
+    
+#ifndef PT_HAVE_URING
+    if(backend == PT_BACKEND_URING){
+        LOG("io_uring backend not compiled, define PT_HAVE_URING",__FUNCTION__,__FILE__,__LINE__);
+        return false;
+    }
+#endif
+    
+    server->backend = backend;
+    return true;
+}
+
+void pt_server_set_nodelay(struct pt_server *server, qboolean nodelay)
+{
+    server->no_delay = nodelay;
+}
+
+void pt_server_set_busy_poll(struct pt_server *server, uint32_t usec)
+{
+    server->busy_poll = usec;
+}
+
+void pt_server_init(struct pt_server *server, uv_loop_t *loop, int max_conn, int keep_alive_delay,pt_server_on_connect on_conn,
+                        pt_server_on_receive on_receive, pt_server_on_disconnect on_disconnect)
+{
+    if(server->is_init){
+        LOG("server already initialize",__FUNCTION__,__FILE__,__LINE__);
+        return;
+    }
+    
+    server->number_of_max_connected = max_conn;
+    server->loop = loop;
+    server->on_connect = on_conn;
+    server->on_receive = on_receive;
+    server->on_disconnect = on_disconnect;
+    server->keep_alive_delay = keep_alive_delay;
+    
+    server->is_init = true;
+}
+
+qboolean pt_server_start(struct pt_server *server, const char* host, uint16_t port)
+{
+    int r;
+    struct sockaddr_in adr;
+    
+    
+    if(!server->is_init){
+        LOG("server not initialize",__FUNCTION__,__FILE__,__LINE__);
+        return false;
+    }
+    
+    uv_ip4_addr(host, port, &adr);
+    
+#ifdef PT_HAVE_URING
+    if(server->backend == PT_BACKEND_URING){
+        server->is_pipe = false;
+        return pt_server_uring_listen(server, AF_INET, (const struct sockaddr*)&adr, sizeof(adr));
+    }
+#endif
+    
+    r = uv_tcp_init(server->loop, &server->listener.tcp);
+    if(r != 0){
+        char log[256];
+        sprintf(log,"uv_tcp_init failed:%s",uv_strerror(r));
+        LOG(log,__FUNCTION__, __FILE__,__LINE__);
+    }
+    
+    server->is_pipe = false;
+    server->listener.stream.data = server;
+    
+    r = uv_tcp_bind(&server->listener.tcp, (const struct sockaddr*)&adr, 0);
+    
+    if(r != 0){
+        pt_server_log("uv_tcp_bind failed:%s",r, __FUNCTION__, __FILE__, __LINE__);
+        return false;
+    }
+    
+    r = uv_listen((uv_stream_t*)&server->listener, SOMAXCONN, server->connection_cb);
+    if(r != 0){
+        pt_server_log("uv_listen failed:%s",r, __FUNCTION__, __FILE__, __LINE__);
+        return false;
+    }
+    
+    server->is_startup = true;
+    return true;
+}
+
+
+/*
+ 删除之前的进程遗留的unix socket文件
+ 路径不是socket或者还有进程在监听(例如热重启时的旧进程)时返回false，不能删除
+ */
+static qboolean pt_server_remove_stale_pipe(const char *path)
+{
+    struct sockaddr_un un;
+    struct stat st;
+    int fd;
+    int r;
+    
+    if(lstat(path, &st) != 0) return true;
+    
+    if(S_ISSOCK(st.st_mode) == false){
+        LOG("pipe path is not a socket",__FUNCTION__,__FILE__,__LINE__);
+        return false;
+    }
+    
+    if(strlen(path) >= sizeof(un.sun_path)){
+        LOG("pipe path too long",__FUNCTION__,__FILE__,__LINE__);
+        return false;
+    }
+    
+    bzero(&un, sizeof(un));
+    un.sun_family = AF_UNIX;
+    strcpy(un.sun_path, path);
+    
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) return false;
+    
+    r = connect(fd, (const struct sockaddr*)&un, sizeof(un));
+    if(r != 0) r = errno;
+    close(fd);
+    
+    if(r == 0){
+        LOG("pipe path in use",__FUNCTION__,__FILE__,__LINE__);
+        return false;
+    }
+    
+    //没有进程监听的socket文件
+    if(r == ECONNREFUSED || r == ENOENT){
+        unlink(path);
+        return true;
+    }
+    
+    pt_server_log("check pipe path failed:%s", uv_translate_sys_error(r), __FUNCTION__, __FILE__, __LINE__);
+    return false;
+}
+
+/*
+ 创建并绑定监听用的unix socket，成功返回fd，失败返回libuv的错误码
+ 不使用uv_pipe_bind，libuv关闭时会删除它绑定的文件，路径由pt_server保存并在关闭时删除
+ */
+static int pt_server_bind_pipe(const char *path)
+{
+    struct sockaddr_un un;
+    int fd;
+    int r;
+    
+    if(strlen(path) >= sizeof(un.sun_path)){
+        return UV_ENAMETOOLONG;
+    }
+    
+    bzero(&un, sizeof(un));
+    un.sun_family = AF_UNIX;
+    strcpy(un.sun_path, path);
+    
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0){
+        return uv_translate_sys_error(errno);
+    }
+    
+    if(bind(fd, (const struct sockaddr*)&un, sizeof(un)) != 0){
+        r = errno;
+        close(fd);
+        return uv_translate_sys_error(r);
+    }
+    
+    return fd;
+}
+
+qboolean pt_server_start_pipe(struct pt_server *server, const char *path)
+{
+    int r;
+    int fd;
+    
+    if(!server->is_init){
+        LOG("server not initialize",__FUNCTION__,__FILE__,__LINE__);
+        return false;
+    }
+    
+#ifdef PT_HAVE_URING
+    if(server->backend == PT_BACKEND_URING){
+        struct sockaddr_un un;
+        
+        if(strlen(path) >= sizeof(un.sun_path)){
+            LOG("pipe path too long",__FUNCTION__,__FILE__,__LINE__);
+            return false;
+        }
+        
+        bzero(&un, sizeof(un));
+        un.sun_family = AF_UNIX;
+        strcpy(un.sun_path, path);
+        
+        server->is_pipe = true;
+        if(pt_server_remove_stale_pipe(path) == false) return false;
+        return pt_server_uring_listen(server, AF_UNIX, (const struct sockaddr*)&un, sizeof(un));
+    }
+#endif
+    
+    //监听用的pipe不能是ipc模式，新版本libuv的uv_listen会返回EINVAL
+    r = uv_pipe_init(server->loop, &server->listener.pipe, false);
+    if(r != 0){
+        char log[256];
+        sprintf(log,"uv_tcp_init failed:%s",uv_strerror(r));
+        LOG(log,__FUNCTION__, __FILE__,__LINE__);
+    }
+    
+    server->is_pipe = true;
+    server->listener.stream.data = server;
+    
+    if(pt_server_remove_stale_pipe(path) == false){
+        uv_close((uv_handle_t*)&server->listener, NULL);
+        return false;
+    }
+    
+    fd = pt_server_bind_pipe(path);
+    if(fd < 0){
+        pt_server_log("bind pipe failed:%s",fd, __FUNCTION__, __FILE__, __LINE__);
+        uv_close((uv_handle_t*)&server->listener, NULL);
+        return false;
+    }
+    
+    r = uv_pipe_open(&server->listener.pipe, fd);
+    if(r != 0){
+        pt_server_log("uv_pipe_open failed:%s",r, __FUNCTION__, __FILE__, __LINE__);
+        close(fd);
+        unlink(path);
+        uv_close((uv_handle_t*)&server->listener, NULL);
+        return false;
+    }
+    
+    server->pipe_path = strdup(path);
+    
+    r = uv_listen(&server->listener.stream, SOMAXCONN, server->connection_cb);
+    if(r != 0){
+        pt_server_log("uv_listen failed:%s",r, __FUNCTION__, __FILE__, __LINE__);
+        return false;
+    }
+    
+    server->is_startup = true;
+    return true;
+}
+
+
+
+qboolean pt_server_start_shm(struct pt_server *server, const char *path)
+{
+#ifdef __linux__
+    if(server->backend != PT_BACKEND_LIBUV){
+        LOG("shm transport requires libuv backend",__FUNCTION__,__FILE__,__LINE__);
+        return false;
+    }
+    
+    server->is_shm = true;
+    return pt_server_start_pipe(server, path);
+#else
+    LOG("shm transport not supported",__FUNCTION__,__FILE__,__LINE__);
+    return false;
+#endif
+}
+
+qboolean pt_server_start_udp(struct pt_server *server, const char* host, uint16_t port)
+{
+    int r;
+    struct sockaddr_in adr;
+    
+    if(!server->is_init){
+        LOG("server not initialize",__FUNCTION__,__FILE__,__LINE__);
+        return false;
+    }
+    
+    if(server->backend != PT_BACKEND_LIBUV){
+        LOG("udp transport requires libuv backend",__FUNCTION__,__FILE__,__LINE__);
+        return false;
+    }
+    
+    uv_ip4_addr(host, port, &adr);
+    
+    r = uv_udp_init(server->loop, &server->listener.udp);
+    if(r != 0){
+        pt_server_log("uv_udp_init failed:%s",r, __FUNCTION__, __FILE__, __LINE__);
+        return false;
+    }
+    
+    server->is_udp = true;
+    server->listener.udp.data = server;
+    
+    if(server->udp_sessions == NULL){
+        server->udp_sessions = pt_table_new();
+    }
+    
+    if(server->udp_buf == NULL){
+        server->udp_buf = malloc(PT_RUDP_MTU);
+        if(server->udp_buf == NULL){
+            FATAL("malloc server->udp_buf failed", __FUNCTION__, __FILE__, __LINE__);
+            abort();
+        }
+    }
+    
+    r = uv_udp_bind(&server->listener.udp, (const struct sockaddr*)&adr, UV_UDP_REUSEADDR);
+    if(r != 0){
+        pt_server_log("uv_udp_bind failed:%s",r, __FUNCTION__, __FILE__, __LINE__);
+        uv_close((uv_handle_t*)&server->listener, NULL);
+        return false;
+    }
+    
+    r = uv_udp_recv_start(&server->listener.udp, pt_server_udp_alloc_buf, pt_server_udp_recv_cb);
+    if(r != 0){
+        pt_server_log("uv_udp_recv_start failed:%s",r, __FUNCTION__, __FILE__, __LINE__);
+        uv_close((uv_handle_t*)&server->listener, NULL);
+        return false;
+    }
+    
+    uv_timer_init(server->loop, &server->udp_timer);
+    server->udp_timer.data = server;
+    uv_timer_start(&server->udp_timer, pt_server_udp_timer_cb, PT_RUDP_INTERVAL, PT_RUDP_INTERVAL);
+    
+    server->is_startup = true;
+    return true;
+}
+
+void pt_server_set_encrypt(struct pt_server *server, const uint32_t encrypt_key[4])
+{
+    server->enable_encrypt = true;
+    
+    for(int i =0;i<4;i++)
+    {
+        server->encrypt_key[i] = encrypt_key[i];
+    }
+}
+
+/*
+ 底层发送队列中未写入socket的字节数
+ */
+static size_t pt_server_backend_queue_size(struct pt_sclient *user)
+{
+#ifdef PT_HAVE_URING
+    if(user->uring){
+        return user->uring->queue_size;
+    }
+#endif
+#ifdef __linux__
+    if(user->shm){
+        return user->shm->pending_size;
+    }
+#endif
+    if(user->rudp){
+        return pt_rudp_queue_size(user->rudp);
+    }
+    return user->sock.stream.write_queue_size;
+}
+
+size_t pt_server_send_queue_size(struct pt_sclient *user)
+{
+    return pt_server_backend_queue_size(user) + user->prio_size;
+}
+
+/*
+ 发送后检查是否超过高水位
+ */
+static void pt_server_check_full(struct pt_sclient *user)
+{
+    if(user->write_blocked == false && pt_server_send_queue_size(user) >= user->send_high_watermark){
+        user->write_blocked = true;
+    }
+}
+
+/*
+ 写入完成后检查是否降到低水位以下，通知用户可以继续发送
+ */
+static void pt_server_flush_priority(struct pt_sclient *user);
+
+static void pt_server_check_drain(struct pt_sclient *user)
+{
+    //底层写入完成，继续写入排队的数据包
+    if(user->prio_size && user->connected){
+        pt_server_flush_priority(user);
+    }
+    
+    if(user->write_blocked == false || user->connected == false) return;
+    
+    if(pt_server_send_queue_size(user) > user->send_low_watermark) return;
+    
+    user->write_blocked = false;
+    
+    if(user->server->on_drain){
+        user->server->on_drain(user);
+    }
+}
+
+/*
+ 将数据写入底层
+ */
+static qboolean pt_server_write(struct pt_sclient *user, struct pt_buffer *buff)
+{
+    if(user->rudp){
+        pt_rudp_send(user->rudp, PT_RUDP_CHANNEL_RELIABLE, buff->buff, buff->length);
+        pt_buffer_free(buff);
+        return true;
+    }
+    
+    struct pt_wreq *wreq = malloc(sizeof(struct pt_wreq));
+    
+    wreq->buff = buff;
+    wreq->data = user;
+    wreq->buf = uv_buf_init((char*)buff->buff, buff->length);
+    
+#ifdef PT_HAVE_URING
+    if(user->uring){
+        pt_uring_conn_write(user->uring, wreq);
+        return true;
+    }
+#endif
+    
+#ifdef __linux__
+    if(user->shm){
+        pt_shm_write(user->shm, wreq);
+        return true;
+    }
+#endif
+    
+    if (uv_write(&wreq->req, (uv_stream_t*)&user->sock, &wreq->buf, 1, user->server->write_cb)) {
+        pt_buffer_free(wreq->buff);
+        free(wreq);
+        return false;
+    }
+    
+    return true;
+}
+
+/*
+ 选择下一个要写入的优先级队列
+ */
+static int pt_server_next_priority(struct pt_sclient *user)
+{
+    int level;
+    
+    for(level = PT_PRIORITY_CONTROL; level < PT_PRIORITY_BULK; level++)
+    {
+        if(user->prio_head[level] == NULL) continue;
+        
+        //大块数据等待太久，让一个大块数据包先发送
+        if(user->prio_head[PT_PRIORITY_BULK]){
+            if(user->bulk_starve >= PT_SERVER_BULK_STARVE){
+                user->bulk_starve = 0;
+                return PT_PRIORITY_BULK;
+            }
+            user->bulk_starve++;
+        }
+        return level;
+    }
+    
+    user->bulk_starve = 0;
+    return PT_PRIORITY_BULK;
+}
+
+/*
+ 底层发送队列较少时，按优先级写入排队的数据包
+ */
+static void pt_server_flush_priority(struct pt_sclient *user)
+{
+    struct pt_buffer *buff;
+    int level;
+    
+    while(user->prio_size && user->connected && pt_server_backend_queue_size(user) < PT_SERVER_PRIORITY_INFLIGHT)
+    {
+        level = pt_server_next_priority(user);
+        
+        buff = user->prio_head[level];
+        user->prio_head[level] = buff->next;
+        if(user->prio_head[level] == NULL){
+            user->prio_tail[level] = NULL;
+        }
+        buff->next = NULL;
+        user->prio_size -= buff->length;
+        
+        pt_server_write(user, buff);
+    }
+}
+
+/*
+ 发送数据到客户端
+ */
+qboolean pt_server_send(struct pt_sclient *user, struct pt_buffer *buff)
+{
+    return pt_server_send_priority(user, buff, PT_PRIORITY_REALTIME);
+}
+
+qboolean pt_server_send_priority(struct pt_sclient *user, struct pt_buffer *buff, int priority)
+{
+    qboolean r = true;
+    
+    if(user->connected == false){
+        pt_buffer_free(buff);
+        return false;
+    }
+    
+    user->last_write = uv_now(user->server->loop);
+    
+    //防止服务器发包过多导致服务器的内存耗尽
+    if(pt_server_send_queue_size(user) + buff->length > (size_t)user->server->number_of_max_send_queue){
+        DBGPRINT("user datagram overflow");
+        pt_server_close_conn(user, true);
+        pt_buffer_free(buff);
+        return false;
+    }
+    
+    if(priority < PT_PRIORITY_CONTROL || priority > PT_PRIORITY_BULK){
+        priority = PT_PRIORITY_REALTIME;
+    }
+    
+    //没有排队的数据并且底层不忙时直接写入
+    if(user->prio_size == 0 && pt_server_backend_queue_size(user) < PT_SERVER_PRIORITY_INFLIGHT){
+        r = pt_server_write(user, buff);
+    } else {
+        buff->next = NULL;
+        if(user->prio_tail[priority]){
+            user->prio_tail[priority]->next = buff;
+        } else {
+            user->prio_head[priority] = buff;
+        }
+        user->prio_tail[priority] = buff;
+        user->prio_size += buff->length;
+    }
+    
+    pt_server_check_full(user);
+    return r;
+}
+
+/*
+ 连接使用libuv的stream写入
+ */
+static qboolean pt_server_is_stream(struct pt_sclient *user)
+{
+#ifdef PT_HAVE_URING
+    if(user->uring) return false;
+#endif
+    return user->shm == NULL && user->rudp == NULL;
+}
+
+qboolean pt_server_send_wrapped(struct pt_sclient *user, uint16_t id, const void *head, uint32_t head_len,
+                                struct pt_buffer *owner, uint32_t offset, uint32_t length)
+{
+    struct net_header hdr = pt_create_nethdr(id);
+    struct pt_wreq_iov *wr;
+    struct pt_buffer *buff;
+    
+    //有排队的数据包时需要保持顺序，其他后端需要完整的数据包
+    if(user->connected == false || user->prio_size || pt_server_backend_queue_size(user) >= PT_SERVER_PRIORITY_INFLIGHT ||
+       pt_server_is_stream(user) == false || head_len > PT_WREQ_HEAD_MAX - sizeof(hdr))
+    {
+        buff = pt_buffer_new(sizeof(hdr) + head_len + length);
+        pt_buffer_write(buff, (unsigned char*)&hdr, sizeof(hdr));
+        if(head_len){
+            pt_buffer_write(buff, head, head_len);
+        }
+        pt_buffer_write(buff, owner->buff + offset, length);
+        ((struct net_header*)buff->buff)->length = buff->length;
+        
+        pt_buffer_free(owner);
+        
+        return pt_server_send(user, buff);
+    }
+    
+    user->last_write = uv_now(user->server->loop);
+    
+    hdr.length = sizeof(hdr) + head_len + length;
+    
+    if(pt_server_send_queue_size(user) + hdr.length > (size_t)user->server->number_of_max_send_queue){
+        DBGPRINT("user datagram overflow");
+        pt_server_close_conn(user, true);
+        pt_buffer_free(owner);
+        return false;
+    }
+    
+    wr = malloc(sizeof(struct pt_wreq_iov));
+    if(wr == NULL){
+        FATAL("malloc pt_wreq_iov failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+    
+    memcpy(wr->head, &hdr, sizeof(hdr));
+    if(head_len){
+        memcpy(wr->head + sizeof(hdr), head, head_len);
+    }
+    
+    //owner在写入完成后由pt_server_write_cb释放
+    wr->base.buff = owner;
+    wr->base.data = user;
+    wr->base.next = NULL;
+    wr->bufs[0] = uv_buf_init((char*)wr->head, sizeof(hdr) + head_len);
+    wr->bufs[1] = uv_buf_init((char*)owner->buff + offset, length);
+    
+    if(uv_write(&wr->base.req, (uv_stream_t*)&user->sock, wr->bufs, 2, user->server->write_cb)){
+        pt_buffer_free(owner);
+        free(wr);
+        return false;
+    }
+    
+    pt_server_check_full(user);
+    return true;
+}
+
+struct pt_buffer *pt_server_detach_packet(struct pt_sclient *user, struct pt_buffer *buff)
+{
+    if(buff == NULL || user->receiving != buff) return NULL;
+    
+    user->receiving = NULL;
+    return buff;
+}
+
+int pt_server_try_send(struct pt_sclient *user, struct pt_buffer *buff)
+{
+    size_t queue_size;
+    
+    if(user->connected == false){
+        return PT_SEND_CLOSED;
+    }
+    
+    if(user->write_blocked){
+        return PT_SEND_FULL;
+    }
+    
+    //队列为空或者低于低水位时总是接受，超过高水位的单个数据包也可以发送
+    //只有队列中有数据时才阻塞，之后的写入完成一定会执行pt_server_check_drain
+    queue_size = pt_server_send_queue_size(user);
+    
+    if(queue_size > user->send_low_watermark && queue_size + buff->length > user->send_high_watermark){
+        user->write_blocked = true;
+        return PT_SEND_FULL;
+    }
+    
+    return pt_server_send(user, buff) ? PT_SEND_OK : PT_SEND_CLOSED;
+}
+
+qboolean pt_server_is_writable(struct pt_sclient *user)
+{
+    return user->connected && user->write_blocked == false;
+}
+
+void pt_server_set_watermark(struct pt_server *server, uint32_t low, uint32_t high, pt_server_on_drain on_drain)
+{
+    server->send_low_watermark = low < high ? low : high;
+    server->send_high_watermark = high;
+    server->on_drain = on_drain;
+}
+
+void pt_sclient_set_watermark(struct pt_sclient *user, uint32_t low, uint32_t high)
+{
+    user->send_low_watermark = low < high ? low : high;
+    user->send_high_watermark = high;
+    
+    pt_server_check_drain(user);
+}
+
+/*
+ 停止底层的读取
+ */
+static void pt_server_read_stop(struct pt_sclient *user)
+{
+#ifdef PT_HAVE_URING
+    if(user->uring){
+        pt_uring_conn_read_stop(user->uring);
+        return;
+    }
+#endif
+    
+#ifdef __linux__
+    if(user->shm){
+        pt_shm_read_stop(user->shm);
+        return;
+    }
+#endif
+    
+    if(user->rudp){
+        pt_rudp_read_stop(user->rudp);
+        return;
+    }
+    
+    uv_read_stop(&user->sock.stream);
+}
+
+/*
+ 恢复底层的读取
+ */
+static void pt_server_read_start(struct pt_sclient *user)
+{
+    int r;
+    
+#ifdef PT_HAVE_URING
+    if(user->uring){
+        pt_uring_conn_read_start(user->uring);
+        return;
+    }
+#endif
+    
+#ifdef __linux__
+    if(user->shm){
+        pt_shm_read_start(user->shm);
+        return;
+    }
+#endif
+    
+    if(user->rudp){
+        pt_rudp_read_start(user->rudp);
+        return;
+    }
+    
+    r = uv_read_start(&user->sock.stream, pt_server_alloc_buf, user->server->read_cb);
+    
+    if(r != 0){
+        pt_server_log("uv_read_start error:%s", r, __FUNCTION__, __FILE__, __LINE__);
+        pt_server_close_conn(user, true);
+    }
+}
+
+/*
+ 根据应用层暂停和预算暂停的状态，停止或者恢复读取
+ */
+static void pt_server_update_read(struct pt_sclient *user)
+{
+    qboolean stop = PT_SERVER_READ_HELD(user) || user->read_deferred;
+    
+    if(user->connected == false || stop == user->read_stopped) return;
+    
+    if(stop){
+        user->read_stopped = true;
+        pt_server_read_stop(user);
+        return;
+    }
+    
+    //缓冲区中剩余的数据包和底层恢复时立即交付的数据都在下一轮loop中处理
+    pt_server_ready_push(user);
+    
+    pt_server_read_start(user);
+    
+    if(user->connected == false) return;
+    
+    user->read_stopped = false;
+}
+
+void pt_server_pause_read(struct pt_sclient *user)
+{
+    user->read_paused = true;
+    pt_server_update_read(user);
+}
+
+void pt_server_resume_read(struct pt_sclient *user)
+{
+    user->read_paused = false;
+    pt_server_update_read(user);
+}
+
+void pt_server_set_idle(struct pt_server *server, uint32_t read_idle, uint32_t write_idle, uint32_t heartbeat,
+                        pt_server_on_idle on_idle)
+{
+    if(server->is_init == false || server->is_startup){
+        LOG("set idle before pt_server_init or after pt_server_start",__FUNCTION__,__FILE__,__LINE__);
+        return;
+    }
+    
+    server->read_idle_timeout = read_idle;
+    server->write_idle_timeout = write_idle;
+    server->heartbeat_interval = heartbeat;
+    server->on_idle = on_idle;
+    
+    if(server->wheel == NULL && (read_idle || write_idle || heartbeat)){
+        server->wheel = pt_timewheel_get(server->loop);
+    }
+}
+
+qboolean pt_server_add_rate_limit(struct pt_server *server, uint16_t id_min, uint16_t id_max,
+                                  uint32_t pps, uint32_t bps, int policy)
+{
+    struct pt_rate_rule *rule;
+    
+    if(server->is_startup){
+        LOG("server already startup",__FUNCTION__,__FILE__,__LINE__);
+        return false;
+    }
+    
+    if(id_min > id_max || policy < PT_RATE_DROP || policy > PT_RATE_DISCONNECT){
+        LOG("invalid rate limit",__FUNCTION__,__FILE__,__LINE__);
+        return false;
+    }
+    
+    server->rate_rules = realloc(server->rate_rules, sizeof(struct pt_rate_rule) * (server->number_of_rate_rules + 1));
+    if(server->rate_rules == NULL){
+        FATAL("realloc server->rate_rules failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+    
+    rule = &server->rate_rules[server->number_of_rate_rules++];
+    rule->id_min = id_min;
+    rule->id_max = id_max;
+    rule->pps = pps;
+    rule->bps = bps;
+    rule->policy = policy;
+    
+    return true;
+}
+
+void pt_server_set_dispatch_budget(struct pt_server *server, uint32_t packets, uint32_t usec)
+{
+    server->dispatch_packets = packets;
+    server->dispatch_time = usec;
+}
+
+void pt_server_set_respcache(struct pt_server *server, struct pt_respcache *cache)
+{
+    server->respcache = cache;
+}
+
+void pt_server_set_read_budget(struct pt_server *server, uint32_t per_conn, uint64_t global)
+{
+    server->read_budget = per_conn;
+    server->global_read_budget = global;
+    
+    pt_server_release_budget(server);
+}
+
+/*
+ 超过单个连接或者全局的预算
+ */
+static qboolean pt_server_over_budget(struct pt_sclient *user)
+{
+    struct pt_server *server = user->server;
+    
+    if(server->read_budget && user->pending_work >= server->read_budget) return true;
+    if(server->global_read_budget && server->pending_work >= server->global_read_budget) return true;
+    
+    return false;
+}
+
+/*
+ 单个连接和全局的工作量都降到预算的一半以下
+ */
+static qboolean pt_server_under_budget(struct pt_sclient *user)
+{
+    struct pt_server *server = user->server;
+    
+    if(server->read_budget && user->pending_work > server->read_budget / 2) return false;
+    if(server->global_read_budget && server->pending_work > server->global_read_budget / 2) return false;
+    
+    return true;
+}
+
+static void pt_server_unthrottle(struct pt_sclient *user)
+{
+    pt_server_throttle_remove(user);
+    pt_server_update_read(user);
+}
+
+/*
+ 恢复所有已经降到预算以下的连接
+ */
+static void pt_server_release_budget(struct pt_server *server)
+{
+    struct pt_sclient *user;
+    struct pt_sclient *next;
+    
+    for(user = server->throttled; user; user = next)
+    {
+        next = user->throttle_next;
+        
+        if(pt_server_under_budget(user)){
+            pt_server_unthrottle(user);
+        }
+    }
+}
+
+void pt_server_work_begin(struct pt_sclient *user, uint32_t cost)
+{
+    struct pt_server *server = user->server;
+    
+    if(user->connected == false) return;
+    
+    user->pending_work += cost;
+    server->pending_work += cost;
+    
+    if(user->read_throttled || pt_server_over_budget(user) == false) return;
+    
+    user->read_throttled = true;
+    user->throttle_prev = NULL;
+    user->throttle_next = server->throttled;
+    if(server->throttled){
+        server->throttled->throttle_prev = user;
+    }
+    server->throttled = user;
+    
+    pt_server_update_read(user);
+}
+
+qboolean pt_server_work_end(struct pt_server *server, uint64_t user_id, uint32_t cost)
+{
+    struct pt_sclient *user = pt_table_find(server->clients, user_id);
+    
+    if(user == NULL) return false;
+    
+    if(cost > user->pending_work){
+        cost = user->pending_work;
+    }
+    
+    user->pending_work -= cost;
+    server->pending_work -= cost;
+    
+    //全局预算可能让其他连接也恢复读取
+    if(server->global_read_budget){
+        pt_server_release_budget(server);
+    } else if(user->read_throttled && pt_server_under_budget(user)){
+        pt_server_unthrottle(user);
+    }
+    
+    return true;
+}
+
+qboolean pt_server_send_unreliable(struct pt_sclient *user, struct pt_buffer *buff)
+{
+    if(user->rudp == NULL){
+        return pt_server_send(user, buff);
+    }
+    
+    if(user->connected == false){
+        pt_buffer_free(buff);
+        return false;
+    }
+    
+    //不可靠通道不分片，不能改用可靠通道发送
+    if(buff->length > PT_RUDP_MSS){
+        LOG("unreliable packet > PT_RUDP_MSS",__FUNCTION__,__FILE__,__LINE__);
+        pt_buffer_free(buff);
+        return false;
+    }
+    
+    user->last_write = uv_now(user->server->loop);
+    
+    pt_rudp_send(user->rudp, PT_RUDP_CHANNEL_UNRELIABLE, buff->buff, buff->length);
+    pt_buffer_free(buff);
+    return true;
+}
+
+void pt_server_close(struct pt_server *server)
+{
+    uint32_t i;
+    struct pt_table_node *n;
+    struct pt_table_node *p;
+    for(i = 0; i < server->clients->granularity;i++)
+    {
+        n = server->clients->head[i];
+        while(n){
+            p = n;
+            n = n->next;
+            pt_server_close_conn(p->ptr, true);
+        }
+    }
+    
+    if(server->ready_idle_init){
+        server->ready_idle_init = false;
+        uv_close((uv_handle_t*)&server->ready_idle, NULL);
+    }
+    
+    if(server->rate_timer_init){
+        server->rate_timer_init = false;
+        uv_close((uv_handle_t*)&server->rate_timer, NULL);
+    }
+    
+    //所有连接的定时器已经在pt_server_close_conn中删除
+    if(server->wheel){
+        pt_timewheel_release(server->wheel);
+        server->wheel = NULL;
+    }
+    
+#ifdef PT_HAVE_URING
+    if(server->backend == PT_BACKEND_URING){
+        //监听socket在accept请求取消完成后关闭
+        if(server->is_startup && server->is_closing == false){
+            server->is_closing = true;
+            pt_uring_cancel(server->uring, server->accept_req);
+        }
+        return;
+    }
+#endif
+    
+    if(server->is_udp){
+        uv_close((uv_handle_t*)&server->udp_timer, NULL);
+    }
+    
+    //热重启后监听socket已经关闭
+    if(uv_is_closing((uv_handle_t*)&server->listener)) return;
+    
+    uv_close((uv_handle_t*)&server->listener, pt_server_on_close_listener);
+}
+
+qboolean pt_server_disconnect_conn(struct pt_sclient *user)
+{
+    if(user->connected){
+        pt_server_close_conn(user, true);
+        return true;
+    }
+    return false;
+}
+
+/*
+ 热重启的一个记录，长度在发送时填写
+ */
+static struct pt_buffer *pt_server_handoff_record(uint8_t type)
+{
+    struct handoff_header hdr;
+    struct pt_buffer *buff = pt_buffer_new(PAGESIZE);
+    
+    hdr.length = sizeof(hdr);
+    hdr.type = type;
+    pt_buffer_write(buff, (unsigned char*)&hdr, sizeof(hdr));
+    
+    return buff;
+}
+
+/*
+ 新进程的确认记录
+ */
+static struct pt_buffer *pt_server_handoff_ack_record(uint8_t type, uint32_t count)
+{
+    struct pt_buffer *buff = pt_server_handoff_record(PT_HANDOFF_ACK);
+    struct handoff_ack ack;
+    
+    ack.magic = PT_HANDOFF_MAGIC;
+    ack.type = type;
+    ack.count = count;
+    pt_buffer_write(buff, (unsigned char*)&ack, sizeof(ack));
+    
+    return buff;
+}
+
+/*
+ 发送一个记录，send_handle不为NULL时随记录一起发送
+ */
+static int pt_server_handoff_write(struct pt_server *server, struct pt_buffer *buff, uv_stream_t *send_handle,
+                                   uv_write_cb cb, void *data)
+{
+    struct pt_wreq *wreq = malloc(sizeof(struct pt_wreq));
+    int r;
+    
+    if(wreq == NULL){
+        FATAL("malloc pt_wreq failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+    
+    ((struct handoff_header*)buff->buff)->length = buff->length;
+    
+    wreq->buff = buff;
+    wreq->data = data;
+    wreq->buf = uv_buf_init((char*)buff->buff, buff->length);
+    
+    r = uv_write2(&wreq->req, (uv_stream_t*)&server->handoff_pipe, &wreq->buf, 1, send_handle, cb);
+    if(r != 0){
+        pt_buffer_free(buff);
+        free(wreq);
+    }
+    
+    return r;
+}
+
+static void pt_server_handoff_update_read(struct pt_server *server)
+{
+    uint32_t i;
+    struct pt_table_node *n;
+    
+    for(i = 0; i < server->clients->granularity; i++)
+    {
+        for(n = server->clients->head[i]; n; n = n->next)
+        {
+            pt_server_update_read(n->ptr);
+        }
+    }
+}
+
+/*
+ 旧进程结束热重启
+ 监听socket还没有交给新进程时恢复原来的状态
+ */
+static void pt_server_handoff_finish(struct pt_server *server, int status)
+{
+    uv_close((uv_handle_t*)&server->handoff_timer, NULL);
+    uv_close((uv_handle_t*)&server->handoff_pipe, NULL);
+    
+    if(server->handoff_buf){
+        pt_buffer_free(server->handoff_buf);
+        server->handoff_buf = NULL;
+    }
+    
+    if(status == 0 || uv_is_closing((uv_handle_t*)&server->listener)){
+        server->handoff_state = PT_SERVER_HANDOFF_DONE;
+    } else {
+        server->handoff_state = PT_SERVER_HANDOFF_NONE;
+        pt_server_handoff_update_read(server);
+    }
+    
+    if(server->on_handoff) server->on_handoff(server, status);
+}
+
+static void pt_server_handoff_alloc_buf(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf)
+{
+    struct pt_server *server = handle->data;
+    struct pt_buffer *buff = server->handoff_buf;
+    
+    pt_buffer_reserve(buff, (uint32_t)suggested_size);
+    
+    buf->base = (char*)buff->buff + buff->length;
+    buf->len = buff->max_length - buff->length;
+}
+
+/*
+ 新进程确认收到了监听socket，关闭自己的监听，之后开始发送连接
+ */
+static void pt_server_handoff_listener_acked(struct pt_server *server)
+{
+    //新进程还在使用这个路径，关闭监听时不再删除
+    if(server->pipe_path){
+        free(server->pipe_path);
+        server->pipe_path = NULL;
+    }
+    
+    //新进程已经开始接受新连接
+    uv_close((uv_handle_t*)&server->listener, pt_server_on_close_listener);
+    
+    server->handoff_deadline = uv_now(server->loop) + PT_SERVER_HANDOFF_TIMEOUT;
+}
+
+/*
+ 新进程的确认，监听socket的确认之前还没有关闭监听，DONE的确认需要回复相同的连接数
+ 不完整的记录等待之后的数据，其他任何数据都是错误
+ */
+static void pt_server_handoff_ack_cb(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf)
+{
+    struct pt_server *server = stream->data;
+    struct pt_buffer *buff = server->handoff_buf;
+    struct handoff_header hdr;
+    struct handoff_ack ack;
+    qboolean listening;
+    
+    if(nread == 0) return;
+    
+    if(nread < 0){
+        pt_server_log("handoff ack failed:%s", (int)nread, __FUNCTION__, __FILE__, __LINE__);
+        pt_server_handoff_finish(server, (int)nread);
+        return;
+    }
+    
+    buff->length += (uint32_t)nread;
+    
+    while(buff->length >= sizeof(hdr))
+    {
+        memcpy(&hdr, buff->buff, sizeof(hdr));
+        
+        if(hdr.type != PT_HANDOFF_ACK || hdr.length != sizeof(hdr) + sizeof(ack)){
+            LOG("handoff ack invalid",__FUNCTION__,__FILE__,__LINE__);
+            pt_server_handoff_finish(server, UV_EPROTO);
+            return;
+        }
+        
+        if(buff->length < hdr.length) return;
+        
+        memcpy(&ack, buff->buff + sizeof(hdr), sizeof(ack));
+        pt_buffer_skip(buff, hdr.length);
+        
+        listening = uv_is_closing((uv_handle_t*)&server->listener) == false;
+        
+        if(ack.magic != PT_HANDOFF_MAGIC){
+            LOG("handoff ack invalid",__FUNCTION__,__FILE__,__LINE__);
+            pt_server_handoff_finish(server, UV_EPROTO);
+            return;
+        }
+        
+        if(listening && ack.type == PT_HANDOFF_LISTENER && ack.count == 0){
+            pt_server_handoff_listener_acked(server);
+            continue;
+        }
+        
+        if(listening == false && server->handoff_state == PT_SERVER_HANDOFF_DONE && ack.type == PT_HANDOFF_DONE){
+            if(ack.count != server->number_of_handoff){
+                LOG("handoff ack count mismatch",__FUNCTION__,__FILE__,__LINE__);
+                pt_server_handoff_finish(server, UV_EPROTO);
+            } else {
+                pt_server_handoff_finish(server, 0);
+            }
+            return;
+        }
+        
+        LOG("handoff ack unexpected",__FUNCTION__,__FILE__,__LINE__);
+        pt_server_handoff_finish(server, UV_EPROTO);
+        return;
+    }
+}
+
+/*
+ 发送完成后等待新进程确认再关闭，确认在pt_server_handoff_ack_cb中处理
+ 每个带有socket的记录都会让对端的recvmsg提前返回，这时关闭pipe，libuv会把POLLHUP当作EOF丢弃还未读取的记录
+ */
+static void pt_server_handoff_done_cb(uv_write_t *req, int status)
+{
+    struct pt_wreq *wr = (struct pt_wreq*)req;
+    struct pt_server *server = wr->data;
+    
+    pt_buffer_free(wr->buff);
+    free(wr);
+    
+    if(status != 0){
+        pt_server_log("handoff done failed:%s", status, __FUNCTION__, __FILE__, __LINE__);
+        pt_server_handoff_finish(server, status);
+    }
+}
+
+/*
+ 所有连接都已经发送或者断开后通知新进程结束
+ */
+static void pt_server_handoff_check(struct pt_server *server)
+{
+    int r;
+    
+    if(server->handoff_state != PT_SERVER_HANDOFF_SENDING || server->number_of_connected || server->handoff_writes ||
+       uv_is_closing((uv_handle_t*)&server->listener) == false){
+        return;
+    }
+    
+    uv_timer_stop(&server->handoff_timer);
+    server->handoff_state = PT_SERVER_HANDOFF_DONE;
+    
+    r = pt_server_handoff_write(server, pt_server_handoff_record(PT_HANDOFF_DONE), NULL, pt_server_handoff_done_cb, server);
+    if(r != 0){
+        pt_server_log("handoff write failed:%s", r, __FUNCTION__, __FILE__, __LINE__);
+        pt_server_handoff_finish(server, r);
+    }
+}
+
+/*
+ 连接的socket已经发送给新进程，关闭本进程中的描述符
+ */
+static void pt_server_handoff_conn_cb(uv_write_t *req, int status)
+{
+    struct pt_wreq *wr = (struct pt_wreq*)req;
+    struct pt_sclient *user = wr->data;
+    struct pt_server *server = user->server;
+    
+    pt_buffer_free(wr->buff);
+    free(wr);
+    
+    server->handoff_writes--;
+    
+    if(status == 0){
+        server->number_of_handoff++;
+    } else {
+        pt_server_log("handoff conn failed:%s", status, __FUNCTION__, __FILE__, __LINE__);
+    }
+    
+    uv_close((uv_handle_t*)&user->sock.stream, pt_server_on_close_conn);
+    
+    pt_server_handoff_check(server);
+}
+
+/*
+ 发送一个连接，之后本进程不再使用这个连接
+ 记录中为加密状态和还未拆包的数据，发送队列已经为空
+ */
+static void pt_server_handoff_conn(struct pt_server *server, struct pt_sclient *user)
+{
+    struct pt_buffer *buff = pt_server_handoff_record(PT_HANDOFF_CONN);
+    uint8_t encrypted = server->enable_encrypt ? 1 : 0;
+    int r;
+    
+    pt_buffer_write(buff, &encrypted, sizeof(encrypted));
+    pt_buffer_write(buff, (unsigned char*)&user->serial, sizeof(user->serial));
+    pt_buffer_write(buff, (unsigned char*)&user->encrypt_ctx, sizeof(user->encrypt_ctx));
+    pt_buffer_write(buff, user->buf->buff, user->buf->length);
+    
+    r = pt_server_handoff_write(server, buff, &user->sock.stream, pt_server_handoff_conn_cb, user);
+    if(r != 0){
+        pt_server_log("handoff write failed:%s", r, __FUNCTION__, __FILE__, __LINE__);
+        pt_server_close_conn(user, true);
+        return;
+    }
+    
+    server->handoff_writes++;
+    
+    //移除连接，socket在发送完成后关闭
+    user->handing_off = true;
+    pt_server_close_conn(user, true);
+}
+
+/*
+ 发送队列已经清空并且没有未完成工作的连接交给新进程，超时的连接直接断开
+ */
+static void pt_server_handoff_timer_cb(uv_timer_t *handle)
+{
+    struct pt_server *server = handle->data;
+    qboolean expired = uv_now(server->loop) >= server->handoff_deadline;
+    struct pt_sclient *user;
+    struct pt_table_node *n;
+    struct pt_table_node *p;
+    uint32_t i;
+    
+    //还在等待新进程确认监听socket，超时放弃热重启
+    if(uv_is_closing((uv_handle_t*)&server->listener) == false){
+        if(expired){
+            LOG("handoff listener ack timeout",__FUNCTION__,__FILE__,__LINE__);
+            pt_server_handoff_finish(server, UV_ETIMEDOUT);
+        }
+        return;
+    }
+    
+    for(i = 0; i < server->clients->granularity; i++)
+    {
+        n = server->clients->head[i];
+        while(n){
+            p = n;
+            n = n->next;
+            user = p->ptr;
+            
+            if(pt_server_send_queue_size(user) == 0 && user->pending_work == 0 && user->batch == NULL){
+                pt_server_handoff_conn(server, user);
+            } else if(expired){
+                DBGPRINT("handoff timeout");
+                pt_server_close_conn(user, true);
+            } else {
+                //关闭监听之前接受的新连接
+                pt_server_update_read(user);
+                
+                //批量包中剩余的子消息在交出连接之前处理完
+                if(user->batch && PT_SERVER_BATCH_HELD(user) == false){
+                    pt_server_ready_push(user);
+                }
+            }
+        }
     }
     
-    //添加到搜索树内
-    pt_table_insert(server->clients, user->id, user);
+    pt_server_handoff_check(server);
+}
+
+static void pt_server_handoff_listener_cb(uv_write_t *req, int status)
+{
+    struct pt_wreq *wr = (struct pt_wreq*)req;
+    struct pt_server *server = wr->data;
     
-    //开始读取网络数据
-    r = uv_read_start(&user->sock.stream, pt_server_alloc_buf, server->read_cb);
+    pt_buffer_free(wr->buff);
+    free(wr);
     
-    if( r != 0 )
-    {
-        char error[255];
-        sprintf(error, "uv_read_start error:%s",uv_strerror(r));
-        ERROR(error, __FUNCTION__, __FILE__, __LINE__);
-        
-        //修复一个bug，之前直接使用uv_close，正确应该使用这个函数
-        pt_server_close_conn(user, true);
+    if(status == 0){
+        server->handoff_buf = pt_buffer_new(PAGESIZE);
+        status = uv_read_start((uv_stream_t*)&server->handoff_pipe, pt_server_handoff_alloc_buf, pt_server_handoff_ack_cb);
+    }
+    
+    if(status != 0){
+        pt_server_log("handoff listener failed:%s", status, __FUNCTION__, __FILE__, __LINE__);
+        pt_server_handoff_finish(server, status);
         return;
     }
+    
+    //新进程确认之前继续使用自己的监听，定时器检查确认是否超时
+    server->handoff_deadline = uv_now(server->loop) + PT_SERVER_HANDOFF_TIMEOUT;
+    uv_timer_start(&server->handoff_timer, pt_server_handoff_timer_cb, PT_SERVER_HANDOFF_INTERVAL, PT_SERVER_HANDOFF_INTERVAL);
 }
 
-struct pt_server* pt_server_new()
+static void pt_server_handoff_connect_cb(uv_connect_t *req, int status)
 {
-    struct pt_server *server = (struct pt_server *)malloc(sizeof(struct pt_server));
+    struct pt_server *server = req->data;
+    int r;
     
-    if(server == NULL){
-        FATAL("malloc pt_server failed",__FUNCTION__,__FILE__,__LINE__);
-        abort();
+    if(status != 0){
+        pt_server_log("handoff connect failed:%s", status, __FUNCTION__, __FILE__, __LINE__);
+        pt_server_handoff_finish(server, status);
+        return;
     }
     
-    bzero(server, sizeof(struct pt_server));
-    
-    server->clients = pt_table_new();
+    server->handoff_state = PT_SERVER_HANDOFF_SENDING;
     
-    //初始化libuv的回调函数
-    server->connection_cb = pt_server_connection_cb;
-    server->read_cb = pt_server_read_cb;
-    server->write_cb = pt_server_write_cb;
-    server->number_of_max_send_queue = 1000;
+    r = pt_server_handoff_write(server, pt_server_handoff_record(PT_HANDOFF_LISTENER), &server->listener.stream,
+                                pt_server_handoff_listener_cb, server);
+    if(r != 0){
+        pt_server_log("handoff write failed:%s", r, __FUNCTION__, __FILE__, __LINE__);
+        pt_server_handoff_finish(server, r);
+        return;
+    }
     
-    return server;
+    //停止读取所有连接，之后收到的数据留在缓冲区中交给新进程
+    pt_server_handoff_update_read(server);
 }
 
-
-
-void pt_server_free(struct pt_server *srv)
+qboolean pt_server_handoff(struct pt_server *server, const char *path, pt_server_on_handoff on_handoff)
 {
-    if(srv->is_startup == true){
-        FATAL("server not shutdown", __FUNCTION__, __FILE__, __LINE__);
-        abort();
+    int r;
+    
+    if(server->is_startup == false || server->handoff_state != PT_SERVER_HANDOFF_NONE){
+        LOG("server not running",__FUNCTION__,__FILE__,__LINE__);
+        return false;
     }
-    pt_table_free(srv->clients);
     
-    free(srv);
-}
-
-void pt_server_set_nodelay(struct pt_server *server, qboolean nodelay)
-{
-    server->no_delay = nodelay;
+    if(server->backend != PT_BACKEND_LIBUV || server->is_udp || server->is_shm){
+        LOG("handoff requires libuv tcp or pipe server",__FUNCTION__,__FILE__,__LINE__);
+        return false;
+    }
+    
+    r = uv_pipe_init(server->loop, &server->handoff_pipe, true);
+    if(r != 0){
+        pt_server_log("uv_pipe_init failed:%s", r, __FUNCTION__, __FILE__, __LINE__);
+        return false;
+    }
+    
+    uv_timer_init(server->loop, &server->handoff_timer);
+    
+    server->handoff_pipe.data = server;
+    server->handoff_timer.data = server;
+    server->handoff_connect.data = server;
+    server->on_handoff = on_handoff;
+    server->number_of_handoff = 0;
+    server->handoff_state = PT_SERVER_HANDOFF_CONNECTING;
+    
+    uv_pipe_connect(&server->handoff_connect, &server->handoff_pipe, path, pt_server_handoff_connect_cb);
+    
+    return true;
 }
 
-void pt_server_init(struct pt_server *server, uv_loop_t *loop, int max_conn, int keep_alive_delay,pt_server_on_connect on_conn,
-                        pt_server_on_receive on_receive, pt_server_on_disconnect on_disconnect)
+/*
+ 新进程结束接收，失败时已经接收的监听socket和连接继续使用
+ */
+static void pt_server_inherit_finish(struct pt_server *server, int status)
 {
-    if(server->is_init){
-        LOG("server already initialize",__FUNCTION__,__FILE__,__LINE__);
-        return;
+    if(uv_is_closing((uv_handle_t*)&server->handoff_listener) == false){
+        uv_close((uv_handle_t*)&server->handoff_listener, NULL);
     }
+    uv_close((uv_handle_t*)&server->handoff_pipe, NULL);
     
-    server->number_of_max_connected = max_conn;
-    server->loop = loop;
-    server->on_connect = on_conn;
-    server->on_receive = on_receive;
-    server->on_disconnect = on_disconnect;
-    server->keep_alive_delay = keep_alive_delay;
+    pt_buffer_free(server->handoff_buf);
+    server->handoff_buf = NULL;
     
-    server->is_init = true;
+    server->handoff_state = status == 0 ? PT_SERVER_HANDOFF_DONE : PT_SERVER_HANDOFF_NONE;
+    
+    if(server->on_handoff) server->on_handoff(server, status);
 }
 
-qboolean pt_server_start(struct pt_server *server, const char* host, uint16_t port)
+static int pt_server_inherit_listener(struct pt_server *server)
 {
+    uv_handle_type type;
     int r;
-    struct sockaddr_in adr;
     
+    if(server->is_startup || uv_pipe_pending_count(&server->handoff_pipe) == 0) return UV_EPROTO;
     
-    if(!server->is_init){
-        LOG("server not initialize",__FUNCTION__,__FILE__,__LINE__);
-        return false;
-    }
+    type = uv_pipe_pending_type(&server->handoff_pipe);
     
-    r = uv_tcp_init(server->loop, &server->listener.tcp);
-    if(r != 0){
-        char log[256];
-        sprintf(log,"uv_tcp_init failed:%s",uv_strerror(r));
-        LOG(log,__FUNCTION__, __FILE__,__LINE__);
+    if(type == UV_TCP){
+        r = uv_tcp_init(server->loop, &server->listener.tcp);
+        server->is_pipe = false;
+    } else if(type == UV_NAMED_PIPE){
+        r = uv_pipe_init(server->loop, &server->listener.pipe, false);
+        server->is_pipe = true;
+    } else {
+        return UV_EPROTO;
     }
     
-    server->is_pipe = false;
-    server->listener.stream.data = server;
-    
-    uv_ip4_addr(host, port, &adr);
+    if(r != 0) return r;
     
-    r = uv_tcp_bind(&server->listener.tcp, (const struct sockaddr*)&adr, 0);
+    server->listener.stream.data = server;
     
-    if(r != 0){
-        pt_server_log("uv_tcp_bind failed:%s",r, __FUNCTION__, __FILE__, __LINE__);
-        return false;
+    r = uv_accept((uv_stream_t*)&server->handoff_pipe, &server->listener.stream);
+    if(r == 0){
+        r = uv_listen(&server->listener.stream, SOMAXCONN, server->connection_cb);
     }
     
-    r = uv_listen((uv_stream_t*)&server->listener, SOMAXCONN, server->connection_cb);
     if(r != 0){
-        pt_server_log("uv_listen failed:%s",r, __FUNCTION__, __FILE__, __LINE__);
-        return false;
+        uv_close((uv_handle_t*)&server->listener, NULL);
+        return r;
     }
     
     server->is_startup = true;
-    return true;
+    return 0;
 }
 
-
-qboolean pt_server_start_pipe(struct pt_server *server, const char *path)
+/*
+ 接收一个连接并恢复加密状态，旧进程还未处理的数据按刚收到的数据处理
+ 只有协议错误时返回错误，单个连接失败时只断开这个连接
+ */
+static int pt_server_inherit_conn(struct pt_server *server, const unsigned char *data, uint32_t length)
 {
+    struct pt_sclient *user;
+    uv_handle_type type;
+    uint8_t encrypted;
+    uint32_t head = sizeof(encrypted) + sizeof(user->serial) + sizeof(user->encrypt_ctx);
     int r;
     
-    if(!server->is_init){
-        LOG("server not initialize",__FUNCTION__,__FILE__,__LINE__);
-        return false;
+    if(length < head || uv_pipe_pending_count(&server->handoff_pipe) == 0) return UV_EPROTO;
+    
+    server->handoff_records++;
+    
+    type = uv_pipe_pending_type(&server->handoff_pipe);
+    if(type != UV_TCP && type != UV_NAMED_PIPE) return UV_EPROTO;
+    
+    user = pt_sclient_new(server);
+    user->server = server;
+    user->inherited = true;
+    
+    if(type == UV_NAMED_PIPE){
+        uv_pipe_init(server->loop, &user->sock.pipe, false);
+    } else {
+        uv_tcp_init(server->loop, &user->sock.tcp);
     }
     
-    r = uv_pipe_init(server->loop, &server->listener.pipe, true);
+    user->sock.stream.data = user;
+    
+    r = uv_accept((uv_stream_t*)&server->handoff_pipe, &user->sock.stream);
     if(r != 0){
-        char log[256];
-        sprintf(log,"uv_tcp_init failed:%s",uv_strerror(r));
-        LOG(log,__FUNCTION__, __FILE__,__LINE__);
+        pt_server_log("uv_accept error:%s", r, __FUNCTION__, __FILE__, __LINE__);
+        uv_close((uv_handle_t*)&user->sock, pt_server_on_close_conn);
+        return r;
     }
     
-    server->is_pipe = true;
-    server->listener.stream.data = server;
+    if(pt_server_accept_user(server, user) == false){
+        return 0;
+    }
     
-    remove(path);
-    r = uv_pipe_bind(&server->listener.pipe, path);
-    if(r != 0){
-        pt_server_log("uv_tcp_bind failed:%s",r, __FUNCTION__, __FILE__, __LINE__);
-        return false;
+    //新旧进程需要使用相同的加密设置
+    memcpy(&encrypted, data, sizeof(encrypted));
+    if(encrypted != (server->enable_encrypt ? 1 : 0)){
+        LOG("handoff encrypt mismatch",__FUNCTION__,__FILE__,__LINE__);
+        pt_server_close_conn(user, true);
+        return 0;
     }
     
-    r = uv_listen(&server->listener.stream, SOMAXCONN, server->connection_cb);
+    if(encrypted){
+        memcpy(&user->serial, data + sizeof(encrypted), sizeof(user->serial));
+        memcpy(&user->encrypt_ctx, data + sizeof(encrypted) + sizeof(user->serial), sizeof(user->encrypt_ctx));
+    }
+    
+    if(type == UV_TCP){
+        uv_tcp_keepalive(&user->sock.tcp, true, server->keep_alive_delay);
+        
+        if(server->no_delay){
+            uv_tcp_nodelay(&user->sock.tcp, true);
+        }
+        
+        if(server->busy_poll){
+            pt_server_set_sock_busy_poll(user);
+        }
+    }
+    
+    r = uv_read_start(&user->sock.stream, pt_server_alloc_buf, server->read_cb);
     if(r != 0){
-        pt_server_log("uv_listen failed:%s",r, __FUNCTION__, __FILE__, __LINE__);
-        return false;
+        pt_server_log("uv_read_start error:%s", r, __FUNCTION__, __FILE__, __LINE__);
+        pt_server_close_conn(user, true);
+        return 0;
     }
     
-    server->is_startup = true;
-    return true;
+    server->number_of_handoff++;
+    
+    if(length > head){
+        pt_server_on_data(user, data + head, length - head);
+    }
+    
+    return 0;
 }
 
+static void pt_server_inherit_done_cb(uv_write_t *req, int status)
+{
+    struct pt_wreq *wr = (struct pt_wreq*)req;
+    struct pt_server *server = wr->data;
+    
+    pt_buffer_free(wr->buff);
+    free(wr);
+    
+    pt_server_inherit_finish(server, status);
+}
 
+static void pt_server_inherit_ack_cb(uv_write_t *req, int status)
+{
+    struct pt_wreq *wr = (struct pt_wreq*)req;
+    
+    pt_buffer_free(wr->buff);
+    free(wr);
+    
+    //pipe出错时之后的读取也会失败，在那里结束
+    if(status != 0){
+        pt_server_log("handoff ack failed:%s", status, __FUNCTION__, __FILE__, __LINE__);
+    }
+}
 
-void pt_server_set_encrypt(struct pt_server *server, const uint32_t encrypt_key[4])
+static void pt_server_inherit_read_cb(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf)
 {
-    server->enable_encrypt = true;
+    struct pt_server *server = stream->data;
+    struct pt_buffer *buff = server->handoff_buf;
+    struct handoff_header hdr;
+    int r;
     
-    for(int i =0;i<4;i++)
+    //旧进程发送完成之前断开
+    if(nread < 0){
+        pt_server_log("handoff read failed:%s", (int)nread, __FUNCTION__, __FILE__, __LINE__);
+        pt_server_inherit_finish(server, (int)nread);
+        return;
+    }
+    
+    buff->length += (uint32_t)nread;
+    
+    //记录的socket和记录的第一个字节一起到达，记录完整时已经可以accept
+    while(buff->length >= sizeof(hdr))
     {
-        server->encrypt_key[i] = encrypt_key[i];
+        memcpy(&hdr, buff->buff, sizeof(hdr));
+        
+        if(hdr.length < sizeof(hdr)){
+            pt_server_inherit_finish(server, UV_EPROTO);
+            return;
+        }
+        
+        if(buff->length < hdr.length) break;
+        
+        switch(hdr.type)
+        {
+            case PT_HANDOFF_LISTENER:
+                r = pt_server_inherit_listener(server);
+                if(r == 0){
+                    r = pt_server_handoff_write(server, pt_server_handoff_ack_record(PT_HANDOFF_LISTENER, 0), NULL,
+                                                pt_server_inherit_ack_cb, server);
+                }
+                break;
+            case PT_HANDOFF_CONN:
+                r = pt_server_inherit_conn(server, buff->buff + sizeof(hdr), hdr.length - sizeof(hdr));
+                break;
+            case PT_HANDOFF_DONE:
+                //回复收到的连接数，旧进程检查后关闭pipe
+                uv_read_stop(stream);
+                r = pt_server_handoff_write(server, pt_server_handoff_ack_record(PT_HANDOFF_DONE, server->handoff_records),
+                                            NULL, pt_server_inherit_done_cb, server);
+                if(r != 0){
+                    pt_server_inherit_finish(server, r);
+                }
+                return;
+            default:
+                r = UV_EPROTO;
+                break;
+        }
+        
+        if(r != 0){
+            pt_server_log("handoff record failed:%s", r, __FUNCTION__, __FILE__, __LINE__);
+            pt_server_inherit_finish(server, r);
+            return;
+        }
+        
+        pt_buffer_skip(buff, hdr.length);
     }
 }
 
 /*
- 发送数据到客户端
+ 旧进程连接成功，只接受一个连接，关闭监听时删除socket文件
  */
-qboolean pt_server_send(struct pt_sclient *user, struct pt_buffer *buff)
+static void pt_server_inherit_connection_cb(uv_stream_t* listener, int status)
 {
-    if(user->connected == false){
-        pt_buffer_free(buff);
+    struct pt_server *server = listener->data;
+    int r = status;
+    
+    if(r == 0){
+        r = uv_accept(listener, (uv_stream_t*)&server->handoff_pipe);
+    }
+    if(r == 0){
+        r = uv_read_start((uv_stream_t*)&server->handoff_pipe, pt_server_handoff_alloc_buf, pt_server_inherit_read_cb);
+    }
+    
+    if(r != 0){
+        pt_server_log("handoff accept failed:%s", r, __FUNCTION__, __FILE__, __LINE__);
+        pt_server_inherit_finish(server, r);
+        return;
+    }
+    
+    uv_close((uv_handle_t*)&server->handoff_listener, NULL);
+}
+
+qboolean pt_server_start_inherit(struct pt_server *server, const char *path, pt_server_on_handoff on_handoff)
+{
+    int r;
+    
+    if(!server->is_init){
+        LOG("server not initialize",__FUNCTION__,__FILE__,__LINE__);
         return false;
     }
     
-    //防止服务器发包过多导致服务器的内存耗尽
-    if(user->sock.stream.write_queue_size >= user->server->number_of_max_send_queue){
-        DBGPRINT("user datagram overflow");
-        pt_server_close_conn(user, true);
-        pt_buffer_free(buff);
+    if(server->backend != PT_BACKEND_LIBUV || server->is_startup || server->handoff_state != PT_SERVER_HANDOFF_NONE){
+        LOG("inherit requires stopped libuv server",__FUNCTION__,__FILE__,__LINE__);
         return false;
     }
     
-    struct pt_wreq *wreq = malloc(sizeof(struct pt_wreq));
+    if(pt_server_remove_stale_pipe(path) == false){
+        return false;
+    }
     
-    wreq->buff = buff;
-    wreq->buf = uv_buf_init((char*)buff->buff, buff->length);
+    uv_pipe_init(server->loop, &server->handoff_listener, false);
+    uv_pipe_init(server->loop, &server->handoff_pipe, true);
+    server->handoff_listener.data = server;
+    server->handoff_pipe.data = server;
     
-    if (uv_write(&wreq->req, (uv_stream_t*)&user->sock, &wreq->buf, 1, user->server->write_cb)) {
-        pt_buffer_free(wreq->buff);
-        free(wreq);
+    r = uv_pipe_bind(&server->handoff_listener, path);
+    if(r == 0){
+        r = uv_listen((uv_stream_t*)&server->handoff_listener, 1, pt_server_inherit_connection_cb);
+    }
+    
+    if(r != 0){
+        pt_server_log("handoff listen failed:%s", r, __FUNCTION__, __FILE__, __LINE__);
+        uv_close((uv_handle_t*)&server->handoff_listener, NULL);
+        uv_close((uv_handle_t*)&server->handoff_pipe, NULL);
         return false;
     }
     
+    server->handoff_buf = pt_buffer_new(PAGESIZE);
+    server->on_handoff = on_handoff;
+    server->number_of_handoff = 0;
+    server->handoff_records = 0;
+    server->handoff_state = PT_SERVER_HANDOFF_RECEIVING;
+    
     return true;
 }
-
-
-void pt_server_close(struct pt_server *server)
-{
-    uint32_t i;
-    struct pt_table_node *n;
-    struct pt_table_node *p;
-    for(i = 0; i < server->clients->granularity;i++)
-    {
-        n = server->clients->head[i];
-        while(n){
-            p = n;
-            n = n->next;
-            pt_server_close_conn(p->ptr, true);
-        }
-    }
-    uv_close((uv_handle_t*)&server->listener, pt_server_on_close_listener);
-}
-
-qboolean pt_server_disconnect_conn(struct pt_sclient *user)
-{
-    if(user->connected){
-        pt_server_close_conn(user, true);
-        return true;
-    }
-    return false;
-}
\ No newline at end of file
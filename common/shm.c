@@ -0,0 +1,642 @@
+//
+//  shm.c
+//  xcode
+//
+//  同一台机器上的进程间共享内存传输
+//
+//  握手：客户端创建memfd和两个eventfd，通过unix socket的SCM_RIGHTS发送给服务器
+//  数据：每个方向一个单生产者单消费者环形缓冲区，数据只复制到共享内存中
+//  通知：消费者处理完所有数据准备等待时设置consumer_waiting，
+//       生产者只有看到这个标记时才写eventfd，对端忙碌时不产生系统调用
+//
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "common.h"
+#include "error.h"
+#include "buffer.h"
+#include "shm.h"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+
+//握手时发送的fd：memfd，服务器的eventfd，客户端的eventfd
+#define PT_SHM_HANDSHAKE_FDS 3
+
+//memfd必须带有的封印，对端不能再改变大小，否则截断后访问映射会产生SIGBUS
+#define PT_SHM_SEALS (F_SEAL_SHRINK | F_SEAL_GROW)
+
+struct pt_shm_handshake
+{
+    uint32_t magic;
+    uint32_t ring_size;
+    uint64_t map_size;
+};
+
+static void pt_shm_log(const char *message, int error, const char *func, const char *file, int line)
+{
+    char log[512];
+    sprintf(log, "%s:%s", message, strerror(error));
+    LOG(log,func,file,line);
+}
+
+static struct pt_shm *pt_shm_new(uv_loop_t *loop, int sock_fd, void *data,
+                                 pt_shm_data_cb on_data, pt_shm_close_cb on_close)
+{
+    struct pt_shm *shm = malloc(sizeof(struct pt_shm));
+
+    if(shm == NULL){
+        FATAL("malloc pt_shm failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+
+    bzero(shm, sizeof(struct pt_shm));
+
+    shm->loop = loop;
+    shm->data = data;
+    shm->sock_fd = sock_fd;
+    shm->notify_fd = -1;
+    shm->peer_fd = -1;
+    shm->on_data = on_data;
+    shm->on_close = on_close;
+
+    return shm;
+}
+
+static void pt_shm_notify_peer(struct pt_shm *shm)
+{
+    uint64_t one = 1;
+
+    if(write(shm->peer_fd, &one, sizeof(one)) < 0 && errno != EAGAIN){
+        pt_shm_log("eventfd write failed", errno, __FUNCTION__, __FILE__, __LINE__);
+    }
+}
+
+/*
+ 写入尽可能多的数据到发送缓冲区，返回写入的字节数
+ */
+static uint32_t pt_shm_ring_write(struct pt_shm *shm, const unsigned char *data, uint32_t length)
+{
+    struct pt_shm_ring *ring = shm->tx;
+    uint32_t size = shm->ring_size;
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    uint32_t space = size - (head - tail);
+    uint32_t offset = head & (size - 1);
+    uint32_t n;
+    uint32_t first;
+
+    if(space > size) return 0;
+
+    n = length < space ? length : space;
+    first = size - offset < n ? size - offset : n;
+
+    memcpy(&ring->data[offset], data, first);
+    memcpy(&ring->data[0], data + first, n - first);
+
+    atomic_store_explicit(&ring->head, head + n, memory_order_release);
+    return n;
+}
+
+/*
+ 将等待中的数据写入发送缓冲区
+ */
+static void pt_shm_flush(struct pt_shm *shm)
+{
+    struct pt_wreq *wreq;
+    uint32_t n;
+    qboolean written = false;
+    qboolean waiting = false;
+
+    while(shm->pending_head)
+    {
+        wreq = shm->pending_head;
+        n = pt_shm_ring_write(shm, (const unsigned char*)wreq->buf.base, (uint32_t)wreq->buf.len);
+
+        if(n > 0){
+            written = true;
+            shm->pending_size -= n;
+        }
+
+        if(n < wreq->buf.len){
+            wreq->buf.base += n;
+            wreq->buf.len -= n;
+
+            if(n > 0) continue;
+            if(waiting) break;
+
+            //空间不足，请求消费者读取后通知，设置后再检查一次防止丢失通知
+            atomic_store_explicit(&shm->tx->producer_waiting, 1, memory_order_relaxed);
+            atomic_thread_fence(memory_order_seq_cst);
+            waiting = true;
+            continue;
+        }
+
+        shm->pending_head = wreq->next;
+        if(shm->pending_head == NULL) shm->pending_tail = NULL;
+
+        pt_buffer_free(wreq->buff);
+        free(wreq);
+    }
+
+    if(written == false) return;
+
+    //消费者正在等待时才通知
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load_explicit(&shm->tx->consumer_waiting, memory_order_relaxed) &&
+       atomic_exchange(&shm->tx->consumer_waiting, 0)){
+        pt_shm_notify_peer(shm);
+    }
+}
+
+/*
+ 读取接收缓冲区中的数据，交给on_data处理
+ */
+static void pt_shm_drain(struct pt_shm *shm)
+{
+    struct pt_shm_ring *ring = shm->rx;
+    uint32_t size = shm->ring_size;
+    uint32_t budget = PT_SHM_READ_BUDGET;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t used;
+    uint32_t offset;
+    uint32_t n;
+    qboolean consumed = false;
+
+    for(;;)
+    {
+        //暂停读取，恢复时通知自己继续
+        if(shm->read_paused) return;
+
+        //处理期间生产者不需要通知
+        atomic_store_explicit(&ring->consumer_waiting, 0, memory_order_relaxed);
+
+        head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        used = head - tail;
+
+        if(used > size){
+            ERROR("shm ring corrupted", __FUNCTION__, __FILE__, __LINE__);
+            shm->on_data(shm, NULL, 0);
+            return;
+        }
+
+        while(used > 0 && budget > 0 && shm->closing == false && shm->read_paused == false)
+        {
+            offset = tail & (size - 1);
+            n = size - offset < used ? size - offset : used;
+            n = n < budget ? n : budget;
+
+            shm->on_data(shm, &ring->data[offset], n);
+
+            tail += n;
+            used -= n;
+            budget -= n;
+            consumed = true;
+            atomic_store_explicit(&ring->tail, tail, memory_order_release);
+        }
+
+        //生产者在等待空间
+        if(consumed){
+            atomic_thread_fence(memory_order_seq_cst);
+            if(atomic_load_explicit(&ring->producer_waiting, memory_order_relaxed) &&
+               atomic_exchange(&ring->producer_waiting, 0)){
+                pt_shm_notify_peer(shm);
+            }
+        }
+
+        if(shm->closing || shm->read_paused) return;
+
+        //本轮预算用完，通知自己在下一轮loop继续处理
+        if(budget == 0){
+            uint64_t one = 1;
+            if(write(shm->notify_fd, &one, sizeof(one)) < 0 && errno != EAGAIN){
+                pt_shm_log("eventfd write failed", errno, __FUNCTION__, __FILE__, __LINE__);
+            }
+            return;
+        }
+
+        //准备等待，设置后再检查一次防止丢失通知
+        atomic_store_explicit(&ring->consumer_waiting, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+
+        if(atomic_load_explicit(&ring->head, memory_order_acquire) == tail){
+            break;
+        }
+    }
+}
+
+static void pt_shm_notify_cb(uv_poll_t *handle, int status, int events)
+{
+    struct pt_shm *shm = handle->data;
+    uint64_t value;
+
+    if(shm->closing) return;
+
+    if(status < 0){
+        shm->on_data(shm, NULL, 0);
+        return;
+    }
+
+    //清空eventfd的计数
+    if(read(shm->notify_fd, &value, sizeof(value)) < 0 && errno != EAGAIN){
+        pt_shm_log("eventfd read failed", errno, __FUNCTION__, __FILE__, __LINE__);
+    }
+
+    //对端读取了数据，等待中的数据可以继续写入
+    if(shm->pending_head){
+        uint32_t pending = shm->pending_size;
+
+        pt_shm_flush(shm);
+
+        if(shm->on_sent && shm->pending_size < pending){
+            shm->on_sent(shm, pending - shm->pending_size);
+            if(shm->closing) return;
+        }
+    }
+
+    pt_shm_drain(shm);
+}
+
+static void pt_shm_start(struct pt_shm *shm)
+{
+    uv_poll_init(shm->loop, &shm->notify_poll, shm->notify_fd);
+    shm->notify_poll.data = shm;
+    uv_poll_start(&shm->notify_poll, UV_READABLE, pt_shm_notify_cb);
+
+    shm->ready = true;
+}
+
+static qboolean pt_shm_map(struct pt_shm *shm, int memfd, size_t map_size)
+{
+    shm->segment = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+
+    if(shm->segment == MAP_FAILED){
+        pt_shm_log("mmap failed", errno, __FUNCTION__, __FILE__, __LINE__);
+        shm->segment = NULL;
+        return false;
+    }
+
+    shm->map_size = map_size;
+    return true;
+}
+
+/*
+ 关闭recvmsg收到的所有fd，握手信息不正确时使用
+ */
+static void pt_shm_close_received(struct msghdr *msg)
+{
+    struct cmsghdr *cmsg;
+    size_t count;
+    size_t i;
+    int fd;
+
+    for(cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg))
+    {
+        if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+
+        count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+        for(i = 0; i < count; i++)
+        {
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            close(fd);
+        }
+    }
+}
+
+/*
+ 服务器收到客户端的握手信息，检查共享内存的布局
+ 返回1成功，0数据还没有到达，-1失败
+ */
+static int pt_shm_recv_handshake(struct pt_shm *shm)
+{
+    struct pt_shm_handshake hs;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    struct stat st;
+    char control[CMSG_SPACE(sizeof(int) * PT_SHM_HANDSHAKE_FDS)];
+    int fds[PT_SHM_HANDSHAKE_FDS] = {-1, -1, -1};
+    uint32_t ring_size;
+    uint32_t offset[2];
+    uint32_t i;
+    ssize_t r;
+    int seals;
+
+    bzero(&msg, sizeof(msg));
+    bzero(control, sizeof(control));
+    iov.iov_base = &hs;
+    iov.iov_len = sizeof(hs);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    r = recvmsg(shm->sock_fd, &msg, MSG_CMSG_CLOEXEC);
+    if(r < 0 && (errno == EAGAIN || errno == EINTR)){
+        return 0;
+    }
+    if(r < 0){
+        return -1;
+    }
+
+    //数据不完整或者fd不对时，已经收到的fd也要关闭
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if(r != sizeof(hs) || (msg.msg_flags & MSG_CTRUNC) || cmsg == NULL ||
+       cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+       cmsg->cmsg_len != CMSG_LEN(sizeof(fds)) || CMSG_NXTHDR(&msg, cmsg) != NULL){
+        pt_shm_close_received(&msg);
+        return -1;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    seals = fcntl(fds[0], F_GET_SEALS);
+
+    ring_size = hs.ring_size;
+
+    //共享内存来自对端，使用前检查所有大小和偏移
+    if(hs.magic != PT_SHM_MAGIC || ring_size == 0 || (ring_size & (ring_size - 1)) != 0 ||
+       seals < 0 || (seals & PT_SHM_SEALS) != PT_SHM_SEALS ||
+       fstat(fds[0], &st) != 0 || (uint64_t)st.st_size < hs.map_size ||
+       hs.map_size < sizeof(struct pt_shm_segment) ||
+       pt_shm_map(shm, fds[0], hs.map_size) == false){
+        for(i = 0; i < PT_SHM_HANDSHAKE_FDS; i++) close(fds[i]);
+        return -1;
+    }
+    close(fds[0]);
+
+    shm->notify_fd = fds[1];
+    shm->peer_fd = fds[2];
+    shm->ring_size = ring_size;
+
+    for(i = 0; i < 2; i++)
+    {
+        offset[i] = shm->segment->ring_offset[i];
+        
+        if(shm->segment->magic != PT_SHM_MAGIC || offset[i] % 64 != 0 ||
+           (uint64_t)offset[i] + sizeof(struct pt_shm_ring) + ring_size > hs.map_size){
+            return -1;
+        }
+    }
+
+    shm->rx = (struct pt_shm_ring*)((unsigned char*)shm->segment + offset[0]);
+    shm->tx = (struct pt_shm_ring*)((unsigned char*)shm->segment + offset[1]);
+
+    return 1;
+}
+
+static void pt_shm_sock_cb(uv_poll_t *handle, int status, int events)
+{
+    struct pt_shm *shm = handle->data;
+    char buf[64];
+    ssize_t r;
+
+    if(shm->closing) return;
+
+    if(status < 0){
+        shm->on_data(shm, NULL, 0);
+        return;
+    }
+
+    if(shm->ready == false)
+    {
+        r = pt_shm_recv_handshake(shm);
+        if(r == 0) return;
+        if(r < 0){
+            LOG("shm handshake failed", __FUNCTION__, __FILE__, __LINE__);
+            if(shm->on_ready) shm->on_ready(shm, -1);
+            return;
+        }
+
+        pt_shm_start(shm);
+
+        if(shm->on_ready) shm->on_ready(shm, 0);
+
+        //客户端可能在握手完成前已经写入了数据
+        if(shm->closing == false) pt_shm_drain(shm);
+        return;
+    }
+
+    //握手后unix socket只用于检测对端断开
+    r = recv(shm->sock_fd, buf, sizeof(buf), 0);
+    if(r == 0 || (r < 0 && errno != EAGAIN && errno != EINTR) || (events & UV_DISCONNECT)){
+        shm->on_data(shm, NULL, 0);
+    }
+}
+
+struct pt_shm *pt_shm_connect(uv_loop_t *loop, int sock_fd, void *data,
+                              pt_shm_data_cb on_data, pt_shm_close_cb on_close)
+{
+    struct pt_shm *shm;
+    struct pt_shm_handshake hs;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char control[CMSG_SPACE(sizeof(int) * PT_SHM_HANDSHAKE_FDS)];
+    int fds[PT_SHM_HANDSHAKE_FDS];
+    uint32_t ring_offset = ALIGN_SIZE(sizeof(struct pt_shm_segment), 64);
+    uint32_t ring_stride = ALIGN_SIZE(sizeof(struct pt_shm_ring) + PT_SHM_RING_SIZE, PAGESIZE);
+    size_t map_size = ring_offset + ring_stride * 2;
+    int memfd;
+
+    shm = pt_shm_new(loop, sock_fd, data, on_data, on_close);
+
+    memfd = memfd_create("pt_shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if(memfd < 0){
+        pt_shm_log("memfd_create failed", errno, __FUNCTION__, __FILE__, __LINE__);
+        close(sock_fd);
+        free(shm);
+        return NULL;
+    }
+
+    if(ftruncate(memfd, map_size) != 0 || fcntl(memfd, F_ADD_SEALS, PT_SHM_SEALS | F_SEAL_SEAL) != 0 ||
+       pt_shm_map(shm, memfd, map_size) == false){
+        pt_shm_log("ftruncate failed", errno, __FUNCTION__, __FILE__, __LINE__);
+        close(memfd);
+        close(sock_fd);
+        free(shm);
+        return NULL;
+    }
+
+    shm->segment->magic = PT_SHM_MAGIC;
+    shm->segment->ring_size = PT_SHM_RING_SIZE;
+    shm->segment->ring_offset[0] = ring_offset;
+    shm->segment->ring_offset[1] = ring_offset + ring_stride;
+
+    shm->tx = (struct pt_shm_ring*)((unsigned char*)shm->segment + shm->segment->ring_offset[0]);
+    shm->rx = (struct pt_shm_ring*)((unsigned char*)shm->segment + shm->segment->ring_offset[1]);
+    shm->tx->size = PT_SHM_RING_SIZE;
+    shm->rx->size = PT_SHM_RING_SIZE;
+    shm->ring_size = PT_SHM_RING_SIZE;
+
+    //服务器握手完成前不会处理数据，完成后会主动检查一次
+    atomic_store(&shm->tx->consumer_waiting, 0);
+    atomic_store(&shm->rx->consumer_waiting, 1);
+
+    shm->peer_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    shm->notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    hs.magic = PT_SHM_MAGIC;
+    hs.ring_size = PT_SHM_RING_SIZE;
+    hs.map_size = map_size;
+
+    fds[0] = memfd;
+    fds[1] = shm->peer_fd;
+    fds[2] = shm->notify_fd;
+
+    bzero(&msg, sizeof(msg));
+    bzero(control, sizeof(control));
+    iov.iov_base = &hs;
+    iov.iov_len = sizeof(hs);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if(shm->peer_fd < 0 || shm->notify_fd < 0 || sendmsg(sock_fd, &msg, MSG_NOSIGNAL) != sizeof(hs)){
+        pt_shm_log("shm handshake failed", errno, __FUNCTION__, __FILE__, __LINE__);
+        close(memfd);
+        if(shm->peer_fd >= 0) close(shm->peer_fd);
+        if(shm->notify_fd >= 0) close(shm->notify_fd);
+        munmap(shm->segment, shm->map_size);
+        close(sock_fd);
+        free(shm);
+        return NULL;
+    }
+
+    //映射后不再需要memfd
+    close(memfd);
+
+    uv_poll_init(loop, &shm->sock_poll, sock_fd);
+    shm->sock_poll.data = shm;
+    uv_poll_start(&shm->sock_poll, UV_READABLE | UV_DISCONNECT, pt_shm_sock_cb);
+
+    pt_shm_start(shm);
+
+    return shm;
+}
+
+struct pt_shm *pt_shm_accept(uv_loop_t *loop, int sock_fd, void *data, pt_shm_ready_cb on_ready,
+                             pt_shm_data_cb on_data, pt_shm_close_cb on_close)
+{
+    struct pt_shm *shm = pt_shm_new(loop, sock_fd, data, on_data, on_close);
+
+    shm->is_server = true;
+    shm->on_ready = on_ready;
+
+    uv_poll_init(loop, &shm->sock_poll, sock_fd);
+    shm->sock_poll.data = shm;
+    uv_poll_start(&shm->sock_poll, UV_READABLE | UV_DISCONNECT, pt_shm_sock_cb);
+
+    return shm;
+}
+
+void pt_shm_write(struct pt_shm *shm, struct pt_wreq *wreq)
+{
+    if(shm->closing){
+        pt_buffer_free(wreq->buff);
+        free(wreq);
+        return;
+    }
+
+    wreq->next = NULL;
+    if(shm->pending_tail){
+        shm->pending_tail->next = wreq;
+    } else {
+        shm->pending_head = wreq;
+    }
+    shm->pending_tail = wreq;
+    shm->pending_size += (uint32_t)wreq->buf.len;
+
+    //握手完成前数据留在队列中
+    if(shm->tx) pt_shm_flush(shm);
+}
+
+static void pt_shm_on_close_handle(uv_handle_t *handle)
+{
+    struct pt_shm *shm = handle->data;
+    struct pt_wreq *wreq;
+
+    if(--shm->closing_handles > 0) return;
+
+    if(shm->segment) munmap(shm->segment, shm->map_size);
+    if(shm->notify_fd >= 0) close(shm->notify_fd);
+    if(shm->peer_fd >= 0) close(shm->peer_fd);
+    if(shm->sock_fd >= 0) close(shm->sock_fd);
+
+    shm->segment = NULL;
+    shm->tx = NULL;
+    shm->rx = NULL;
+    shm->notify_fd = shm->peer_fd = shm->sock_fd = -1;
+
+    while(shm->pending_head)
+    {
+        wreq = shm->pending_head;
+        shm->pending_head = wreq->next;
+        pt_buffer_free(wreq->buff);
+        free(wreq);
+    }
+    shm->pending_tail = NULL;
+    shm->pending_size = 0;
+
+    if(shm->on_close) shm->on_close(shm);
+}
+
+void pt_shm_read_stop(struct pt_shm *shm)
+{
+    shm->read_paused = true;
+}
+
+void pt_shm_read_start(struct pt_shm *shm)
+{
+    uint64_t one = 1;
+
+    if(shm->read_paused == false) return;
+
+    shm->read_paused = false;
+
+    if(shm->closing || shm->ready == false) return;
+
+    //在下一轮loop中继续读取
+    if(write(shm->notify_fd, &one, sizeof(one)) < 0 && errno != EAGAIN){
+        pt_shm_log("eventfd write failed", errno, __FUNCTION__, __FILE__, __LINE__);
+    }
+}
+
+void pt_shm_close(struct pt_shm *shm)
+{
+    if(shm->closing) return;
+
+    shm->closing = true;
+
+    //对端通过unix socket的EOF得知断开
+    shm->closing_handles = 1;
+    if(shm->ready){
+        shm->closing_handles++;
+        uv_close((uv_handle_t*)&shm->notify_poll, pt_shm_on_close_handle);
+    }
+    uv_close((uv_handle_t*)&shm->sock_poll, pt_shm_on_close_handle);
+}
+
+void pt_shm_free(struct pt_shm *shm)
+{
+    free(shm);
+}
+
+#endif
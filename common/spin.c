@@ -0,0 +1,144 @@
+//
+//  spin.c
+//  xcode
+//
+//  独占CPU核心的低延迟事件循环
+//
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "common.h"
+#include "error.h"
+#include "spin.h"
+
+#ifdef __linux__
+#include <sched.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#endif
+
+struct pt_spin *pt_spin_new(uv_loop_t *loop)
+{
+    struct pt_spin *spin = malloc(sizeof(struct pt_spin));
+
+    if(spin == NULL){
+        FATAL("malloc pt_spin failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+
+    bzero(spin, sizeof(struct pt_spin));
+
+    spin->loop = loop;
+    spin->idle_time = PT_SPIN_IDLE_TIME;
+
+    return spin;
+}
+
+void pt_spin_free(struct pt_spin *spin)
+{
+    free(spin);
+}
+
+void pt_spin_set_idle_time(struct pt_spin *spin, uint32_t idle_time)
+{
+    spin->idle_time = idle_time;
+}
+
+int pt_spin_run(struct pt_spin *spin)
+{
+#if UV_VERSION_HEX >= 0x012d00
+    uv_metrics_t metrics;
+    uint64_t events;
+    uint64_t last_active;
+    uint64_t now;
+    int alive = 1;
+
+    spin->stopped = false;
+
+    uv_metrics_info(spin->loop, &metrics);
+    events = metrics.events;
+    last_active = uv_hrtime();
+
+    while(alive && spin->stopped == false)
+    {
+        alive = uv_run(spin->loop, UV_RUN_NOWAIT);
+        spin->number_of_polls++;
+
+        //epoll返回的事件数变化说明这次轮询处理了网络数据
+        uv_metrics_info(spin->loop, &metrics);
+        now = uv_hrtime();
+
+        if(metrics.events != events){
+            events = metrics.events;
+            last_active = now;
+            spin->number_of_active++;
+            continue;
+        }
+
+        if(alive == 0 || spin->stopped || spin->idle_time == 0) continue;
+
+        //空闲太久，阻塞到下一个事件，之后重新开始轮询
+        if(now - last_active >= (uint64_t)spin->idle_time * 1000){
+            spin->number_of_blocks++;
+            alive = uv_run(spin->loop, UV_RUN_ONCE);
+            last_active = uv_hrtime();
+        }
+    }
+
+    return alive;
+#else
+    LOG("spin mode requires libuv 1.45, fallback to UV_RUN_DEFAULT",__FUNCTION__,__FILE__,__LINE__);
+    spin->stopped = false;
+    return uv_run(spin->loop, UV_RUN_DEFAULT);
+#endif
+}
+
+void pt_spin_stop(struct pt_spin *spin)
+{
+    spin->stopped = true;
+    uv_stop(spin->loop);
+}
+
+qboolean pt_spin_pin_cpu(int cpu)
+{
+#ifdef __linux__
+    cpu_set_t set;
+
+    if(cpu < 0 || cpu >= CPU_SETSIZE){
+        LOG("invalid cpu",__FUNCTION__,__FILE__,__LINE__);
+        return false;
+    }
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0){
+        LOG("pthread_setaffinity_np failed",__FUNCTION__,__FILE__,__LINE__);
+        return false;
+    }
+
+    return true;
+#else
+    LOG("cpu pinning not supported",__FUNCTION__,__FILE__,__LINE__);
+    return false;
+#endif
+}
+
+qboolean pt_spin_busy_poll(int fd, uint32_t usec)
+{
+#if defined(__linux__) && defined(SO_BUSY_POLL)
+    int value = (int)usec;
+
+    //超过net.core.busy_read的值需要CAP_NET_ADMIN
+    if(setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &value, sizeof(value)) != 0){
+        DBGPRINT("setsockopt SO_BUSY_POLL failed");
+        return false;
+    }
+
+    return true;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,261 @@
+//
+//  timewheel.c
+//  xcode
+//
+//  分层时间轮
+//
+
+#include "common.h"
+#include "error.h"
+#include "timewheel.h"
+
+static struct pt_timewheel *timewheel_list = NULL;
+
+static void pt_timewheel_list_init(struct pt_timewheel_node *head)
+{
+    head->prev = head;
+    head->next = head;
+}
+
+static void pt_timewheel_list_append(struct pt_timewheel_node *head, struct pt_timewheel_node *node)
+{
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+static void pt_timewheel_unlink(struct pt_timewheel_node *node)
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = NULL;
+    node->next = NULL;
+}
+
+/*
+ 按照到期的tick选择槽
+ */
+static void pt_timewheel_place(struct pt_timewheel *wheel, struct pt_timewheel_node *node)
+{
+    uint64_t expire = node->expire;
+    uint64_t delta = expire - wheel->current;
+    uint32_t shift = PT_TIMEWHEEL_ROOT_BITS;
+    uint32_t i;
+
+    if(delta < PT_TIMEWHEEL_ROOT_SIZE){
+        pt_timewheel_list_append(&wheel->root[expire & (PT_TIMEWHEEL_ROOT_SIZE - 1)], node);
+        return;
+    }
+
+    for(i = 0; i < PT_TIMEWHEEL_LEVELS; i++, shift += PT_TIMEWHEEL_LEVEL_BITS)
+    {
+        if(delta < (1ULL << (shift + PT_TIMEWHEEL_LEVEL_BITS)) || i == PT_TIMEWHEEL_LEVELS - 1){
+            //超过最大范围的放在最后一层，每圈重新检查一次
+            if(delta >= (1ULL << (shift + PT_TIMEWHEEL_LEVEL_BITS))){
+                expire = wheel->current + (1ULL << (shift + PT_TIMEWHEEL_LEVEL_BITS)) - 1;
+            }
+            pt_timewheel_list_append(&wheel->levels[i][(expire >> shift) & (PT_TIMEWHEEL_LEVEL_SIZE - 1)], node);
+            return;
+        }
+    }
+}
+
+/*
+ 上层的一个槽到期，把节点重新分配到下层
+ */
+static void pt_timewheel_cascade(struct pt_timewheel *wheel, uint32_t level, uint32_t index)
+{
+    struct pt_timewheel_node list;
+    struct pt_timewheel_node *node;
+
+    pt_timewheel_list_init(&list);
+
+    //先移到临时链表，重新放置时可能回到同一个槽
+    if(wheel->levels[level][index].next != &wheel->levels[level][index]){
+        list.next = wheel->levels[level][index].next;
+        list.prev = wheel->levels[level][index].prev;
+        list.next->prev = &list;
+        list.prev->next = &list;
+        pt_timewheel_list_init(&wheel->levels[level][index]);
+    }
+
+    while(list.next != &list)
+    {
+        node = list.next;
+        pt_timewheel_unlink(node);
+        pt_timewheel_place(wheel, node);
+    }
+}
+
+/*
+ 前进一个tick，执行到期的节点
+ */
+static void pt_timewheel_tick(struct pt_timewheel *wheel)
+{
+    struct pt_timewheel_node list;
+    struct pt_timewheel_node *node;
+    struct pt_timewheel_node *slot;
+    uint32_t index = wheel->current & (PT_TIMEWHEEL_ROOT_SIZE - 1);
+    uint32_t shift = PT_TIMEWHEEL_ROOT_BITS;
+    uint32_t i;
+
+    //第一层转完一圈时从上层取下一批
+    for(i = 0; i < PT_TIMEWHEEL_LEVELS && index == 0; i++, shift += PT_TIMEWHEEL_LEVEL_BITS)
+    {
+        index = (wheel->current >> shift) & (PT_TIMEWHEEL_LEVEL_SIZE - 1);
+        pt_timewheel_cascade(wheel, i, index);
+    }
+
+    slot = &wheel->root[wheel->current & (PT_TIMEWHEEL_ROOT_SIZE - 1)];
+    wheel->current++;
+
+    if(slot->next == slot) return;
+
+    //回调中可能添加或者删除其他节点，先移到临时链表
+    list.next = slot->next;
+    list.prev = slot->prev;
+    list.next->prev = &list;
+    list.prev->next = &list;
+    pt_timewheel_list_init(slot);
+
+    while(list.next != &list)
+    {
+        node = list.next;
+        pt_timewheel_unlink(node);
+        wheel->count--;
+        node->cb(node);
+    }
+}
+
+static void pt_timewheel_timer_cb(uv_timer_t *handle)
+{
+    struct pt_timewheel *wheel = handle->data;
+    uint64_t now = uv_now(wheel->loop);
+
+    //loop阻塞时补上错过的tick
+    while(now - wheel->last >= PT_TIMEWHEEL_TICK && wheel->count > 0)
+    {
+        wheel->last += PT_TIMEWHEEL_TICK;
+        pt_timewheel_tick(wheel);
+    }
+
+    //按照last对齐下一次回调，避免误差累积
+    if(wheel->count > 0 && uv_is_active((uv_handle_t*)&wheel->timer) == false){
+        uv_timer_start(&wheel->timer, pt_timewheel_timer_cb, wheel->last + PT_TIMEWHEEL_TICK - now, 0);
+    }
+}
+
+static void pt_timewheel_on_close(uv_handle_t *handle)
+{
+    free(handle->data);
+}
+
+struct pt_timewheel *pt_timewheel_get(uv_loop_t *loop)
+{
+    struct pt_timewheel *wheel;
+    uint32_t i, j;
+
+    for(wheel = timewheel_list; wheel; wheel = wheel->next)
+    {
+        if(wheel->loop == loop){
+            wheel->ref++;
+            return wheel;
+        }
+    }
+
+    wheel = malloc(sizeof(struct pt_timewheel));
+    if(wheel == NULL){
+        FATAL("malloc pt_timewheel failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+    bzero(wheel, sizeof(struct pt_timewheel));
+
+    for(i = 0; i < PT_TIMEWHEEL_ROOT_SIZE; i++)
+    {
+        pt_timewheel_list_init(&wheel->root[i]);
+    }
+    for(i = 0; i < PT_TIMEWHEEL_LEVELS; i++)
+    {
+        for(j = 0; j < PT_TIMEWHEEL_LEVEL_SIZE; j++)
+        {
+            pt_timewheel_list_init(&wheel->levels[i][j]);
+        }
+    }
+
+    wheel->loop = loop;
+    wheel->ref = 1;
+
+    uv_timer_init(loop, &wheel->timer);
+    wheel->timer.data = wheel;
+
+    wheel->next = timewheel_list;
+    timewheel_list = wheel;
+
+    return wheel;
+}
+
+void pt_timewheel_release(struct pt_timewheel *wheel)
+{
+    struct pt_timewheel **p;
+
+    if(--wheel->ref > 0) return;
+
+    if(wheel->count > 0){
+        FATAL("timewheel still has nodes", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+
+    for(p = &timewheel_list; *p; p = &(*p)->next)
+    {
+        if(*p == wheel){
+            *p = wheel->next;
+            break;
+        }
+    }
+
+    uv_close((uv_handle_t*)&wheel->timer, pt_timewheel_on_close);
+}
+
+void pt_timewheel_node_init(struct pt_timewheel_node *node, pt_timewheel_cb cb, void *data)
+{
+    node->prev = NULL;
+    node->next = NULL;
+    node->expire = 0;
+    node->cb = cb;
+    node->data = data;
+}
+
+void pt_timewheel_add(struct pt_timewheel *wheel, struct pt_timewheel_node *node, uint64_t timeout)
+{
+    uint64_t now = uv_now(wheel->loop);
+    uint64_t ticks;
+
+    pt_timewheel_remove(wheel, node);
+
+    //时间轮空闲时uv_timer已经停止，从现在开始计时
+    if(wheel->count == 0){
+        wheel->last = now;
+        uv_timer_start(&wheel->timer, pt_timewheel_timer_cb, PT_TIMEWHEEL_TICK, 0);
+    }
+
+    //current对应的槽在last + PT_TIMEWHEEL_TICK执行，按这个时间点计算到期的tick
+    //不会早于timeout，最多晚一个tick
+    ticks = (now - wheel->last + timeout + PT_TIMEWHEEL_TICK - 1) / PT_TIMEWHEEL_TICK;
+    node->expire = wheel->current + (ticks ? ticks - 1 : 0);
+    pt_timewheel_place(wheel, node);
+    wheel->count++;
+}
+
+void pt_timewheel_remove(struct pt_timewheel *wheel, struct pt_timewheel_node *node)
+{
+    if(node->next == NULL) return;
+
+    pt_timewheel_unlink(node);
+    wheel->count--;
+}
+
+qboolean pt_timewheel_active(struct pt_timewheel_node *node)
+{
+    return node->next != NULL;
+}
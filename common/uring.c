@@ -0,0 +1,515 @@
+//
+//  uring.c
+//  xcode
+//
+//  Linux io_uring网络后端
+//  accept和recv使用multishot，接收缓冲区由内核从buf_ring中选择
+//  同一轮loop中产生的sqe在uv_prepare中统一提交
+//
+
+#include "common.h"
+#include "error.h"
+#include "buffer.h"
+#include "uring.h"
+
+#ifdef PT_HAVE_URING
+
+#include <errno.h>
+
+static struct pt_uring *uring_list = NULL;
+
+static void pt_uring_log(const char *fmt, int error, const char *func, const char *file, int line)
+{
+    char log[512];
+    sprintf(log, fmt, strerror(error));
+    LOG(log,func,file,line);
+}
+
+static void pt_uring_submit(struct pt_uring *ring)
+{
+    int r;
+
+    if(ring->pending == 0) return;
+
+    r = io_uring_submit(&ring->ring);
+    if(r < 0){
+        pt_uring_log("io_uring_submit failed:%s", -r, __FUNCTION__, __FILE__, __LINE__);
+        return;
+    }
+
+    ring->pending = 0;
+}
+
+static struct io_uring_sqe *pt_uring_get_sqe(struct pt_uring *ring)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&ring->ring);
+
+    //提交队列已满，先提交一次再获取
+    if(sqe == NULL){
+        pt_uring_submit(ring);
+        sqe = io_uring_get_sqe(&ring->ring);
+    }
+
+    if(sqe == NULL){
+        ERROR("io_uring_get_sqe == NULL", __FUNCTION__, __FILE__, __LINE__);
+        return NULL;
+    }
+
+    ring->pending++;
+    return sqe;
+}
+
+/*
+ 处理所有已经完成的cqe
+ 回调中可能会继续投递sqe，所以每次只取一个
+ */
+static void pt_uring_reap(struct pt_uring *ring)
+{
+    struct io_uring_cqe *cqe;
+    struct pt_uring_req *req;
+    int res;
+    uint32_t flags;
+
+    while(io_uring_peek_cqe(&ring->ring, &cqe) == 0)
+    {
+        req = io_uring_cqe_get_data(cqe);
+        res = cqe->res;
+        flags = cqe->flags;
+        io_uring_cqe_seen(&ring->ring, cqe);
+
+        //取消请求本身的cqe没有user_data
+        if(req && req->cb){
+            req->cb(req, res, flags);
+        }
+    }
+}
+
+static void pt_uring_poll_cb(uv_poll_t *handle, int status, int events)
+{
+    struct pt_uring *ring = handle->data;
+
+    pt_uring_reap(ring);
+    pt_uring_submit(ring);
+}
+
+static void pt_uring_prepare_cb(uv_prepare_t *handle)
+{
+    struct pt_uring *ring = handle->data;
+
+    pt_uring_submit(ring);
+
+    //提交时内核可能已经直接完成了部分请求
+    pt_uring_reap(ring);
+    pt_uring_submit(ring);
+}
+
+static void pt_uring_on_close(uv_handle_t *handle)
+{
+    struct pt_uring *ring = handle->data;
+
+    //poll和prepare都关闭后释放
+    if(uv_is_closing((uv_handle_t*)&ring->poll) && uv_is_closing((uv_handle_t*)&ring->prepare)){
+        if(handle == (uv_handle_t*)&ring->prepare){
+            io_uring_free_buf_ring(&ring->ring, ring->buf_ring, PT_URING_BUF_COUNT, PT_URING_BGID);
+            io_uring_queue_exit(&ring->ring);
+            free(ring->buf_base);
+            free(ring);
+        }
+    }
+}
+
+struct pt_uring *pt_uring_get(uv_loop_t *loop)
+{
+    int r;
+    uint32_t i;
+    struct pt_uring *ring;
+
+    for(ring = uring_list; ring; ring = ring->next)
+    {
+        if(ring->loop == loop){
+            ring->ref++;
+            return ring;
+        }
+    }
+
+    ring = malloc(sizeof(struct pt_uring));
+    if(ring == NULL){
+        FATAL("malloc pt_uring failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+    bzero(ring, sizeof(struct pt_uring));
+
+    r = io_uring_queue_init(PT_URING_ENTRIES, &ring->ring, 0);
+    if(r < 0){
+        pt_uring_log("io_uring_queue_init failed:%s", -r, __FUNCTION__, __FILE__, __LINE__);
+        free(ring);
+        return NULL;
+    }
+
+    ring->buf_ring = io_uring_setup_buf_ring(&ring->ring, PT_URING_BUF_COUNT, PT_URING_BGID, 0, &r);
+    if(ring->buf_ring == NULL){
+        pt_uring_log("io_uring_setup_buf_ring failed:%s", -r, __FUNCTION__, __FILE__, __LINE__);
+        io_uring_queue_exit(&ring->ring);
+        free(ring);
+        return NULL;
+    }
+
+    ring->buf_base = malloc(PT_URING_BUF_COUNT * PT_URING_BUF_SIZE);
+    if(ring->buf_base == NULL){
+        FATAL("malloc ring->buf_base failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+
+    for(i = 0; i < PT_URING_BUF_COUNT; i++)
+    {
+        io_uring_buf_ring_add(ring->buf_ring, ring->buf_base + i * PT_URING_BUF_SIZE, PT_URING_BUF_SIZE, i,
+                              io_uring_buf_ring_mask(PT_URING_BUF_COUNT), i);
+    }
+    io_uring_buf_ring_advance(ring->buf_ring, PT_URING_BUF_COUNT);
+
+    ring->loop = loop;
+    ring->ref = 1;
+
+    uv_poll_init(loop, &ring->poll, ring->ring.ring_fd);
+    ring->poll.data = ring;
+    uv_poll_start(&ring->poll, UV_READABLE, pt_uring_poll_cb);
+
+    uv_prepare_init(loop, &ring->prepare);
+    ring->prepare.data = ring;
+    uv_prepare_start(&ring->prepare, pt_uring_prepare_cb);
+
+    ring->next = uring_list;
+    uring_list = ring;
+
+    return ring;
+}
+
+void pt_uring_release(struct pt_uring *ring)
+{
+    struct pt_uring **p;
+
+    if(--ring->ref > 0) return;
+
+    for(p = &uring_list; *p; p = &(*p)->next)
+    {
+        if(*p == ring){
+            *p = ring->next;
+            break;
+        }
+    }
+
+    pt_uring_submit(ring);
+    uv_close((uv_handle_t*)&ring->poll, pt_uring_on_close);
+    uv_close((uv_handle_t*)&ring->prepare, pt_uring_on_close);
+}
+
+qboolean pt_uring_accept(struct pt_uring *ring, struct pt_uring_req *req, int fd)
+{
+    struct io_uring_sqe *sqe = pt_uring_get_sqe(ring);
+    if(sqe == NULL) return false;
+
+    io_uring_prep_multishot_accept(sqe, fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    io_uring_sqe_set_data(sqe, req);
+    return true;
+}
+
+qboolean pt_uring_cancel(struct pt_uring *ring, struct pt_uring_req *req)
+{
+    struct io_uring_sqe *sqe = pt_uring_get_sqe(ring);
+    if(sqe == NULL) return false;
+
+    io_uring_prep_cancel(sqe, req, 0);
+    io_uring_sqe_set_data(sqe, NULL);
+    return true;
+}
+
+
+
+static void pt_uring_conn_finish(struct pt_uring_conn *conn)
+{
+    struct pt_wreq *wreq;
+
+    if(conn->inflight > 0) return;
+
+    if(conn->fd >= 0){
+        close(conn->fd);
+        conn->fd = -1;
+    }
+
+    while(conn->send_head)
+    {
+        wreq = conn->send_head;
+        conn->send_head = wreq->next;
+        pt_buffer_free(wreq->buff);
+        free(wreq);
+    }
+    conn->send_tail = NULL;
+    conn->queue_size = 0;
+
+    if(conn->on_close) conn->on_close(conn);
+}
+
+static qboolean pt_uring_conn_arm_recv(struct pt_uring_conn *conn)
+{
+    struct io_uring_sqe *sqe = pt_uring_get_sqe(conn->ring);
+    if(sqe == NULL) return false;
+
+    io_uring_prep_recv_multishot(sqe, conn->fd, NULL, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = PT_URING_BGID;
+    io_uring_sqe_set_data(sqe, &conn->recv_req);
+
+    conn->recving = true;
+    conn->inflight++;
+    return true;
+}
+
+static void pt_uring_conn_recv_cb(struct pt_uring_req *req, int res, uint32_t flags)
+{
+    struct pt_uring_conn *conn = req->data;
+    struct pt_uring *ring = conn->ring;
+    uint16_t bid;
+
+    if(flags & IORING_CQE_F_BUFFER)
+    {
+        bid = flags >> IORING_CQE_BUFFER_SHIFT;
+
+        if(res > 0 && conn->closing == false){
+            conn->on_data(conn, ring->buf_base + bid * PT_URING_BUF_SIZE, res);
+        }
+
+        //数据已经复制到连接的缓冲区，立即归还给内核
+        io_uring_buf_ring_add(ring->buf_ring, ring->buf_base + bid * PT_URING_BUF_SIZE, PT_URING_BUF_SIZE, bid,
+                              io_uring_buf_ring_mask(PT_URING_BUF_COUNT), 0);
+        io_uring_buf_ring_advance(ring->buf_ring, 1);
+    }
+
+    if(flags & IORING_CQE_F_MORE) return;
+
+    //multishot已经结束
+    conn->recving = false;
+    conn->inflight--;
+
+    if(conn->closing){
+        pt_uring_conn_finish(conn);
+        return;
+    }
+
+    //暂停接收，恢复时重新投递
+    if(conn->read_paused) return;
+
+    //缓冲区暂时用完，内核主动结束multishot，或者暂停后又恢复，重新投递
+    if(res > 0 || res == -ENOBUFS || res == -ECANCELED){
+        pt_uring_conn_arm_recv(conn);
+        return;
+    }
+
+    conn->on_data(conn, NULL, res);
+}
+
+static void pt_uring_conn_flush(struct pt_uring_conn *conn);
+
+static void pt_uring_conn_send_cb(struct pt_uring_req *req, int res, uint32_t flags)
+{
+    struct pt_uring_conn *conn = req->data;
+    struct pt_wreq *wreq;
+    uint32_t sent = res > 0 ? (uint32_t)res : 0;
+
+    conn->inflight--;
+    conn->queue_size -= sent > conn->queue_size ? conn->queue_size : sent;
+
+    //释放已经完全写入的请求，出错或关闭时全部释放
+    while(conn->sending)
+    {
+        wreq = conn->sending;
+
+        if(res >= 0 && conn->closing == false && sent < wreq->buf.len){
+            wreq->buf.base += sent;
+            wreq->buf.len -= sent;
+            break;
+        }
+
+        sent -= sent < wreq->buf.len ? sent : (uint32_t)wreq->buf.len;
+        conn->sending = wreq->next;
+        pt_buffer_free(wreq->buff);
+        free(wreq);
+    }
+
+    //部分写入时，剩下的请求放回队首
+    if(conn->sending){
+        wreq = conn->sending;
+        while(wreq->next) wreq = wreq->next;
+        wreq->next = conn->send_head;
+        conn->send_head = conn->sending;
+        if(conn->send_tail == NULL) conn->send_tail = wreq;
+        conn->sending = NULL;
+    }
+    conn->sending_count = 0;
+
+    if(conn->closing){
+        pt_uring_conn_finish(conn);
+        return;
+    }
+
+    if(res < 0){
+        conn->on_data(conn, NULL, res);
+        return;
+    }
+
+    if(conn->on_sent && res > 0) conn->on_sent(conn, (uint32_t)res);
+
+    pt_uring_conn_flush(conn);
+}
+
+/*
+ 同一个连接同时只有一个sendmsg在进行，保证数据的顺序
+ 等待中的请求在上一个完成后合并成一个sendmsg
+ */
+static void pt_uring_conn_flush(struct pt_uring_conn *conn)
+{
+    struct io_uring_sqe *sqe;
+    struct pt_wreq *wreq;
+    struct pt_wreq *last = NULL;
+    uint32_t n = 0;
+
+    if(conn->sending || conn->send_head == NULL || conn->closing) return;
+
+    for(wreq = conn->send_head; wreq && n < PT_URING_MAX_IOV; wreq = wreq->next)
+    {
+        conn->iov[n].iov_base = wreq->buf.base;
+        conn->iov[n].iov_len = wreq->buf.len;
+        last = wreq;
+        n++;
+    }
+
+    sqe = pt_uring_get_sqe(conn->ring);
+    if(sqe == NULL) return;
+
+    conn->sending = conn->send_head;
+    conn->sending_count = n;
+    conn->send_head = last->next;
+    if(conn->send_head == NULL) conn->send_tail = NULL;
+    last->next = NULL;
+
+    bzero(&conn->msg, sizeof(conn->msg));
+    conn->msg.msg_iov = conn->iov;
+    conn->msg.msg_iovlen = n;
+
+    io_uring_prep_sendmsg(sqe, conn->fd, &conn->msg, MSG_NOSIGNAL);
+    io_uring_sqe_set_data(sqe, &conn->send_req);
+    conn->inflight++;
+}
+
+struct pt_uring_conn *pt_uring_conn_new(struct pt_uring *ring, int fd, void *data)
+{
+    struct pt_uring_conn *conn = malloc(sizeof(struct pt_uring_conn));
+
+    if(conn == NULL){
+        FATAL("malloc pt_uring_conn failed", __FUNCTION__, __FILE__, __LINE__);
+        abort();
+    }
+
+    bzero(conn, sizeof(struct pt_uring_conn));
+
+    conn->ring = ring;
+    conn->fd = fd;
+    conn->data = data;
+    conn->recv_req.cb = pt_uring_conn_recv_cb;
+    conn->recv_req.data = conn;
+    conn->send_req.cb = pt_uring_conn_send_cb;
+    conn->send_req.data = conn;
+
+    return conn;
+}
+
+void pt_uring_conn_free(struct pt_uring_conn *conn)
+{
+    free(conn);
+}
+
+qboolean pt_uring_conn_start(struct pt_uring_conn *conn, pt_uring_data_cb on_data, pt_uring_close_cb on_close)
+{
+    conn->on_data = on_data;
+    conn->on_close = on_close;
+
+    return pt_uring_conn_arm_recv(conn);
+}
+
+void pt_uring_conn_read_stop(struct pt_uring_conn *conn)
+{
+    if(conn->read_paused || conn->closing) return;
+
+    conn->read_paused = true;
+
+    if(conn->recving){
+        pt_uring_cancel(conn->ring, &conn->recv_req);
+    }
+}
+
+void pt_uring_conn_read_start(struct pt_uring_conn *conn)
+{
+    if(conn->read_paused == false || conn->closing) return;
+
+    conn->read_paused = false;
+
+    //取消还没有完成时，在最终的cqe中重新投递
+    if(conn->recving == false){
+        pt_uring_conn_arm_recv(conn);
+    }
+}
+
+qboolean pt_uring_conn_connect(struct pt_uring_conn *conn, const struct sockaddr *addr, socklen_t length, pt_uring_cb cb)
+{
+    struct io_uring_sqe *sqe;
+
+    if(length > sizeof(conn->addr)) return false;
+
+    sqe = pt_uring_get_sqe(conn->ring);
+    if(sqe == NULL) return false;
+
+    //sockaddr需要在请求完成前保持有效
+    memcpy(&conn->addr, addr, length);
+
+    conn->send_req.cb = cb;
+    io_uring_prep_connect(sqe, conn->fd, (struct sockaddr*)&conn->addr, length);
+    io_uring_sqe_set_data(sqe, &conn->send_req);
+
+    return true;
+}
+
+void pt_uring_conn_write(struct pt_uring_conn *conn, struct pt_wreq *wreq)
+{
+    //连接完成后send_req恢复为发送回调
+    conn->send_req.cb = pt_uring_conn_send_cb;
+
+    wreq->next = NULL;
+    if(conn->send_tail){
+        conn->send_tail->next = wreq;
+    } else {
+        conn->send_head = wreq;
+    }
+    conn->send_tail = wreq;
+    conn->queue_size += (uint32_t)wreq->buf.len;
+
+    pt_uring_conn_flush(conn);
+}
+
+void pt_uring_conn_close(struct pt_uring_conn *conn)
+{
+    if(conn->closing) return;
+
+    conn->closing = true;
+
+    if(conn->recving){
+        pt_uring_cancel(conn->ring, &conn->recv_req);
+    }
+
+    //正在进行的sendmsg在关闭socket后会返回错误
+    if(conn->sending && conn->fd >= 0){
+        shutdown(conn->fd, SHUT_RDWR);
+    }
+
+    pt_uring_conn_finish(conn);
+}
+
+#endif
@@ -4,7 +4,7 @@
 
 #define PAGESIZE 0x1000
 
-#define ALIGN_SIZE(n,a) n % a == 0 ? n : ((n / a)+1) * a
+#define ALIGN_SIZE(n,a) ((n) % (a) == 0 ? (n) : (((n) / (a))+1) * (a))
 
 
 /*
@@ -16,6 +16,8 @@ struct pt_buffer
 	unsigned char *buff;
 	uint32_t length;
 	uint32_t max_length;
+    //pt_buffer_ref增加的引用数，为0时pt_buffer_free才真正释放
+    uint32_t refs;
 };
 
 /*
@@ -33,8 +35,15 @@ struct pt_buffer_allocator
 //申请一个新的pt_buffer 如果buffer_allocator为enable，则使用buffer_allocator申请
 struct pt_buffer* pt_buffer_new(uint32_t length);
 //释放一个pt_buffer 如果已启用buffer_allocator 则使用buffer_allocator释放
+//有其他引用时只减少引用数
 void pt_buffer_free(struct pt_buffer *buff);
 
+/*
+    增加一个引用并返回buff，每个引用各调用一次pt_buffer_free
+    共享的pt_buffer不能再修改，也不能使用next放入链表(例如加密或者pt_server_send的优先级队列)
+ */
+struct pt_buffer *pt_buffer_ref(struct pt_buffer *buff);
+
 //为pt_buffer预留多少字节的空间，如果空间不足则执行realloc
 void pt_buffer_reserve(struct pt_buffer *buff, uint32_t length);
 
@@ -44,6 +53,25 @@ void pt_buffer_write(struct pt_buffer *buff, const unsigned char *data, uint32_t
 //将数据从pt_buffer的头部读取数据，并从pt_buffer中删除已经读区的数据
 qboolean pt_buffer_read(struct pt_buffer *buff,unsigned char *data, uint32_t length, qboolean remove);
 
+//从pt_buffer的头部删除length字节的数据
+void pt_buffer_skip(struct pt_buffer *buff, uint32_t length);
+
+/*
+    二进制编码，格式见buffer_reader.h
+    写入前可以用pt_buffer_reserve预留整个消息的大小
+ */
+void pt_buffer_write_u8(struct pt_buffer *buff, uint8_t v);
+void pt_buffer_write_u16(struct pt_buffer *buff, uint16_t v);
+void pt_buffer_write_u32(struct pt_buffer *buff, uint32_t v);
+void pt_buffer_write_u64(struct pt_buffer *buff, uint64_t v);
+void pt_buffer_write_varint(struct pt_buffer *buff, uint64_t v);
+void pt_buffer_write_svarint(struct pt_buffer *buff, int64_t v);
+void pt_buffer_write_bytes(struct pt_buffer *buff, const unsigned char *data, uint32_t length);
+//写入数组的元素数量，之后依次写入每个元素
+void pt_buffer_write_array(struct pt_buffer *buff, uint32_t count);
+//写入optional字段是否存在，存在时之后写入字段的值
+void pt_buffer_write_optional(struct pt_buffer *buff, qboolean present);
+
 
 
 //allocator manager
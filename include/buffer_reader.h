@@ -9,10 +9,35 @@
 #ifndef buffer_reader_h
 #define buffer_reader_h
 
+/*
+    二进制编码格式，对应buffer.h中的pt_buffer_write_*
+    u8/u16/u32/u64   本机字节序的定长整数，和net_header一致
+    varint           每字节7位，小端在前，最多10字节
+    svarint          zigzag编码后的varint
+    bytes/string     varint长度 + 数据，字符串不包含结尾的0
+    array            varint元素数量 + 元素
+    optional         1字节是否存在 + 存在时的值
+ */
+
+/*
+    读取时不单独检查每个字段，越界后error置为true，之后的读取都返回0或者空值
+    整个消息读取完成后检查一次buffer_reader_ok即可
+ */
 struct buffer_reader
 {
     struct pt_buffer *buff;
     uint32_t pos;
+    qboolean error;
+};
+
+/*
+    指向数据包内部的数据，不复制
+    只在数据包释放之前有效
+ */
+struct pt_bytes
+{
+    const unsigned char *data;
+    uint32_t length;
 };
 
 
@@ -23,5 +48,27 @@ qboolean buffer_reader_is_eof(struct buffer_reader *reader);
 unsigned char *buffer_reader_cur_pos(struct buffer_reader *reader);
 uint32_t buffer_reader_over_size(struct buffer_reader *reader);
 
+//之前的读取都没有越界
+qboolean buffer_reader_ok(struct buffer_reader *reader);
+
+uint8_t buffer_reader_read_u8(struct buffer_reader *reader);
+uint16_t buffer_reader_read_u16(struct buffer_reader *reader);
+uint32_t buffer_reader_read_u32(struct buffer_reader *reader);
+uint64_t buffer_reader_read_u64(struct buffer_reader *reader);
+uint64_t buffer_reader_read_varint(struct buffer_reader *reader);
+int64_t buffer_reader_read_svarint(struct buffer_reader *reader);
+
+//读取长度和数据，返回指向数据包内部的视图
+struct pt_bytes buffer_reader_read_bytes(struct buffer_reader *reader);
+
+/*
+    读取数组的元素数量，min_item_size为每个元素最少占用的字节数
+    剩余数据不够放下所有元素时置为错误并返回0，避免按错误的数量申请内存
+ */
+uint32_t buffer_reader_read_array(struct buffer_reader *reader, uint32_t min_item_size);
+
+//读取optional字段是否存在，存在时再读取字段的值
+qboolean buffer_reader_read_optional(struct buffer_reader *reader);
+
 
 #endif /* buffer_reader_h */
@@ -6,8 +6,25 @@
 #include "packet.h"
 
 struct pt_client;
+struct pt_uring_conn;
+struct pt_shm;
+struct pt_rudp;
+struct pt_rpc;
 
 
+//自动重连使用的连接方式
+#define PT_CLIENT_CONNECT_TCP 1
+#define PT_CLIENT_CONNECT_PIPE 2
+#define PT_CLIENT_CONNECT_UDP 3
+
+//重连定时器状态
+#define PT_CLIENT_TIMER_NONE 0
+#define PT_CLIENT_TIMER_READY 1
+#define PT_CLIENT_TIMER_CLOSING 2
+
+//重连时上一个连接还没有关闭完成，等待多久后再检查(毫秒)
+#define PT_CLIENT_CLOSE_WAIT 10
+
 typedef void (*pt_cli_on_connected)(struct pt_client *conn);
 typedef void (*pt_cli_on_receive)(struct pt_client *conn, struct pt_buffer *buff);
 typedef void (*pt_cli_on_disconnected)(struct pt_client *conn);
@@ -36,12 +53,21 @@ struct pt_client
     //正在连接中
     qboolean connecting;
     
+    //断开后句柄正在关闭，关闭完成前不能重新连接
+    qboolean closing;
+    
+    //用户数据
+    void *data;
+    
     //收到的缓冲区数据
     struct pt_buffer *buf;
     
     //投递给libuv的异步缓冲区
     uv_buf_t *async_buf;
     
+    //正在通知on_receive的数据包，被pt_client_detach_packet取走后为NULL
+    struct pt_buffer *receiving;
+    
     
     //加密函数使用
     uint32_t serial;
@@ -49,6 +75,49 @@ struct pt_client
     qboolean enable_encrypt;
     uint32_t encrypt_key[4];
     
+    //网络后端 PT_BACKEND_LIBUV 或 PT_BACKEND_URING
+    int backend;
+    
+    //io_uring后端的连接信息
+    struct pt_uring_conn *uring;
+    
+    //tcp连接的SO_BUSY_POLL时间(微秒)，0为不设置
+    uint32_t busy_poll;
+    
+    //共享内存连接，pipe只用于握手
+    qboolean is_shm;
+    struct pt_shm *shm;
+    
+    //UDP可靠传输连接，conn为uv_udp_t
+    struct pt_rudp *rudp;
+    //不可靠通道的包序列，每个数据包单独加密
+    uint32_t unrel_serial;
+    struct sockaddr_in udp_addr;
+    uv_timer_t udp_timer;
+    
+    //请求/回复，由pt_rpc_new设置
+    struct pt_rpc *rpc;
+    
+    //自动重连
+    qboolean auto_reconnect;
+    uint32_t reconnect_min_delay;
+    uint32_t reconnect_max_delay;
+    uint32_t reconnect_attempts;
+    //退避抖动的xorshift状态，每个客户端单独设置种子
+    uint32_t reconnect_seed;
+    uv_timer_t reconnect_timer;
+    int reconnect_timer_state;
+    
+    //最后一次连接的地址，自动重连时使用
+    int connect_type;
+    char connect_host[256];
+    uint16_t connect_port;
+    
+    //断开期间缓存的数据包，连接成功后加密并一次写入
+    struct pt_wreq *outbox_head;
+    struct pt_wreq *outbox_tail;
+    uint32_t outbox_size;
+    uint32_t outbox_max;
     
     
     /*
@@ -67,14 +136,73 @@ void pt_client_free(struct pt_client *client);
 //初始化一个pt_client结构，设置回调函数等
 void pt_client_init(uv_loop_t *loop, struct pt_client *client, pt_cli_on_connected on_connected, pt_cli_on_receive on_receive, pt_cli_on_disconnected on_disconnected);
 
+//选择网络后端，需要在连接之前调用，后端不可用时返回false
+qboolean pt_client_set_backend(struct pt_client *client, int backend);
+
+//连接成功后设置SO_BUSY_POLL(微秒)，配合pt_spin_run使用
+void pt_client_set_busy_poll(struct pt_client *client, uint32_t usec);
+
 //连接服务器
 void pt_client_connect(struct pt_client *client, const char *host, uint16_t port);
 void pt_client_connect_pipe(struct pt_client *client, const char *path);
+//连接同一台机器上pt_server_start_shm启动的服务器，数据通过共享内存传输
+void pt_client_connect_shm(struct pt_client *client, const char *path);
+//连接pt_server_start_udp启动的服务器
+void pt_client_connect_udp(struct pt_client *client, const char *host, uint16_t port);
+//主动断开连接，同时关闭自动重连
 void pt_client_disconnect(struct pt_client *client);
 
-//添加发送数据到队列中
+/*
+    开启自动重连，断开或者连接失败后在[delay/2, delay]内随机等待后重连
+    delay从min_delay开始每次失败加倍，最大max_delay(毫秒)
+    断开期间pt_client_send_data的数据最多缓存outbox_max字节
+ */
+void pt_client_set_reconnect(struct pt_client *client, uint32_t min_delay, uint32_t max_delay, uint32_t outbox_max);
+
+//添加发送数据到队列中，未连接时释放buff
+//自动重连模式下未加密的数据包会缓存到outbox
 void pt_client_send(struct pt_client *client, struct pt_buffer *buff);
 
+//组包并发送，加密在发送时进行，自动重连模式下断开期间缓存到outbox
+//未连接且无法缓存时返回false
+qboolean pt_client_send_data(struct pt_client *client, uint16_t id, const unsigned char *data, uint32_t length);
+/*
+    发送已经组好但未加密的数据包，加密时net_header之后需要预留4字节的包序列
+    加密在发送时进行，自动重连模式下断开期间缓存到outbox，无法缓存时释放buff并返回false
+ */
+qboolean pt_client_send_prepared(struct pt_client *client, struct pt_buffer *buff);
+
+/*
+    发送pt_batch_new(client->enable_encrypt)创建的批量包，加密在发送时进行
+    未连接且无法缓存时释放batch并返回false
+ */
+qboolean pt_client_send_batch(struct pt_client *client, struct pt_buffer *batch);
+
+/*
+    组一个id的数据包，net_header之后是head和owner中offset开始的length字节
+    libuv后端不加密时头部和数据分两段写入，数据不复制，否则组成完整的数据包后发送
+    owner的所有权交给发送队列，无法发送时释放owner并返回false
+ */
+qboolean pt_client_send_wrapped(struct pt_client *client, uint16_t id, const void *head, uint32_t head_len,
+                                struct pt_buffer *owner, uint32_t offset, uint32_t length);
+
+/*
+    在on_receive中取走收到的数据包，之后由调用者释放
+    只有直接收到的数据包可以取走，批量包拆开的子消息等返回NULL
+ */
+struct pt_buffer *pt_client_detach_packet(struct pt_client *client, struct pt_buffer *buff);
+
+//发送队列中还没有写入socket的字节数
+size_t pt_client_send_queue_size(struct pt_client *client);
+
+/*
+    通过不可靠有序通道发送，数据包格式和pt_client_send_prepared相同(加密时预留包序列)
+    加密时每个数据包单独加密，超过PT_RUDP_MSS的数据包不发送并返回false
+    非UDP连接等同于pt_client_send_prepared
+ */
+qboolean pt_client_send_unreliable(struct pt_client *client, struct pt_buffer *buff);
+qboolean pt_client_send_unreliable_data(struct pt_client *client, uint16_t id, const unsigned char *data, uint32_t length);
+
 //设置加密解密信息
 void pt_client_set_encrypt(struct pt_client *client, const uint32_t encrypt_key[4]);
 
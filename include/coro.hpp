@@ -0,0 +1,706 @@
+//
+//  coro.hpp
+//  xcode
+//
+//  pt_client和pt_server的C++20协程接口，只有头文件
+//  所有回调都在uv_loop的线程中直接恢复协程，不切换线程
+//  协程帧从frame_pool分配，收到的数据包使用pt_buffer_new复制，
+//  启用pt_buffer_enable_allocator后稳定状态下await不再申请内存
+//
+
+#ifndef _PT_CORO_INCLUED_HPP_
+#define _PT_CORO_INCLUED_HPP_
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <optional>
+#include <utility>
+
+#include "net.hpp"
+
+extern "C"
+{
+    #include "rpc.h"
+};
+
+namespace pt
+{
+    /*
+        协程帧的内存池，按64字节分级缓存释放的帧
+        只在uv_loop的线程中使用，每个线程一个
+     */
+    class frame_pool
+    {
+    public:
+        static constexpr size_t granularity = 64;
+        static constexpr size_t classes = 32;
+        static constexpr uint32_t max_cached = 256;
+
+        static void *allocate(size_t size)
+        {
+            size_t index = (size + granularity - 1) / granularity;
+            node *n;
+
+            if (index < classes && (n = free_[index]) != nullptr) {
+                free_[index] = n->next;
+                count_[index]--;
+                return n;
+            }
+
+            return ::operator new(index < classes ? index * granularity : size);
+        }
+
+        static void deallocate(void *p, size_t size)
+        {
+            size_t index = (size + granularity - 1) / granularity;
+
+            if (index < classes && count_[index] < max_cached) {
+                node *n = static_cast<node*>(p);
+                n->next = free_[index];
+                free_[index] = n;
+                count_[index]++;
+                return;
+            }
+
+            ::operator delete(p);
+        }
+
+    private:
+        struct node
+        {
+            node *next;
+        };
+
+        static inline thread_local node *free_[classes] = {};
+        static inline thread_local uint32_t count_[classes] = {};
+    };
+
+    //收到的数据包(包含net_header)，连接断开时为空
+    using packet = Buffer;
+
+    namespace detail
+    {
+        struct promise_base
+        {
+            std::coroutine_handle<> continuation = std::noop_coroutine();
+
+            static void *operator new(size_t size) { return frame_pool::allocate(size); }
+            static void operator delete(void *p, size_t size) { frame_pool::deallocate(p, size); }
+
+            std::suspend_always initial_suspend() noexcept { return {}; }
+
+            //完成后直接切换到等待的协程
+            struct final_awaiter
+            {
+                bool await_ready() noexcept { return false; }
+
+                template<class P>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+                {
+                    return h.promise().continuation;
+                }
+
+                void await_resume() noexcept {}
+            };
+
+            final_awaiter final_suspend() noexcept { return {}; }
+
+            void unhandled_exception() noexcept { std::terminate(); }
+        };
+
+        /*
+            等待一个回调，回调可能在发起操作时同步执行
+            同步完成时不挂起，否则在回调中直接恢复协程
+         */
+        struct waiter
+        {
+            std::coroutine_handle<> handle;
+            bool suspending = false;
+            bool done = false;
+
+            template<class F>
+            bool suspend(std::coroutine_handle<> h, F &&start)
+            {
+                handle = h;
+                done = false;
+                suspending = true;
+                start();
+                suspending = false;
+
+                if (done) {
+                    handle = nullptr;
+                    return false;
+                }
+                return true;
+            }
+
+            void wake()
+            {
+                if (suspending) {
+                    done = true;
+                    return;
+                }
+
+                if (handle) {
+                    std::coroutine_handle<> h = std::exchange(handle, nullptr);
+                    h.resume();
+                }
+            }
+        };
+
+        //编码typed请求的参数，每个线程复用一个缓冲区
+        inline struct pt_buffer *scratch()
+        {
+            static thread_local struct pt_buffer *buff = pt_buffer_new(256);
+            buff->length = 0;
+            return buff;
+        }
+    }
+
+    /*
+        延迟启动的协程，被co_await时才开始执行
+     */
+    template<class T = void>
+    class task
+    {
+    public:
+        struct promise_type : detail::promise_base
+        {
+            std::optional<T> value;
+
+            task get_return_object() { return task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+            void return_value(T v) { value.emplace(std::move(v)); }
+        };
+
+        task(task &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+        task(const task&) = delete;
+        ~task() { if (handle_) handle_.destroy(); }
+
+        bool await_ready() const noexcept { return !handle_ || handle_.done(); }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept
+        {
+            handle_.promise().continuation = caller;
+            return handle_;
+        }
+
+        T await_resume() { return std::move(*handle_.promise().value); }
+
+    private:
+        explicit task(std::coroutine_handle<promise_type> h) : handle_(h) {}
+
+        std::coroutine_handle<promise_type> handle_;
+    };
+
+    template<>
+    class task<void>
+    {
+    public:
+        struct promise_type : detail::promise_base
+        {
+            task get_return_object() { return task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+            void return_void() {}
+        };
+
+        task(task &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+        task(const task&) = delete;
+        ~task() { if (handle_) handle_.destroy(); }
+
+        bool await_ready() const noexcept { return !handle_ || handle_.done(); }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept
+        {
+            handle_.promise().continuation = caller;
+            return handle_;
+        }
+
+        void await_resume() {}
+
+    private:
+        explicit task(std::coroutine_handle<promise_type> h) : handle_(h) {}
+
+        std::coroutine_handle<promise_type> handle_;
+    };
+
+    namespace detail
+    {
+        //立即执行，完成后自动释放
+        struct detached
+        {
+            struct promise_type
+            {
+                static void *operator new(size_t size) { return frame_pool::allocate(size); }
+                static void operator delete(void *p, size_t size) { frame_pool::deallocate(p, size); }
+
+                detached get_return_object() noexcept { return {}; }
+                std::suspend_never initial_suspend() noexcept { return {}; }
+                std::suspend_never final_suspend() noexcept { return {}; }
+                void return_void() noexcept {}
+                void unhandled_exception() noexcept { std::terminate(); }
+            };
+        };
+
+        inline detached run_detached(task<void> t)
+        {
+            co_await t;
+        }
+    }
+
+    //在当前线程中开始执行一个协程，不等待结果
+    inline void spawn(task<void> t)
+    {
+        detail::run_detached(std::move(t));
+    }
+
+    /*
+        RPC请求的结果，status < 0时body为空
+        body的payload为回复的数据，不包含rpc_header
+     */
+    struct rpc_result
+    {
+        int status = PT_RPC_DISCONNECTED;
+        packet body;
+    };
+
+    /*
+        协程客户端，收到的数据包通过receive按顺序取出
+        需要在断开并且句柄关闭完成后析构，和pt_client_free一样
+     */
+    class client
+    {
+    public:
+        explicit client(uv_loop_t *loop) : client_(pt_client_new())
+        {
+            pt_client_init(loop, client_, on_connected, on_receive, on_disconnected);
+            client_->data = this;
+            rpc_ = pt_rpc_new(client_);
+        }
+
+        client(const client&) = delete;
+        client &operator=(const client&) = delete;
+
+        ~client()
+        {
+            pt_rpc_free(rpc_);
+            while (head_) {
+                pt_buffer_free(pop());
+            }
+            pt_client_free(client_);
+        }
+
+        struct pt_client *get() const noexcept { return client_; }
+        bool connected() const noexcept { return client_->connected != false; }
+
+        void set_encrypt(const uint32_t key[4]) { pt_client_set_encrypt(client_, key); }
+
+        //连接成功返回true
+        auto connect(const char *host, uint16_t port)
+        {
+            struct awaiter
+            {
+                client &self;
+                const char *host;
+                uint16_t port;
+
+                bool await_ready() const noexcept { return false; }
+
+                bool await_suspend(std::coroutine_handle<> h)
+                {
+                    return self.connect_.suspend(h, [this] { pt_client_connect(self.client_, host, port); });
+                }
+
+                bool await_resume() const noexcept { return self.connected(); }
+            };
+
+            return awaiter{*this, host, port};
+        }
+
+        //下一个数据包，断开并且没有剩余的数据包时为空
+        auto receive()
+        {
+            struct awaiter
+            {
+                client &self;
+
+                bool await_ready() const noexcept { return self.head_ != nullptr || self.connected() == false; }
+
+                void await_suspend(std::coroutine_handle<> h) { self.receive_.handle = h; }
+
+                packet await_resume() { return Buffer::adopt(self.head_ ? self.pop() : nullptr); }
+            };
+
+            return awaiter{*this};
+        }
+
+        /*
+            发送RPC请求并等待回复或者超时，timeout为0时使用默认超时
+            等待期间不能销毁当前协程
+         */
+        auto request(uint16_t method, const unsigned char *data, uint32_t length, uint32_t timeout = 0)
+        {
+            struct awaiter
+            {
+                client &self;
+                uint16_t method;
+                const unsigned char *data;
+                uint32_t length;
+                uint32_t timeout;
+                detail::waiter wait;
+                rpc_result result;
+
+                bool await_ready() const noexcept { return false; }
+
+                bool await_suspend(std::coroutine_handle<> h)
+                {
+                    return wait.suspend(h, [this] {
+                        //未连接时不会执行回调
+                        if (pt_rpc_call(self.rpc_, method, data, length, timeout, on_reply, this) == 0) {
+                            wait.done = true;
+                        }
+                    });
+                }
+
+                rpc_result await_resume() { return std::move(result); }
+
+                static void on_reply(struct pt_rpc_request *req, int status, const unsigned char *data, uint32_t length)
+                {
+                    awaiter *self = static_cast<awaiter*>(req->data);
+
+                    self->result.status = status;
+                    if (status >= 0) {
+                        self->result.body = Buffer::packet(ID_RESERVE_RPC_RESPONSE, std::span<const unsigned char>(data, length));
+                    }
+
+                    self->wait.wake();
+                }
+            };
+
+            return awaiter{*this, method, data, length, timeout, {}, {}};
+        }
+
+        //使用PT_MESSAGE的消息作为请求，method为消息的id
+        template<class M>
+        auto request(const M &msg, uint32_t timeout = 0)
+        {
+            static_assert(is_message_v<M>, "type is not declared with PT_MESSAGE");
+
+            struct pt_buffer *buff = detail::scratch();
+            Writer writer(buff);
+            msg.pt_fields(writer);
+
+            //pt_rpc_call在await_suspend中复制参数，之前不会再使用scratch
+            return request(M::id, buff->buff, buff->length, timeout);
+        }
+
+        bool send(uint16_t id, const unsigned char *data, uint32_t length)
+        {
+            return pt_client_send_data(client_, id, data, length) != false;
+        }
+
+        template<class M>
+        bool send(const M &msg)
+        {
+            return pt::send(client_, msg);
+        }
+
+        void disconnect() { pt_client_disconnect(client_); }
+
+    private:
+        struct pt_buffer *pop()
+        {
+            struct pt_buffer *buff = head_;
+
+            head_ = buff->next;
+            if (head_ == nullptr) tail_ = nullptr;
+            buff->next = nullptr;
+
+            return buff;
+        }
+
+        static void on_connected(struct pt_client *conn)
+        {
+            static_cast<client*>(conn->data)->connect_.wake();
+        }
+
+        static void on_receive(struct pt_client *conn, struct pt_buffer *buff)
+        {
+            client *self = static_cast<client*>(conn->data);
+            struct pt_buffer *copy = Buffer::copy_of(buff).release();
+
+            if (self->tail_) {
+                self->tail_->next = copy;
+            } else {
+                self->head_ = copy;
+            }
+            self->tail_ = copy;
+
+            self->receive_.wake();
+        }
+
+        static void on_disconnected(struct pt_client *conn)
+        {
+            client *self = static_cast<client*>(conn->data);
+
+            self->receive_.wake();
+        }
+
+        struct pt_client *client_;
+        struct pt_rpc *rpc_;
+
+        detail::waiter connect_;
+        detail::waiter receive_;
+
+        //还没有取出的数据包，使用pt_buffer->next连接
+        struct pt_buffer *head_ = nullptr;
+        struct pt_buffer *tail_ = nullptr;
+    };
+
+    class server;
+
+    /*
+        服务器上的一个连接，收到的数据包通过receive按顺序取出
+        未取出的数据包超过max_pending时暂停读取，取出一半后恢复
+     */
+    class connection
+    {
+    public:
+        static constexpr uint32_t max_pending = 64;
+
+        connection(const connection&) = delete;
+        connection &operator=(const connection&) = delete;
+
+        //还连接时断开连接
+        ~connection()
+        {
+            while (head_) {
+                pt_buffer_free(pop());
+            }
+
+            if (user_) {
+                user_->data = nullptr;
+                pt_server_disconnect_conn(user_);
+            }
+        }
+
+        struct pt_sclient *get() const noexcept { return user_; }
+        bool connected() const noexcept { return user_ != nullptr; }
+
+        //下一个数据包，断开并且没有剩余的数据包时为空
+        auto receive()
+        {
+            struct awaiter
+            {
+                connection &self;
+
+                bool await_ready() const noexcept { return self.head_ != nullptr || self.user_ == nullptr; }
+
+                void await_suspend(std::coroutine_handle<> h) { self.receive_.handle = h; }
+
+                packet await_resume() { return Buffer::adopt(self.head_ ? self.pop() : nullptr); }
+            };
+
+            return awaiter{*this};
+        }
+
+        template<class B> requires rvalue_buffer<B>
+        bool send(B &&buff)
+        {
+            if (user_ == nullptr) {
+                buff.reset();
+                return false;
+            }
+            return Server::send(user_, std::move(buff));
+        }
+
+        bool send(Buffer &buff) = delete;
+        bool send(const Buffer &buff) = delete;
+
+        template<class M>
+        bool send(const M &msg)
+        {
+            return user_ != nullptr && pt::send(user_, msg);
+        }
+
+        void disconnect()
+        {
+            if (user_) pt_server_disconnect_conn(user_);
+        }
+
+    private:
+        friend class server;
+
+        explicit connection(struct pt_sclient *user) : user_(user) {}
+
+        struct pt_buffer *pop()
+        {
+            struct pt_buffer *buff = head_;
+
+            head_ = buff->next;
+            if (head_ == nullptr) tail_ = nullptr;
+            buff->next = nullptr;
+
+            //取出一半后恢复读取
+            if (--pending_ == max_pending / 2 && paused_ && user_) {
+                paused_ = false;
+                pt_server_resume_read(user_);
+            }
+
+            return buff;
+        }
+
+        void push(struct pt_buffer *buff)
+        {
+            struct pt_buffer *copy = Buffer::copy_of(buff).release();
+
+            if (tail_) {
+                tail_->next = copy;
+            } else {
+                head_ = copy;
+            }
+            tail_ = copy;
+
+            if (++pending_ >= max_pending && paused_ == false) {
+                paused_ = true;
+                pt_server_pause_read(user_);
+            }
+
+            receive_.wake();
+        }
+
+        void closed()
+        {
+            user_ = nullptr;
+            receive_.wake();
+        }
+
+        struct pt_sclient *user_;
+        detail::waiter receive_;
+
+        struct pt_buffer *head_ = nullptr;
+        struct pt_buffer *tail_ = nullptr;
+        uint32_t pending_ = 0;
+        bool paused_ = false;
+
+        //等待accept的连接
+        connection *next_ = nullptr;
+    };
+
+    /*
+        协程服务器，新连接通过accept按顺序取出
+        需要在pt_server_close并且关闭完成后析构
+     */
+    class server
+    {
+    public:
+        server(uv_loop_t *loop, int max_conn, int keep_alive_delay) : server_(pt_server_new())
+        {
+            pt_server_init(server_, loop, max_conn, keep_alive_delay, on_connect, on_receive, on_disconnect);
+            server_->data = this;
+        }
+
+        server(const server&) = delete;
+        server &operator=(const server&) = delete;
+
+        ~server()
+        {
+            connection *conn;
+
+            while ((conn = accept_head_) != nullptr) {
+                accept_head_ = conn->next_;
+                delete conn;
+            }
+
+            pt_server_free(server_);
+        }
+
+        struct pt_server *get() const noexcept { return server_; }
+
+        void set_encrypt(const uint32_t key[4]) { pt_server_set_encrypt(server_, key); }
+
+        bool start(const char *host, uint16_t port) { return pt_server_start(server_, host, port) != false; }
+        bool start_pipe(const char *path) { return pt_server_start_pipe(server_, path) != false; }
+
+        //关闭监听和所有连接，等待中的accept返回空
+        void close()
+        {
+            closed_ = true;
+            pt_server_close(server_);
+            accept_.wake();
+        }
+
+        /*
+            下一个新连接，服务器关闭后为空
+            返回的连接由调用者释放
+         */
+        auto accept()
+        {
+            struct awaiter
+            {
+                server &self;
+
+                bool await_ready() const noexcept { return self.accept_head_ != nullptr || self.closed_; }
+
+                void await_suspend(std::coroutine_handle<> h) { self.accept_.handle = h; }
+
+                connection *await_resume()
+                {
+                    connection *conn = self.accept_head_;
+
+                    if (conn) {
+                        self.accept_head_ = conn->next_;
+                        if (self.accept_head_ == nullptr) self.accept_tail_ = nullptr;
+                        conn->next_ = nullptr;
+                    }
+                    return conn;
+                }
+            };
+
+            return awaiter{*this};
+        }
+
+    private:
+        static qboolean on_connect(struct pt_sclient *user)
+        {
+            server *self = static_cast<server*>(user->server->data);
+            connection *conn = new connection(user);
+
+            user->data = conn;
+
+            if (self->accept_tail_) {
+                self->accept_tail_->next_ = conn;
+            } else {
+                self->accept_head_ = conn;
+            }
+            self->accept_tail_ = conn;
+
+            self->accept_.wake();
+            return true;
+        }
+
+        static void on_receive(struct pt_sclient *user, struct pt_buffer *buff)
+        {
+            connection *conn = static_cast<connection*>(user->data);
+
+            //连接对象已经释放
+            if (conn) conn->push(buff);
+        }
+
+        static void on_disconnect(struct pt_sclient *user)
+        {
+            connection *conn = static_cast<connection*>(user->data);
+
+            user->data = nullptr;
+            if (conn) conn->closed();
+        }
+
+        struct pt_server *server_;
+        detail::waiter accept_;
+        bool closed_ = false;
+
+        connection *accept_head_ = nullptr;
+        connection *accept_tail_ = nullptr;
+    };
+}
+
+#endif
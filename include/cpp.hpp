@@ -10,6 +10,7 @@ extern "C"
 	#include "packet.h"
 	#include "server.h"
 	#include "client.h"
+	#include "spin.h"
     #include "buffer_reader.h"
 };
 
@@ -3,8 +3,11 @@
 
 typedef int qboolean;
 
+//C++中true和false是关键字，重新定义后<optional>等标准头文件的比较运算无法编译
+#ifndef __cplusplus
 #define true 1
 #define false 0
+#endif
 #define TRUE 1
 #define FALSE 0
 
@@ -16,11 +19,23 @@ union pt_net_s {
     uv_stream_t stream;
     uv_tcp_t tcp;
     uv_pipe_t pipe;
+    uv_udp_t udp;
 };
 
 typedef union pt_net_s pt_net_t;
 
 
+//网络后端类型
+enum pt_backend_type
+{
+    //默认的libuv(epoll)后端
+    PT_BACKEND_LIBUV = 0,
+    
+    //Linux io_uring后端，需要编译时定义PT_HAVE_URING
+    PT_BACKEND_URING,
+};
+
+
 struct pt_wreq
 {
     uv_write_t req;
@@ -28,6 +43,23 @@ struct pt_wreq
     struct pt_buffer *buff;
     
     void* data;
+    
+    //非libuv后端使用的发送队列
+    struct pt_wreq *next;
+};
+
+//pt_wreq_iov中头部的最大长度
+#define PT_WREQ_HEAD_MAX 64
+
+/*
+    头部和数据分两段写入，数据直接指向base.buff内部
+    base必须是第一个成员，写入完成后和pt_wreq一样释放base.buff和整个结构
+ */
+struct pt_wreq_iov
+{
+    struct pt_wreq base;
+    uv_buf_t bufs[2];
+    unsigned char head[PT_WREQ_HEAD_MAX];
 };
 
 #endif
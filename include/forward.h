@@ -0,0 +1,67 @@
+//
+//  forward.h
+//  xcode
+//
+//  网关转发，按包ID范围把客户端的数据包转发到后端连接池
+//  转发的数据包为ID_RESERVE_TRANSMIT_ENUM，net_header之后是forward_header和客户端的原始数据
+//  只重新生成包头，原始数据直接引用收到的数据包，不复制
+//  后端的回复按forward_header中的session找到客户端连接
+//
+
+#ifndef _PT_FORWARD_INCLUED_H_
+#define _PT_FORWARD_INCLUED_H_
+
+#include "server.h"
+#include "pool.h"
+
+struct pt_forward_route
+{
+    uint16_t id_min;
+    uint16_t id_max;
+    struct pt_pool *pool;
+};
+
+struct pt_forward
+{
+    //面向客户端的服务器
+    struct pt_server *server;
+
+    //按添加顺序匹配，范围不重叠
+    struct pt_forward_route *routes;
+    uint32_t number_of_routes;
+
+    //转发到后端，转发给客户端和因为没有后端或者客户端已断开而丢弃的数据包数
+    uint64_t number_of_forwarded;
+    uint64_t number_of_replied;
+    uint64_t number_of_dropped;
+
+    //用户数据
+    void *data;
+};
+
+struct pt_forward *pt_forward_new(struct pt_server *server);
+void pt_forward_free(struct pt_forward *forward);
+
+/*
+    id_min到id_max的数据包转发到pool，同一个客户端按session的哈希固定使用一个后端
+    范围无效或者和已有的规则重叠时返回false
+ */
+qboolean pt_forward_add_route(struct pt_forward *forward, uint16_t id_min, uint16_t id_max, struct pt_pool *pool);
+
+/*
+    在服务器的on_receive中调用，匹配规则的数据包转发到后端并返回true
+    没有匹配的规则返回false，由调用者继续处理
+    匹配时取走buff，后端连接使用libuv并且不加密时直接引用其中的数据写入
+ */
+qboolean pt_forward_client_receive(struct pt_forward *forward, struct pt_sclient *user, struct pt_buffer *buff);
+
+/*
+    在连接池的on_receive中调用，ID_RESERVE_TRANSMIT_ENUM的数据包转发给对应的客户端并返回true
+    其他数据包返回false，由调用者继续处理
+ */
+qboolean pt_forward_backend_receive(struct pt_forward *forward, struct pt_client *client, struct pt_buffer *buff);
+
+//在服务器的on_disconnect中调用，通知每个连接池中这个session对应的后端
+void pt_forward_client_disconnect(struct pt_forward *forward, struct pt_sclient *user);
+
+#endif
@@ -0,0 +1,69 @@
+//
+//  hashring.h
+//  xcode
+//
+//  一致性哈希环，把key(例如pt_sclient的id)固定分配到一个后端分片
+//  每个节点在环上有weight * vnodes个虚拟节点，节点加入或者离开时只有落在它的虚拟节点上的key改变分配
+//  虚拟节点按哈希值排序保存在数组中，查找为二分查找
+//
+
+#ifndef _PT_HASHRING_INCLUED_H_
+#define _PT_HASHRING_INCLUED_H_
+
+#include "common.h"
+
+//每个权重单位的虚拟节点数
+#define PT_HASHRING_VNODES 160
+
+//环上的一个虚拟节点
+struct pt_hashring_point
+{
+    uint64_t hash;
+    void *node;
+};
+
+struct pt_hashring_node
+{
+    //决定虚拟节点位置的值，例如地址的哈希，同一个key在每个进程中得到相同的环
+    uint64_t key;
+    void *node;
+    uint32_t weight;
+};
+
+struct pt_hashring
+{
+    uint32_t vnodes;
+
+    struct pt_hashring_node *nodes;
+    uint32_t number_of_nodes;
+
+    //按hash排序
+    struct pt_hashring_point *points;
+    uint32_t number_of_points;
+};
+
+//64位混合函数(splitmix64)
+uint64_t pt_hashring_mix(uint64_t x);
+
+//任意数据的哈希，用于计算节点的key或者字符串的key
+uint64_t pt_hashring_hash(const void *data, uint32_t length);
+
+//vnodes为0时使用PT_HASHRING_VNODES
+struct pt_hashring *pt_hashring_new(uint32_t vnodes);
+void pt_hashring_free(struct pt_hashring *ring);
+
+/*
+    添加一个节点，weight为0时按1计算
+    node已经在环上时返回false
+ */
+qboolean pt_hashring_add(struct pt_hashring *ring, uint64_t key, void *node, uint32_t weight);
+
+//移除一个节点，不在环上时返回false
+qboolean pt_hashring_remove(struct pt_hashring *ring, void *node);
+
+qboolean pt_hashring_contains(struct pt_hashring *ring, void *node);
+
+//顺时针方向第一个虚拟节点所属的节点，环为空时返回NULL
+void *pt_hashring_lookup(struct pt_hashring *ring, uint64_t key);
+
+#endif
@@ -0,0 +1,169 @@
+//
+//  json.h
+//  xcode
+//
+//  ID_TRANSMIT_JSON使用的JSON解析，路由和输出
+//  解析直接在数据包上进行，不建立DOM，只在访问字段时扫描需要的部分
+//  跳过字符串和嵌套的对象时使用SSE2每次检查16字节
+//
+
+#ifndef _PT_JSON_INCLUED_H_
+#define _PT_JSON_INCLUED_H_
+
+#include "common.h"
+#include "buffer.h"
+#include "buffer_reader.h"
+#include "table.h"
+
+//值的类型，由第一个字符决定
+#define PT_JSON_INVALID 0
+#define PT_JSON_OBJECT 1
+#define PT_JSON_ARRAY 2
+#define PT_JSON_STRING 3
+#define PT_JSON_NUMBER 4
+#define PT_JSON_TRUE 5
+#define PT_JSON_FALSE 6
+#define PT_JSON_NULL 7
+
+//pt_json_router_dispatch的返回值
+#define PT_JSON_ROUTE_OK 0
+#define PT_JSON_ROUTE_UNKNOWN 1
+#define PT_JSON_ROUTE_INVALID 2
+
+//输出时最多嵌套的层数
+#define PT_JSON_MAX_DEPTH 64
+
+/*
+    一个JSON值在原始数据中的范围，字符串包含两边的引号
+    不复制数据，只在原始数据释放之前有效
+ */
+struct pt_json
+{
+    const char *data;
+    uint32_t length;
+};
+
+//遍历对象或者数组的成员
+struct pt_json_iter
+{
+    const char *pos;
+    const char *end;
+    qboolean object;
+    qboolean first;
+};
+
+/*
+    从data中取出一个JSON值，只去掉两边的空白
+    内容在访问时才检查，格式错误的部分在访问时返回false
+ */
+qboolean pt_json_parse(struct pt_json *value, const char *data, uint32_t length);
+
+int pt_json_type(const struct pt_json *value);
+
+/*
+    在对象中查找key，跳过其他成员的值但不解析
+    key按原始字节比较，不处理转义
+ */
+qboolean pt_json_get(const struct pt_json *object, const char *key, struct pt_json *out);
+
+//取数组的第index个元素
+qboolean pt_json_index(const struct pt_json *array, uint32_t index, struct pt_json *out);
+
+//开始遍历对象或者数组，数组成员的key为空
+qboolean pt_json_iter_init(struct pt_json_iter *iter, const struct pt_json *value);
+qboolean pt_json_iter_next(struct pt_json_iter *iter, struct pt_json *key, struct pt_json *value);
+
+//字符串两个引号之间的原始数据，保留转义
+qboolean pt_json_string_view(const struct pt_json *value, struct pt_bytes *out);
+
+/*
+    处理转义后复制字符串到buf，\u转为UTF-8，结尾补0
+    size不够或者格式错误时返回false，length为字符串的长度
+ */
+qboolean pt_json_string_copy(const struct pt_json *value, char *buf, uint32_t size, uint32_t *length);
+
+//字符串的原始数据是否等于str
+qboolean pt_json_string_equals(const struct pt_json *value, const char *str);
+
+//整数，有小数或者溢出时返回false
+qboolean pt_json_get_int(const struct pt_json *value, int64_t *out);
+qboolean pt_json_get_double(const struct pt_json *value, double *out);
+qboolean pt_json_get_bool(const struct pt_json *value, qboolean *out);
+
+/*
+    路由的处理函数
+    ctx为pt_json_router_dispatch传入的参数(例如pt_sclient)，params为消息的params字段，没有时length为0
+ */
+typedef void (*pt_json_handler)(void *ctx, const struct pt_json *params, void *udata);
+
+struct pt_json_route
+{
+    //哈希冲突时的下一个路由
+    struct pt_json_route *next;
+
+    char *type;
+    char *action;
+
+    pt_json_handler handler;
+    void *udata;
+};
+
+/*
+    按type和action分发ID_TRANSMIT_JSON消息
+    路由表以type和action的哈希值为key，添加时计算好，分发时只扫描一次顶层的成员
+ */
+struct pt_json_router
+{
+    struct pt_table *routes;
+    uint32_t count;
+};
+
+struct pt_json_router *pt_json_router_new();
+void pt_json_router_free(struct pt_json_router *router);
+
+//添加路由，相同的type和action会替换之前的处理函数
+void pt_json_router_add(struct pt_json_router *router, const char *type, const char *action,
+                        pt_json_handler handler, void *udata);
+
+/*
+    读取顶层的type和action后查找路由，params不解析直接交给处理函数
+    type和action按原始字节比较，不处理转义
+ */
+int pt_json_router_dispatch(struct pt_json_router *router, const char *data, uint32_t length, void *ctx);
+
+/*
+    直接输出到pt_buffer，自动添加逗号
+    嵌套超过PT_JSON_MAX_DEPTH或者begin/end不匹配时error为true
+ */
+struct pt_json_writer
+{
+    struct pt_buffer *buff;
+    uint32_t depth;
+    //每一层是否已经有成员，需要先输出逗号
+    uint64_t has_item;
+    qboolean after_key;
+    qboolean error;
+};
+
+void pt_json_writer_init(struct pt_json_writer *writer, struct pt_buffer *buff);
+qboolean pt_json_writer_ok(struct pt_json_writer *writer);
+
+void pt_json_write_object_begin(struct pt_json_writer *writer);
+void pt_json_write_object_end(struct pt_json_writer *writer);
+void pt_json_write_array_begin(struct pt_json_writer *writer);
+void pt_json_write_array_end(struct pt_json_writer *writer);
+
+//对象成员的key，之后写入一个值
+void pt_json_write_key(struct pt_json_writer *writer, const char *key);
+
+void pt_json_write_string(struct pt_json_writer *writer, const char *str, uint32_t length);
+void pt_json_write_int(struct pt_json_writer *writer, int64_t v);
+//NaN和无穷大输出为null
+void pt_json_write_double(struct pt_json_writer *writer, double v);
+void pt_json_write_bool(struct pt_json_writer *writer, qboolean v);
+void pt_json_write_null(struct pt_json_writer *writer);
+
+//已经是JSON格式的数据，例如转发收到的params
+void pt_json_write_raw(struct pt_json_writer *writer, const char *json, uint32_t length);
+
+#endif
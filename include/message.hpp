@@ -0,0 +1,360 @@
+//
+//  message.hpp
+//  xcode
+//
+//  C++的类型化消息，只有头文件，需要C++17
+//  消息类型使用PT_MESSAGE声明包ID和字段，编码格式和buffer_reader.h一致
+//  Dispatcher在编译期按消息列表生成以包ID为下标的跳转表
+//
+
+#ifndef _PT_MESSAGE_INCLUED_HPP_
+#define _PT_MESSAGE_INCLUED_HPP_
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+extern "C"
+{
+    #include "common.h"
+    #include "packet.h"
+    #include "buffer.h"
+    #include "buffer_reader.h"
+    #include "server.h"
+    #include "client.h"
+};
+
+/*
+    在消息结构体内声明包ID和需要编码的字段，字段按顺序编码
+    struct chat_msg
+    {
+        uint32_t from;
+        std::string_view text;
+        PT_MESSAGE(ID_USER_CLIENT_ENUM + 1, from, text)
+    };
+ */
+#define PT_MESSAGE(ID, ...) \
+    static constexpr uint16_t id = (ID); \
+    template<class Ar> void pt_fields(Ar &ar) { ar(__VA_ARGS__); } \
+    template<class Ar> void pt_fields(Ar &ar) const { ar(__VA_ARGS__); }
+
+namespace pt
+{
+    template<class T, class = void>
+    struct is_message : std::false_type {};
+
+    template<class T>
+    struct is_message<T, std::void_t<decltype(T::id)>> : std::is_same<std::remove_cv_t<decltype(T::id)>, uint16_t> {};
+
+    template<class T>
+    inline constexpr bool is_message_v = is_message<T>::value;
+
+    struct field_probe
+    {
+        template<class... Ts> void operator()(Ts&...) {}
+    };
+
+    //嵌套的结构体也可以使用pt_fields，只是不作为独立的消息
+    template<class T, class = void>
+    struct has_fields : std::false_type {};
+
+    template<class T>
+    struct has_fields<T, std::void_t<decltype(std::declval<T&>().pt_fields(std::declval<field_probe&>()))>> : std::true_type {};
+
+    template<class T> struct is_vector : std::false_type {};
+    template<class T> struct is_vector<std::vector<T>> : std::true_type {};
+
+    template<class T> struct is_optional : std::false_type {};
+    template<class T> struct is_optional<std::optional<T>> : std::true_type {};
+
+    template<class T> inline constexpr bool always_false = false;
+
+    /*
+        编码字段到pt_buffer
+     */
+    class Writer
+    {
+    public:
+        explicit Writer(struct pt_buffer *buff) : buff_(buff) {}
+
+        template<class... Ts>
+        void operator()(const Ts&... values)
+        {
+            (write(values), ...);
+        }
+
+        template<class T>
+        void write(const T &v)
+        {
+            if constexpr (std::is_same_v<T, bool>) {
+                pt_buffer_write_u8(buff_, v ? 1 : 0);
+            } else if constexpr (std::is_enum_v<T>) {
+                write(static_cast<std::underlying_type_t<T>>(v));
+            } else if constexpr (std::is_integral_v<T> && sizeof(T) == 1) {
+                pt_buffer_write_u8(buff_, static_cast<uint8_t>(v));
+            } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+                pt_buffer_write_svarint(buff_, v);
+            } else if constexpr (std::is_integral_v<T>) {
+                pt_buffer_write_varint(buff_, v);
+            } else if constexpr (std::is_same_v<T, float>) {
+                uint32_t bits;
+                std::memcpy(&bits, &v, sizeof(bits));
+                pt_buffer_write_u32(buff_, bits);
+            } else if constexpr (std::is_same_v<T, double>) {
+                uint64_t bits;
+                std::memcpy(&bits, &v, sizeof(bits));
+                pt_buffer_write_u64(buff_, bits);
+            } else if constexpr (std::is_same_v<T, std::string_view> || std::is_same_v<T, std::string>) {
+                pt_buffer_write_bytes(buff_, reinterpret_cast<const unsigned char*>(v.data()), static_cast<uint32_t>(v.size()));
+            } else if constexpr (is_vector<T>::value) {
+                pt_buffer_write_array(buff_, static_cast<uint32_t>(v.size()));
+                for (const auto &item : v) {
+                    write(item);
+                }
+            } else if constexpr (is_optional<T>::value) {
+                pt_buffer_write_optional(buff_, v.has_value());
+                if (v) {
+                    write(*v);
+                }
+            } else if constexpr (has_fields<T>::value) {
+                v.pt_fields(*this);
+            } else {
+                static_assert(always_false<T>, "field type is not serializable");
+            }
+        }
+
+    private:
+        struct pt_buffer *buff_;
+    };
+
+    /*
+        从buffer_reader解码字段，越界或者数值超过字段类型时reader的error为true
+        std::string_view指向数据包内部，只在数据包释放之前有效
+     */
+    class Reader
+    {
+    public:
+        explicit Reader(struct buffer_reader *reader) : reader_(reader) {}
+
+        template<class... Ts>
+        void operator()(Ts&... values)
+        {
+            (read(values), ...);
+        }
+
+        template<class T>
+        void read(T &v)
+        {
+            if constexpr (std::is_same_v<T, bool>) {
+                v = buffer_reader_read_u8(reader_) != 0;
+            } else if constexpr (std::is_enum_v<T>) {
+                std::underlying_type_t<T> raw{};
+                read(raw);
+                v = static_cast<T>(raw);
+            } else if constexpr (std::is_integral_v<T> && sizeof(T) == 1) {
+                v = static_cast<T>(buffer_reader_read_u8(reader_));
+            } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+                int64_t raw = buffer_reader_read_svarint(reader_);
+                if (raw < std::numeric_limits<T>::min() || raw > std::numeric_limits<T>::max()) {
+                    reader_->error = true;
+                }
+                v = static_cast<T>(raw);
+            } else if constexpr (std::is_integral_v<T>) {
+                uint64_t raw = buffer_reader_read_varint(reader_);
+                if (raw > std::numeric_limits<T>::max()) {
+                    reader_->error = true;
+                }
+                v = static_cast<T>(raw);
+            } else if constexpr (std::is_same_v<T, float>) {
+                uint32_t bits = buffer_reader_read_u32(reader_);
+                std::memcpy(&v, &bits, sizeof(bits));
+            } else if constexpr (std::is_same_v<T, double>) {
+                uint64_t bits = buffer_reader_read_u64(reader_);
+                std::memcpy(&v, &bits, sizeof(bits));
+            } else if constexpr (std::is_same_v<T, std::string_view> || std::is_same_v<T, std::string>) {
+                struct pt_bytes bytes = buffer_reader_read_bytes(reader_);
+                v = T(reinterpret_cast<const char*>(bytes.data), bytes.length);
+            } else if constexpr (is_vector<T>::value) {
+                uint32_t count = buffer_reader_read_array(reader_, 1);
+                v.clear();
+                v.resize(count);
+                for (auto &item : v) {
+                    read(item);
+                }
+            } else if constexpr (is_optional<T>::value) {
+                if (buffer_reader_read_optional(reader_)) {
+                    v.emplace();
+                    read(*v);
+                } else {
+                    v.reset();
+                }
+            } else if constexpr (has_fields<T>::value) {
+                v.pt_fields(*this);
+            } else {
+                static_assert(always_false<T>, "field type is not serializable");
+            }
+        }
+
+    private:
+        struct buffer_reader *reader_;
+    };
+
+    /*
+        编码一个消息，reserve_serial为true时在net_header之后预留加密用的包序列
+     */
+    template<class M>
+    struct pt_buffer *encode(const M &msg, bool reserve_serial = false)
+    {
+        static_assert(is_message_v<M>, "type is not declared with PT_MESSAGE");
+
+        struct net_header hdr = pt_create_nethdr(M::id);
+        struct pt_buffer *buff = pt_buffer_new(256);
+        uint32_t serial = 0;
+
+        pt_buffer_write(buff, reinterpret_cast<unsigned char*>(&hdr), sizeof(hdr));
+        if (reserve_serial) {
+            pt_buffer_write(buff, reinterpret_cast<unsigned char*>(&serial), sizeof(serial));
+        }
+
+        Writer writer(buff);
+        msg.pt_fields(writer);
+
+        reinterpret_cast<struct net_header*>(buff->buff)->length = buff->length;
+
+        return buff;
+    }
+
+    //服务器发送到客户端，不加密
+    template<class M>
+    bool send(struct pt_sclient *user, const M &msg)
+    {
+        return pt_server_send(user, encode(msg)) != false;
+    }
+
+    template<class M>
+    bool send_priority(struct pt_sclient *user, const M &msg, int priority)
+    {
+        return pt_server_send_priority(user, encode(msg), priority) != false;
+    }
+
+    //客户端发送到服务器，加密在发送时进行
+    template<class M>
+    bool send(struct pt_client *client, const M &msg)
+    {
+        return pt_client_send_prepared(client, encode(msg, client->enable_encrypt != false)) != false;
+    }
+
+    /*
+        按消息列表分发收到的数据包
+        Handler需要对每个消息类型提供operator()(Ctx, const M&)，编译期检查
+        所有包ID在编译期生成一个以(id - 最小id)为下标的表，每一项是解码和调用Handler内联后的函数
+     */
+    template<class Handler, class... Msgs>
+    class Dispatcher
+    {
+        static_assert(sizeof...(Msgs) > 0, "dispatcher needs at least one message");
+        static_assert((is_message_v<Msgs> && ...), "type is not declared with PT_MESSAGE");
+
+        static constexpr uint16_t min_id = std::min({Msgs::id...});
+        static constexpr uint16_t max_id = std::max({Msgs::id...});
+        static constexpr size_t table_size = static_cast<size_t>(max_id - min_id) + 1;
+
+        static_assert(table_size <= 4096, "message ids are too sparse for a jump table");
+
+        static constexpr bool unique_ids()
+        {
+            uint16_t ids[] = {Msgs::id...};
+            for (size_t i = 0; i < sizeof...(Msgs); i++) {
+                for (size_t j = i + 1; j < sizeof...(Msgs); j++) {
+                    if (ids[i] == ids[j]) return false;
+                }
+            }
+            return true;
+        }
+
+        static_assert(unique_ids(), "duplicate message id in dispatcher");
+
+        template<class Ctx>
+        using thunk = bool (*)(Handler&, Ctx, struct buffer_reader*);
+
+        template<class Ctx, class M>
+        static bool invoke(Handler &handler, Ctx ctx, struct buffer_reader *reader)
+        {
+            static_assert(std::is_invocable_v<Handler&, Ctx, const M&>, "handler does not accept this message");
+
+            M msg{};
+            Reader r(reader);
+            msg.pt_fields(r);
+
+            if (buffer_reader_ok(reader) == false) return false;
+
+            handler(ctx, static_cast<const M&>(msg));
+            return true;
+        }
+
+        template<class Ctx>
+        static constexpr std::array<thunk<Ctx>, table_size> make_table()
+        {
+            std::array<thunk<Ctx>, table_size> table{};
+            ((table[Msgs::id - min_id] = &invoke<Ctx, Msgs>), ...);
+            return table;
+        }
+
+        template<class Ctx>
+        static constexpr std::array<thunk<Ctx>, table_size> table = make_table<Ctx>();
+
+    public:
+        explicit Dispatcher(Handler &handler) : handler_(handler) {}
+
+        /*
+            offset为net_header之后跳过的字节数
+            未知的包ID或者解码失败返回false
+         */
+        template<class Ctx>
+        bool dispatch(Ctx ctx, struct pt_buffer *buff, uint32_t offset)
+        {
+            struct net_header *hdr = reinterpret_cast<struct net_header*>(buff->buff);
+            struct buffer_reader reader;
+            uint32_t index;
+
+            if (buff->length < sizeof(struct net_header) + offset) return false;
+
+            index = static_cast<uint32_t>(hdr->id) - min_id;
+            if (hdr->id < min_id || index >= table_size || table<Ctx>[index] == nullptr) return false;
+
+            buffer_reader_init(&reader, buff);
+            buffer_reader_ignore_bytes(&reader, sizeof(struct net_header) + offset);
+
+            return table<Ctx>[index](handler_, ctx, &reader);
+        }
+
+        //服务器收到的数据包，加密时跳过包序列
+        bool dispatch(struct pt_sclient *user, struct pt_buffer *buff)
+        {
+            return dispatch(user, buff, user->server->enable_encrypt ? sizeof(uint32_t) : 0);
+        }
+
+        bool dispatch(struct pt_client *client, struct pt_buffer *buff)
+        {
+            return dispatch(client, buff, 0);
+        }
+
+        //编译期检查消息是否在这个分发器的列表中
+        template<class M>
+        static constexpr bool contains()
+        {
+            return (std::is_same_v<M, Msgs> || ...);
+        }
+
+    private:
+        Handler &handler_;
+    };
+}
+
+#endif
@@ -0,0 +1,146 @@
+//
+//  mux.h
+//  xcode
+//
+//  在一个内网连接上复用多个会话(虚拟通道)
+//  会话由打开/关闭控制帧管理，每个会话按字节计算发送窗口，对方处理后用CREDIT帧归还
+//  所有会话的子帧追加到同一个ID_RESERVE_MUX数据包，每次事件循环合并为一次写入
+//
+
+#ifndef _PT_MUX_INCLUED_H_
+#define _PT_MUX_INCLUED_H_
+
+#include "server.h"
+#include "client.h"
+#include "table.h"
+
+//子帧类型
+#define PT_MUX_OPEN 1
+#define PT_MUX_DATA 2
+#define PT_MUX_CLOSE 3
+#define PT_MUX_CREDIT 4
+//发送端有数据因为窗口不足在排队，接收端处理的数据不再等到半个窗口，立即归还
+#define PT_MUX_BLOCKED 5
+
+//pt_mux_receive的返回值
+#define PT_MUX_RECV_OK 0
+#define PT_MUX_RECV_UNKNOWN 1
+#define PT_MUX_RECV_INVALID 2
+
+//每个会话的初始窗口(字节)，处理超过一半或者对方等待窗口时归还
+#define PT_MUX_WINDOW 0x10000
+
+//窗口不足时每个会话最多排队的字节数
+#define PT_MUX_MAX_PENDING 0x40000
+
+struct pt_mux;
+struct pt_mux_session;
+
+//对方打开了一个会话
+typedef void (*pt_mux_on_open)(struct pt_mux_session *session);
+//收到一个DATA帧，每次pt_mux_send的数据是一个完整的DATA帧
+typedef void (*pt_mux_on_data)(struct pt_mux_session *session, const unsigned char *data, uint32_t length);
+//对方关闭了会话，或者pt_mux_free时会话还没有关闭，返回后session被释放，不需要再调用pt_mux_close
+typedef void (*pt_mux_on_close)(struct pt_mux_session *session);
+
+struct pt_mux_session
+{
+    struct pt_mux *mux;
+    uint32_t id;
+
+    //所有会话的链表
+    struct pt_mux_session *prev;
+    struct pt_mux_session *next;
+
+    //本端还可以发送的字节数，收到CREDIT帧后增加
+    uint32_t send_window;
+
+    //对方还可以发送的字节数，和已经处理但还没有归还的字节数
+    uint32_t recv_window;
+    uint32_t recv_consumed;
+    //对方发送了BLOCKED，下次归还窗口之前为true
+    qboolean peer_blocked;
+
+    //窗口不足时排队的数据，每个pt_buffer是一次pt_mux_send的数据
+    struct pt_buffer *pending_head;
+    struct pt_buffer *pending_tail;
+    uint32_t pending_size;
+
+    //用户数据
+    void *data;
+};
+
+struct pt_mux
+{
+    uv_loop_t *loop;
+
+    //底层连接，只有一个不为NULL
+    struct pt_client *client;
+    struct pt_sclient *user;
+
+    struct pt_table *sessions;
+    struct pt_mux_session *head;
+    uint32_t number_of_sessions;
+
+    //本端打开会话使用的id，客户端一侧为奇数，服务器一侧为偶数，避免两端冲突
+    uint32_t next_id;
+
+    //正在组合的ID_RESERVE_MUX数据包，在idle中写入
+    struct pt_buffer *out;
+    uv_idle_t flush_idle;
+
+    //pt_mux_free之后为true，等待idle关闭后释放
+    qboolean closed;
+
+    //为false时处理完的数据需要调用pt_mux_consume归还窗口
+    qboolean auto_credit;
+
+    pt_mux_on_open on_open;
+    pt_mux_on_data on_data;
+    pt_mux_on_close on_close;
+
+    //写入底层的数据包数和子帧数
+    uint64_t number_of_writes;
+    uint64_t number_of_frames;
+
+    //用户数据
+    void *data;
+};
+
+//在pt_client上复用，加密时使用连接的加密状态
+struct pt_mux *pt_mux_new_client(struct pt_client *client, pt_mux_on_open on_open, pt_mux_on_data on_data, pt_mux_on_close on_close);
+
+//在服务器的一个连接上复用
+struct pt_mux *pt_mux_new_server(struct pt_sclient *user, pt_mux_on_open on_open, pt_mux_on_data on_data, pt_mux_on_close on_close);
+
+/*
+    底层连接断开或者不再使用时调用，还没有关闭的会话执行on_close
+    不再发送任何数据，内存在idle关闭后释放
+ */
+void pt_mux_free(struct pt_mux *mux);
+
+//打开一个会话，对方执行on_open
+struct pt_mux_session *pt_mux_open(struct pt_mux *mux, void *data);
+
+/*
+    发送一个DATA帧，窗口不足时排队
+    数据超过一个数据包或者排队超过PT_MUX_MAX_PENDING时返回false
+ */
+qboolean pt_mux_send(struct pt_mux_session *session, const unsigned char *data, uint32_t length);
+
+//关闭会话并释放，对方执行on_close，本端不执行，排队的数据被丢弃
+void pt_mux_close(struct pt_mux_session *session);
+
+//auto_credit为false时，处理完length字节后归还给对方
+void pt_mux_consume(struct pt_mux_session *session, uint32_t length);
+
+/*
+    在底层连接的on_receive中调用
+    不是ID_RESERVE_MUX返回PT_MUX_RECV_UNKNOWN，格式错误或者对方超过窗口返回PT_MUX_RECV_INVALID，调用者应该断开连接
+ */
+int pt_mux_receive(struct pt_mux *mux, struct pt_buffer *buff);
+
+//立即写入正在组合的数据包，不等待idle
+void pt_mux_flush(struct pt_mux *mux);
+
+#endif
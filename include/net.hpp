@@ -0,0 +1,294 @@
+//
+//  net.hpp
+//  xcode
+//
+//  pt_buffer，pt_server和pt_client的C++包装，只有头文件，需要C++20
+//  所有类型只能移动，复制需要显式调用copy
+//  发送函数只接受右值的Buffer，所有权直接交给C接口的发送队列，不再复制
+//
+
+#ifndef _PT_NET_INCLUED_HPP_
+#define _PT_NET_INCLUED_HPP_
+
+#include <cstddef>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+#include "message.hpp"
+
+namespace pt
+{
+    /*
+        拥有一个pt_buffer，析构时释放
+        作为数据包使用时以net_header开头
+     */
+    class Buffer
+    {
+    public:
+        Buffer() noexcept : buff_(nullptr) {}
+
+        //预留length字节的空间
+        explicit Buffer(uint32_t length) : buff_(pt_buffer_new(length)) {}
+
+        Buffer(Buffer &&other) noexcept : buff_(std::exchange(other.buff_, nullptr)) {}
+
+        Buffer &operator=(Buffer &&other) noexcept
+        {
+            if (this != &other) {
+                reset();
+                buff_ = std::exchange(other.buff_, nullptr);
+            }
+            return *this;
+        }
+
+        Buffer(const Buffer&) = delete;
+        Buffer &operator=(const Buffer&) = delete;
+
+        ~Buffer() { reset(); }
+
+        //接管一个pt_buffer
+        static Buffer adopt(struct pt_buffer *buff) noexcept
+        {
+            Buffer b;
+            b.buff_ = buff;
+            return b;
+        }
+
+        //复制一个不属于自己的pt_buffer，例如on_receive中的数据包
+        static Buffer copy_of(const struct pt_buffer *buff)
+        {
+            Buffer b(buff->length);
+            pt_buffer_write(b.buff_, buff->buff, buff->length);
+            return b;
+        }
+
+        /*
+            组一个数据包，reserve_serial为true时在net_header之后预留加密用的包序列
+         */
+        static Buffer packet(uint16_t id, std::span<const unsigned char> payload, bool reserve_serial = false)
+        {
+            struct net_header hdr = pt_create_nethdr(id);
+            uint32_t serial = 0;
+            Buffer b(static_cast<uint32_t>(sizeof(hdr) + sizeof(serial) + payload.size()));
+
+            b.write(std::span<const unsigned char>(reinterpret_cast<const unsigned char*>(&hdr), sizeof(hdr)));
+            if (reserve_serial) {
+                b.write(std::span<const unsigned char>(reinterpret_cast<const unsigned char*>(&serial), sizeof(serial)));
+            }
+            b.write(payload);
+            b.finish();
+
+            return b;
+        }
+
+        //显式复制
+        Buffer copy() const
+        {
+            return buff_ ? copy_of(buff_) : Buffer();
+        }
+
+        explicit operator bool() const noexcept { return buff_ != nullptr; }
+
+        struct pt_buffer *get() const noexcept { return buff_; }
+        struct pt_buffer *release() noexcept { return std::exchange(buff_, nullptr); }
+
+        void reset() noexcept
+        {
+            if (buff_) {
+                pt_buffer_free(buff_);
+                buff_ = nullptr;
+            }
+        }
+
+        unsigned char *data() const noexcept { return buff_ ? buff_->buff : nullptr; }
+        uint32_t size() const noexcept { return buff_ ? buff_->length : 0; }
+
+        std::span<unsigned char> span() noexcept { return {data(), size()}; }
+        std::span<const unsigned char> span() const noexcept { return {data(), size()}; }
+
+        void reserve(uint32_t length) { pt_buffer_reserve(buff_, length); }
+        void clear() noexcept { buff_->length = 0; }
+
+        void write(std::span<const unsigned char> bytes)
+        {
+            pt_buffer_write(buff_, bytes.data(), static_cast<uint32_t>(bytes.size()));
+        }
+
+        //数据包的ID和net_header之后的数据
+        uint16_t id() const noexcept { return reinterpret_cast<const struct net_header*>(buff_->buff)->id; }
+        std::span<const unsigned char> payload() const noexcept { return {pt_get_packet_buffer(buff_), pt_get_packet_size(buff_)}; }
+
+        //追加数据后更新net_header的长度
+        void finish() noexcept { reinterpret_cast<struct net_header*>(buff_->buff)->length = buff_->length; }
+
+    private:
+        struct pt_buffer *buff_;
+    };
+
+    //发送函数只接受右值，左值需要std::move或者copy
+    template<class B>
+    concept rvalue_buffer = std::is_same_v<B, Buffer>;
+
+    /*
+        服务器，析构时需要已经关闭完成，和pt_server_free一样
+     */
+    class Server
+    {
+    public:
+        Server() noexcept : server_(nullptr) {}
+
+        Server(uv_loop_t *loop, int max_conn, int keep_alive_delay,
+               pt_server_on_connect on_connect, pt_server_on_receive on_receive, pt_server_on_disconnect on_disconnect)
+            : server_(pt_server_new())
+        {
+            pt_server_init(server_, loop, max_conn, keep_alive_delay, on_connect, on_receive, on_disconnect);
+        }
+
+        Server(Server &&other) noexcept : server_(std::exchange(other.server_, nullptr)) {}
+
+        Server &operator=(Server &&other) noexcept
+        {
+            if (this != &other) {
+                reset();
+                server_ = std::exchange(other.server_, nullptr);
+            }
+            return *this;
+        }
+
+        Server(const Server&) = delete;
+        Server &operator=(const Server&) = delete;
+
+        ~Server() { reset(); }
+
+        struct pt_server *get() const noexcept { return server_; }
+        explicit operator bool() const noexcept { return server_ != nullptr; }
+
+        void set_encrypt(const uint32_t key[4]) { pt_server_set_encrypt(server_, key); }
+
+        bool start(const char *host, uint16_t port) { return pt_server_start(server_, host, port) != false; }
+        bool start_pipe(const char *path) { return pt_server_start_pipe(server_, path) != false; }
+        void close() { pt_server_close(server_); }
+
+        //发送到客户端，buff的所有权交给发送队列
+        template<class B> requires rvalue_buffer<B>
+        static bool send(struct pt_sclient *user, B &&buff)
+        {
+            return pt_server_send(user, buff.release()) != false;
+        }
+
+        template<class B> requires rvalue_buffer<B>
+        static bool send(struct pt_sclient *user, B &&buff, int priority)
+        {
+            return pt_server_send_priority(user, buff.release(), priority) != false;
+        }
+
+        static bool send(struct pt_sclient *user, uint16_t id, std::span<const unsigned char> payload)
+        {
+            return send(user, Buffer::packet(id, payload));
+        }
+
+        template<class M> requires is_message_v<M>
+        static bool send(struct pt_sclient *user, const M &msg)
+        {
+            return pt::send(user, msg);
+        }
+
+        //左值的Buffer需要明确是移动还是复制
+        static bool send(struct pt_sclient *user, Buffer &buff) = delete;
+        static bool send(struct pt_sclient *user, const Buffer &buff) = delete;
+
+    private:
+        void reset() noexcept
+        {
+            if (server_) {
+                pt_server_free(server_);
+                server_ = nullptr;
+            }
+        }
+
+        struct pt_server *server_;
+    };
+
+    /*
+        客户端，析构时需要已经断开并且关闭完成，和pt_client_free一样
+     */
+    class Client
+    {
+    public:
+        Client() noexcept : client_(nullptr) {}
+
+        Client(uv_loop_t *loop, pt_cli_on_connected on_connected, pt_cli_on_receive on_receive,
+               pt_cli_on_disconnected on_disconnected)
+            : client_(pt_client_new())
+        {
+            pt_client_init(loop, client_, on_connected, on_receive, on_disconnected);
+        }
+
+        Client(Client &&other) noexcept : client_(std::exchange(other.client_, nullptr)) {}
+
+        Client &operator=(Client &&other) noexcept
+        {
+            if (this != &other) {
+                reset();
+                client_ = std::exchange(other.client_, nullptr);
+            }
+            return *this;
+        }
+
+        Client(const Client&) = delete;
+        Client &operator=(const Client&) = delete;
+
+        ~Client() { reset(); }
+
+        struct pt_client *get() const noexcept { return client_; }
+        explicit operator bool() const noexcept { return client_ != nullptr; }
+        bool connected() const noexcept { return client_->connected != false; }
+
+        void set_encrypt(const uint32_t key[4]) { pt_client_set_encrypt(client_, key); }
+
+        void connect(const char *host, uint16_t port) { pt_client_connect(client_, host, port); }
+        void connect_pipe(const char *path) { pt_client_connect_pipe(client_, path); }
+        void disconnect() { pt_client_disconnect(client_); }
+
+        //按当前的加密设置组包，加密时预留包序列
+        Buffer packet(uint16_t id, std::span<const unsigned char> payload) const
+        {
+            return Buffer::packet(id, payload, client_->enable_encrypt != false);
+        }
+
+        //发送packet()组好的数据包，加密在发送时进行
+        template<class B> requires rvalue_buffer<B>
+        bool send(B &&buff)
+        {
+            return pt_client_send_prepared(client_, buff.release()) != false;
+        }
+
+        bool send(uint16_t id, std::span<const unsigned char> payload)
+        {
+            return send(packet(id, payload));
+        }
+
+        template<class M> requires is_message_v<M>
+        bool send(const M &msg)
+        {
+            return pt::send(client_, msg);
+        }
+
+        bool send(Buffer &buff) = delete;
+        bool send(const Buffer &buff) = delete;
+
+    private:
+        void reset() noexcept
+        {
+            if (client_) {
+                pt_client_free(client_);
+                client_ = nullptr;
+            }
+        }
+
+        struct pt_client *client_;
+    };
+}
+
+#endif
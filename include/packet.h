@@ -46,8 +46,42 @@ qboolean pt_decrypt_package(uint32_t serial,RC4_KEY *ctx, struct pt_buffer *buff
 struct pt_buffer *pt_create_encrypt_package(RC4_KEY *ctx, uint32_t *serial,
                                struct net_header hdr,unsigned char* data, uint32_t length);
 
+/*
+    对已经组好的数据包加密，net_header之后需要预留4字节的包序列
+    设置包长度和crc，完成后serial加1
+ */
+void pt_encrypt_package(RC4_KEY *ctx, uint32_t *serial, struct pt_buffer *buff);
+
+/*
+    不可靠通道的数据包每个单独加密，丢包和乱序不影响其他数据包
+    格式和普通数据包相同，包序列不加密，和key一起生成这个数据包的rc4密钥，crc同样包括包序列
+ */
+void pt_encrypt_datagram(const uint32_t key[4], uint32_t serial, struct pt_buffer *buff);
+//解密并校验crc，serial为数据包的包序列
+qboolean pt_decrypt_datagram(const uint32_t key[4], struct pt_buffer *buff, uint32_t *serial);
+
 
 struct pt_buffer *pt_create_package(struct net_header hdr,
                        unsigned char* data, uint32_t length);
 
+/*
+    创建一个空的ID_TRANSMIT_BATCH批量包，encrypt为true时预留4字节的包序列
+    服务器使用pt_server_send发送，客户端使用pt_client_send_batch发送
+ */
+struct pt_buffer *pt_batch_new(qboolean encrypt);
+
+/*
+    追加一个子消息并更新包长度
+    超过pt_max_pack_size时不追加并返回false，需要先发送当前的批量包
+ */
+qboolean pt_batch_append(struct pt_buffer *batch, uint16_t id, const unsigned char *data, uint32_t length);
+
+/*
+    从pos开始读取一个子消息，remain为剩余字节数，读取后pos和remain前进
+    没有剩余数据或者数据不完整时返回false，数据不完整时remain不为0
+    不允许嵌套的批量包
+ */
+qboolean pt_batch_next(const unsigned char **pos, uint32_t *remain, uint16_t *id,
+                       const unsigned char **data, uint32_t *length);
+
 #endif
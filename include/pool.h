@@ -0,0 +1,115 @@
+//
+//  pool.h
+//  xcode
+//
+//  客户端连接池
+//  每个后端地址保持N个连接，发送时按未发送字节数最少或者按key的一致性哈希选择连接
+//  没有可用连接的后端标记为不可用，断开的连接由定时器重连
+//
+
+#ifndef _PT_POOL_INCLUED_H_
+#define _PT_POOL_INCLUED_H_
+
+#include "client.h"
+#include "hashring.h"
+
+//重连间隔(毫秒)，连续失败时按2的次方增加，最多64倍
+#define PT_POOL_RECONNECT_INTERVAL 1000
+#define PT_POOL_RECONNECT_MAX_SHIFT 6
+
+//检查重连的定时器间隔(毫秒)
+#define PT_POOL_TIMER_INTERVAL 250
+
+struct pt_pool;
+struct pt_pool_endpoint;
+
+typedef void (*pt_pool_on_receive)(struct pt_pool *pool, struct pt_client *client, struct pt_buffer *buff);
+//后端可用状态改变
+typedef void (*pt_pool_on_state)(struct pt_pool *pool, struct pt_pool_endpoint *endpoint);
+
+struct pt_pool_endpoint
+{
+    struct pt_pool *pool;
+
+    //port为0时host为pipe路径
+    char host[256];
+    uint16_t port;
+
+    //地址的哈希值，决定在一致性哈希环上的位置
+    uint64_t hash;
+
+    struct pt_client **conns;
+    int number_of_connected;
+
+    //连续连接失败次数和下一次重连的时间
+    int failures;
+    uint64_t next_retry;
+
+    //至少有一个连接可用
+    qboolean healthy;
+};
+
+struct pt_pool
+{
+    uv_loop_t *loop;
+
+    struct pt_pool_endpoint **endpoints;
+    int number_of_endpoints;
+
+    //每个后端的连接数
+    int conns_per_endpoint;
+
+    //轮询起点，未发送字节数相同时分散到不同的连接
+    uint32_t cursor;
+
+    //可用后端的一致性哈希环，后端可用状态改变时加入或者移除
+    struct pt_hashring *ring;
+
+    qboolean enable_encrypt;
+    uint32_t encrypt_key[4];
+
+    uv_timer_t timer;
+    qboolean is_startup;
+
+    pt_pool_on_receive on_receive;
+    pt_pool_on_state on_state;
+
+    //用户数据
+    void *data;
+};
+
+struct pt_pool *pt_pool_new(uv_loop_t *loop, int conns_per_endpoint, pt_pool_on_receive on_receive, pt_pool_on_state on_state);
+
+//需要在pt_pool_close之后，所有连接关闭完成后调用
+void pt_pool_free(struct pt_pool *pool);
+
+//所有连接使用的加密key，需要在pt_pool_start之前调用
+void pt_pool_set_encrypt(struct pt_pool *pool, const uint32_t encrypt_key[4]);
+
+//添加一个后端，port为0时host为pipe路径
+struct pt_pool_endpoint *pt_pool_add_endpoint(struct pt_pool *pool, const char *host, uint16_t port);
+
+//连接所有后端并启动重连定时器
+void pt_pool_start(struct pt_pool *pool);
+
+//断开所有连接
+void pt_pool_close(struct pt_pool *pool);
+
+//选择可用后端中未发送字节数最少的连接，没有可用连接返回NULL
+struct pt_client *pt_pool_pick(struct pt_pool *pool);
+
+/*
+    按key在一致性哈希环上选择后端，同一个key在后端不变时总是选择同一个后端
+    后端加入或者离开时只有原来属于这个后端或者新分配给它的key改变
+    后端内使用第key % conns_per_endpoint个连接，断开时依次使用后面第一个已连接的
+ */
+struct pt_client *pt_pool_pick_hash(struct pt_pool *pool, uint64_t key);
+
+/*
+    组包并发送，加密时使用所选连接的加密状态
+    没有可用连接返回false
+ */
+qboolean pt_pool_send(struct pt_pool *pool, uint16_t id, const unsigned char *data, uint32_t length);
+qboolean pt_pool_send_hash(struct pt_pool *pool, uint64_t key, uint16_t id, const unsigned char *data, uint32_t length);
+
+#endif
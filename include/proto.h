@@ -37,8 +37,18 @@ enum protocol_enum_id
 	//传送JSON值到另外一端。
 	ID_TRANSMIT_JSON,
 
-    //内网服务器交互封包
+    //批量包，数据由多个batch_header和子消息组成，接收端拆开后逐个通知
+    ID_TRANSMIT_BATCH,
+
+    //内网服务器交互封包，网关转发的数据包以struct forward_header开头
 	ID_RESERVE_TRANSMIT_ENUM = 10000,
+    
+    //RPC请求和回复，数据以struct rpc_header开头
+    ID_RESERVE_RPC_REQUEST,
+    ID_RESERVE_RPC_RESPONSE,
+    
+    //多个会话复用一个内网连接，数据由多个struct mux_header和子帧组成
+    ID_RESERVE_MUX,
 
     //客户端请求包
     ID_USER_CLIENT_ENUM = 20000,
@@ -50,6 +60,70 @@ enum protocol_enum_id
     ID_USER_PACKET_ENUM = 40000,
 };
 
+/*
+    RPC请求和回复的头部，位于net_header(加密时为包序列)之后
+    回复使用请求的request_id，status为0表示成功
+ */
+struct rpc_header
+{
+    uint32_t request_id;
+    uint16_t method;
+    uint16_t status;
+};
+
+/*
+    批量包中每个子消息的头部，之后是length字节的子消息数据
+    多个小消息共用一个net_header，加密时也只有一个包序列、一次crc和一次RC4
+ */
+struct batch_header
+{
+    uint16_t id;
+    uint32_t length;
+};
+
+/*
+    网关和后端之间转发的头部，位于ID_RESERVE_TRANSMIT_ENUM的net_header之后，之后是原始数据
+    session为网关上客户端连接的id，id为客户端数据包的包ID
+    id等于ID_RESERVE_TRANSMIT_ENUM时没有数据：网关发给后端表示客户端已断开，后端发给网关表示断开这个客户端
+ */
+struct forward_header
+{
+    uint64_t session;
+    uint16_t id;
+};
+
+/*
+    ID_RESERVE_MUX中每个子帧的头部，之后是length字节的数据
+    type为mux.h中的PT_MUX_OPEN等，CREDIT帧的数据为uint32_t的字节数
+ */
+struct mux_header
+{
+    uint32_t session;
+    uint8_t type;
+    uint32_t length;
+};
+
+/*
+    热重启时旧进程通过unix socket发送给新进程的记录，length包括头部
+    type为server.h中的PT_HANDOFF_LISTENER等，监听socket和连接的socket随记录一起发送
+ */
+struct handoff_header
+{
+    uint32_t length;
+    uint8_t type;
+};
+
+/*
+    新进程回复的PT_HANDOFF_ACK记录，在handoff_header之后
+    type为确认的记录类型(PT_HANDOFF_LISTENER或者PT_HANDOFF_DONE)，count为收到的连接记录数
+ */
+struct handoff_ack
+{
+    uint32_t magic;
+    uint8_t type;
+    uint32_t count;
+};
+
 /*
  =========================================================================
  当数据传输为ID_TRANSMIT_JSON时的JSON结构信息为
@@ -61,6 +135,8 @@ enum protocol_enum_id
         .....
     }
  }
+ 
+ json.h中的pt_json_router按type和action分发，params交给处理函数时不解析
 
  =========================================================================
  */
@@ -0,0 +1,118 @@
+//
+//  pubsub.h
+//  xcode
+//
+//  服务器内的发布/订阅
+//  主题按'.'分段，订阅时'*'匹配一段，最后一段为'#'时匹配剩余的任意段(包括零段)
+//  每个主题的订阅者保存在连续的数组中，每个连接也记录自己订阅的主题，取消订阅和断开时交换删除
+//  发布时只组一次数据包，所有订阅者共享同一个pt_buffer
+//  每次投递仍然是一次uv_write，扇出速度受写调用限制，test/pubsub_bench.c在本机约为每秒几十万次投递
+//
+
+#ifndef _PT_PUBSUB_INCLUED_H_
+#define _PT_PUBSUB_INCLUED_H_
+
+#include "server.h"
+#include "table.h"
+
+//主题的最大长度
+#define PT_PUBSUB_MAX_TOPIC 255
+
+struct pt_pubsub_topic;
+struct pt_pubsub_member;
+
+//主题中的一个订阅者，slot为这个主题在member->links中的下标
+struct pt_pubsub_sub
+{
+    struct pt_sclient *user;
+    struct pt_pubsub_member *member;
+    uint32_t slot;
+};
+
+//连接订阅的一个主题，slot为这个连接在topic->subs中的下标
+struct pt_pubsub_link
+{
+    struct pt_pubsub_topic *topic;
+    uint32_t slot;
+};
+
+struct pt_pubsub_topic
+{
+    //哈希冲突时的下一个主题，通配符主题为通配符链表的下一个
+    struct pt_pubsub_topic *next;
+
+    char *name;
+    uint32_t length;
+    uint64_t hash;
+    qboolean wildcard;
+
+    struct pt_pubsub_sub *subs;
+    uint32_t number_of_subs;
+    uint32_t max_subs;
+};
+
+struct pt_pubsub_member
+{
+    struct pt_sclient *user;
+
+    //所有连接的链表
+    struct pt_pubsub_member *prev;
+    struct pt_pubsub_member *next;
+
+    struct pt_pubsub_link *links;
+    uint32_t number_of_links;
+    uint32_t max_links;
+
+    //最后一次投递的发布序号，同时匹配多个主题时只投递一次
+    uint64_t generation;
+};
+
+struct pt_pubsub
+{
+    struct pt_server *server;
+
+    //普通主题，key为名字的哈希
+    struct pt_table *topics;
+    uint32_t number_of_topics;
+
+    //通配符主题，发布时逐个匹配
+    struct pt_pubsub_topic *wildcards;
+
+    //订阅了主题的连接，key为pt_sclient的id
+    struct pt_table *members;
+    struct pt_pubsub_member *member_head;
+
+    //发布序号
+    uint64_t generation;
+
+    //发布中断开的连接在发布完成后再清理
+    uint32_t publishing;
+    struct pt_sclient **deferred;
+    uint32_t number_of_deferred;
+    uint32_t max_deferred;
+
+    //投递的总次数
+    uint64_t number_of_deliveries;
+};
+
+//创建时注册服务器的断开通知，连接断开时自动取消所有订阅
+struct pt_pubsub *pt_pubsub_new(struct pt_server *server);
+void pt_pubsub_free(struct pt_pubsub *pubsub);
+
+//订阅主题，已经订阅或者主题格式错误时返回false
+qboolean pt_pubsub_subscribe(struct pt_pubsub *pubsub, struct pt_sclient *user, const char *topic);
+
+//取消订阅，订阅时是什么主题就传入什么主题(包括通配符)
+qboolean pt_pubsub_unsubscribe(struct pt_pubsub *pubsub, struct pt_sclient *user, const char *topic);
+void pt_pubsub_unsubscribe_all(struct pt_pubsub *pubsub, struct pt_sclient *user);
+
+/*
+    发布到topic，topic不能包含通配符
+    数据包只组一次，匹配的每个连接最多收到一次，返回投递的连接数
+ */
+uint32_t pt_pubsub_publish(struct pt_pubsub *pubsub, const char *topic, uint16_t id, const unsigned char *data, uint32_t length);
+
+//发布已经组好的数据包(例如ID_TRANSMIT_JSON)，packet的所有权交给pt_pubsub
+uint32_t pt_pubsub_publish_packet(struct pt_pubsub *pubsub, const char *topic, struct pt_buffer *packet);
+
+#endif
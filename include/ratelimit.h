@@ -0,0 +1,84 @@
+//
+//  ratelimit.h
+//  xcode
+//
+//  令牌桶限速
+//  服务器按数据包ID范围配置每秒的包数和字节数，每个连接有各自的令牌桶
+//  在拆包之前只读取net_header检查，超过限制的包不会解密和回调
+//
+
+#ifndef _PT_RATELIMIT_INCLUED_H_
+#define _PT_RATELIMIT_INCLUED_H_
+
+#include "common.h"
+
+//超过限制时的处理方式，数值越大越严格
+//丢弃数据包，加密时仍然需要解密一次保持rc4状态同步
+#define PT_RATE_DROP 0
+//暂停读取，等待令牌足够后继续处理
+#define PT_RATE_DELAY 1
+//断开连接
+#define PT_RATE_DISCONNECT 2
+//没有超过限制
+#define PT_RATE_PASS -1
+
+//令牌按千分之一个保存，毫秒级补充不会丢失精度
+#define PT_TOKEN_SCALE 1000
+
+struct pt_token_bucket
+{
+    //每秒补充的令牌数，0为不限制
+    uint32_t rate;
+    //令牌上限，单位为千分之一个
+    uint64_t burst;
+    uint64_t tokens;
+    //上一次补充的时间(毫秒)
+    uint64_t last;
+};
+
+/*
+    一条限速规则，id在[id_min, id_max]范围内的数据包使用
+    pps和bps为0时不限制
+ */
+struct pt_rate_rule
+{
+    uint16_t id_min;
+    uint16_t id_max;
+    uint32_t pps;
+    uint32_t bps;
+    int policy;
+};
+
+//每个连接上一条规则的令牌桶
+struct pt_rate_limit
+{
+    struct pt_token_bucket packets;
+    struct pt_token_bucket bytes;
+};
+
+//初始化令牌桶，初始为满
+void pt_token_bucket_init(struct pt_token_bucket *bucket, uint32_t rate, uint32_t burst, uint64_t now);
+
+//补充令牌后检查是否有count个令牌，不消耗
+qboolean pt_token_bucket_check(struct pt_token_bucket *bucket, uint32_t count, uint64_t now);
+
+//消耗count个令牌，需要先执行pt_token_bucket_check
+void pt_token_bucket_take(struct pt_token_bucket *bucket, uint32_t count);
+
+//还需要多少毫秒才有count个令牌
+uint64_t pt_token_bucket_wait(struct pt_token_bucket *bucket, uint32_t count);
+
+/*
+    按规则初始化一个连接的令牌桶，突发量为一秒的速率
+    字节桶的突发量至少为pt_max_pack_size，保证最大的包可以通过
+ */
+void pt_rate_limit_init(struct pt_rate_limit *limit, const struct pt_rate_rule *rule, uint64_t now);
+
+/*
+    检查所有匹配id的规则，全部通过时消耗令牌并返回PT_RATE_PASS
+    否则不消耗任何令牌，返回最严格的policy，wait为恢复需要等待的毫秒数
+ */
+int pt_rate_limit_check(const struct pt_rate_rule *rules, struct pt_rate_limit *limits, uint32_t count,
+                        uint16_t id, uint32_t length, uint64_t now, uint64_t *wait);
+
+#endif
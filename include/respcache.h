@@ -0,0 +1,96 @@
+//
+//  respcache.h
+//  xcode
+//
+//  幂等请求的响应缓存(例如排行榜，配置，商店列表)
+//  以数据包id和请求数据为key，命中时把缓存的数据包直接加入连接的发送队列，不执行on_receive
+//  缓存的响应是组好的完整数据包，所有命中的连接共享同一个pt_buffer
+//  超过ttl的条目在查找时删除，总大小超过上限时按LRU淘汰
+//
+
+#ifndef _PT_RESPCACHE_INCLUED_H_
+#define _PT_RESPCACHE_INCLUED_H_
+
+#include "server.h"
+#include "table.h"
+
+//默认的缓存时间(毫秒)和总大小(字节)
+#define PT_RESPCACHE_TTL 1000
+#define PT_RESPCACHE_MAX_SIZE 0x4000000
+
+struct pt_respcache_entry
+{
+    //哈希冲突时的下一个条目
+    struct pt_respcache_entry *next;
+
+    //LRU链表，头部为最近使用
+    struct pt_respcache_entry *lru_prev;
+    struct pt_respcache_entry *lru_next;
+
+    uint64_t hash;
+    uint16_t id;
+
+    //请求的数据，哈希相同时逐字节比较
+    unsigned char *request;
+    uint32_t request_length;
+
+    //完整的响应数据包，包括net_header
+    struct pt_buffer *response;
+
+    //过期时间(uv_now)
+    uint64_t expire;
+
+    //计入总大小的字节数
+    uint32_t size;
+};
+
+struct pt_respcache
+{
+    uv_loop_t *loop;
+
+    //key为id和请求数据的哈希
+    struct pt_table *entries;
+    uint32_t number_of_entries;
+
+    struct pt_respcache_entry *lru_head;
+    struct pt_respcache_entry *lru_tail;
+
+    uint32_t ttl;
+    uint64_t max_size;
+    uint64_t size;
+
+    //保存过响应的数据包id，其他id查找时不需要计算哈希
+    uint8_t ids[0x10000 / 8];
+
+    uint64_t number_of_hits;
+    uint64_t number_of_misses;
+    uint64_t number_of_evictions;
+};
+
+//ttl和max_size为0时使用默认值
+struct pt_respcache *pt_respcache_new(uv_loop_t *loop, uint32_t ttl, uint64_t max_size);
+void pt_respcache_free(struct pt_respcache *cache);
+
+/*
+    查找request的缓存，命中时把响应加入user的发送队列并返回true
+    request为on_receive收到的数据包，开启加密时跳过包序列
+    使用pt_server_set_respcache后由pt_server在on_receive之前调用
+ */
+qboolean pt_respcache_reply(struct pt_respcache *cache, struct pt_sclient *user, struct pt_buffer *request);
+
+/*
+    发送响应并缓存，之后相同的请求直接使用这个响应
+    只能用于结果和连接无关的请求
+ */
+qboolean pt_respcache_send(struct pt_respcache *cache, struct pt_sclient *user, struct pt_buffer *request,
+                           uint16_t id, const unsigned char *data, uint32_t length);
+
+//发送已经组好的响应数据包并缓存，packet的所有权交给pt_respcache
+qboolean pt_respcache_send_packet(struct pt_respcache *cache, struct pt_sclient *user, struct pt_buffer *request,
+                                  struct pt_buffer *packet);
+
+//删除数据包id为id的所有请求的缓存，例如配置改变时
+void pt_respcache_invalidate(struct pt_respcache *cache, uint16_t id);
+void pt_respcache_clear(struct pt_respcache *cache);
+
+#endif
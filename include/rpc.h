@@ -0,0 +1,112 @@
+//
+//  rpc.h
+//  xcode
+//
+//  基于pt_client的请求/回复
+//  每个请求带有request_id，同一个连接上可以同时有多个未完成的请求
+//  所有请求的超时使用一个最小堆和一个定时器处理
+//
+
+#ifndef _PT_RPC_INCLUED_H_
+#define _PT_RPC_INCLUED_H_
+
+#include "client.h"
+#include "server.h"
+
+//请求成功，回复的status为0
+#define PT_RPC_OK 0
+//请求超时
+#define PT_RPC_TIMEOUT -1
+//连接断开或者请求被取消
+#define PT_RPC_DISCONNECTED -2
+
+//默认的请求超时(毫秒)
+#define PT_RPC_DEFAULT_TIMEOUT 5000
+
+struct pt_rpc;
+struct pt_rpc_request;
+
+/*
+    请求完成后回调，只会执行一次
+    status < 0 时data为NULL，否则为回复的status
+ */
+typedef void (*pt_rpc_callback)(struct pt_rpc_request *req, int status, const unsigned char *data, uint32_t length);
+
+struct pt_rpc_request
+{
+    struct pt_rpc *rpc;
+
+    uint32_t id;
+    uint16_t method;
+
+    //超时的时间点和在最小堆中的位置
+    uint64_t deadline;
+    uint32_t heap_index;
+
+    pt_rpc_callback cb;
+    //用户数据
+    void *data;
+};
+
+struct pt_rpc
+{
+    struct pt_client *client;
+
+    //下一个请求ID，0不使用
+    uint32_t next_id;
+
+    //未完成的请求，key为request_id
+    struct pt_table *pending;
+
+    //按超时时间排序的最小堆
+    struct pt_rpc_request **heap;
+    uint32_t heap_size;
+    uint32_t heap_max;
+
+    //超时定时器，只在堆顶改变时重新设置
+    uv_timer_t timer;
+    uint64_t timer_due;
+
+    uint32_t default_timeout;
+};
+
+/*
+    在已经执行过pt_client_init的客户端上创建rpc
+    回复包不会再传给client->on_receive
+ */
+struct pt_rpc *pt_rpc_new(struct pt_client *client);
+
+//所有未完成的请求以PT_RPC_DISCONNECTED完成，定时器关闭后释放
+void pt_rpc_free(struct pt_rpc *rpc);
+
+/*
+    发送一个请求，timeout为0时使用default_timeout
+    成功返回request_id，未连接时返回0且不会执行回调
+ */
+uint32_t pt_rpc_call(struct pt_rpc *rpc, uint16_t method, const unsigned char *data, uint32_t length,
+                     uint32_t timeout, pt_rpc_callback cb, void *udata);
+
+//取消一个请求，回调以PT_RPC_DISCONNECTED执行
+qboolean pt_rpc_cancel(struct pt_rpc *rpc, uint32_t request_id);
+
+//未完成的请求数量
+uint32_t pt_rpc_pending_count(struct pt_rpc *rpc);
+
+//客户端收到ID_RESERVE_RPC_RESPONSE时调用，由client.c使用
+void pt_rpc_on_response(struct pt_rpc *rpc, struct pt_buffer *buff);
+
+//连接断开时完成所有请求，由client.c使用
+void pt_rpc_on_disconnect(struct pt_rpc *rpc);
+
+/*
+    服务器端：读取ID_RESERVE_RPC_REQUEST的请求头和参数
+    加密时跳过包序列，数据不完整返回false
+ */
+qboolean pt_rpc_read_request(struct pt_sclient *user, struct pt_buffer *buff, struct rpc_header *hdr,
+                             const unsigned char **data, uint32_t *length);
+
+//服务器端：回复一个请求
+qboolean pt_rpc_reply(struct pt_sclient *user, const struct rpc_header *request, uint16_t status,
+                      const unsigned char *data, uint32_t length);
+
+#endif
@@ -0,0 +1,213 @@
+//
+//  rudp.h
+//  xcode
+//
+//  基于UDP的可靠传输
+//  选择确认(sack)，快速重传，拥塞控制
+//  每个连接两个通道：可靠有序通道和不可靠有序通道(迟到的包直接丢弃)
+//
+
+#ifndef _PT_RUDP_INCLUED_H_
+#define _PT_RUDP_INCLUED_H_
+
+#define PT_RUDP_MTU 1400
+
+#define PT_RUDP_CMD_PUSH 1
+#define PT_RUDP_CMD_ACK 2
+#define PT_RUDP_CMD_SYN 3
+#define PT_RUDP_CMD_SYNACK 4
+#define PT_RUDP_CMD_FIN 5
+#define PT_RUDP_CMD_PING 6
+
+//可靠有序通道，丢包会重传
+#define PT_RUDP_CHANNEL_RELIABLE 0
+//不可靠有序通道，丢包不重传，比最新序列旧的包直接丢弃
+#define PT_RUDP_CHANNEL_UNRELIABLE 1
+
+#define PT_RUDP_STATE_CLOSED 0
+#define PT_RUDP_STATE_SYN_SENT 1
+#define PT_RUDP_STATE_ESTABLISHED 2
+
+#define PT_RUDP_EVENT_CONNECTED 1
+#define PT_RUDP_EVENT_CLOSED 2
+
+//每个包的重传超时范围(毫秒)
+#define PT_RUDP_RTO_MIN 30
+#define PT_RUDP_RTO_MAX 5000
+#define PT_RUDP_RTO_DEFAULT 200
+
+//收到多少个更新的确认后快速重传
+#define PT_RUDP_FASTACK 3
+
+//一个包重传多少次后认为连接已经断开
+#define PT_RUDP_DEAD_LINK 20
+
+//发送和接收窗口(包数量)
+#define PT_RUDP_WND_SIZE 256
+
+//多久没有收到数据认为连接已经断开
+#define PT_RUDP_IDLE_TIMEOUT 10000
+//多久没有发送数据时发送心跳
+#define PT_RUDP_PING_INTERVAL 1000
+//连接超时和SYN重发间隔
+#define PT_RUDP_CONNECT_TIMEOUT 5000
+#define PT_RUDP_SYN_INTERVAL 250
+//建议的pt_rudp_update调用间隔
+#define PT_RUDP_INTERVAL 10
+
+#pragma pack(1)
+/*
+    每个数据段的头部，一个UDP包中可以有多个数据段
+ */
+struct pt_rudp_header
+{
+    //连接ID，由客户端随机生成
+    uint32_t conv;
+    uint8_t cmd;
+    uint8_t channel;
+    //剩余分片数量，0表示消息的最后一个分片
+    uint16_t frg;
+    //接收端剩余窗口
+    uint16_t wnd;
+    uint32_t sn;
+    //累计确认，小于una的包都已经收到
+    uint32_t una;
+    //选择确认，第i位表示una + 1 + i已经收到
+    uint32_t sack;
+    //PUSH为发送时间，ACK为回显对方的发送时间
+    uint32_t ts;
+    uint16_t len;
+};
+#pragma pack()
+
+#define PT_RUDP_MSS (PT_RUDP_MTU - sizeof(struct pt_rudp_header))
+
+struct pt_rudp;
+
+//需要发送一个UDP包
+typedef void (*pt_rudp_output_cb)(struct pt_rudp *rudp, const unsigned char *data, uint32_t length);
+//收到一个完整的消息
+typedef void (*pt_rudp_message_cb)(struct pt_rudp *rudp, int channel, const unsigned char *data, uint32_t length);
+//连接状态改变
+typedef void (*pt_rudp_event_cb)(struct pt_rudp *rudp, int event);
+
+struct pt_rudp_seg
+{
+    struct pt_rudp_seg *next;
+    struct pt_rudp_seg *prev;
+
+    uint32_t sn;
+    uint32_t ts;
+    uint32_t resendts;
+    uint32_t rto;
+    uint32_t fastack;
+    uint32_t xmit;
+    uint16_t frg;
+    uint16_t len;
+    unsigned char data[];
+};
+
+struct pt_rudp_list
+{
+    struct pt_rudp_seg *head;
+    struct pt_rudp_seg *tail;
+    uint32_t count;
+};
+
+struct pt_rudp
+{
+    uint32_t conv;
+    int state;
+    void *data;
+
+    //可靠通道的发送状态
+    uint32_t snd_una;
+    uint32_t snd_nxt;
+    uint32_t rmt_wnd;
+    struct pt_rudp_list snd_queue;
+    struct pt_rudp_list snd_buf;
+    //snd_queue中的字节数
+    uint32_t snd_queue_size;
+
+    //可靠通道的接收状态
+    uint32_t rcv_nxt;
+    struct pt_rudp_list rcv_buf;
+    struct pt_rudp_list rcv_queue;
+
+    //不可靠通道的序列
+    uint32_t unrel_snd_nxt;
+    uint32_t unrel_rcv_last;
+    qboolean unrel_received;
+
+    //rtt估算
+    int32_t srtt;
+    int32_t rttvar;
+    uint32_t rto;
+
+    //拥塞控制，单位为包
+    uint32_t cwnd;
+    uint32_t ssthresh;
+    uint32_t cwnd_incr;
+
+    //需要回复ACK，ack_ts为回显给对方的时间
+    qboolean ack_pending;
+    uint32_t ack_ts;
+
+    uint32_t current;
+    uint32_t last_recv;
+    uint32_t last_send;
+    uint32_t connect_start;
+    uint32_t syn_ts;
+
+    //合并输出的UDP包
+    unsigned char *out;
+    uint32_t out_length;
+    //正在处理输入，期间发送的数据延迟到处理结束后合并发送
+    qboolean inputting;
+
+    //暂停交付可靠通道的消息，消息留在rcv_queue中并减小接收窗口
+    qboolean recv_paused;
+
+    //可靠通道作为字节流使用，不保留消息边界，发送的数据合并到还没有发送的数据段中
+    qboolean stream;
+
+    //重组消息使用
+    unsigned char *msg;
+    uint32_t msg_max;
+
+    pt_rudp_output_cb output;
+    pt_rudp_message_cb on_message;
+    pt_rudp_event_cb on_event;
+};
+
+struct pt_rudp *pt_rudp_new(uint32_t conv, void *data, pt_rudp_output_cb output,
+                            pt_rudp_message_cb on_message, pt_rudp_event_cb on_event);
+void pt_rudp_free(struct pt_rudp *rudp);
+
+//客户端发起连接
+void pt_rudp_connect(struct pt_rudp *rudp, uint32_t current);
+//服务器收到SYN后接受连接
+void pt_rudp_accept(struct pt_rudp *rudp, uint32_t current);
+//发送FIN并关闭
+void pt_rudp_close(struct pt_rudp *rudp);
+
+//发送一个消息，不可靠通道的消息不能超过PT_RUDP_MSS
+void pt_rudp_send(struct pt_rudp *rudp, int channel, const unsigned char *data, uint32_t length);
+
+//处理收到的一个UDP包
+void pt_rudp_input(struct pt_rudp *rudp, const unsigned char *data, uint32_t length, uint32_t current);
+
+//定时调用，处理重传，心跳和超时
+void pt_rudp_update(struct pt_rudp *rudp, uint32_t current);
+
+//读取UDP包的连接ID和命令，包不合法返回false
+qboolean pt_rudp_peek(const unsigned char *data, uint32_t length, uint32_t *conv, uint8_t *cmd);
+
+//暂停和恢复交付可靠通道的消息
+void pt_rudp_read_stop(struct pt_rudp *rudp);
+void pt_rudp_read_start(struct pt_rudp *rudp);
+
+//发送队列中等待的字节数
+uint32_t pt_rudp_queue_size(struct pt_rudp *rudp);
+
+#endif
@@ -5,9 +5,74 @@
 #include "buffer.h"
 #include "table.h"
 #include "packet.h"
+#include "ratelimit.h"
+#include "timewheel.h"
+
+//发送队列的默认高低水位(字节)
+//超过高水位后pt_server_try_send返回PT_SEND_FULL，降到低水位以下时执行on_drain
+#define PT_SERVER_SEND_HIGH_WATERMARK 0x100000
+#define PT_SERVER_SEND_LOW_WATERMARK 0x40000
+//发送队列的默认上限(字节)，超过后断开连接
+#define PT_SERVER_MAX_SEND_QUEUE 0x1000000
+
+//每个连接每次最多处理的数据包数量和时间(微秒)，剩余的数据包轮流在idle中处理
+#define PT_SERVER_DISPATCH_PACKETS 64
+#define PT_SERVER_DISPATCH_TIME 2000
+
+//限速暂停读取的连接检查恢复的间隔(毫秒)
+#define PT_SERVER_RATE_INTERVAL 10
+
+//热重启时等待连接的发送队列清空的最长时间和检查间隔(毫秒)，超时的连接直接断开
+#define PT_SERVER_HANDOFF_TIMEOUT 5000
+#define PT_SERVER_HANDOFF_INTERVAL 10
+
+//热重启的状态
+#define PT_SERVER_HANDOFF_NONE 0
+//旧进程正在连接新进程
+#define PT_SERVER_HANDOFF_CONNECTING 1
+//旧进程正在发送监听socket和连接
+#define PT_SERVER_HANDOFF_SENDING 2
+//新进程正在等待和接收
+#define PT_SERVER_HANDOFF_RECEIVING 3
+#define PT_SERVER_HANDOFF_DONE 4
+
+//热重启记录的类型，新进程收到LISTENER和DONE后回复ACK，旧进程检查后才继续
+#define PT_HANDOFF_LISTENER 1
+#define PT_HANDOFF_CONN 2
+#define PT_HANDOFF_DONE 3
+#define PT_HANDOFF_ACK 4
+
+#define PT_HANDOFF_MAGIC 0x46464F48
+
+//on_idle的类型，超过read_idle_timeout没有收到数据或者超过write_idle_timeout没有发送数据
+#define PT_IDLE_READ 1
+#define PT_IDLE_WRITE 2
+
+//发送优先级，数值越小越优先
+//控制消息(心跳等)，实时消息，大块数据
+#define PT_PRIORITY_CONTROL 0
+#define PT_PRIORITY_REALTIME 1
+#define PT_PRIORITY_BULK 2
+#define PT_PRIORITY_LEVELS 3
+
+//底层发送队列超过这个字节数时，新的数据包按优先级排队
+#define PT_SERVER_PRIORITY_INFLIGHT 0x10000
+//大块数据等待期间最多连续发送多少个高优先级的包，之后发送一个大块数据包
+#define PT_SERVER_BULK_STARVE 16
+
+//pt_server_try_send的返回值
+#define PT_SEND_OK 0
+#define PT_SEND_FULL 1
+#define PT_SEND_CLOSED 2
 
 struct pt_server;
 struct pt_sclient;
+struct pt_uring;
+struct pt_uring_req;
+struct pt_uring_conn;
+struct pt_shm;
+struct pt_rudp;
+struct pt_respcache;
 
 
 struct pt_sclient
@@ -33,11 +98,105 @@ struct pt_sclient
     uint32_t serial;
     //rc4加密key
     RC4_KEY encrypt_ctx;
+    
+    //发送队列的高低水位(字节)，创建时从服务器复制
+    uint32_t send_high_watermark;
+    uint32_t send_low_watermark;
+    
+    //发送队列超过了高水位，等待降到低水位
+    qboolean write_blocked;
+    
+    //按优先级排队等待写入底层的数据包，使用pt_buffer->next连接
+    struct pt_buffer *prio_head[PT_PRIORITY_LEVELS];
+    struct pt_buffer *prio_tail[PT_PRIORITY_LEVELS];
+    //排队中的字节数
+    uint32_t prio_size;
+    //大块数据等待期间连续发送的高优先级包数量
+    uint32_t bulk_starve;
+    
+    //应用层调用pt_server_pause_read暂停读取
+    qboolean read_paused;
+    //未完成的工作量超过预算，自动暂停读取
+    qboolean read_throttled;
+    //本次处理的数据包超过预算，等待轮到时再处理，期间不读取新数据
+    qboolean read_deferred;
+    //超过限速，暂停读取到rate_resume
+    qboolean read_limited;
+    uint64_t rate_resume;
+    struct pt_sclient *rate_prev;
+    struct pt_sclient *rate_next;
+    //每条限速规则的令牌桶，和server->rate_rules对应
+    struct pt_rate_limit *rate_limits;
+    
+    //最后一次收到和发送数据的时间，最后一次发送心跳的时间(毫秒)
+    uint64_t last_read;
+    uint64_t last_write;
+    uint64_t last_ping;
+    //读空闲(包括心跳)和写空闲的定时器，到期时再按最后的时间重新计算
+    struct pt_timewheel_node read_timer;
+    struct pt_timewheel_node write_timer;
+    //底层当前是否已经停止读取
+    qboolean read_stopped;
+    //正在拆包并回调on_receive
+    qboolean dispatching;
+    //正在通知on_receive的数据包，被pt_server_detach_packet取走后为NULL
+    struct pt_buffer *receiving;
+    //正在拆开的批量包，暂停或者超过预算时剩余的子消息留到下次处理
+    //batch_offset为下一个子消息在batch->buff中的位置
+    struct pt_buffer *batch;
+    uint32_t batch_offset;
+    //未完成的工作量，由pt_server_work_begin/pt_server_work_end维护
+    uint32_t pending_work;
+    //自动暂停读取的连接链表
+    struct pt_sclient *throttle_prev;
+    struct pt_sclient *throttle_next;
+    //缓冲区中还有等待处理的数据包，在idle中轮流处理
+    qboolean in_ready;
+    struct pt_sclient *ready_prev;
+    struct pt_sclient *ready_next;
+    
+    //io_uring后端的连接信息，libuv后端为NULL
+    struct pt_uring_conn *uring;
+    
+    //共享内存连接，非共享内存模式为NULL
+    struct pt_shm *shm;
+    
+    //UDP可靠传输连接，非UDP模式为NULL
+    struct pt_rudp *rudp;
+    //UDP对端地址
+    struct sockaddr_storage udp_addr;
+    //最后收到的不可靠通道包序列，加密时拒绝重放的数据包
+    uint32_t unrel_serial;
+    qboolean unrel_received;
+    //UDP连接链表，定时器遍历使用
+    struct pt_sclient *udp_prev;
+    struct pt_sclient *udp_next;
+    
+    //热重启时socket正在发送给新进程，on_disconnect中为true
+    qboolean handing_off;
+    //从旧进程接收的连接，on_connect中为true
+    qboolean inherited;
+    
+    //用户数据
+    void *data;
 };
 
 typedef qboolean (*pt_server_on_connect)(struct pt_sclient *user);
 typedef void (*pt_server_on_receive)(struct pt_sclient *user, struct pt_buffer *buff);
 typedef void (*pt_server_on_disconnect)(struct pt_sclient *user);
+//组件注册的断开通知，在on_disconnect之后执行
+typedef void (*pt_server_disconnect_hook)(struct pt_sclient *user, void *udata);
+
+struct pt_server_hook
+{
+    struct pt_server_hook *next;
+    pt_server_disconnect_hook hook;
+    void *udata;
+};
+typedef void (*pt_server_on_drain)(struct pt_sclient *user);
+//热重启完成，status为0表示成功，否则为libuv的错误码
+typedef void (*pt_server_on_handoff)(struct pt_server *server, int status);
+typedef void (*pt_server_on_idle)(struct pt_sclient *user, int type);
 
 struct pt_server
 {
@@ -55,17 +214,68 @@ struct pt_server
     int number_of_max_connected;
     int number_of_connected;
     
-    //限制服务器每个用户的发送数据队列
+    //限制服务器每个用户的发送数据队列(字节)
     //防止服务器因为客户端拒绝接收数据导致内存耗尽
-    //默认1000
+    //默认PT_SERVER_MAX_SEND_QUEUE
     int number_of_max_send_queue;
     
+    //新连接使用的发送队列高低水位(字节)
+    uint32_t send_high_watermark;
+    uint32_t send_low_watermark;
+    
+    //单个连接和所有连接未完成工作量的预算，0为不限制
+    //超过预算时暂停读取，降到一半以下时恢复
+    uint32_t read_budget;
+    uint64_t global_read_budget;
+    //所有连接未完成的工作量
+    uint64_t pending_work;
+    //因为超过预算暂停读取的连接
+    struct pt_sclient *throttled;
+    
+    //限速规则，需要在pt_server_start之前添加
+    struct pt_rate_rule *rate_rules;
+    uint32_t number_of_rate_rules;
+    //因为限速暂停读取的连接
+    struct pt_sclient *rate_delayed;
+    uv_timer_t rate_timer;
+    qboolean rate_timer_init;
+    
+    //空闲超时和心跳间隔(毫秒)，0为不启用
+    uint32_t read_idle_timeout;
+    uint32_t write_idle_timeout;
+    uint32_t heartbeat_interval;
+    //所有连接的空闲定时器共用loop的时间轮
+    struct pt_timewheel *wheel;
+    
+    //每个连接每次最多处理的数据包数量和时间(微秒)，0为不限制
+    uint32_t dispatch_packets;
+    uint32_t dispatch_time;
+    
+    //幂等请求的响应缓存，命中时不执行on_receive
+    struct pt_respcache *respcache;
+    
+    //等待处理缓冲区数据的连接，在idle中轮流处理
+    struct pt_sclient *ready_head;
+    struct pt_sclient *ready_tail;
+    uint32_t ready_count;
+    uv_idle_t ready_idle;
+    qboolean ready_idle_init;
+    
     //服务器当前工作模式是否是pipe
     qboolean is_pipe;
     
+    //pipe监听的路径，关闭监听时删除，热重启交给新进程后为NULL
+    char *pipe_path;
+    
+    //pipe只用于握手，数据通过共享内存传输
+    qboolean is_shm;
+    
     //tcp nodelay
     qboolean no_delay;
     
+    //SO_BUSY_POLL的时间(微秒)，0为不设置
+    uint32_t busy_poll;
+    
     //keep alive延迟时间
     int keep_alive_delay;
     
@@ -76,6 +286,44 @@ struct pt_server
     
     qboolean is_startup;
     
+    //网络后端 PT_BACKEND_LIBUV 或 PT_BACKEND_URING
+    int backend;
+    
+    //io_uring后端使用的监听socket
+    struct pt_uring *uring;
+    struct pt_uring_req *accept_req;
+    int listen_fd;
+    qboolean is_closing;
+    
+    //UDP模式，listener为uv_udp_t
+    qboolean is_udp;
+    //UDP连接表，key为连接ID(conv)
+    struct pt_table *udp_sessions;
+    //正在工作的连接和等待释放的连接
+    struct pt_sclient *udp_active;
+    struct pt_sclient *udp_closed;
+    //驱动重传和心跳的定时器
+    uv_timer_t udp_timer;
+    //接收缓冲区
+    char *udp_buf;
+    
+    //热重启，旧进程连接新进程发送监听socket和连接，新进程监听并接收
+    int handoff_state;
+    uv_pipe_t handoff_pipe;
+    uv_pipe_t handoff_listener;
+    uv_connect_t handoff_connect;
+    uv_timer_t handoff_timer;
+    uint64_t handoff_deadline;
+    //已经发送但还未完成的连接
+    uint32_t handoff_writes;
+    //成功发送或者接收的连接数
+    uint32_t number_of_handoff;
+    //新进程收到的连接记录数，包括接收失败的连接，在确认中回复给旧进程
+    uint32_t handoff_records;
+    //新进程未处理完的记录
+    struct pt_buffer *handoff_buf;
+    pt_server_on_handoff on_handoff;
+    
     //服务器是否已经初始化
     qboolean is_init;
     /*
@@ -99,15 +347,47 @@ struct pt_server
         当用户断开连接时执行
      */
     pt_server_on_disconnect on_disconnect;
+    
+    /*
+        组件(例如pt_pubsub)注册的断开通知，按注册顺序执行
+     */
+    struct pt_server_hook *disconnect_hooks;
+    
+    /*
+        发送队列从高水位降到低水位以下时执行
+     */
+    pt_server_on_drain on_drain;
+    
+    /*
+        连接空闲超时，没有设置时读空闲断开连接，写空闲发送心跳包
+     */
+    pt_server_on_idle on_idle;
+    
+    //用户数据
+    void *data;
 };
 
 struct pt_server* pt_server_new();
 void pt_server_free(struct pt_server *srv);
 
 
+/*
+    注册一个断开通知，用于组件自动清理连接相关的数据，不占用on_disconnect
+    和on_disconnect一样只在连接被移除时执行
+ */
+void pt_server_add_disconnect_hook(struct pt_server *server, pt_server_disconnect_hook hook, void *udata);
+void pt_server_remove_disconnect_hook(struct pt_server *server, pt_server_disconnect_hook hook, void *udata);
+
+//选择网络后端，需要在pt_server_start之前调用
+//后端不可用时返回false
+qboolean pt_server_set_backend(struct pt_server *server, int backend);
+
 //禁用或者启用Nagle算法
 void pt_server_set_nodelay(struct pt_server *server, qboolean nodelay);
 
+//新的tcp连接设置SO_BUSY_POLL(微秒)，配合pt_spin_run使用
+void pt_server_set_busy_poll(struct pt_server *server, uint32_t usec);
+
 
 //初始化一个服务器对象
 //设置回调函数
@@ -123,10 +403,139 @@ void pt_server_set_encrypt(struct pt_server *server, const uint32_t encrypt_key[
 qboolean pt_server_start(struct pt_server *server, const char* host, uint16_t port);
 
 //启动服务器 监听文件描述符
+//path上遗留的socket文件没有进程监听时才删除，还在使用时返回false
 qboolean pt_server_start_pipe(struct pt_server *server, const char *path);
 
-//将数据追加到发送队列
+/*
+    热重启的旧进程，连接path上等待的新进程，发送监听socket和所有连接
+    先发送监听socket，新进程确认后关闭自己的监听，确认不正确或者超时时放弃热重启继续服务
+    然后停止读取所有连接，发送队列清空后连同加密状态和未处理的数据一起发送
+    最后新进程确认的连接数和发送的不同时on_handoff的status为UV_EPROTO
+    发送的连接执行on_disconnect时handing_off为true，超过PT_SERVER_HANDOFF_TIMEOUT的连接直接断开
+    完成后执行on_handoff，之后调用pt_server_close释放其他资源
+    只支持libuv后端的tcp和pipe模式
+ */
+qboolean pt_server_handoff(struct pt_server *server, const char *path, pt_server_on_handoff on_handoff);
+
+/*
+    热重启的新进程，代替pt_server_start和pt_server_start_pipe
+    在path上等待旧进程连接，收到监听socket后开始接受新连接，收到的连接执行on_connect时inherited为true
+    接收完所有连接后执行on_handoff
+ */
+qboolean pt_server_start_inherit(struct pt_server *server, const char *path, pt_server_on_handoff on_handoff);
+
+//启动服务器 监听文件描述符，同一台机器上的客户端通过共享内存传输数据
+//客户端需要使用pt_client_connect_shm连接
+qboolean pt_server_start_shm(struct pt_server *server, const char *path);
+
+//启动服务器 监听udp端口，客户端需要使用pt_client_connect_udp连接
+//数据使用可靠有序通道传输，和tcp模式的行为相同
+qboolean pt_server_start_udp(struct pt_server *server, const char* host, uint16_t port);
+
+/*
+    添加一条限速规则，id在[id_min, id_max]范围内的数据包每秒最多pps个包和bps字节
+    一个数据包匹配多条规则时全部检查，超过时使用最严格的policy
+    policy为PT_RATE_DROP/PT_RATE_DELAY/PT_RATE_DISCONNECT
+    需要在pt_server_start之前调用
+ */
+qboolean pt_server_add_rate_limit(struct pt_server *server, uint16_t id_min, uint16_t id_max,
+                                  uint32_t pps, uint32_t bps, int policy);
+
+/*
+    设置空闲超时和心跳，单位为毫秒，0为不启用，需要在pt_server_init之后，pt_server_start之前调用
+    read_idle: 超过这个时间没有收到任何数据时执行on_idle(PT_IDLE_READ)，默认断开连接
+    write_idle: 超过这个时间没有发送任何数据时执行on_idle(PT_IDLE_WRITE)，默认发送心跳包
+    heartbeat: 超过这个时间没有收到数据时发送一个空的ID_TRANSMIT_KEEPALIVE，客户端会回复
+    有数据收发时不会发送心跳包
+ */
+void pt_server_set_idle(struct pt_server *server, uint32_t read_idle, uint32_t write_idle, uint32_t heartbeat,
+                        pt_server_on_idle on_idle);
+
+/*
+    设置每个连接每次最多处理的数据包数量和时间(微秒)，0为不限制
+    超过后剩余的数据包在idle中和其他连接轮流处理，防止一个连接占用整个loop
+ */
+void pt_server_set_dispatch_budget(struct pt_server *server, uint32_t packets, uint32_t usec);
+
+/*
+    设置响应缓存，收到的数据包先在缓存中查找，命中时直接发送缓存的响应
+    on_receive中使用pt_respcache_send回复的请求才会被缓存，批量包中的子消息不查找
+ */
+void pt_server_set_respcache(struct pt_server *server, struct pt_respcache *cache);
+
+//设置新连接的发送队列高低水位和降到低水位时的回调
+void pt_server_set_watermark(struct pt_server *server, uint32_t low, uint32_t high, pt_server_on_drain on_drain);
+
+//单独设置一个连接的发送队列高低水位
+void pt_sclient_set_watermark(struct pt_sclient *user, uint32_t low, uint32_t high);
+
+//发送队列中还未写入的字节数，包括优先级队列
+size_t pt_server_send_queue_size(struct pt_sclient *user);
+
+//将数据追加到发送队列，发送队列超过number_of_max_send_queue时断开连接
+//使用PT_PRIORITY_REALTIME优先级
 qboolean pt_server_send(struct pt_sclient *user, struct pt_buffer *buff);
+
+/*
+    按优先级发送，底层发送队列较少时直接写入
+    否则按优先级排队，底层写入完成后先发送高优先级的数据包
+    大块数据只在高优先级队列为空时发送，但连续PT_SERVER_BULK_STARVE个高优先级包后会发送一个
+ */
+qboolean pt_server_send_priority(struct pt_sclient *user, struct pt_buffer *buff, int priority);
+
+/*
+    组一个id的数据包，net_header之后是head和owner中offset开始的length字节
+    libuv后端没有排队的数据时头部和数据分两段写入，数据不复制，否则组成完整的数据包后按pt_server_send发送
+    owner的所有权交给发送队列，连接已断开或者发送队列溢出时释放owner并返回false
+ */
+qboolean pt_server_send_wrapped(struct pt_sclient *user, uint16_t id, const void *head, uint32_t head_len,
+                                struct pt_buffer *owner, uint32_t offset, uint32_t length);
+
+/*
+    在on_receive中取走收到的数据包，之后由调用者释放
+    只有拆包得到的数据包可以取走，批量包拆开的子消息和UDP消息返回NULL
+ */
+struct pt_buffer *pt_server_detach_packet(struct pt_sclient *user, struct pt_buffer *buff);
+
+/*
+    发送队列低于高水位时追加数据并返回PT_SEND_OK，队列低于低水位时超过高水位的数据包也会接受
+    否则返回PT_SEND_FULL，降到低水位以下时执行on_drain
+    连接已经断开返回PT_SEND_CLOSED
+    只有返回PT_SEND_OK时buff被接管，其他情况由调用者处理
+ */
+int pt_server_try_send(struct pt_sclient *user, struct pt_buffer *buff);
+
+//发送队列是否低于高水位
+qboolean pt_server_is_writable(struct pt_sclient *user);
+
+/*
+    暂停和恢复读取一个连接的数据
+    暂停后缓冲区中剩余的数据包不再回调on_receive，恢复后在下一轮loop中继续处理
+    TCP连接停止读取后由接收窗口限制对端发送
+ */
+void pt_server_pause_read(struct pt_sclient *user);
+void pt_server_resume_read(struct pt_sclient *user);
+
+/*
+    设置自动暂停读取的预算，单位由应用层定义(请求数或者字节数)
+    per_conn为单个连接的预算，global为所有连接的预算，0为不限制
+ */
+void pt_server_set_read_budget(struct pt_server *server, uint32_t per_conn, uint64_t global);
+
+//应用层开始处理一个连接的请求，超过预算时暂停这个连接的读取
+void pt_server_work_begin(struct pt_sclient *user, uint32_t cost);
+
+/*
+    请求处理完成，降到预算的一半以下时恢复读取
+    使用用户ID查找连接，连接已经断开时返回false
+    断开连接时未完成的工作量已经从全局计数中删除
+ */
+qboolean pt_server_work_end(struct pt_server *server, uint64_t user_id, uint32_t cost);
+
+//通过不可靠有序通道发送，丢失不重传，迟到的包被丢弃
+//和pt_server_send一样不加密，超过PT_RUDP_MSS的数据包不发送并返回false
+//非UDP模式等同于pt_server_send
+qboolean pt_server_send_unreliable(struct pt_sclient *user, struct pt_buffer *buff);
 //服务器请求断开一个用户的连接
 qboolean pt_server_disconnect_conn(struct pt_sclient *user);
 
@@ -0,0 +1,141 @@
+//
+//  shm.h
+//  xcode
+//
+//  同一台机器上的进程间共享内存传输
+//  每个连接一块memfd共享内存，包含两个方向的单生产者单消费者环形缓冲区
+//  通知使用eventfd，对端正在处理数据时不会产生通知
+//
+
+#ifndef _PT_SHM_INCLUED_H_
+#define _PT_SHM_INCLUED_H_
+
+#include <stdatomic.h>
+
+#include "buffer.h"
+
+#define PT_SHM_MAGIC 0x4D485350
+
+//每个方向的环形缓冲区大小，必须是2的次方
+#define PT_SHM_RING_SIZE 0x100000
+
+//每次被唤醒后最多处理的字节数，防止一个连接占用整个loop
+#define PT_SHM_READ_BUDGET 0x40000
+
+struct pt_shm;
+
+//收到数据时回调，length == 0 表示对端断开
+typedef void (*pt_shm_data_cb)(struct pt_shm *shm, const unsigned char *data, uint32_t length);
+//所有句柄关闭后回调，可以在这里释放资源
+typedef void (*pt_shm_close_cb)(struct pt_shm *shm);
+//握手完成后回调，status != 0 表示失败
+typedef void (*pt_shm_ready_cb)(struct pt_shm *shm, int status);
+//等待中的数据写入了环形缓冲区
+typedef void (*pt_shm_sent_cb)(struct pt_shm *shm, uint32_t length);
+
+/*
+    单生产者单消费者环形缓冲区，位于共享内存中
+    head和tail是一直增长的计数，使用时和size - 1取与
+ */
+struct pt_shm_ring
+{
+    //生产者写入位置
+    _Alignas(64) _Atomic uint32_t head;
+    //消费者读取位置
+    _Alignas(64) _Atomic uint32_t tail;
+
+    //消费者已经处理完所有数据，准备进入等待，生产者写入后需要通知
+    _Alignas(64) _Atomic uint32_t consumer_waiting;
+    //生产者因为空间不足而等待，消费者读取后需要通知
+    _Atomic uint32_t producer_waiting;
+
+    uint32_t size;
+
+    _Alignas(64) unsigned char data[];
+};
+
+/*
+    共享内存头部，后面跟着两个环形缓冲区
+    rings[0] 客户端 -> 服务器
+    rings[1] 服务器 -> 客户端
+ */
+struct pt_shm_segment
+{
+    uint32_t magic;
+    uint32_t ring_size;
+    uint32_t ring_offset[2];
+};
+
+/*
+    一个共享内存连接的本地状态
+ */
+struct pt_shm
+{
+    uv_loop_t *loop;
+    void *data;
+
+    struct pt_shm_segment *segment;
+    size_t map_size;
+    //共享内存可以被对端修改，本地保存一份缓冲区大小
+    uint32_t ring_size;
+
+    //本端写入的缓冲区和读取的缓冲区
+    struct pt_shm_ring *tx;
+    struct pt_shm_ring *rx;
+
+    //本端等待通知的eventfd和对端的eventfd
+    int notify_fd;
+    int peer_fd;
+    //unix socket，用于握手和检测对端断开
+    int sock_fd;
+
+    uv_poll_t notify_poll;
+    uv_poll_t sock_poll;
+
+    //环形缓冲区空间不足时等待写入的数据
+    struct pt_wreq *pending_head;
+    struct pt_wreq *pending_tail;
+    uint32_t pending_size;
+
+    qboolean is_server;
+    qboolean ready;
+    qboolean closing;
+    //暂停读取，数据留在接收缓冲区中，写满后对端等待
+    qboolean read_paused;
+    int closing_handles;
+
+    pt_shm_data_cb on_data;
+    pt_shm_close_cb on_close;
+    pt_shm_ready_cb on_ready;
+    //可选，对端读取后等待中的数据继续写入时回调
+    pt_shm_sent_cb on_sent;
+};
+
+/*
+    客户端：创建共享内存和eventfd，通过sock_fd发送给服务器
+    sock_fd的所有权交给shm
+ */
+struct pt_shm *pt_shm_connect(uv_loop_t *loop, int sock_fd, void *data,
+                              pt_shm_data_cb on_data, pt_shm_close_cb on_close);
+
+/*
+    服务器：等待客户端通过sock_fd发送共享内存，完成后执行on_ready
+    sock_fd的所有权交给shm
+ */
+struct pt_shm *pt_shm_accept(uv_loop_t *loop, int sock_fd, void *data, pt_shm_ready_cb on_ready,
+                             pt_shm_data_cb on_data, pt_shm_close_cb on_close);
+
+//将写请求追加到发送缓冲区，wreq的所有权交给shm
+void pt_shm_write(struct pt_shm *shm, struct pt_wreq *wreq);
+
+//暂停和恢复读取接收缓冲区
+void pt_shm_read_stop(struct pt_shm *shm);
+void pt_shm_read_start(struct pt_shm *shm);
+
+//关闭共享内存连接，所有句柄关闭后执行on_close
+void pt_shm_close(struct pt_shm *shm);
+
+//释放pt_shm结构，需要在on_close中或之后调用
+void pt_shm_free(struct pt_shm *shm);
+
+#endif
@@ -0,0 +1,58 @@
+//
+//  spin.h
+//  xcode
+//
+//  独占CPU核心的低延迟事件循环
+//  用UV_RUN_NOWAIT反复轮询，有事件时不进入epoll_wait的睡眠，省去唤醒线程的延迟
+//  连续空闲超过idle_time后退回一次阻塞的UV_RUN_ONCE，没有流量时不占满CPU
+//  需要libuv 1.45以上(uv_metrics_info)，更低的版本直接使用UV_RUN_DEFAULT
+//
+
+#ifndef _PT_SPIN_INCLUED_H_
+#define _PT_SPIN_INCLUED_H_
+
+#include "common.h"
+
+//默认的空闲轮询时间(微秒)，超过后阻塞等待下一个事件
+#define PT_SPIN_IDLE_TIME 2000
+
+//默认的SO_BUSY_POLL时间(微秒)
+#define PT_SPIN_BUSY_POLL 50
+
+struct pt_spin
+{
+    uv_loop_t *loop;
+
+    //空闲轮询的时间(微秒)，0表示一直轮询不阻塞
+    uint32_t idle_time;
+
+    qboolean stopped;
+
+    //轮询次数，处理到事件的次数，退回阻塞的次数
+    uint64_t number_of_polls;
+    uint64_t number_of_active;
+    uint64_t number_of_blocks;
+};
+
+struct pt_spin *pt_spin_new(uv_loop_t *loop);
+void pt_spin_free(struct pt_spin *spin);
+
+//设置空闲轮询的时间(微秒)
+void pt_spin_set_idle_time(struct pt_spin *spin, uint32_t idle_time);
+
+/*
+    代替uv_run(loop, UV_RUN_DEFAULT)
+    循环中没有活动的句柄或者调用pt_spin_stop后返回，返回值同uv_run
+ */
+int pt_spin_run(struct pt_spin *spin);
+
+//在事件循环的回调中调用，当前这次轮询结束后pt_spin_run返回
+void pt_spin_stop(struct pt_spin *spin);
+
+//把调用的线程绑定到cpu核心上，在运行事件循环的线程中调用，不支持时返回false
+qboolean pt_spin_pin_cpu(int cpu);
+
+//设置socket的SO_BUSY_POLL(微秒)，读取时在驱动中轮询网卡队列，不支持时返回false
+qboolean pt_spin_busy_poll(int fd, uint32_t usec);
+
+#endif
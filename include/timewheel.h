@@ -0,0 +1,82 @@
+//
+//  timewheel.h
+//  xcode
+//
+//  分层时间轮
+//  每个loop一个时间轮，所有连接的空闲超时和心跳共用一个uv_timer_t
+//  添加和删除都是O(1)，第一层每个槽为一个tick，之后每层的槽覆盖上一层的整圈
+//
+
+#ifndef _PT_TIMEWHEEL_INCLUED_H_
+#define _PT_TIMEWHEEL_INCLUED_H_
+
+#include "common.h"
+
+//每个tick的毫秒数
+#define PT_TIMEWHEEL_TICK 100
+
+//第一层256个槽，其余三层每层64个槽，最长约77天
+#define PT_TIMEWHEEL_ROOT_BITS 8
+#define PT_TIMEWHEEL_LEVEL_BITS 6
+#define PT_TIMEWHEEL_LEVELS 3
+#define PT_TIMEWHEEL_ROOT_SIZE (1 << PT_TIMEWHEEL_ROOT_BITS)
+#define PT_TIMEWHEEL_LEVEL_SIZE (1 << PT_TIMEWHEEL_LEVEL_BITS)
+
+struct pt_timewheel;
+struct pt_timewheel_node;
+
+typedef void (*pt_timewheel_cb)(struct pt_timewheel_node *node);
+
+/*
+    时间轮上的一个定时器，一般嵌入到连接结构中
+    同一个槽中的节点组成双向循环链表，槽本身是链表头
+ */
+struct pt_timewheel_node
+{
+    struct pt_timewheel_node *prev;
+    struct pt_timewheel_node *next;
+
+    //到期的tick
+    uint64_t expire;
+
+    pt_timewheel_cb cb;
+    void *data;
+};
+
+struct pt_timewheel
+{
+    uv_loop_t *loop;
+    uv_timer_t timer;
+
+    //当前的tick和对应的时间(毫秒)
+    uint64_t current;
+    uint64_t last;
+
+    struct pt_timewheel_node root[PT_TIMEWHEEL_ROOT_SIZE];
+    struct pt_timewheel_node levels[PT_TIMEWHEEL_LEVELS][PT_TIMEWHEEL_LEVEL_SIZE];
+
+    //时间轮上的节点数量，为0时停止uv_timer
+    uint32_t count;
+
+    uint32_t ref;
+    struct pt_timewheel *next;
+};
+
+//获取loop对应的时间轮，不存在则创建
+struct pt_timewheel *pt_timewheel_get(uv_loop_t *loop);
+
+//释放引用，最后一个引用释放时关闭定时器，时间轮上不能再有节点
+void pt_timewheel_release(struct pt_timewheel *wheel);
+
+void pt_timewheel_node_init(struct pt_timewheel_node *node, pt_timewheel_cb cb, void *data);
+
+//timeout毫秒后执行回调，已经在时间轮上的节点会先删除，精度为一个tick
+void pt_timewheel_add(struct pt_timewheel *wheel, struct pt_timewheel_node *node, uint64_t timeout);
+
+//从时间轮上删除，不在时间轮上时不做任何事
+void pt_timewheel_remove(struct pt_timewheel *wheel, struct pt_timewheel_node *node);
+
+//节点是否在时间轮上
+qboolean pt_timewheel_active(struct pt_timewheel_node *node);
+
+#endif
@@ -0,0 +1,143 @@
+//
+//  uring.h
+//  xcode
+//
+//  Linux io_uring网络后端
+//  编译时需要定义PT_HAVE_URING并链接liburing(>=2.4)
+//
+
+#ifndef _PT_URING_INCLUED_H_
+#define _PT_URING_INCLUED_H_
+
+#ifdef PT_HAVE_URING
+
+#include <liburing.h>
+#include <sys/socket.h>
+
+#include "buffer.h"
+
+//提交队列的深度
+#define PT_URING_ENTRIES 4096
+
+//提供给内核选择的接收缓冲区数量和大小，数量必须是2的次方
+#define PT_URING_BUF_COUNT 1024
+#define PT_URING_BUF_SIZE 8192
+#define PT_URING_BGID 1
+
+//一次sendmsg最多合并的数据块
+#define PT_URING_MAX_IOV 64
+
+struct pt_uring_req;
+struct pt_uring_conn;
+
+//完成事件回调，res和flags为cqe中的值
+typedef void (*pt_uring_cb)(struct pt_uring_req *req, int res, uint32_t flags);
+
+//收到数据时回调，length <= 0 表示连接断开或者出错
+typedef void (*pt_uring_data_cb)(struct pt_uring_conn *conn, const unsigned char *data, int length);
+//连接的所有请求都已完成并关闭fd后回调，可以在这里释放资源
+typedef void (*pt_uring_close_cb)(struct pt_uring_conn *conn);
+//一批数据发送完成后回调，length为成功写入的字节数
+typedef void (*pt_uring_sent_cb)(struct pt_uring_conn *conn, uint32_t length);
+
+/*
+    提交给io_uring的请求，cqe的user_data指向本结构
+ */
+struct pt_uring_req
+{
+    pt_uring_cb cb;
+    void *data;
+};
+
+/*
+    每个loop一个ring，同一个loop上的server和client共用
+ */
+struct pt_uring
+{
+    struct io_uring ring;
+    uv_loop_t *loop;
+
+    //ring_fd可读表示有完成事件
+    uv_poll_t poll;
+    //每轮loop进入poll之前统一提交本轮产生的sqe
+    uv_prepare_t prepare;
+
+    //内核选择的接收缓冲区
+    struct io_uring_buf_ring *buf_ring;
+    unsigned char *buf_base;
+
+    //尚未提交的sqe数量
+    uint32_t pending;
+
+    uint32_t ref;
+    struct pt_uring *next;
+};
+
+/*
+    一个socket连接的io_uring状态
+ */
+struct pt_uring_conn
+{
+    struct pt_uring *ring;
+    int fd;
+    void *data;
+
+    struct pt_uring_req recv_req;
+    struct pt_uring_req send_req;
+
+    //等待发送的队列
+    struct pt_wreq *send_head;
+    struct pt_wreq *send_tail;
+    //正在发送中的请求，最多PT_URING_MAX_IOV个
+    struct pt_wreq *sending;
+    uint32_t sending_count;
+    //队列中未写入socket的字节数
+    uint32_t queue_size;
+
+    struct msghdr msg;
+    struct iovec iov[PT_URING_MAX_IOV];
+    struct sockaddr_storage addr;
+
+    //还没有收到最终cqe的请求数量
+    int inflight;
+    qboolean recving;
+    qboolean closing;
+    //暂停接收，multishot结束后不再投递
+    qboolean read_paused;
+
+    pt_uring_data_cb on_data;
+    pt_uring_close_cb on_close;
+    pt_uring_sent_cb on_sent;
+};
+
+//获取loop对应的ring，不存在则创建，失败返回NULL
+struct pt_uring *pt_uring_get(uv_loop_t *loop);
+void pt_uring_release(struct pt_uring *ring);
+
+//投递请求，sqe会在本轮loop结束前批量提交
+qboolean pt_uring_accept(struct pt_uring *ring, struct pt_uring_req *req, int fd);
+qboolean pt_uring_cancel(struct pt_uring *ring, struct pt_uring_req *req);
+
+//创建一个连接对象，fd的所有权交给conn
+struct pt_uring_conn *pt_uring_conn_new(struct pt_uring *ring, int fd, void *data);
+void pt_uring_conn_free(struct pt_uring_conn *conn);
+
+//开始多次接收数据(multishot recv)
+qboolean pt_uring_conn_start(struct pt_uring_conn *conn, pt_uring_data_cb on_data, pt_uring_close_cb on_close);
+
+//暂停和恢复接收，暂停时已经在完成队列中的数据仍然会回调
+void pt_uring_conn_read_stop(struct pt_uring_conn *conn);
+void pt_uring_conn_read_start(struct pt_uring_conn *conn);
+
+//异步连接，完成后执行cb
+qboolean pt_uring_conn_connect(struct pt_uring_conn *conn, const struct sockaddr *addr, socklen_t length, pt_uring_cb cb);
+
+//将写请求加入发送队列，wreq的所有权交给conn
+void pt_uring_conn_write(struct pt_uring_conn *conn, struct pt_wreq *wreq);
+
+//取消所有请求并关闭fd，完成后执行on_close
+void pt_uring_conn_close(struct pt_uring_conn *conn);
+
+#endif
+
+#endif
@@ -8,71 +8,98 @@
 
 
 #include <iostream>
+#include <algorithm>
 #include "cpp.hpp"
-#include "branch.hpp"
-#include "forward.hpp"
-#include "remotes.hpp"
 
 
 
 static uint32_t encrypt_key[4] = {0x42970C86,0xA0B3A057,0x51B97B3C,0x70F8891E};
 
+/*
+ 本机tcp回环的ping-pong延迟测试
+ agent           普通的UV_RUN_DEFAULT
+ agent spin [cpu] 绑定cpu核心，使用pt_spin_run轮询，连接设置SO_BUSY_POLL
+ */
+#define PING_PORT 19850
+#define PING_WARMUP 1000
+#define PING_COUNT 100000
+
+static const uint16_t ID_PING = ID_USER_PACKET_ENUM;
+
 struct pt_server *server;
 struct pt_client *client;
+struct pt_spin *spin;
 
-void pt_srv_send(struct pt_sclient *user)
-{
-    char helloworld[32] = "helloworld";
-    
-    struct pt_buffer *buff;
-    struct net_header hdr = pt_create_nethdr(ID_TRANSMIT_KEEPALIVE);
-    
-    buff = pt_create_package(hdr, (unsigned char*)&helloworld, sizeof(helloworld));
-    
+//每次往返的时间(纳秒)，不包括预热
+static std::vector<uint64_t> samples;
+static uint32_t number_of_pings;
 
-    pt_server_send(user, buff);
+static void pt_print_histogram()
+{
+    uint64_t buckets[64] = {0};
+    uint64_t max_bucket = 0;
+    size_t count = samples.size();
+    
+    std::sort(samples.begin(), samples.end());
+    
+    printf("%s mode, %zu round trips\n", spin ? "spin" : "default", count);
+    printf("min %.2fus p50 %.2fus p90 %.2fus p99 %.2fus p99.9 %.2fus max %.2fus\n",
+           samples[0] / 1000.0,
+           samples[count / 2] / 1000.0,
+           samples[count * 90 / 100] / 1000.0,
+           samples[count * 99 / 100] / 1000.0,
+           samples[count * 999 / 1000] / 1000.0,
+           samples[count - 1] / 1000.0);
+    
+    //按2的幂分桶，每一行为[low, high)纳秒
+    for(uint64_t rtt : samples){
+        int i = 0;
+        while((rtt >> (i + 1)) && i < 63) i++;
+        buckets[i]++;
+    }
+    
+    for(int i = 0; i < 64; i++){
+        if(buckets[i] > max_bucket) max_bucket = buckets[i];
+    }
+    
+    for(int i = 0; i < 64; i++){
+        if(buckets[i] == 0) continue;
+        
+        int width = (int)(buckets[i] * 50 / max_bucket);
+        printf("%9.2fus - %9.2fus %8llu |%s\n", (1ull << i) / 1000.0, (2ull << i) / 1000.0,
+               (unsigned long long)buckets[i], std::string(width, '#').c_str());
+    }
+    
+    if(spin){
+        printf("polls %llu active %llu blocks %llu\n", (unsigned long long)spin->number_of_polls,
+               (unsigned long long)spin->number_of_active, (unsigned long long)spin->number_of_blocks);
+    }
 }
 
 qboolean pt_srv_connect(struct pt_sclient *user)
 {
-    printf("server connected\n");
-    
     return true;
 }
 
 void pt_srv_receive(struct pt_sclient *user, struct pt_buffer *buff)
 {
-    buffer_reader reader;
-    struct net_header hdr;
-    
-    buffer_reader_init(&reader, buff);
-    buffer_reader_read(&reader, (unsigned char*)&hdr, sizeof(hdr));
-    buffer_reader_ignore_bytes(&reader, 4);
-    
-    char *s = (char*)buffer_reader_cur_pos(&reader);
+    //原样返回客户端的时间戳，跳过包序列
+    struct net_header hdr = pt_create_nethdr(ID_PING);
+    unsigned char *data = pt_get_packet_buffer(buff) + sizeof(uint32_t);
+    uint32_t length = pt_get_packet_size(buff) - sizeof(uint32_t);
     
-    printf("%s\n",s);
-    
-    //printf("pt_srv_receive => %d\n",user->serial);
-    
-    pt_srv_send(user);
+    pt_server_send(user, pt_create_package(hdr, data, length));
 }
 
 void pt_srv_disconnect(struct pt_sclient *user)
 {
-    printf("server disconnected\n");
 }
 
 void pt_cli_sent(struct pt_client *client)
 {
-    char helloworld[32] = "helloworld";
-    
-    struct pt_buffer *buff;
-    struct net_header hdr = pt_create_nethdr(ID_TRANSMIT_KEEPALIVE);
+    uint64_t now = uv_hrtime();
     
-    buff = pt_create_encrypt_package(&client->encrypt_ctx, &client->serial, hdr, (unsigned char*)&helloworld, sizeof(helloworld));
-    
-    pt_client_send(client, buff);
+    pt_client_send_data(client, ID_PING, (unsigned char*)&now, sizeof(now));
 }
 
 void pt_cli_connect(struct pt_client *client)
@@ -83,9 +110,29 @@ void pt_cli_connect(struct pt_client *client)
 
 void pt_cli_receive(struct pt_client *client, struct pt_buffer *buff)
 {
-//    char *s = (char*)pt_get_packet_buffer(buff);
-//    printf("%s\n",s);
-    pt_cli_sent(client);
+    uint64_t sent;
+    
+    memcpy(&sent, pt_get_packet_buffer(buff), sizeof(sent));
+    
+    if(++number_of_pings > PING_WARMUP){
+        samples.push_back(uv_hrtime() - sent);
+    }
+    
+    if(samples.size() < PING_COUNT){
+        pt_cli_sent(client);
+        return;
+    }
+    
+    pt_print_histogram();
+    
+    pt_client_disconnect(client);
+    pt_server_close(server);
+    
+    if(spin){
+        pt_spin_stop(spin);
+    } else {
+        uv_stop(client->loop);
+    }
 }
 
 void pt_cli_disconnect(struct pt_client *client)
@@ -98,22 +145,33 @@ int main(int argc, const char * argv[]) {
     
     server = pt_server_new();
     client = pt_client_new();
+    samples.reserve(PING_COUNT);
     
     
     pt_server_init(server, loop, 10000, 30, pt_srv_connect, pt_srv_receive, pt_srv_disconnect);
     pt_server_set_encrypt(server, encrypt_key);
-    pt_server_start_pipe(server, "/var/tmp/agent.sock");
-    
+    pt_server_set_nodelay(server, true);
     
     pt_client_init(loop, client, pt_cli_connect, pt_cli_receive, pt_cli_disconnect);
     pt_client_set_encrypt(client,encrypt_key);
-    pt_client_connect_pipe(client, "/var/tmp/agent.sock");
-    
-    uv_run(loop, UV_RUN_DEFAULT);
-    
-    printf("hello world\n");
-    
     
+    if(argc > 1 && strcmp(argv[1], "spin") == 0){
+        pt_spin_pin_cpu(argc > 2 ? atoi(argv[2]) : 0);
+        
+        spin = pt_spin_new(loop);
+        pt_server_set_busy_poll(server, PT_SPIN_BUSY_POLL);
+        pt_client_set_busy_poll(client, PT_SPIN_BUSY_POLL);
+    }
+    
+    pt_server_start(server, "127.0.0.1", PING_PORT);
+    pt_client_connect(client, "127.0.0.1", PING_PORT);
+    
+    if(spin){
+        pt_spin_run(spin);
+        pt_spin_free(spin);
+    } else {
+        uv_run(loop, UV_RUN_DEFAULT);
+    }
     
     return 0;
 }
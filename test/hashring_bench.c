@@ -0,0 +1,140 @@
+//
+//  hashring_bench.c
+//  test
+//
+//  一致性哈希环的查找速度和分配质量
+//  连续的key(和pt_sclient的id一样)分配到shards个分片，统计每个分片的key数量
+//  再加入一个分片、移除一个分片，统计改变分配的key的比例，理想值为1/(shards+1)和1/shards
+//  改变分配的key只能移到新加入的分片或者从移除的分片移出，否则计为错误
+//
+//  gcc -std=gnu11 -O2 -Iinclude test/hashring_bench.c common/*.c -luv -lcrypto -lpthread -o hashring_bench
+//  ./hashring_bench [分片数] [每个分片的虚拟节点数]
+//
+
+#include "common.h"
+#include "hashring.h"
+
+#define KEY_COUNT 1000000
+#define LOOKUP_COUNT 10000000
+#define MAX_SHARDS 1024
+
+static uint32_t number_of_shards = 16;
+static uint32_t vnodes = PT_HASHRING_VNODES;
+
+//环上节点的值，分片编号为和shards的距离
+static int shards[MAX_SHARDS + 1];
+static uint32_t load[MAX_SHARDS + 1];
+static uint16_t *owner;
+
+static uint32_t shard_of(struct pt_hashring *ring, uint64_t key)
+{
+    return (uint32_t)((int*)pt_hashring_lookup(ring, key) - shards);
+}
+
+static void print_balance(struct pt_hashring *ring, uint32_t count)
+{
+    uint32_t min_load = UINT32_MAX;
+    uint32_t max_load = 0;
+    double mean = (double)KEY_COUNT / count;
+    uint32_t i;
+
+    bzero(load, sizeof(load));
+
+    for(i = 0; i < KEY_COUNT; i++)
+    {
+        owner[i] = (uint16_t)shard_of(ring, i);
+        load[owner[i]]++;
+    }
+
+    for(i = 0; i < MAX_SHARDS + 1; i++)
+    {
+        if(load[i] == 0) continue;
+        if(load[i] < min_load) min_load = load[i];
+        if(load[i] > max_load) max_load = load[i];
+    }
+
+    printf("balance      %u shards  mean %.0f  max/mean %.3f  min/mean %.3f\n",
+           count, mean, max_load / mean, min_load / mean);
+}
+
+/*
+ 和owner比较，统计改变分配的key，changed为加入或者移除的分片
+ */
+static qboolean print_remap(struct pt_hashring *ring, const char *name, uint32_t changed, double ideal)
+{
+    uint32_t moved = 0;
+    uint32_t wrong = 0;
+    uint32_t shard;
+    uint32_t i;
+
+    for(i = 0; i < KEY_COUNT; i++)
+    {
+        shard = shard_of(ring, i);
+
+        if(shard == owner[i]) continue;
+
+        moved++;
+        if(shard != changed && owner[i] != changed) wrong++;
+    }
+
+    printf("%-12s remapped %.4f  ideal %.4f  wrong %u\n", name, (double)moved / KEY_COUNT, ideal, wrong);
+
+    return wrong == 0;
+}
+
+int main(int argc, const char * argv[])
+{
+    struct pt_hashring *ring;
+    uint64_t start;
+    uint64_t elapsed;
+    uintptr_t sum = 0;
+    qboolean passed = true;
+    uint32_t i;
+
+    if(argc > 1) number_of_shards = atoi(argv[1]);
+    if(argc > 2) vnodes = atoi(argv[2]);
+
+    if(number_of_shards < 2 || number_of_shards >= MAX_SHARDS){
+        printf("shards must be in [2, %u)\n", MAX_SHARDS);
+        return 1;
+    }
+
+    owner = malloc(sizeof(uint16_t) * KEY_COUNT);
+    ring = pt_hashring_new(vnodes);
+
+    for(i = 0; i < number_of_shards; i++)
+    {
+        pt_hashring_add(ring, pt_hashring_mix(i), &shards[i], 1);
+    }
+
+    printf("%u shards, %u vnodes per shard, %u keys\n", number_of_shards, ring->vnodes, KEY_COUNT);
+
+    start = uv_hrtime();
+    for(i = 0; i < LOOKUP_COUNT; i++)
+    {
+        sum += (uintptr_t)pt_hashring_lookup(ring, i);
+    }
+    elapsed = uv_hrtime() - start;
+
+    printf("lookup       %.2f Mlookups/s  %.1f ns/lookup\n",
+           LOOKUP_COUNT / (elapsed / 1e9) / 1e6, (double)elapsed / LOOKUP_COUNT);
+
+    print_balance(ring, number_of_shards);
+
+    //加入一个分片
+    pt_hashring_add(ring, pt_hashring_mix(number_of_shards), &shards[number_of_shards], 1);
+    if(print_remap(ring, "add shard", number_of_shards, 1.0 / (number_of_shards + 1)) == false) passed = false;
+    pt_hashring_remove(ring, &shards[number_of_shards]);
+
+    //移除一个分片
+    pt_hashring_remove(ring, &shards[0]);
+    if(print_remap(ring, "remove shard", 0, 1.0 / number_of_shards) == false) passed = false;
+
+    pt_hashring_free(ring);
+    free(owner);
+
+    //避免查找循环被优化掉
+    if(sum == 0) printf("\n");
+
+    return passed ? 0 : 1;
+}
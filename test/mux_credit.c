@@ -0,0 +1,182 @@
+//
+//  mux_credit.c
+//  test
+//
+//  多路复用的窗口归还
+//  一个会话先发送30000字节再发送40000字节，第二次发送超过剩余的窗口需要排队
+//  接收端处理的30000字节不到半个窗口，没有BLOCKED帧时不会归还，第二次发送的数据永远不会到达
+//  分别测试自动归还和接收端在定时器中延迟归还两种情况
+//
+//  gcc -std=gnu11 -Iinclude test/mux_credit.c common/*.c -luv -lcrypto -lpthread -o mux_credit
+//  ./mux_credit
+//
+
+#include "common.h"
+#include "error.h"
+#include "server.h"
+#include "client.h"
+#include "mux.h"
+
+#define SERVER_PORT 47311
+
+#define FIRST_SIZE 30000
+#define SECOND_SIZE 40000
+//超过这个时间(毫秒)还没有收到全部数据认为失败
+#define TIMEOUT 3000
+#define CONSUME_INTERVAL 10
+
+static uv_loop_t *loop;
+static struct pt_server *server;
+static struct pt_client *client;
+static struct pt_mux *server_mux;
+static struct pt_mux *client_mux;
+static uv_timer_t timer;
+
+static qboolean auto_credit;
+static uint32_t received;
+static uint32_t unconsumed;
+static uint32_t number_of_messages;
+static uint64_t start_time;
+static qboolean invalid;
+
+static void srv_on_open(struct pt_mux_session *session)
+{
+}
+
+static void srv_on_data(struct pt_mux_session *session, const unsigned char *data, uint32_t length)
+{
+    uint32_t i;
+
+    for(i = 0; i < length; i++){
+        if(data[i] != (unsigned char)(number_of_messages + 1)) invalid = true;
+    }
+
+    received += length;
+    number_of_messages++;
+
+    if(auto_credit == false) unconsumed += length;
+}
+
+static qboolean srv_connect(struct pt_sclient *user)
+{
+    server_mux = pt_mux_new_server(user, srv_on_open, srv_on_data, NULL);
+    server_mux->auto_credit = auto_credit;
+    return true;
+}
+
+static void srv_receive(struct pt_sclient *user, struct pt_buffer *buff)
+{
+    if(pt_mux_receive(server_mux, buff) != PT_MUX_RECV_OK) invalid = true;
+}
+
+static void srv_disconnect(struct pt_sclient *user)
+{
+    pt_mux_free(server_mux);
+    server_mux = NULL;
+}
+
+static void cli_connect(struct pt_client *c)
+{
+    struct pt_mux_session *session;
+    unsigned char *data;
+
+    if(c->connected == false){
+        printf("connect failed\n");
+        exit(1);
+    }
+
+    client_mux = pt_mux_new_client(c, NULL, NULL, NULL);
+    session = pt_mux_open(client_mux, NULL);
+
+    data = malloc(SECOND_SIZE);
+
+    memset(data, 1, FIRST_SIZE);
+    if(pt_mux_send(session, data, FIRST_SIZE) == false) invalid = true;
+
+    memset(data, 2, SECOND_SIZE);
+    if(pt_mux_send(session, data, SECOND_SIZE) == false) invalid = true;
+
+    free(data);
+}
+
+static void cli_receive(struct pt_client *c, struct pt_buffer *buff)
+{
+    if(pt_mux_receive(client_mux, buff) != PT_MUX_RECV_OK) invalid = true;
+}
+
+static void cli_disconnect(struct pt_client *c)
+{
+    if(client_mux) pt_mux_free(client_mux);
+    client_mux = NULL;
+}
+
+static void timer_cb(uv_timer_t *handle)
+{
+    struct pt_mux_session *session;
+
+    //接收端延迟处理数据
+    if(server_mux && unconsumed){
+        for(session = server_mux->head; session; session = session->next){
+            pt_mux_consume(session, unconsumed);
+        }
+        unconsumed = 0;
+    }
+
+    if(received < FIRST_SIZE + SECOND_SIZE && uv_now(loop) - start_time < TIMEOUT) return;
+
+    uv_close((uv_handle_t*)handle, NULL);
+    pt_client_disconnect(client);
+    pt_server_close(server);
+}
+
+static qboolean run(qboolean credit)
+{
+    qboolean passed;
+
+    auto_credit = credit;
+    received = 0;
+    unconsumed = 0;
+    number_of_messages = 0;
+    invalid = false;
+
+    server = pt_server_new();
+    client = pt_client_new();
+
+    pt_server_init(server, loop, 16, 30, srv_connect, srv_receive, srv_disconnect);
+    if(pt_server_start(server, "127.0.0.1", SERVER_PORT) == false){
+        printf("server start failed\n");
+        exit(1);
+    }
+
+    pt_client_init(loop, client, cli_connect, cli_receive, cli_disconnect);
+    pt_client_connect(client, "127.0.0.1", SERVER_PORT);
+
+    start_time = uv_now(loop);
+    uv_timer_init(loop, &timer);
+    uv_timer_start(&timer, timer_cb, CONSUME_INTERVAL, CONSUME_INTERVAL);
+
+    uv_run(loop, UV_RUN_DEFAULT);
+
+    pt_server_free(server);
+    pt_client_free(client);
+
+    passed = received == FIRST_SIZE + SECOND_SIZE && number_of_messages == 2 && invalid == false;
+
+    printf("%-14s received %u/%u messages %u  %s\n", credit ? "auto credit" : "manual credit",
+           received, FIRST_SIZE + SECOND_SIZE, number_of_messages, passed ? "ok" : "FAILED");
+
+    return passed;
+}
+
+int main(int argc, const char * argv[])
+{
+    qboolean passed = true;
+
+    loop = uv_default_loop();
+    set_log_filter(NULL);
+
+    if(run(true) == false) passed = false;
+    if(run(false) == false) passed = false;
+
+    return passed ? 0 : 1;
+}
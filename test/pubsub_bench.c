@@ -0,0 +1,194 @@
+//
+//  pubsub_bench.c
+//  test
+//
+//  发布/订阅的扇出速度，服务器和所有订阅者在同一个进程的同一个uv_loop中
+//  subscribers个客户端订阅同一个主题(一半再订阅一个匹配的通配符主题，检查只投递一次)
+//  每轮发布ROUND_PUBLISHES条消息，所有订阅者收到后开始下一轮
+//
+//  publish: 只统计pt_pubsub_publish的时间，即组包一次并加入每个连接发送队列的速度
+//  end-to-end: 从第一次发布到所有订阅者收到最后一条的时间，包括socket写入和客户端拆包
+//  两者都只使用一个核心
+//
+//  gcc -std=gnu11 -O2 -Iinclude test/pubsub_bench.c common/*.c -luv -lcrypto -lpthread -o pubsub_bench
+//  ./pubsub_bench [订阅者数量] [每条消息的字节数]
+//
+
+#include "common.h"
+#include "error.h"
+#include "server.h"
+#include "client.h"
+#include "pubsub.h"
+
+#define SERVER_PORT 47331
+#define MAX_SUBSCRIBERS 4096
+
+#define ROUND_COUNT 200
+#define ROUND_PUBLISHES 20
+
+#define TOPIC "market.btc.trade"
+#define WILDCARD_TOPIC "market.*.trade"
+
+static uv_loop_t *loop;
+static struct pt_server *server;
+static struct pt_pubsub *pubsub;
+static struct pt_client *clients[MAX_SUBSCRIBERS];
+static uv_idle_t idle;
+
+static uint32_t number_of_subscribers = 500;
+static uint32_t message_size = 64;
+static unsigned char *message;
+
+static uint32_t number_of_connected;
+static uint32_t number_of_rounds;
+static uint64_t round_expected;
+static uint64_t number_of_received;
+static uint64_t number_of_deliveries;
+static qboolean invalid;
+
+static uint64_t publish_time;
+static uint64_t start_time;
+static uint64_t end_time;
+
+static qboolean srv_connect(struct pt_sclient *user)
+{
+    if(pt_pubsub_subscribe(pubsub, user, TOPIC) == false) invalid = true;
+
+    if(user->id % 2 == 0 && pt_pubsub_subscribe(pubsub, user, WILDCARD_TOPIC) == false) invalid = true;
+
+    number_of_connected++;
+    return true;
+}
+
+static void srv_receive(struct pt_sclient *user, struct pt_buffer *buff)
+{
+}
+
+static void cli_connect(struct pt_client *c)
+{
+    if(c->connected == false){
+        printf("connect failed\n");
+        exit(1);
+    }
+}
+
+static void cli_receive(struct pt_client *c, struct pt_buffer *buff)
+{
+    if(pt_get_packet_size(buff) != message_size) invalid = true;
+    number_of_received++;
+}
+
+static void cli_disconnect(struct pt_client *c)
+{
+}
+
+static void finish(void)
+{
+    uint32_t i;
+
+    uv_idle_stop(&idle);
+    uv_close((uv_handle_t*)&idle, NULL);
+
+    for(i = 0; i < number_of_subscribers; i++)
+    {
+        pt_client_disconnect(clients[i]);
+    }
+
+    pt_server_close(server);
+}
+
+/*
+ 上一轮全部收到后发布下一轮
+ */
+static void idle_cb(uv_idle_t *handle)
+{
+    uint64_t begin;
+    uint32_t i;
+
+    if(number_of_connected < number_of_subscribers) return;
+    if(number_of_received < round_expected) return;
+
+    if(number_of_rounds == ROUND_COUNT){
+        end_time = uv_hrtime();
+        finish();
+        return;
+    }
+
+    if(number_of_rounds == 0){
+        start_time = uv_hrtime();
+    }
+
+    begin = uv_hrtime();
+    for(i = 0; i < ROUND_PUBLISHES; i++)
+    {
+        number_of_deliveries += pt_pubsub_publish(pubsub, TOPIC, ID_USER_SERVER_ENUM, message, message_size);
+    }
+    publish_time += uv_hrtime() - begin;
+
+    round_expected = number_of_deliveries;
+    number_of_rounds++;
+}
+
+int main(int argc, const char * argv[])
+{
+    uint64_t expected;
+    qboolean passed;
+    uint32_t i;
+
+    loop = uv_default_loop();
+    set_log_filter(NULL);
+
+    if(argc > 1) number_of_subscribers = atoi(argv[1]);
+    if(argc > 2) message_size = atoi(argv[2]);
+
+    if(number_of_subscribers == 0 || number_of_subscribers > MAX_SUBSCRIBERS){
+        printf("subscribers must be in [1, %u]\n", MAX_SUBSCRIBERS);
+        return 1;
+    }
+
+    message = malloc(message_size);
+    memset(message, 0x5A, message_size);
+
+    server = pt_server_new();
+    pt_server_init(server, loop, MAX_SUBSCRIBERS, 30, srv_connect, srv_receive, NULL);
+    pubsub = pt_pubsub_new(server);
+
+    if(pt_server_start(server, "127.0.0.1", SERVER_PORT) == false){
+        printf("server start failed\n");
+        return 1;
+    }
+
+    for(i = 0; i < number_of_subscribers; i++)
+    {
+        clients[i] = pt_client_new();
+        pt_client_init(loop, clients[i], cli_connect, cli_receive, cli_disconnect);
+        pt_client_connect(clients[i], "127.0.0.1", SERVER_PORT);
+    }
+
+    uv_idle_init(loop, &idle);
+    uv_idle_start(&idle, idle_cb);
+
+    uv_run(loop, UV_RUN_DEFAULT);
+
+    expected = (uint64_t)number_of_subscribers * ROUND_COUNT * ROUND_PUBLISHES;
+    passed = number_of_deliveries == expected && number_of_received == expected && invalid == false;
+
+    printf("%u subscribers, %u byte messages, %u publishes\n", number_of_subscribers, message_size,
+           ROUND_COUNT * ROUND_PUBLISHES);
+    printf("publish      %.2f M deliveries/s  %.1f ns/delivery\n",
+           number_of_deliveries / (publish_time / 1e9) / 1e6, (double)publish_time / number_of_deliveries);
+    printf("end-to-end   %.2f M deliveries/s  received %llu/%llu  %s\n",
+           number_of_received / ((end_time - start_time) / 1e9) / 1e6,
+           (unsigned long long)number_of_received, (unsigned long long)expected, passed ? "ok" : "FAILED");
+
+    pt_pubsub_free(pubsub);
+    pt_server_free(server);
+
+    for(i = 0; i < number_of_subscribers; i++)
+    {
+        pt_client_free(clients[i]);
+    }
+    free(message);
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,421 @@
+//
+//  rudp_latency.c
+//  test
+//
+//  本机回环上注入丢包和延迟，比较tcp和UDP可靠传输的延迟分布
+//  客户端每隔PING_INTERVAL毫秒发送一个带时间戳的数据包，服务器原样返回，统计往返时间
+//
+//  丢包和延迟由进程内的中转实现(沙盒中没有netem)：
+//  UDP中转按概率丢弃数据报，每个数据报延迟delay毫秒
+//  tcp中转不能丢弃数据，丢失的数据段按重传处理：这段数据和之后的所有数据再等待TCP_RTO毫秒(Linux的最小RTO)
+//
+//  gcc -std=gnu11 -Iinclude test/rudp_latency.c common/*.c -luv -lcrypto -lpthread -o rudp_latency
+//  ./rudp_latency [loss百分比] [单向延迟毫秒]
+//
+
+#include "common.h"
+#include "error.h"
+#include "server.h"
+#include "client.h"
+#include "packet.h"
+
+#define SERVER_PORT 47301
+#define RELAY_PORT 47302
+
+#define PING_COUNT 1000
+#define PING_INTERVAL 5
+//最后一个包发送后等待迟到的回复
+#define PING_LINGER 1000
+#define TCP_RTO 200
+
+#define MODE_TCP 0
+#define MODE_UDP 1
+#define MODE_UDP_UNRELIABLE 2
+
+static const char *mode_names[] = {"tcp", "udp reliable", "udp unreliable"};
+
+static uint32_t encrypt_key[4] = {0x42970C86,0xA0B3A057,0x51B97B3C,0x70F8891E};
+
+static uint32_t loss_percent = 2;
+static uint32_t delay_ms = 10;
+
+static int mode;
+static uv_loop_t *loop;
+static struct pt_server *server;
+static struct pt_client *client;
+static uv_timer_t ping_timer;
+static uv_timer_t relay_timer;
+static uint32_t number_of_sent;
+static uint64_t last_sent;
+
+static uint64_t samples[PING_COUNT];
+static uint32_t number_of_samples;
+
+struct ping
+{
+    uint32_t seq;
+    uint64_t time;
+};
+
+/*
+ 中转中等待发送的数据，延迟相同，按到期时间排队
+ */
+struct relay_item
+{
+    struct relay_item *next;
+    uint64_t due;
+    int dir;
+    uv_buf_t buf;
+};
+
+static struct relay_item *relay_head;
+static struct relay_item *relay_tail;
+static uint64_t relay_last_due[2];
+
+//UDP中转，front面向客户端，back面向服务器
+static uv_udp_t udp_front;
+static uv_udp_t udp_back;
+static struct sockaddr_storage udp_client_addr;
+static qboolean udp_client_known;
+
+//tcp中转，每个方向一个连接
+static uv_tcp_t tcp_listener;
+static uv_tcp_t tcp_side[2];
+static qboolean tcp_connected[2];
+
+static qboolean lost(void)
+{
+    return (uint32_t)(rand() % 100) < loss_percent;
+}
+
+static void relay_push(int dir, const char *data, size_t length, uint64_t extra)
+{
+    struct relay_item *item = malloc(sizeof(struct relay_item));
+    uint64_t due = uv_now(loop) + delay_ms + extra;
+
+    //tcp的数据按顺序到达，前面的数据重传时后面的数据也要等待
+    if(due < relay_last_due[dir]) due = relay_last_due[dir];
+    relay_last_due[dir] = due;
+
+    item->next = NULL;
+    item->due = due;
+    item->dir = dir;
+    item->buf = uv_buf_init(malloc(length), (unsigned int)length);
+    memcpy(item->buf.base, data, length);
+
+    if(relay_tail){
+        relay_tail->next = item;
+    } else {
+        relay_head = item;
+    }
+    relay_tail = item;
+}
+
+static void relay_write_cb(uv_write_t *req, int status)
+{
+    free(req->data);
+    free(req);
+}
+
+static void relay_timer_cb(uv_timer_t *handle)
+{
+    struct relay_item *item;
+    struct sockaddr_in addr;
+    uv_write_t *req;
+
+    while(relay_head && relay_head->due <= uv_now(loop))
+    {
+        item = relay_head;
+        relay_head = item->next;
+        if(relay_head == NULL) relay_tail = NULL;
+
+        if(mode == MODE_TCP){
+            //dir 0为客户端到服务器，写入tcp_side[1]
+            if(tcp_connected[item->dir ^ 1]){
+                req = malloc(sizeof(uv_write_t));
+                req->data = item->buf.base;
+                uv_write(req, (uv_stream_t*)&tcp_side[item->dir ^ 1], &item->buf, 1, relay_write_cb);
+                item->buf.base = NULL;
+            }
+        } else if(item->dir == 0){
+            uv_ip4_addr("127.0.0.1", SERVER_PORT, &addr);
+            uv_udp_try_send(&udp_back, &item->buf, 1, (const struct sockaddr*)&addr);
+        } else if(udp_client_known){
+            uv_udp_try_send(&udp_front, &item->buf, 1, (const struct sockaddr*)&udp_client_addr);
+        }
+
+        free(item->buf.base);
+        free(item);
+    }
+}
+
+static void relay_alloc_cb(uv_handle_t *handle, size_t suggested_size, uv_buf_t *buf)
+{
+    static char slab[0x10000];
+
+    *buf = uv_buf_init(slab, sizeof(slab));
+}
+
+static void udp_front_recv_cb(uv_udp_t *handle, ssize_t nread, const uv_buf_t *buf, const struct sockaddr *addr, unsigned flags)
+{
+    if(nread <= 0 || addr == NULL) return;
+
+    memcpy(&udp_client_addr, addr, sizeof(struct sockaddr_in));
+    udp_client_known = true;
+
+    if(lost() == false) relay_push(0, buf->base, nread, 0);
+}
+
+static void udp_back_recv_cb(uv_udp_t *handle, ssize_t nread, const uv_buf_t *buf, const struct sockaddr *addr, unsigned flags)
+{
+    if(nread <= 0 || addr == NULL) return;
+
+    if(lost() == false) relay_push(1, buf->base, nread, 0);
+}
+
+static void tcp_read_cb(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf)
+{
+    int dir = stream == (uv_stream_t*)&tcp_side[0] ? 0 : 1;
+
+    if(nread < 0){
+        if(tcp_connected[0]) uv_close((uv_handle_t*)&tcp_side[0], NULL);
+        if(tcp_connected[1]) uv_close((uv_handle_t*)&tcp_side[1], NULL);
+        tcp_connected[0] = false;
+        tcp_connected[1] = false;
+        return;
+    }
+
+    if(nread > 0) relay_push(dir, buf->base, nread, lost() ? TCP_RTO : 0);
+}
+
+static void tcp_connect_cb(uv_connect_t *req, int status)
+{
+    free(req);
+
+    if(status != 0){
+        printf("relay connect failed\n");
+        exit(1);
+    }
+
+    tcp_connected[1] = true;
+    uv_read_start((uv_stream_t*)&tcp_side[1], relay_alloc_cb, tcp_read_cb);
+    uv_read_start((uv_stream_t*)&tcp_side[0], relay_alloc_cb, tcp_read_cb);
+}
+
+static void tcp_connection_cb(uv_stream_t *listener, int status)
+{
+    struct sockaddr_in addr;
+    uv_connect_t *req = malloc(sizeof(uv_connect_t));
+
+    uv_tcp_init(loop, &tcp_side[0]);
+    uv_accept(listener, (uv_stream_t*)&tcp_side[0]);
+    uv_tcp_nodelay(&tcp_side[0], true);
+    tcp_connected[0] = true;
+
+    uv_ip4_addr("127.0.0.1", SERVER_PORT, &addr);
+    uv_tcp_init(loop, &tcp_side[1]);
+    uv_tcp_nodelay(&tcp_side[1], true);
+    uv_tcp_connect(req, &tcp_side[1], (const struct sockaddr*)&addr, tcp_connect_cb);
+}
+
+static void relay_start(void)
+{
+    struct sockaddr_in addr;
+
+    uv_ip4_addr("127.0.0.1", RELAY_PORT, &addr);
+
+    if(mode == MODE_TCP){
+        uv_tcp_init(loop, &tcp_listener);
+        uv_tcp_bind(&tcp_listener, (const struct sockaddr*)&addr, 0);
+        uv_listen((uv_stream_t*)&tcp_listener, 16, tcp_connection_cb);
+    } else {
+        uv_udp_init(loop, &udp_front);
+        uv_udp_bind(&udp_front, (const struct sockaddr*)&addr, 0);
+        uv_udp_recv_start(&udp_front, relay_alloc_cb, udp_front_recv_cb);
+
+        uv_ip4_addr("127.0.0.1", 0, &addr);
+        uv_udp_init(loop, &udp_back);
+        uv_udp_bind(&udp_back, (const struct sockaddr*)&addr, 0);
+        uv_udp_recv_start(&udp_back, relay_alloc_cb, udp_back_recv_cb);
+        udp_client_known = false;
+    }
+
+    relay_last_due[0] = 0;
+    relay_last_due[1] = 0;
+    uv_timer_init(loop, &relay_timer);
+    uv_timer_start(&relay_timer, relay_timer_cb, 1, 1);
+}
+
+static void relay_stop(void)
+{
+    struct relay_item *item;
+
+    while(relay_head){
+        item = relay_head;
+        relay_head = item->next;
+        free(item->buf.base);
+        free(item);
+    }
+    relay_tail = NULL;
+
+    uv_close((uv_handle_t*)&relay_timer, NULL);
+
+    if(mode == MODE_TCP){
+        uv_close((uv_handle_t*)&tcp_listener, NULL);
+        if(tcp_connected[0]) uv_close((uv_handle_t*)&tcp_side[0], NULL);
+        if(tcp_connected[1]) uv_close((uv_handle_t*)&tcp_side[1], NULL);
+        tcp_connected[0] = false;
+        tcp_connected[1] = false;
+    } else {
+        uv_close((uv_handle_t*)&udp_front, NULL);
+        uv_close((uv_handle_t*)&udp_back, NULL);
+    }
+}
+
+static void srv_receive(struct pt_sclient *user, struct pt_buffer *buff)
+{
+    //跳过包序列，原样返回
+    struct net_header hdr = pt_create_nethdr(ID_USER_SERVER_ENUM);
+    struct pt_buffer *reply = pt_create_package(hdr, pt_get_packet_buffer(buff) + sizeof(uint32_t),
+                                                pt_get_packet_size(buff) - sizeof(uint32_t));
+
+    if(mode == MODE_UDP_UNRELIABLE){
+        pt_server_send_unreliable(user, reply);
+    } else {
+        pt_server_send(user, reply);
+    }
+}
+
+static void cli_receive(struct pt_client *c, struct pt_buffer *buff)
+{
+    struct ping ping;
+
+    memcpy(&ping, pt_get_packet_buffer(buff), sizeof(ping));
+
+    if(number_of_samples < PING_COUNT){
+        samples[number_of_samples++] = uv_hrtime() - ping.time;
+    }
+}
+
+static void cli_connect(struct pt_client *c)
+{
+    if(c->connected == false){
+        printf("connect failed\n");
+        exit(1);
+    }
+}
+
+static void cli_disconnect(struct pt_client *c)
+{
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void print_result(void)
+{
+    qsort(samples, number_of_samples, sizeof(uint64_t), compare_u64);
+
+    if(number_of_samples == 0){
+        printf("%-16s no replies\n", mode_names[mode]);
+        return;
+    }
+
+    printf("%-16s replies %4u/%u  p50 %7.2fms  p90 %7.2fms  p99 %7.2fms  max %7.2fms\n",
+           mode_names[mode], number_of_samples, number_of_sent,
+           samples[number_of_samples / 2] / 1e6,
+           samples[number_of_samples * 90 / 100] / 1e6,
+           samples[number_of_samples * 99 / 100] / 1e6,
+           samples[number_of_samples - 1] / 1e6);
+}
+
+static void ping_timer_cb(uv_timer_t *handle)
+{
+    struct ping ping;
+
+    if(client->connected == false) return;
+
+    if(number_of_sent < PING_COUNT){
+        ping.seq = number_of_sent++;
+        ping.time = uv_hrtime();
+        last_sent = uv_now(loop);
+
+        if(mode == MODE_UDP_UNRELIABLE){
+            pt_client_send_unreliable_data(client, ID_USER_CLIENT_ENUM, (unsigned char*)&ping, sizeof(ping));
+        } else {
+            pt_client_send_data(client, ID_USER_CLIENT_ENUM, (unsigned char*)&ping, sizeof(ping));
+        }
+        return;
+    }
+
+    if(uv_now(loop) - last_sent < PING_LINGER) return;
+
+    print_result();
+
+    uv_close((uv_handle_t*)handle, NULL);
+    pt_client_disconnect(client);
+    pt_server_close(server);
+    relay_stop();
+}
+
+static void run(int m)
+{
+    mode = m;
+    number_of_sent = 0;
+    number_of_samples = 0;
+
+    server = pt_server_new();
+    client = pt_client_new();
+
+    pt_server_init(server, loop, 16, 30, NULL, srv_receive, NULL);
+    pt_server_set_encrypt(server, encrypt_key);
+    pt_server_set_nodelay(server, true);
+
+    pt_client_init(loop, client, cli_connect, cli_receive, cli_disconnect);
+    pt_client_set_encrypt(client, encrypt_key);
+
+    if(mode == MODE_TCP){
+        pt_server_start(server, "127.0.0.1", SERVER_PORT);
+    } else {
+        pt_server_start_udp(server, "127.0.0.1", SERVER_PORT);
+    }
+
+    relay_start();
+
+    if(mode == MODE_TCP){
+        pt_client_connect(client, "127.0.0.1", RELAY_PORT);
+    } else {
+        pt_client_connect_udp(client, "127.0.0.1", RELAY_PORT);
+    }
+
+    uv_timer_init(loop, &ping_timer);
+    uv_timer_start(&ping_timer, ping_timer_cb, PING_INTERVAL, PING_INTERVAL);
+
+    uv_run(loop, UV_RUN_DEFAULT);
+
+    pt_server_free(server);
+    pt_client_free(client);
+}
+
+int main(int argc, const char * argv[])
+{
+    loop = uv_default_loop();
+    set_log_filter(NULL);
+    srand(1);
+
+    if(argc > 1) loss_percent = atoi(argv[1]);
+    if(argc > 2) delay_ms = atoi(argv[2]);
+
+    printf("loss %u%%, one-way delay %ums, %u pings every %ums\n", loss_percent, delay_ms, PING_COUNT, PING_INTERVAL);
+
+    run(MODE_TCP);
+    run(MODE_UDP);
+    run(MODE_UDP_UNRELIABLE);
+
+    return 0;
+}
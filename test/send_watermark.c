@@ -0,0 +1,152 @@
+//
+//  send_watermark.c
+//  test
+//
+//  发送队列水位
+//  空闲连接上用pt_server_try_send发送超过高水位的数据包，队列为空时必须接受
+//  之后持续发送，返回PT_SEND_FULL时等待on_drain再继续，检查所有数据包都能到达
+//
+//  gcc -std=gnu11 -Iinclude test/send_watermark.c common/*.c -luv -lcrypto -lpthread -o send_watermark
+//  ./send_watermark
+//
+
+#include "common.h"
+#include "error.h"
+#include "server.h"
+#include "client.h"
+#include "packet.h"
+
+#define SERVER_PORT 47321
+
+#define LOW_WATERMARK 1024
+#define HIGH_WATERMARK 4096
+//每个数据包都超过高水位
+#define PACKET_SIZE 60000
+#define PACKET_COUNT 200
+//超过这个时间(毫秒)还没有收到全部数据认为失败
+#define TIMEOUT 5000
+
+static uv_loop_t *loop;
+static struct pt_server *server;
+static struct pt_client *client;
+static uv_timer_t timer;
+
+static unsigned char payload[PACKET_SIZE];
+static uint32_t number_of_sent;
+static uint32_t number_of_received;
+static uint32_t number_of_full;
+static uint32_t number_of_drains;
+static qboolean idle_accepted;
+static qboolean invalid;
+static uint64_t start_time;
+
+static void srv_send(struct pt_sclient *user)
+{
+    struct pt_buffer *buff;
+    int r;
+
+    while(number_of_sent < PACKET_COUNT)
+    {
+        buff = pt_create_package(pt_create_nethdr(ID_USER_SERVER_ENUM), payload, PACKET_SIZE);
+
+        r = pt_server_try_send(user, buff);
+
+        if(r == PT_SEND_FULL){
+            pt_buffer_free(buff);
+            number_of_full++;
+            return;
+        }
+
+        if(r != PT_SEND_OK){
+            pt_buffer_free(buff);
+            invalid = true;
+            return;
+        }
+
+        number_of_sent++;
+    }
+}
+
+static void srv_receive(struct pt_sclient *user, struct pt_buffer *buff)
+{
+    //空闲的连接上第一个超过高水位的数据包
+    idle_accepted = pt_server_send_queue_size(user) == 0;
+
+    srv_send(user);
+
+    if(number_of_sent == 0) idle_accepted = false;
+}
+
+static void srv_drain(struct pt_sclient *user)
+{
+    number_of_drains++;
+    srv_send(user);
+}
+
+static void cli_connect(struct pt_client *c)
+{
+    if(c->connected == false){
+        printf("connect failed\n");
+        exit(1);
+    }
+
+    pt_client_send_data(c, ID_USER_CLIENT_ENUM, (unsigned char*)"go", 2);
+}
+
+static void cli_receive(struct pt_client *c, struct pt_buffer *buff)
+{
+    if(pt_get_packet_size(buff) != PACKET_SIZE) invalid = true;
+    number_of_received++;
+}
+
+static void cli_disconnect(struct pt_client *c)
+{
+}
+
+static void timer_cb(uv_timer_t *handle)
+{
+    if(number_of_received < PACKET_COUNT && uv_now(loop) - start_time < TIMEOUT) return;
+
+    uv_close((uv_handle_t*)handle, NULL);
+    pt_client_disconnect(client);
+    pt_server_close(server);
+}
+
+int main(int argc, const char * argv[])
+{
+    qboolean passed;
+
+    loop = uv_default_loop();
+    set_log_filter(NULL);
+    memset(payload, 0x5A, sizeof(payload));
+
+    server = pt_server_new();
+    client = pt_client_new();
+
+    pt_server_init(server, loop, 16, 30, NULL, srv_receive, NULL);
+    pt_server_set_watermark(server, LOW_WATERMARK, HIGH_WATERMARK, srv_drain);
+
+    if(pt_server_start(server, "127.0.0.1", SERVER_PORT) == false){
+        printf("server start failed\n");
+        return 1;
+    }
+
+    pt_client_init(loop, client, cli_connect, cli_receive, cli_disconnect);
+    pt_client_connect(client, "127.0.0.1", SERVER_PORT);
+
+    start_time = uv_now(loop);
+    uv_timer_init(loop, &timer);
+    uv_timer_start(&timer, timer_cb, 10, 10);
+
+    uv_run(loop, UV_RUN_DEFAULT);
+
+    pt_server_free(server);
+    pt_client_free(client);
+
+    passed = idle_accepted && number_of_received == PACKET_COUNT && invalid == false;
+
+    printf("idle oversize %s  received %u/%u  full %u  drains %u  %s\n", idle_accepted ? "accepted" : "refused",
+           number_of_received, PACKET_COUNT, number_of_full, number_of_drains, passed ? "ok" : "FAILED");
+
+    return passed ? 0 : 1;
+}